@@ -0,0 +1,30 @@
+#ifndef _CLIENTCFG_H
+#define _CLIENTCFG_H
+
+// Socket backend, TRANSPORT_SDLNET or TRANSPORT_POSIX (see transport.h).
+// TRANSPORT_LOOP is for in-process simulation only.
+#ifndef CLIENT_TRANSPORT
+#ifdef _WIN32
+#define CLIENT_TRANSPORT TRANSPORT_SDLNET
+#else
+#define CLIENT_TRANSPORT TRANSPORT_POSIX
+#endif
+#endif
+
+// Receive window on server sequence numbers. Frames that arrive ahead
+// of a gap are held for up to CLIENT_REORDER_HOLD_MS waiting for it to
+// fill, then the gap counts as lost. Slots must be a power of two.
+#define CLIENT_REORDER_SLOTS 64
+#define CLIENT_REORDER_HOLD_MS 50
+
+// Join the multicast group a server announces and take broadcasts
+// from it, 0 keeps every broadcast unicast
+#ifndef CLIENT_MULTICAST
+#define CLIENT_MULTICAST 1
+#endif
+
+// Impair outgoing datagrams to test on a bad network, see
+// ImpairmentConfig::parse() for the settings
+//#define CLIENT_IMPAIRMENT "loss=0.01,delay=20000,jitter=5000"
+
+#endif
@@ -20,12 +20,15 @@
  * @param server server's IP address/port
  * @return true if success, otherwise failure
  */
-bool ClientSocket::init(U32 localport, U32 bufferSize, IPaddress *server)
+template <class Transport>
+bool BasicClientSocket<Transport>::init(U32 localport, U32 bufferSize, IPaddress *server)
 {
     bool retval = true; // default success
 
     mBufferSize = bufferSize;
-    mClientSocket = 0;
+    mTransport.clear();
+    mGroupTransport.clear();
+    mGroupOpen = false;
 
     // validate arguments
     if (!server || (bufferSize == 0)) {
@@ -36,12 +39,11 @@ bool ClientSocket::init(U32 localport, U32 bufferSize, IPaddress *server)
     mServerIPaddress = *server;
 
     // Open up the socket using the local port
-    mClientSocket = SDLNet_UDP_Open(localport);
-    if (mClientSocket == 0) {
+    if (!mTransport.open(localport)) {
         retval = false;
-        ConsolePrintf("ERROR: SDLNet_UDP_Open(%d): %s\n",
+        ConsolePrintf("ERROR: open(%d): %s\n",
                       localport,
-                      SDLNet_GetError());
+                      mTransport.getError());
     }
 
     return retval;
@@ -52,11 +54,11 @@ bool ClientSocket::init(U32 localport, U32 bufferSize, IPaddress *server)
  * @brief Closes the client socket
  *
  */
-void ClientSocket::shutdown()
+template <class Transport>
+void BasicClientSocket<Transport>::shutdown()
 {
-    if (mClientSocket) {
-        SDLNet_UDP_Close(mClientSocket);
-    }
+    closeGroup();
+    mTransport.close();
 }
 
 
@@ -65,15 +67,16 @@ void ClientSocket::shutdown()
  *        size indicated at init time.
  * @return NULL if error, otherwise pointer to valid packet
  */
-ClientPacket* ClientSocket::allocPacket()
+template <class Transport>
+ClientPacket* BasicClientSocket<Transport>::allocPacket()
 {
     ClientPacket *pkt;
 
-    pkt = SDLNet_AllocPacket(mBufferSize);
+    pkt = mTransport.allocPacket(mBufferSize);
     if (pkt == NULL) {
-        ConsolePrintf("ERROR: SDLNet_AllocPacket(%d): %s\n",
+        ConsolePrintf("ERROR: allocPacket(%d): %s\n",
                       mBufferSize,
-                      SDLNet_GetError());
+                      mTransport.getError());
     }
 
     return pkt;
@@ -84,10 +87,11 @@ ClientPacket* ClientSocket::allocPacket()
  * @brief Frees the client packet previously allocated
  * @param pkt pointer to packet to be freed
  */
-void ClientSocket::freePacket(ClientPacket *pkt)
+template <class Transport>
+void BasicClientSocket<Transport>::freePacket(ClientPacket *pkt)
 {
     if (pkt) {
-        SDLNet_FreePacket(pkt);
+        mTransport.freePacket(pkt);
     }
 }
 
@@ -97,7 +101,8 @@ void ClientSocket::freePacket(ClientPacket *pkt)
  * @param pkt pointer to packet
  * @return true if pkt contains data from network, otherwise no data received
  */
-bool ClientSocket::receiveData(ClientPacket *pkt)
+template <class Transport>
+bool BasicClientSocket<Transport>::receiveData(ClientPacket *pkt)
 {
     int numPkts;
 
@@ -107,7 +112,7 @@ bool ClientSocket::receiveData(ClientPacket *pkt)
     }
 
     // Attempt to receive data from socket
-    numPkts = SDLNet_UDP_Recv(mClientSocket, pkt);
+    numPkts = mTransport.recv(pkt);
     if (numPkts > 0) {
         // packets received
 #ifdef DEBUG_SHOW_RAW_RX_PACKET
@@ -128,8 +133,8 @@ bool ClientSocket::receiveData(ClientPacket *pkt)
 #endif
         return true;
     } else if (numPkts < 0) {
-        ConsolePrintf("ERROR: SDLNet_UDP_Recv(): %s\n",
-                      SDLNet_GetError());
+        ConsolePrintf("ERROR: recv(): %s\n",
+                      mTransport.getError());
         return false;
     } else {
         // no data
@@ -143,10 +148,9 @@ bool ClientSocket::receiveData(ClientPacket *pkt)
  * @param pkt pointer to valid packet to transmit
  * @return true if success, otherwise error
  */
-bool ClientSocket::transmitData(ClientPacket *pkt)
+template <class Transport>
+bool BasicClientSocket<Transport>::transmitData(ClientPacket *pkt)
 {
-    int numRecepients;
-
     // validate arguments
     if (pkt == NULL) {
         return false;
@@ -173,14 +177,90 @@ bool ClientSocket::transmitData(ClientPacket *pkt)
 #endif
 
     // Attempt to transmit data
-    numRecepients = SDLNet_UDP_Send(mClientSocket, -1, pkt);
-    if (numRecepients == 0) {
-        // unable to send
-        return false;
-    } else {
-        // success
+    return mTransport.send(pkt);
+}
+
+
+/**
+ * @brief Starts receiving a multicast group, on the loopback
+ *        interface if the server is on this host, otherwise on
+ *        whichever the system picks
+ * @param group group address and port, network order
+ * @return true if success, otherwise error
+ */
+template <class Transport>
+bool BasicClientSocket<Transport>::openGroup(IPaddress *group)
+{
+    IPaddress local;
+
+    if (mGroupOpen &&
+        (mGroupIPaddress.host == group->host) &&
+        (mGroupIPaddress.port == group->port)) {
+        // already a member
         return true;
     }
+
+    closeGroup();
+
+    // Host is in network order, 127.0.0.0/8 is loopback
+    if ((mServerIPaddress.host & 0xFF) == 127) {
+        mTransport.resolveHost(&local, "127.0.0.1", 0);
+    } else {
+        mTransport.resolveHost(&local, NULL, 0);
+    }
+
+    if (!mGroupTransport.openGroup(group, local.host)) {
+        ConsolePrintf("ERROR: openGroup(%d.%d.%d.%d:%d): %s\n",
+                      (group->host >>  0) & 0xFF,
+                      (group->host >>  8) & 0xFF,
+                      (group->host >> 16) & 0xFF,
+                      (group->host >> 24) & 0xFF,
+                      SDLNet_Read16(&group->port),
+                      mGroupTransport.getError());
+        return false;
+    }
+
+    mGroupIPaddress = *group;
+    mGroupOpen = true;
+
+    return true;
+}
+
+
+/**
+ * @brief Stops receiving the multicast group, if open
+ */
+template <class Transport>
+void BasicClientSocket<Transport>::closeGroup()
+{
+    if (mGroupOpen) {
+        mGroupTransport.close();
+        mGroupOpen = false;
+    }
+}
+
+
+/**
+ * @brief Receives a datagram sent to the multicast group
+ * @param pkt pointer to packet
+ * @return true if pkt contains data from network, otherwise no data received
+ */
+template <class Transport>
+bool BasicClientSocket<Transport>::receiveGroupData(ClientPacket *pkt)
+{
+    int numPkts;
+
+    if (!mGroupOpen || (pkt == NULL)) {
+        return false;
+    }
+
+    numPkts = mGroupTransport.recv(pkt);
+    if (numPkts < 0) {
+        ConsolePrintf("ERROR: group recv(): %s\n",
+                      mGroupTransport.getError());
+    }
+
+    return numPkts > 0;
 }
 
 
@@ -191,7 +271,8 @@ bool ClientSocket::transmitData(ClientPacket *pkt)
  * @param port remote port to use
  * @return true if success, otherwise error
  */
-bool ClientSocket::toIPaddress(IPaddress *address, char *name, int port)
+template <class Transport>
+bool BasicClientSocket<Transport>::toIPaddress(IPaddress *address, char *name, int port)
 {
     // validate arguments
     if (!address || !name) {
@@ -199,12 +280,11 @@ bool ClientSocket::toIPaddress(IPaddress *address, char *name, int port)
     }
 
     // perform the lookup
-    int hostResolved = SDLNet_ResolveHost(address, name, port);
-    if (hostResolved == -1) {
-        ConsolePrintf("ERROR: SDLNet_ResolveHost(%s:%d): %s\n",
+    if (!mTransport.resolveHost(address, name, port)) {
+        ConsolePrintf("ERROR: resolveHost(%s:%d): %s\n",
                       name,
                       port,
-                      SDLNet_GetError());
+                      mTransport.getError());
 
         return false;
     } else {
@@ -213,3 +293,14 @@ bool ClientSocket::toIPaddress(IPaddress *address, char *name, int port)
     }
 }
 
+
+/**
+ * @brief Gives access to the transport, e.g. to tune socket options
+ */
+template <class Transport>
+Transport* BasicClientSocket<Transport>::getTransport()
+{
+    return &mTransport;
+}
+
+template struct BasicClientSocket<ClientTransport>;
@@ -8,26 +8,60 @@
 
 #include "types.h"
 #include "SDL_net.h"
+#include "clientcfg.h"
+#include "transport.h"
 
-typedef UDPpacket ClientPacket;
+typedef NetPacket ClientPacket;
 
-struct ClientSocket
+/**
+ * @brief Client socket over a transport, see transport.h. Use the
+ *        ClientSocket typedef, the transport is chosen by
+ *        CLIENT_TRANSPORT in clientcfg.h.
+ */
+template <class Transport>
+struct BasicClientSocket
 {
     U32 mBufferSize;
-    UDPsocket mClientSocket;
+    Transport mTransport;
     IPaddress mServerIPaddress;
 
+    // multicast group the server broadcasts to, receive only
+    Transport mGroupTransport;
+    IPaddress mGroupIPaddress;
+    bool mGroupOpen;
+
     bool init(U32 localport, U32 bufferSize, IPaddress *server);
     void shutdown();
 
     bool receiveData(ClientPacket *pkt);
     bool transmitData(ClientPacket *pkt);
 
+    bool openGroup(IPaddress *group);
+    void closeGroup();
+    bool receiveGroupData(ClientPacket *pkt);
+
     ClientPacket* allocPacket();
     void freePacket(ClientPacket *pkt);
 
     bool toIPaddress(IPaddress *address, char *name, int port);
+    Transport* getTransport();
 };
 
+#if CLIENT_TRANSPORT == TRANSPORT_LOOP
+typedef LoopTransport ClientBaseTransport;
+#elif CLIENT_TRANSPORT == TRANSPORT_POSIX
+typedef PosixUdpTransport ClientBaseTransport;
+#else
+typedef SdlNetTransport ClientBaseTransport;
+#endif
+
+#ifdef CLIENT_IMPAIRMENT
+typedef ImpairedTransport<ClientBaseTransport> ClientTransport;
+#else
+typedef ClientBaseTransport ClientTransport;
+#endif
+
+typedef BasicClientSocket<ClientTransport> ClientSocket;
+
 #endif
 
@@ -28,6 +28,7 @@ int main(int argc, char **argv)
 {
     ClientSocket client;
 	IPaddress srvadd;
+    ClientPacket *pkt;
 	bool quit;
     bool obtainingInput = false;
 
@@ -54,10 +55,9 @@ int main(int argc, char **argv)
 	// Resolve server name
 	if (!client.toIPaddress(&srvadd, argv[1], atoi(argv[2])))
 	{
-		ConsolePrintf("ERROR: SDLNet_ResolveHost(%s:%d): %s\n",
+		ConsolePrintf("ERROR: Unable to resolve %s:%d\n",
                       argv[1],
-                      atoi(argv[2]),
-                      SDLNet_GetError());
+                      atoi(argv[2]));
 		exit(EXIT_FAILURE);
 	}
 
@@ -69,6 +69,14 @@ int main(int argc, char **argv)
                   (srvadd.host >> 24) & 0xFF,
                   SDLNet_Read16(&srvadd.port));
 
+#ifdef CLIENT_IMPAIRMENT
+    gImpairmentDefaults.clear();
+    if (!gImpairmentDefaults.parse(CLIENT_IMPAIRMENT)) {
+        ConsolePrintf("ERROR: Bad CLIENT_IMPAIRMENT: %s\n", CLIENT_IMPAIRMENT);
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     // Initialize client
     if (!client.init(USE_RANDOM_PORT, UDP_MAX_PACKET_SIZE, &srvadd)) {
         ConsolePrintf("ERROR: client.init(): failed\n");
@@ -77,12 +85,19 @@ int main(int argc, char **argv)
     ConsolePrintf("Client Ready\n");
 
     // Initialize the Messenger protocol
-    if (!InitMessengerProtocol()) {
+    if (!InitMessengerProtocol(&client)) {
         ConsolePrintf("ERROR: InitMessengerProtocol() failed\n");
         exit(EXIT_FAILURE);
     }
     ConsolePrintf("Messenger Protocol Ready\n");
 
+    // One receive packet for the whole run
+    pkt = client.allocPacket();
+    if (pkt == NULL) {
+        ConsolePrintf("ERROR: Unable to allocate receive packet\n");
+        exit(EXIT_FAILURE);
+    }
+
 	// Main loop
 	quit = false;
 	while (!quit) {
@@ -104,20 +119,22 @@ int main(int argc, char **argv)
 
         // get network input
         if (!quit) {
-            ClientPacket *pkt;
-
-            pkt = client.allocPacket();
-            if (pkt) {
-                if (client.receiveData(pkt)) {
-                    // handle data
-                    if (!HandleServerData(&client, pkt)) {
-                        quit = true;
-                    }
+            while (!quit && client.receiveData(pkt)) {
+                // handle data
+                if (!HandleServerData(&client, pkt)) {
+                    quit = true;
                 }
+            }
 
-                // finish with the packet, free it
-                client.freePacket(pkt);
+            // broadcasts, once the session is in a multicast group
+            while (!quit && client.receiveGroupData(pkt)) {
+                if (!HandleGroupData(&client, pkt)) {
+                    quit = true;
+                }
             }
+
+            // give up on gaps that have waited long enough
+            ServiceMessengerProtocol(&client);
         } // end network
 	}
 
@@ -125,6 +142,7 @@ int main(int argc, char **argv)
 
     // cleanup
     ShutdownMessengerProtocol();
+    client.freePacket(pkt);
     client.shutdown();
 	SDLNet_Quit();
 
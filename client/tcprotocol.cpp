@@ -4,6 +4,8 @@
  *        implementation.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "tcprotocol.h"
 #include "consoleutil.h"
 #include "util.h"
@@ -11,40 +13,755 @@
 // By commenting out these defines it turns off
 // debugs. Likewise, uncommenting them out will
 // turn them on.
-#define DEBUG_SHOW_RAW_PACKET
+//#define DEBUG_SHOW_RAW_PACKET
 //#define DEBUG_SHOW_USER_INPUT
 
+#define REORDER_MASK (CLIENT_REORDER_SLOTS - 1)
+#define REORDER_HOLD_NS ((U64)CLIENT_REORDER_HOLD_MS * 1000000ULL)
+
+static MessengerSession gSession;
+
+static bool handleFrames(ClientPacket *pkt, bool fromGroup);
+static void showFrame(MessengerPacket *mpkt, bool late);
+
 
 /**
- * @brief Initializes the Messenger protocol
+ * @brief Empties the window and its statistics
+ */
+void RxWindow::clear()
+{
+    memset(&mStats, 0, sizeof(mStats));
+    reset();
+}
+
+
+/**
+ * @brief Empties the window for a new join, the server numbers
+ *        frames from 1 again. Statistics are kept.
+ */
+void RxWindow::reset()
+{
+    resetAt(1);
+}
+
+
+/**
+ * @brief Empties the window for a stream that starts at firstSeq,
+ *        anything before it counts as stale. Statistics are kept.
+ */
+void RxWindow::resetAt(U32 firstSeq)
+{
+    for (U32 i=0; i<CLIENT_REORDER_SLOTS; ++i) {
+        mSlots[i].used = false;
+        mSlots[i].skipped = false;
+    }
+
+    mExpected = firstSeq;
+    mHighest = firstSeq - 1;
+    mHeld = 0;
+    mReleaseBelow = firstSeq;
+    mOverflowUsed = false;
+    mLate = false;
+}
+
+
+/**
+ * @brief Takes a frame from the server
+ * @param mpkt frame, only copied if it has to be held
+ * @param nowNs arrival time
+ * @return true if mpkt is in order, or late and mLate is set, use it
+ *         now then call next(), otherwise it was held or dropped
+ */
+bool RxWindow::accept(MessengerPacket *mpkt, U64 nowNs)
+{
+    U32 seq = mpkt->hdr.seq;
+    S32 ahead;
+    RxWindowSlot *slot;
+
+    mLate = false;
+
+    if (seq == 0) {
+        // unsequenced
+        return true;
+    }
+
+    ++mStats.received;
+
+    if ((S32)(seq - mHighest) < 0) {
+        // something later already arrived
+        ++mStats.reordered;
+    } else {
+        mHighest = seq;
+    }
+
+    ahead = (S32)(seq - mExpected);
+    if (ahead < 0) {
+        slot = &mSlots[seq & REORDER_MASK];
+        if (!slot->used && slot->skipped && (slot->seq == seq)) {
+            // its gap was given up on, show it anyway
+            slot->skipped = false;
+            mLate = true;
+            ++mStats.late;
+            return true;
+        }
+        ++mStats.stale;
+        return false;
+    }
+
+    if (ahead == 0) {
+        ++mExpected;
+        return true;
+    }
+
+    if ((sizeof(MsgrHdr) + mpkt->hdr.length) > sizeof(slot->frame)) {
+        // can't hold it, don't lose it either
+        return true;
+    }
+
+    if (ahead >= CLIENT_REORDER_SLOTS) {
+        // past the end of the ring, give up on enough of the gap
+        // to make room, next() places it once that is done
+        mReleaseBelow = seq - CLIENT_REORDER_SLOTS + 1;
+        hold(&mOverflow, mpkt, nowNs);
+        mOverflowUsed = true;
+        ++mStats.held;
+        return false;
+    }
+
+    slot = &mSlots[seq & REORDER_MASK];
+    if (slot->used) {
+        // already holding this seq
+        ++mStats.stale;
+        return false;
+    }
+
+    hold(slot, mpkt, nowNs);
+    ++mHeld;
+    ++mStats.held;
+
+    return false;
+}
+
+
+/**
+ * @brief Releases held frames that are now in order, and gives up
+ *        on gaps the frames after them have waited on for too long
+ * @param nowNs current time
+ * @return NULL if nothing is ready, otherwise a frame that stays
+ *         valid until the next accept() or next()
+ */
+MessengerPacket* RxWindow::next(U64 nowNs)
+{
+    RxWindowSlot *slot;
+
+    for (;;) {
+        // seqs pushed out of the ring by a frame far ahead
+        if ((S32)(mReleaseBelow - mExpected) > 0) {
+            slot = &mSlots[mExpected & REORDER_MASK];
+            if (slot->used) {
+                slot->used = false;
+                --mHeld;
+                ++mExpected;
+                return (MessengerPacket*)slot->frame;
+            }
+            skip();
+            continue;
+        }
+
+        if (mOverflowUsed) {
+            slot = &mSlots[mOverflow.seq & REORDER_MASK];
+            memcpy(slot, &mOverflow, sizeof(*slot));
+            mOverflowUsed = false;
+            ++mHeld;
+        }
+
+        slot = &mSlots[mExpected & REORDER_MASK];
+        if (slot->used) {
+            slot->used = false;
+            --mHeld;
+            ++mExpected;
+            return (MessengerPacket*)slot->frame;
+        }
+
+        if ((mHeld > 0) && ((nowNs - gapSinceNs()) >= REORDER_HOLD_NS)) {
+            // waited long enough, skip the missing seq
+            skip();
+            continue;
+        }
+
+        return NULL;
+    }
+}
+
+
+/**
+ * @brief Gives up on the seq at mExpected, remembering it in its
+ *        slot so it still shows, as late, if it arrives
+ */
+void RxWindow::skip()
+{
+    RxWindowSlot *slot = &mSlots[mExpected & REORDER_MASK];
+
+    slot->skipped = true;
+    slot->seq = mExpected;
+    ++mStats.lost;
+    ++mExpected;
+}
+
+
+/**
+ * @brief When the first frame held after the gap at mExpected
+ *        arrived, the gap is waited on from then. Only called with
+ *        frames held.
+ */
+U64 RxWindow::gapSinceNs()
+{
+    for (U32 i=1; i<CLIENT_REORDER_SLOTS; ++i) {
+        RxWindowSlot *slot = &mSlots[(mExpected + i) & REORDER_MASK];
+
+        if (slot->used) {
+            return slot->arrivedNs;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Holds a frame of a stream whose first seq isn't known yet,
+ *        delivering nothing, see skipTo(). Only the newest
+ *        CLIENT_REORDER_SLOTS seqs are kept.
+ * @param mpkt frame, copied
+ */
+void RxWindow::stash(MessengerPacket *mpkt)
+{
+    U32 seq = mpkt->hdr.seq;
+    RxWindowSlot *slot;
+
+    if ((seq == 0) || ((S32)(seq - mExpected) < 0) ||
+        ((sizeof(MsgrHdr) + mpkt->hdr.length) > sizeof(slot->frame))) {
+        return;
+    }
+
+    // make room, the oldest are the least likely to be wanted
+    while ((S32)(seq - mExpected) >= CLIENT_REORDER_SLOTS) {
+        slot = &mSlots[mExpected & REORDER_MASK];
+        if (slot->used) {
+            slot->used = false;
+            --mHeld;
+        }
+        ++mExpected;
+    }
+    mReleaseBelow = mExpected;
+
+    ++mStats.received;
+    if ((S32)(seq - mHighest) > 0) {
+        mHighest = seq;
+    }
+
+    slot = &mSlots[seq & REORDER_MASK];
+    if (slot->used) {
+        ++mStats.stale;
+        return;
+    }
+
+    // skipTo() starts the clock
+    hold(slot, mpkt, 0);
+    ++mHeld;
+    ++mStats.held;
+}
+
+
+/**
+ * @brief Starts delivering at firstSeq, stashed frames before it are
+ *        forgotten and the ones after wait for next()
+ * @param nowNs current time, a gap left open is waited on from here
+ */
+void RxWindow::skipTo(U32 firstSeq, U64 nowNs)
+{
+    RxWindowSlot *slot;
+
+    if ((S32)(firstSeq - mExpected) >= CLIENT_REORDER_SLOTS) {
+        // nothing stashed is late enough
+        resetAt(firstSeq);
+        return;
+    }
+
+    if ((S32)(firstSeq - mExpected) < 0) {
+        // stash() already made room past it
+        mStats.lost += mExpected - firstSeq;
+    }
+
+    while ((S32)(firstSeq - mExpected) > 0) {
+        slot = &mSlots[mExpected & REORDER_MASK];
+        if (slot->used) {
+            slot->used = false;
+            --mHeld;
+        }
+        ++mExpected;
+    }
+    mReleaseBelow = mExpected;
+
+    if ((S32)(mHighest - mExpected) < 0) {
+        mHighest = mExpected - 1;
+    }
+
+    for (U32 i=0; i<CLIENT_REORDER_SLOTS; ++i) {
+        if (mSlots[i].used) {
+            mSlots[i].arrivedNs = nowNs;
+        }
+    }
+}
+
+
+void RxWindow::hold(RxWindowSlot *slot, MessengerPacket *mpkt, U64 nowNs)
+{
+    slot->used = true;
+    slot->skipped = false;
+    slot->seq = mpkt->hdr.seq;
+    slot->arrivedNs = nowNs;
+    memcpy(slot->frame, mpkt, sizeof(MsgrHdr) + mpkt->hdr.length);
+}
+
+
+/**
+ * @brief Allocates the session's packets and builds what doesn't
+ *        change between sends
+ * @param socket client socket to send on, must outlive the session
  * @return true if success, otherwise error
  */
-bool InitMessengerProtocol()
+bool MessengerSession::init(ClientSocket *socket)
 {
+    MessengerPacket *mpkt;
+
+    mSocket = socket;
+    mHandle = -1;
+    mTxSeq = 0;
+    mJoining = false;
+    mAwaitingCookie = false;
+    mJoinRetryNs = 0;
+    mGroupState = GROUP_NONE;
+    memset(mName, 0, sizeof(mName));
+    mRxWindow.clear();
+    mGroupWindow.clear();
+
+    mJoinPkt = socket->allocPacket();
+    mLeavePkt = socket->allocPacket();
+    mTextPkt = socket->allocPacket();
+    mDirectPkt = socket->allocPacket();
+    mGroupPkt = socket->allocPacket();
+    if (!mJoinPkt || !mLeavePkt || !mTextPkt || !mDirectPkt || !mGroupPkt) {
+        shutdown();
+        return false;
+    }
+
+    // no cookie yet
+    memset(mJoinPkt->data, 0, MSGR_JOIN_FRAME_SIZE);
+
+    mpkt = (MessengerPacket*)mTextPkt->data;
+    memset(mpkt, 0, MSGR_TEXT_FRAME_SIZE);
+    EncodeText(mpkt, TO_ADDRESS_BROADCAST, 0, 0);
+    mTextPkt->len = MSGR_TEXT_FRAME_SIZE;
+
+    mpkt = (MessengerPacket*)mDirectPkt->data;
+    memset(mpkt, 0, MSGR_DIRECT_FRAME_SIZE);
+    EncodeDirect(mpkt, TO_ADDRESS_SERVER, 0, 0);
+    mDirectPkt->len = MSGR_DIRECT_FRAME_SIZE;
+
+    setName("");
+
     return true;
 }
 
 
+/**
+ * @brief Frees the session's packets
+ */
+void MessengerSession::shutdown()
+{
+    if (mSocket) {
+        mSocket->freePacket(mJoinPkt);
+        mSocket->freePacket(mLeavePkt);
+        mSocket->freePacket(mTextPkt);
+        mSocket->freePacket(mDirectPkt);
+        mSocket->freePacket(mGroupPkt);
+    }
+
+    mJoinPkt = NULL;
+    mLeavePkt = NULL;
+    mTextPkt = NULL;
+    mDirectPkt = NULL;
+    mGroupPkt = NULL;
+    mSocket = NULL;
+}
+
+
+/**
+ * @brief Sets the name to join as and rebuilds the JOIN and LEAVE
+ *        frames, the name is padded with zeros to TC_MAX_NAME_SIZE
+ */
+void MessengerSession::setName(const char *name)
+{
+    MsgrJoin *join;
+    MsgrLeave *leave;
+
+    strncpy(mName, name, TC_MAX_NAME_SIZE);
+    mName[TC_MAX_NAME_SIZE-1] = '\0';
+
+    // the cookie is kept
+    join = EncodeJoin((MessengerPacket*)mJoinPkt->data, TO_ADDRESS_SERVER, 0, 0);
+    strncpy(join->name, mName, TC_MAX_NAME_SIZE);
+    mJoinPkt->len = MSGR_JOIN_FRAME_SIZE;
+
+    leave = EncodeLeave((MessengerPacket*)mLeavePkt->data, TO_ADDRESS_SERVER, 0, 0);
+    strncpy(leave->name, mName, TC_MAX_NAME_SIZE);
+    mLeavePkt->len = MSGR_LEAVE_FRAME_SIZE;
+
+    strncpy(((MessengerPacket*)mTextPkt->data)->text.name, mName, TC_MAX_NAME_SIZE);
+    strncpy(((MessengerPacket*)mDirectPkt->data)->direct.name, mName, TC_MAX_NAME_SIZE);
+}
+
+
+/**
+ * @return true once the server has addressed a frame to us
+ */
+bool MessengerSession::isJoined()
+{
+    return mHandle >= 0;
+}
+
+
+/**
+ * @brief Sends the prebuilt JOIN, the server numbers its frames to
+ *        us from 1 again. Unless its cookie is still good the server
+ *        answers with a COOKIE, and handleFrame() sends the JOIN
+ *        again with it.
+ * @return true if success, otherwise error
+ */
+bool MessengerSession::sendJoin()
+{
+    MessengerPacket *mpkt = (MessengerPacket*)mJoinPkt->data;
+
+    mpkt->hdr.seq = ++mTxSeq;
+    mJoining = true;
+    mAwaitingCookie = true;
+    mJoinRetryNs = 0;
+    mGroupState = GROUP_NONE;
+    mRxWindow.reset();
+
+    return mSocket->transmitData(mJoinPkt);
+}
+
+
+/**
+ * @brief Sends the JOIN again once the wait a BUSY asked for is over
+ * @return true if it was sent
+ */
+bool MessengerSession::serviceJoin(U64 nowNs)
+{
+    if ((mJoinRetryNs == 0) || (nowNs < mJoinRetryNs) || isJoined()) {
+        return false;
+    }
+
+    return sendJoin();
+}
+
+
+/**
+ * @brief Sends the prebuilt LEAVE, the session counts as not joined
+ *        afterwards
+ * @return true if success, otherwise error
+ */
+bool MessengerSession::sendLeave()
+{
+    MessengerPacket *mpkt = (MessengerPacket*)mLeavePkt->data;
+
+    mpkt->hdr.seq = ++mTxSeq;
+    mHandle = -1;
+    mJoining = false;
+    mAwaitingCookie = false;
+    mJoinRetryNs = 0;
+    mGroupState = GROUP_NONE;
+
+    return mSocket->transmitData(mLeavePkt);
+}
+
+
+/**
+ * @brief Where to write the next TEXT, TC_MAX_TEXT_SIZE bytes
+ */
+char* MessengerSession::textBuffer()
+{
+    return ((MessengerPacket*)mTextPkt->data)->text.data;
+}
+
+
+/**
+ * @brief Sends the text written to textBuffer()
+ * @param to TO_ADDRESS_BROADCAST or a client address
+ * @param length bytes of text written, the rest is zeroed
+ * @return true if success, otherwise error
+ */
+bool MessengerSession::sendText(U32 to, U32 length)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)mTextPkt->data;
+    U64 nowNs;
+
+    if (length >= TC_MAX_TEXT_SIZE) {
+        length = TC_MAX_TEXT_SIZE - 1;
+    }
+    memset(&mpkt->text.data[length], 0, TC_MAX_TEXT_SIZE - length);
+
+    mpkt->hdr.to = to;
+    mpkt->hdr.seq = ++mTxSeq;
+
+    // lets the server and the readers see how long it took to arrive
+    nowNs = timeWallNs();
+    mpkt->text.sentSec = (U32)(nowNs / 1000000000ULL);
+    mpkt->text.sentNsec = (U32)(nowNs % 1000000000ULL);
+
+    return mSocket->transmitData(mTextPkt);
+}
+
+
+/**
+ * @brief Sends text to one client by name, the server passes it on
+ *        as a DIRECT that only they see
+ * @param to name of the recipient
+ * @param text null terminated, cut to TC_MAX_TEXT_SIZE - 1 bytes
+ * @return true if success, otherwise error
+ */
+bool MessengerSession::sendDirect(const char *to, const char *text)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)mDirectPkt->data;
+
+    memset(mpkt->direct.to, 0, TC_MAX_NAME_SIZE);
+    strncpy(mpkt->direct.to, to, TC_MAX_NAME_SIZE - 1);
+    memset(mpkt->direct.data, 0, TC_MAX_TEXT_SIZE);
+    strncpy(mpkt->direct.data, text, TC_MAX_TEXT_SIZE - 1);
+
+    mpkt->hdr.seq = ++mTxSeq;
+
+    return mSocket->transmitData(mDirectPkt);
+}
+
+
+/**
+ * @brief Updates the session from a frame the server sent, while a
+ *        JOIN is outstanding the first frame addressed to a handle
+ *        tells us ours and a COOKIE is echoed in a new JOIN, once per
+ *        sendJoin(). Then puts it through the receive window.
+ * @param mpkt frame from NextMessengerFrame()
+ * @param nowNs arrival time
+ * @return true if mpkt is in order, use it now then drain
+ *         nextFrame(), otherwise it was held or dropped
+ */
+bool MessengerSession::handleFrame(MessengerPacket *mpkt, U64 nowNs)
+{
+    // after a LEAVE, frames still on their way to the old handle
+    // must not join us again
+    if (mJoining && (mpkt->hdr.to >= TO_ADDRESS_HANDLE_BASE)) {
+        U32 from;
+
+        mHandle = mpkt->hdr.to - TO_ADDRESS_HANDLE_BASE;
+        mJoining = false;
+        mAwaitingCookie = false;
+
+        from = TO_ADDRESS_HANDLE_BASE + mHandle;
+        ((MessengerPacket*)mLeavePkt->data)->hdr.from = from;
+        ((MessengerPacket*)mTextPkt->data)->hdr.from = from;
+        ((MessengerPacket*)mDirectPkt->data)->hdr.from = from;
+    }
+
+    if ((mHandle >= 0) &&
+        IsValidGroup(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        handleGroup(&mpkt->group, nowNs);
+    }
+
+    // NextMessengerFrame() already made sure the frame is whole
+    if (mAwaitingCookie &&
+        IsValidCookie(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        MessengerPacket *join = (MessengerPacket*)mJoinPkt->data;
+
+        memcpy(join->join.cookie, mpkt->cookie.cookie, TC_COOKIE_SIZE);
+        join->hdr.seq = ++mTxSeq;
+        mAwaitingCookie = false;
+        mSocket->transmitData(mJoinPkt);
+    }
+
+    if (mJoining &&
+        IsValidBusy(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        // the server is overloaded, it keeps nothing about this JOIN
+        mJoining = false;
+        mAwaitingCookie = false;
+        mJoinRetryNs = nowNs + ((U64)mpkt->busy.retryMs * 1000000ULL) + 1;
+    }
+
+    return mRxWindow.accept(mpkt, nowNs);
+}
+
+
+/**
+ * @brief Takes a frame that came through the multicast group. A
+ *        probe for our handle is echoed, and once the server has
+ *        switched us over broadcasts go through the group's window.
+ *        Until the echo, group frames are dropped, the server still
+ *        sends ours unicast. After it they are stashed, the switch
+ *        can arrive after the first of them.
+ * @return true if mpkt is in order, use it now then drain
+ *         nextFrame(), otherwise it was held or dropped
+ */
+bool MessengerSession::handleGroupFrame(MessengerPacket *mpkt, U64 nowNs)
+{
+    if (IsValidGroup(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        if ((mGroupState == GROUP_JOINING) &&
+            (mpkt->hdr.to == (U32)(TO_ADDRESS_HANDLE_BASE + mHandle))) {
+            mGroupState = GROUP_PROBED;
+            mGroupWindow.resetAt(mpkt->group.seq + 1);
+            sendGroup(&mpkt->group);
+        }
+        return false;
+    }
+
+    if (mGroupState == GROUP_PROBED) {
+        mGroupWindow.stash(mpkt);
+        return false;
+    }
+
+    if (mGroupState != GROUP_ACTIVE) {
+        return false;
+    }
+
+    return mGroupWindow.accept(mpkt, nowNs);
+}
+
+
+/**
+ * @brief Next frame either receive window has put back in order
+ * @return NULL if none, see RxWindow::next()
+ */
+MessengerPacket* MessengerSession::nextFrame(U64 nowNs)
+{
+    MessengerPacket *mpkt = mRxWindow.next(nowNs);
+
+    if ((mpkt == NULL) && (mGroupState == GROUP_ACTIVE)) {
+        mpkt = mGroupWindow.next(nowNs);
+    }
+
+    return mpkt;
+}
+
+
+/**
+ * @brief A GROUP the server sent us directly. The first joins the
+ *        group it names, the one after our probe echo means the
+ *        server now sends broadcasts there, numbered after its seq.
+ */
+void MessengerSession::handleGroup(MsgrGroup *group, U64 nowNs)
+{
+    if (mGroupState == GROUP_NONE) {
+#if CLIENT_MULTICAST
+        IPaddress address;
+
+        // Host and Port are in network order
+        address.host = group->host;
+        address.port = group->port;
+
+        if ((group->host != 0) && mSocket->openGroup(&address)) {
+            mGroupState = GROUP_JOINING;
+            sendGroup(group);
+        }
+#endif
+    } else if (mGroupState == GROUP_PROBED) {
+        mGroupWindow.skipTo(group->seq + 1, nowNs);
+        mGroupState = GROUP_ACTIVE;
+    }
+}
+
+
+/**
+ * @brief Sends group back to the server
+ * @return true if success, otherwise error
+ */
+bool MessengerSession::sendGroup(MsgrGroup *group)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)mGroupPkt->data;
+    MsgrGroup *body;
+
+    body = EncodeGroup(mpkt,
+                       TO_ADDRESS_SERVER,
+                       TO_ADDRESS_HANDLE_BASE + mHandle,
+                       ++mTxSeq);
+    memcpy(body, group, sizeof(*body));
+    mGroupPkt->len = MSGR_GROUP_FRAME_SIZE;
+
+    return mSocket->transmitData(mGroupPkt);
+}
+
+
+/**
+ * @brief Walks the frames in a server datagram in place, one
+ *        datagram may hold several back to back
+ * @param pkt datagram from the server
+ * @param offset in/out, start at 0
+ * @return NULL when no whole frame is left, otherwise the frame,
+ *         pointing into pkt
+ */
+MessengerPacket* NextMessengerFrame(ClientPacket *pkt, U32 *offset)
+{
+    MessengerPacket *mpkt;
+
+    if ((*offset + sizeof(MsgrHdr)) > (U32)pkt->len) {
+        return NULL;
+    }
+
+    mpkt = (MessengerPacket*)&pkt->data[*offset];
+    if (mpkt->hdr.length > ((U32)pkt->len - *offset - sizeof(MsgrHdr))) {
+        // truncated frame
+        return NULL;
+    }
+
+    *offset += sizeof(MsgrHdr) + mpkt->hdr.length;
+
+    return mpkt;
+}
+
+
+/**
+ * @brief Initializes the Messenger protocol
+ * @param client pointer to client socket
+ * @return true if success, otherwise error
+ */
+bool InitMessengerProtocol(ClientSocket *client)
+{
+    return gSession.init(client);
+}
+
+
 /**
  * @brief Cleans up any resources
  *
  */
 void ShutdownMessengerProtocol()
 {
+    gSession.shutdown();
 }
 
 
 /**
- * @brief This function handles input from the user
+ * @brief This function handles input from the user. The line is
+ *        read straight into the TEXT frame, so plain text goes out
+ *        without a copy.
  * @return true if keep going, otherwise exit the program
  */
 bool HandleUserInput(ClientSocket *client)
 {
-    char buffer[CONSOLE_MAX_INPUT];
+    char *buffer = gSession.textBuffer();
     int length;
     bool keepGoing = true;
 
-    length = ConsoleFlushQueueToBuffer(buffer, CONSOLE_MAX_INPUT);
+    length = ConsoleFlushQueueToBuffer(buffer, TC_MAX_TEXT_SIZE);
 
     if (length > 0) {
 #ifdef DEBUG_SHOW_USER_INPUT
@@ -54,18 +771,88 @@ bool HandleUserInput(ClientSocket *client)
         // Process commands from user
 
         // "/join" format: name(8)
+        if (!strcmp(buffer, "/join") || !strncmp(buffer, "/join ", 6)) {
+            if (gSession.isJoined()) {
+                ConsolePrintf("Already joined as %s\n", gSession.mName);
+            } else if ((length <= 6) || (buffer[6] == '\0')) {
+                ConsolePrintf("Usage: /join name\n");
+            } else {
+                gSession.setName(&buffer[6]);
+                gSession.sendJoin();
+            }
 
         // "/leave" format: name(8)
+        } else if (!strcmp(buffer, "/leave")) {
+            if (gSession.isJoined()) {
+                gSession.sendLeave();
+                ConsolePrintf("Left\n");
+            } else {
+                ConsolePrintf("Not joined\n");
+            }
+
+        // "/msg" format: name text, or #handle text
+        } else if (!strcmp(buffer, "/msg") || !strncmp(buffer, "/msg ", 5)) {
+            char *to = &buffer[5];
+            char *text = (length > 5) ? strchr(to, ' ') : NULL;
+
+            if (!gSession.isJoined()) {
+                ConsolePrintf("Join first with /join name\n");
+            } else if ((text == NULL) || (text == to) || (text[1] == '\0') ||
+                       ((to[0] == '#') && ((to[1] < '0') || (to[1] > '9')))) {
+                ConsolePrintf("Usage: /msg name text, or /msg #handle text\n");
+            } else if (to[0] == '#') {
+                // a TEXT to the handle, sent from textBuffer() like
+                // any other so the text moves to its start
+                U32 handle = (U32)atoi(&to[1]);
+
+                ++text;
+                length = strlen(text);
+                memmove(buffer, text, length + 1);
+                gSession.sendText(TO_ADDRESS_HANDLE_BASE + handle, length);
+            } else {
+                *text++ = '\0';
+                gSession.sendDirect(to, text);
+            }
+
+        // "/stats"
+        } else if (!strcmp(buffer, "/stats")) {
+            RxWindowStats *stats = &gSession.mRxWindow.mStats;
+
+            ConsolePrintf("Received %llu held %llu reordered %llu lost %llu late %llu stale %llu\n",
+                          stats->received,
+                          stats->held,
+                          stats->reordered,
+                          stats->lost,
+                          stats->late,
+                          stats->stale);
+
+            if (gSession.mGroupState == GROUP_ACTIVE) {
+                stats = &gSession.mGroupWindow.mStats;
+                ConsolePrintf("Group received %llu held %llu reordered %llu lost %llu late %llu stale %llu\n",
+                              stats->received,
+                              stats->held,
+                              stats->reordered,
+                              stats->lost,
+                              stats->late,
+                              stats->stale);
+            }
 
         // "/quit"
-        if (!strcmp(buffer, "/quit")) {
+        } else if (!strcmp(buffer, "/quit")) {
             // user wants to quit
             keepGoing = false;
 
             // cleanup
-        }
+            if (gSession.isJoined()) {
+                gSession.sendLeave();
+            }
 
         // text format: name(8) text(128)
+        } else if (gSession.isJoined()) {
+            gSession.sendText(TO_ADDRESS_BROADCAST, length);
+        } else {
+            ConsolePrintf("Join first with /join name\n");
+        }
     }
 
     return keepGoing;
@@ -97,11 +884,107 @@ bool HandleServerData(ClientSocket *client, ClientPacket *pkt)
     debugDumpMemoryContents(pkt->data, pkt->len);
 #endif
 
+    return handleFrames(pkt, false);
+}
+
+
+/**
+ * @brief This function handles data from the multicast group
+ * @param client pointer to client socket
+ * @param pkt pointer to packet received on the group
+ * @return true to keep going, otherwise, quit the program
+ */
+bool HandleGroupData(ClientSocket *client, ClientPacket *pkt)
+{
+    return handleFrames(pkt, true);
+}
+
+
+/**
+ * @brief Shows every frame in a datagram that is in order, and any
+ *        held ones that it puts back in order
+ * @param fromGroup pkt came through the multicast group
+ * @return true to keep going, otherwise, quit the program
+ */
+bool handleFrames(ClientPacket *pkt, bool fromGroup)
+{
     bool keepGoing = true;
+    MessengerPacket *mpkt;
+    U32 offset = 0;
+    U64 nowNs = timeNowNs();
 
-    // message from server
+    // message from server, possibly several frames
+    while ((mpkt = NextMessengerFrame(pkt, &offset)) != NULL) {
+        bool wasJoined = gSession.isJoined();
+        bool inOrder;
 
+        if (fromGroup) {
+            inOrder = gSession.handleGroupFrame(mpkt, nowNs);
+        } else {
+            inOrder = gSession.handleFrame(mpkt, nowNs);
+        }
+
+        if (!wasJoined && gSession.isJoined()) {
+            ConsolePrintf("Joined as %s (handle %d)\n",
+                          gSession.mName,
+                          gSession.mHandle);
+        }
+
+        if (inOrder) {
+            RxWindow *window = fromGroup ? &gSession.mGroupWindow : &gSession.mRxWindow;
+
+            showFrame(mpkt, window->mLate);
+        }
+
+        // anything held that is in order now
+        while ((mpkt = gSession.nextFrame(nowNs)) != NULL) {
+            showFrame(mpkt, false);
+        }
+    }
 
     return keepGoing;
 }
 
+
+/**
+ * @brief Releases held frames whose gap has timed out
+ * @param client pointer to client socket
+ */
+void ServiceMessengerProtocol(ClientSocket *client)
+{
+    MessengerPacket *mpkt;
+
+    while ((mpkt = gSession.nextFrame(timeNowNs())) != NULL) {
+        showFrame(mpkt, false);
+    }
+
+    gSession.serviceJoin(timeNowNs());
+}
+
+
+/**
+ * @brief Prints a frame from the server
+ * @param late it came after the frames that followed it were shown
+ */
+void showFrame(MessengerPacket *mpkt, bool late)
+{
+    if (IsValidText(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        // terminate in place, the server pads with zeros anyway
+        mpkt->text.data[TC_MAX_TEXT_SIZE-1] = '\0';
+        ConsolePrintf("%s%.*s: %s\n",
+                      late ? "(late) " : "",
+                      TC_MAX_NAME_SIZE,
+                      mpkt->text.name,
+                      mpkt->text.data);
+    } else if (IsValidDirect(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        mpkt->direct.data[TC_MAX_TEXT_SIZE-1] = '\0';
+        ConsolePrintf("%s%.*s (private): %s\n",
+                      late ? "(late) " : "",
+                      TC_MAX_NAME_SIZE,
+                      mpkt->direct.name,
+                      mpkt->direct.data);
+    } else if (IsValidBusy(&mpkt->hdr, sizeof(MsgrHdr) + mpkt->hdr.length)) {
+        ConsolePrintf("Server is busy, joining again in %d ms\n",
+                      mpkt->busy.retryMs);
+    }
+}
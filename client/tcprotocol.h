@@ -8,63 +8,140 @@
 #define _TCPROTOCOL_H
 
 #include "types.h"
+#include "messenger.h"
+#include "clientcfg.h"
 #include "clientsocket.h"
 
-enum {
-    TYPE_ACK = 1, // No ACKs right now
-    TYPE_JOIN,
-    TYPE_LEAVE,
-    TYPE_TEXT
-};
-
-enum {
-    TO_ADDRESS_SERVER = 0,
-    TO_ADDRESS_BROADCAST = 1
-};
-
-enum {
-    TC_MAX_NAME_SIZE = 8,
-    TC_MAX_TEXT_SIZE = 128
+struct RxWindowStats
+{
+    U64 received;           // sequenced frames seen
+    U64 held;               // arrived ahead of a gap
+    U64 reordered;          // arrived late and filled a gap
+    U64 lost;               // gaps given up on
+    U64 late;               // arrived after its gap was given up on
+    U64 stale;              // duplicate, or too late to deliver
 };
 
-struct MsgrHdr
+struct RxWindowSlot
 {
-    U32 to;
-    U32 from;
+    bool used;
+    bool skipped;           // seq was given up on, it may still come
     U32 seq;
-    U32 type;
-    U32 length;
+    U64 arrivedNs;
+    U8 frame[sizeof(MessengerPacket)];
 };
 
-struct MsgrJoin
+/**
+ * @brief Puts server frames back in seq order. A frame ahead of a
+ *        gap is copied into a fixed ring and held until the gap
+ *        fills, in order frames go straight through. The gap is
+ *        given up on once the first frame held after it has waited
+ *        CLIENT_REORDER_HOLD_MS. If the missing frame turns up after
+ *        all it is still passed on, as late. Seq 0 is unsequenced
+ *        and always passes.
+ *
+ *        After every accept(), and now and then without one, call
+ *        next() until it returns NULL.
+ */
+struct RxWindow
 {
-    char name[TC_MAX_NAME_SIZE];
-};
+    RxWindowSlot mSlots[CLIENT_REORDER_SLOTS];
+    U32 mExpected;          // next seq to deliver
+    U32 mHighest;           // highest seq seen
+    U32 mHeld;
+    U32 mReleaseBelow;      // seqs below this are given up on
+    bool mOverflowUsed;     // frame too far ahead, placed once
+    RxWindowSlot mOverflow; // the ring has caught up
+    bool mLate;             // the frame accept() last passed is late
+    RxWindowStats mStats;
 
-struct MsgrLeave
-{
-    char name[TC_MAX_NAME_SIZE];
+    void clear();
+    void reset();
+    void resetAt(U32 firstSeq);
+
+    bool accept(MessengerPacket *mpkt, U64 nowNs);
+    MessengerPacket* next(U64 nowNs);
+
+    void stash(MessengerPacket *mpkt);
+    void skipTo(U32 firstSeq, U64 nowNs);
+
+    void hold(RxWindowSlot *slot, MessengerPacket *mpkt, U64 nowNs);
+    void skip();
+    U64 gapSinceNs();
 };
 
-struct MsgrText
-{
-    char name[TC_MAX_NAME_SIZE];
-    char data[TC_MAX_TEXT_SIZE];
+// MessengerSession::mGroupState
+enum {
+    GROUP_NONE = 0,         // broadcasts come unicast
+    GROUP_JOINING,          // in the group, asked the server for a probe
+    GROUP_PROBED,           // echoed the probe, waiting for the switch
+    GROUP_ACTIVE            // broadcasts come through the group
 };
 
-struct MessengerPacket
+/**
+ * @brief One Messenger session over a client socket. Its packets
+ *        are allocated once in init() so sending never allocates:
+ *        JOIN and LEAVE are built when the name is set and only get
+ *        a new seq, TEXT is written straight into its packet through
+ *        textBuffer(), DIRECT is copied into its own. The JOIN keeps the last cookie, so a rejoin
+ *        within its lifetime takes a single round trip. A JOIN the
+ *        server turns away with a BUSY is sent again by serviceJoin()
+ *        once the time it asked for has passed.
+ *
+ *        If the server announces a multicast group the session joins
+ *        it through the socket and, once the server has seen a probe
+ *        arrive, takes broadcasts from the group through a receive
+ *        window of their own. Until then, or if the group can't be
+ *        joined, they keep coming unicast.
+ */
+struct MessengerSession
 {
-    MsgrHdr hdr;
-    union {
-        MsgrJoin join;
-        MsgrLeave leave;
-        MsgrText text;
-    };
+    ClientSocket *mSocket;
+    char mName[TC_MAX_NAME_SIZE];
+    int mHandle;            // -1 until the server addresses us
+    U32 mTxSeq;             // seq of the last frame sent
+    bool mJoining;          // JOIN sent, the next handle is ours
+    bool mAwaitingCookie;   // JOIN sent, echo the COOKIE it brings
+    U64 mJoinRetryNs;       // when to JOIN again after a BUSY, 0 if not
+    U32 mGroupState;
+
+    ClientPacket *mJoinPkt;
+    ClientPacket *mLeavePkt;
+    ClientPacket *mTextPkt;
+    ClientPacket *mDirectPkt;
+    ClientPacket *mGroupPkt;
+
+    RxWindow mRxWindow;
+    RxWindow mGroupWindow;
+
+    bool init(ClientSocket *socket);
+    void shutdown();
+
+    void setName(const char *name);
+    bool isJoined();
+
+    bool sendJoin();
+    bool serviceJoin(U64 nowNs);
+    bool sendLeave();
+    char* textBuffer();
+    bool sendText(U32 to, U32 length);
+    bool sendDirect(const char *to, const char *text);
+
+    bool handleFrame(MessengerPacket *mpkt, U64 nowNs);
+    bool handleGroupFrame(MessengerPacket *mpkt, U64 nowNs);
+    MessengerPacket* nextFrame(U64 nowNs);
+
+    void handleGroup(MsgrGroup *group, U64 nowNs);
+    bool sendGroup(MsgrGroup *group);
 };
 
-bool InitMessengerProtocol();
+MessengerPacket* NextMessengerFrame(ClientPacket *pkt, U32 *offset);
+
+bool InitMessengerProtocol(ClientSocket *client);
 void ShutdownMessengerProtocol();
 bool HandleUserInput(ClientSocket *client);
 bool HandleServerData(ClientSocket *client, ClientPacket *pkt);
+bool HandleGroupData(ClientSocket *client, ClientPacket *pkt);
+void ServiceMessengerProtocol(ClientSocket *client);
 
 #endif
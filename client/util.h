@@ -9,5 +9,13 @@
 #include "types.h"
 
 void debugDumpMemoryContents(const U8* bufPtr, U32 length, U32 offset=0);
+U64 timeNowNs();
+U64 timeWallNs();
+
+// Builds with USE_VIRTUAL_CLOCK read time from gVirtualClockNs, which
+// the simulation advances by hand (see tools/sim)
+#ifdef USE_VIRTUAL_CLOCK
+extern U64 gVirtualClockNs;
+#endif
 
 #endif
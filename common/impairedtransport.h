@@ -0,0 +1,141 @@
+/**
+ * @brief Transport decorator that impairs outgoing datagrams, see
+ *        impairment.h. Wraps any transport, e.g.
+ *        ImpairedTransport<PosixUdpTransport> or
+ *        ImpairedTransport<LoopTransport>. Only sends are impaired,
+ *        wrap both ends to impair both directions.
+ *
+ *        Held back datagrams go out from send, recv and flush, so the
+ *        owner has to keep calling one of them for them to leave.
+ */
+
+#ifndef _IMPAIREDTRANSPORT_H
+#define _IMPAIREDTRANSPORT_H
+
+#include <string.h>
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+#include "impairment.h"
+#include "util.h"
+
+template <class Inner>
+struct ImpairedTransport
+{
+    Inner mInner;
+    NetImpairment mImpairment;
+    NetPacket *mScratch;        // carries released datagrams to mInner
+    bool mOpen;
+
+    void clear() {
+        mInner.clear();
+        mScratch = NULL;
+        mOpen = false;
+    }
+
+    /**
+     * @brief Opens the inner transport, impaired as
+     *        gImpairmentDefaults says
+     */
+    bool open(U32 port) {
+        if (!mInner.open(port)) {
+            return false;
+        }
+
+        mScratch = mInner.allocPacket(IMPAIR_MAX_DATAGRAM);
+        if (mScratch == NULL) {
+            mInner.close();
+            return false;
+        }
+
+        mImpairment.init(&gImpairmentDefaults, gImpairmentNextStream++);
+        mOpen = true;
+
+        return true;
+    }
+
+    /**
+     * @brief Opens the inner transport on a multicast group, nothing
+     *        is sent on it so nothing is impaired
+     */
+    bool openGroup(IPaddress *group, U32 interfaceHost) {
+        return mInner.openGroup(group, interfaceHost);
+    }
+
+    void close() {
+        if (mOpen) {
+            mImpairment.shutdown();
+            mInner.freePacket(mScratch);
+            mScratch = NULL;
+            mOpen = false;
+        }
+        mInner.close();
+    }
+
+    NetPacket* allocPacket(U32 size) {
+        return mInner.allocPacket(size);
+    }
+
+    void freePacket(NetPacket *pkt) {
+        mInner.freePacket(pkt);
+    }
+
+    int recv(NetPacket *pkt) {
+        releaseDue();
+        return mInner.recv(pkt);
+    }
+
+    /**
+     * @brief Like UDP, a datagram the impairment drops still counts
+     *        as sent
+     */
+    bool send(NetPacket *pkt) {
+        mImpairment.admit(pkt, timeNowNs());
+        releaseDue();
+        return true;
+    }
+
+    void flush() {
+        releaseDue();
+        mInner.flush();
+    }
+
+    bool resolveHost(IPaddress *address, const char *host, U32 port) {
+        return mInner.resolveHost(address, host, port);
+    }
+
+    const char* getError() {
+        return mInner.getError();
+    }
+
+    // sending on the socket directly would skip the impairment
+    int getFd() {
+        return -1;
+    }
+
+    Inner* getInner() {
+        return &mInner;
+    }
+
+    NetImpairment* getImpairment() {
+        return &mImpairment;
+    }
+
+    /**
+     * @brief Passes every datagram whose time has come to mInner
+     */
+    void releaseDue() {
+        ImpairedDatagram *datagram;
+        U64 nowNs = timeNowNs();
+
+        while ((datagram = mImpairment.nextDue(nowNs)) != NULL) {
+            mScratch->address = datagram->to;
+            mScratch->len = datagram->len;
+            memcpy(mScratch->data, datagram->data, datagram->len);
+            mInner.send(mScratch);
+            mImpairment.release(datagram);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,372 @@
+/**
+ * @brief Network impairment model
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "impairment.h"
+
+ImpairmentConfig gImpairmentDefaults;
+U64 gImpairmentNextStream = 0;
+ImpairmentStats gImpairmentTotals;
+
+
+void ImpairmentConfig::clear()
+{
+    memset(this, 0, sizeof(*this));
+    seed = 1;
+}
+
+/**
+ * @brief Reads a comma separated list of settings, times in
+ *        microseconds, rate in bits/s, e.g.
+ *
+ *          loss=0.01,burst=0.001:0.3:0.5,dup=0.001,reorder=0.01:5000,
+ *          delay=20000,jitter=5000,rate=10000000,queue=65536,seed=7
+ *
+ *        burst is enter:exit:loss, reorder is chance:hold back.
+ *        Settings not named keep their value.
+ * @return true if success, otherwise a setting was not understood
+ */
+bool ImpairmentConfig::parse(const char *spec)
+{
+    char buffer[256];
+    char *token;
+    char *save = NULL;
+
+    if ((spec == NULL) || (strlen(spec) >= sizeof(buffer))) {
+        return false;
+    }
+    strcpy(buffer, spec);
+
+    for (token = strtok_r(buffer, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(token, '=');
+        char *next;
+
+        if (value == NULL) {
+            return false;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(token, "loss")) {
+            loss = strtod(value, NULL);
+        } else if (!strcmp(token, "burst")) {
+            burstEnter = strtod(value, &next);
+            if (*next++ != ':') {
+                return false;
+            }
+            burstExit = strtod(next, &next);
+            if (*next++ != ':') {
+                return false;
+            }
+            burstLoss = strtod(next, NULL);
+        } else if (!strcmp(token, "dup")) {
+            duplicate = strtod(value, NULL);
+        } else if (!strcmp(token, "reorder")) {
+            reorder = strtod(value, &next);
+            if (*next++ != ':') {
+                return false;
+            }
+            reorderDelayNs = strtoull(next, NULL, 10) * 1000ULL;
+        } else if (!strcmp(token, "delay")) {
+            latencyNs = strtoull(value, NULL, 10) * 1000ULL;
+        } else if (!strcmp(token, "jitter")) {
+            jitterNs = strtoull(value, NULL, 10) * 1000ULL;
+        } else if (!strcmp(token, "rate")) {
+            bandwidthBps = strtoull(value, NULL, 10);
+        } else if (!strcmp(token, "queue")) {
+            queueLimitBytes = strtoul(value, NULL, 10);
+        } else if (!strcmp(token, "seed")) {
+            seed = strtoull(value, NULL, 10);
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @param config settings, copied
+ * @param stream picks an independent random stream for this seed
+ * @return true if success, otherwise error
+ */
+bool NetImpairment::init(const ImpairmentConfig *config, U64 stream)
+{
+    U64 z;
+
+    mConfig = *config;
+    memset(&mStats, 0, sizeof(mStats));
+
+    // splitmix64 spreads nearby seeds and streams apart
+    z = mConfig.seed + ((stream + 1) * 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    mRandom = z ^ (z >> 31);
+    if (mRandom == 0) {
+        mRandom = 1;
+    }
+
+    mBurst = false;
+    mLinkFreeNs = 0;
+    mOrder = 0;
+
+    mHeap = NULL;
+    mHeapCount = 0;
+    mHeapCapacity = 0;
+    mFree = NULL;
+    mChunks = NULL;
+
+    return true;
+}
+
+void NetImpairment::shutdown()
+{
+    while (mChunks) {
+        ImpairedChunk *next = mChunks->next;
+
+        delete mChunks;
+        mChunks = next;
+    }
+
+    delete [] mHeap;
+    mHeap = NULL;
+    mHeapCount = 0;
+    mHeapCapacity = 0;
+    mFree = NULL;
+}
+
+/**
+ * @brief Decides the fate of an outgoing datagram, and if it lives,
+ *        when it leaves
+ */
+void NetImpairment::admit(NetPacket *pkt, U64 nowNs)
+{
+    U32 copies = 1;
+
+    ++mStats.offered;
+    ++gImpairmentTotals.offered;
+
+    // Gilbert-Elliott, a two state chain of good and bursty loss
+    if (mConfig.burstEnter > 0.0) {
+        if (mBurst) {
+            mBurst = !chance(mConfig.burstExit);
+        } else {
+            mBurst = chance(mConfig.burstEnter);
+        }
+
+        if (mBurst && chance(mConfig.burstLoss)) {
+            ++mStats.burstLost;
+            ++gImpairmentTotals.burstLost;
+            return;
+        }
+    }
+
+    if (chance(mConfig.loss)) {
+        ++mStats.lost;
+        ++gImpairmentTotals.lost;
+        return;
+    }
+
+    if (chance(mConfig.duplicate)) {
+        ++mStats.duplicated;
+        ++gImpairmentTotals.duplicated;
+        copies = 2;
+    }
+
+    for (U32 copy=0; copy<copies; ++copy) {
+        U64 departNs = nowNs;
+        U64 releaseNs;
+
+        if (mConfig.bandwidthBps > 0) {
+            U64 startNs = (mLinkFreeNs > nowNs) ? mLinkFreeNs : nowNs;
+            U64 backlogBytes = ((startNs - nowNs) * mConfig.bandwidthBps) / 8000000000ULL;
+
+            if ((mConfig.queueLimitBytes > 0) &&
+                ((backlogBytes + pkt->len) > mConfig.queueLimitBytes)) {
+                ++mStats.queueDropped;
+                ++gImpairmentTotals.queueDropped;
+                continue;
+            }
+
+            mLinkFreeNs = startNs + (((U64)pkt->len * 8000000000ULL) / mConfig.bandwidthBps);
+            departNs = mLinkFreeNs;
+        }
+
+        releaseNs = departNs + mConfig.latencyNs;
+        if (mConfig.jitterNs > 0) {
+            releaseNs += random() % (mConfig.jitterNs + 1);
+        }
+
+        if (chance(mConfig.reorder)) {
+            ++mStats.reordered;
+            ++gImpairmentTotals.reordered;
+            releaseNs += mConfig.reorderDelayNs;
+        }
+
+        schedule(pkt, releaseNs);
+    }
+}
+
+/**
+ * @brief Takes the next datagram due by nowNs, hand it back with
+ *        release() once sent
+ * @return NULL if none is due
+ */
+ImpairedDatagram* NetImpairment::nextDue(U64 nowNs)
+{
+    if ((mHeapCount == 0) || (mHeap[0]->releaseNs > nowNs)) {
+        return NULL;
+    }
+
+    ++mStats.released;
+    ++gImpairmentTotals.released;
+
+    return heapPop();
+}
+
+void NetImpairment::release(ImpairedDatagram *datagram)
+{
+    datagram->next = mFree;
+    mFree = datagram;
+}
+
+// xorshift64*
+U64 NetImpairment::random()
+{
+    mRandom ^= mRandom >> 12;
+    mRandom ^= mRandom << 25;
+    mRandom ^= mRandom >> 27;
+
+    return mRandom * 0x2545F4914F6CDD1DULL;
+}
+
+double NetImpairment::uniform()
+{
+    return (double)(random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Draws only when probability is set, so turning one
+ *        impairment on leaves the others' choices unchanged
+ */
+bool NetImpairment::chance(double probability)
+{
+    return (probability > 0.0) && (uniform() < probability);
+}
+
+bool NetImpairment::schedule(NetPacket *pkt, U64 releaseNs)
+{
+    ImpairedDatagram *datagram;
+
+    if ((pkt->len < 0) || (pkt->len > IMPAIR_MAX_DATAGRAM) ||
+        (mHeapCount >= IMPAIR_MAX_PENDING)) {
+        ++mStats.queueDropped;
+        ++gImpairmentTotals.queueDropped;
+        return false;
+    }
+
+    datagram = allocDatagram();
+    if (datagram == NULL) {
+        return false;
+    }
+
+    datagram->releaseNs = releaseNs;
+    datagram->order = mOrder++;
+    datagram->to = pkt->address;
+    datagram->len = pkt->len;
+    memcpy(datagram->data, pkt->data, pkt->len);
+
+    heapPush(datagram);
+
+    return true;
+}
+
+static bool releasesBefore(ImpairedDatagram *a, ImpairedDatagram *b)
+{
+    return (a->releaseNs < b->releaseNs) ||
+           ((a->releaseNs == b->releaseNs) && (a->order < b->order));
+}
+
+void NetImpairment::heapPush(ImpairedDatagram *datagram)
+{
+    U32 index;
+
+    if (mHeapCount >= mHeapCapacity) {
+        U32 capacity = mHeapCapacity ? (mHeapCapacity * 2) : 16;
+        ImpairedDatagram **heap = new ImpairedDatagram*[capacity];
+
+        if (mHeap) {
+            memcpy(heap, mHeap, mHeapCount * sizeof(*heap));
+            delete [] mHeap;
+        }
+        mHeap = heap;
+        mHeapCapacity = capacity;
+    }
+
+    index = mHeapCount++;
+    while (index > 0) {
+        U32 parent = (index - 1) / 2;
+
+        if (!releasesBefore(datagram, mHeap[parent])) {
+            break;
+        }
+        mHeap[index] = mHeap[parent];
+        index = parent;
+    }
+    mHeap[index] = datagram;
+}
+
+ImpairedDatagram* NetImpairment::heapPop()
+{
+    ImpairedDatagram *top = mHeap[0];
+    ImpairedDatagram *last = mHeap[--mHeapCount];
+    U32 index = 0;
+
+    for (;;) {
+        U32 child = (index * 2) + 1;
+
+        if (child >= mHeapCount) {
+            break;
+        }
+        if (((child + 1) < mHeapCount) && releasesBefore(mHeap[child + 1], mHeap[child])) {
+            ++child;
+        }
+        if (!releasesBefore(mHeap[child], last)) {
+            break;
+        }
+        mHeap[index] = mHeap[child];
+        index = child;
+    }
+    if (mHeapCount > 0) {
+        mHeap[index] = last;
+    }
+
+    return top;
+}
+
+ImpairedDatagram* NetImpairment::allocDatagram()
+{
+    ImpairedDatagram *datagram;
+
+    if (mFree == NULL) {
+        ImpairedChunk *chunk = new ImpairedChunk;
+
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->next = mChunks;
+        mChunks = chunk;
+
+        for (U32 i=0; i<IMPAIR_CHUNK_DATAGRAMS; ++i) {
+            release(&chunk->datagrams[i]);
+        }
+    }
+
+    datagram = mFree;
+    mFree = datagram->next;
+
+    return datagram;
+}
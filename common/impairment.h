@@ -0,0 +1,121 @@
+/**
+ * @brief Network impairment model: loss, burst loss, duplication,
+ *        reordering, latency, jitter and a bandwidth capped
+ *        bottleneck. Every random choice comes from a seeded
+ *        generator, so with the loop transport and the virtual clock
+ *        an impaired run is still exactly reproducible.
+ */
+
+#ifndef _IMPAIRMENT_H
+#define _IMPAIRMENT_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+
+#ifndef IMPAIR_MAX_DATAGRAM
+#define IMPAIR_MAX_DATAGRAM 2048
+#endif
+// Datagrams held back at once, beyond this they are dropped
+#ifndef IMPAIR_MAX_PENDING
+#define IMPAIR_MAX_PENDING 65536
+#endif
+#define IMPAIR_CHUNK_DATAGRAMS 8
+
+/**
+ * @brief What to do to datagrams. Probabilities are 0..1, times are
+ *        in nanoseconds. All zero passes datagrams straight through.
+ */
+struct ImpairmentConfig
+{
+    U64 seed;
+
+    double loss;            // independent loss
+    double burstEnter;      // chance per datagram to start a loss burst
+    double burstExit;       // chance per datagram to end it
+    double burstLoss;       // loss while in a burst
+    double duplicate;
+    double reorder;         // chance to hold a datagram back...
+    U64 reorderDelayNs;     // ...by this much, so later ones overtake it
+
+    U64 latencyNs;
+    U64 jitterNs;           // uniform extra delay in [0, jitterNs]
+
+    U64 bandwidthBps;       // bottleneck rate in bits/s, 0 for unlimited
+    U32 queueLimitBytes;    // bottleneck queue, drop tail, 0 for unlimited
+
+    void clear();
+    bool parse(const char *spec);
+};
+
+struct ImpairmentStats
+{
+    U64 offered;
+    U64 lost;
+    U64 burstLost;
+    U64 queueDropped;
+    U64 duplicated;
+    U64 reordered;
+    U64 released;
+};
+
+struct ImpairedDatagram
+{
+    ImpairedDatagram *next;
+    U64 releaseNs;
+    U64 order;              // breaks release time ties in send order
+    IPaddress to;
+    U32 len;
+    U8 data[IMPAIR_MAX_DATAGRAM];
+};
+
+struct ImpairedChunk
+{
+    ImpairedChunk *next;
+    ImpairedDatagram datagrams[IMPAIR_CHUNK_DATAGRAMS];
+};
+
+struct NetImpairment
+{
+    ImpairmentConfig mConfig;
+    ImpairmentStats mStats;
+
+    U64 mRandom;            // xorshift64* state
+    bool mBurst;            // in a loss burst
+    U64 mLinkFreeNs;        // when the bottleneck is done with what it has
+    U64 mOrder;
+
+    // datagrams held back, min heap on release time
+    ImpairedDatagram **mHeap;
+    U32 mHeapCount;
+    U32 mHeapCapacity;
+
+    ImpairedDatagram *mFree;
+    ImpairedChunk *mChunks;
+
+    bool init(const ImpairmentConfig *config, U64 stream);
+    void shutdown();
+
+    void admit(NetPacket *pkt, U64 nowNs);
+    ImpairedDatagram* nextDue(U64 nowNs);
+    void release(ImpairedDatagram *datagram);
+
+    U64 random();
+    double uniform();
+    bool chance(double probability);
+
+    bool schedule(NetPacket *pkt, U64 releaseNs);
+    void heapPush(ImpairedDatagram *datagram);
+    ImpairedDatagram* heapPop();
+    ImpairedDatagram* allocDatagram();
+};
+
+// Applied by every ImpairedTransport when it opens, each takes the
+// next random stream so no two transports make the same choices
+extern ImpairmentConfig gImpairmentDefaults;
+extern U64 gImpairmentNextStream;
+
+// Sum over every NetImpairment, updated as they run
+extern ImpairmentStats gImpairmentTotals;
+
+#endif
@@ -0,0 +1,703 @@
+/**
+ * @brief io_uring UDP transport, talks to the kernel directly
+ *        through the io_uring syscalls
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "iouringtransport.h"
+#include "util.h"
+
+// user_data of the multishot receive and of each send slot
+#define IOURING_TAG_RECV (1ULL << 32)
+#define IOURING_TAG_SEND (2ULL << 32)
+
+#define IOURING_BUFFER_GROUP 0
+
+
+void IoUringTransport::clear()
+{
+    mSocket.clear();
+    mUring = false;
+    mErrno = 0;
+
+    mRingFd = -1;
+    mSqRing = NULL;
+    mSqes = NULL;
+    mCqRing = NULL;
+    mStash = NULL;
+    mBufRing = NULL;
+    mBuffers = NULL;
+    mSendSlots = NULL;
+    mSendData = NULL;
+    mFreeSlots = NULL;
+}
+
+/**
+ * @brief Opens the UDP socket and sets up the ring. A kernel without
+ *        a usable io_uring is not an error, the transport then runs
+ *        on the plain socket.
+ * @param port local port, 0 to let the system pick
+ * @return true if success, otherwise error
+ */
+bool IoUringTransport::open(U32 port)
+{
+    if (!mSocket.open(port)) {
+        mErrno = mSocket.mErrno;
+        return false;
+    }
+
+    mUring = setupRing();
+    if (!mUring) {
+        teardownRing();
+    }
+
+    return true;
+}
+
+void IoUringTransport::close()
+{
+    teardownRing();
+    mSocket.close();
+    mUring = false;
+}
+
+NetPacket* IoUringTransport::allocPacket(U32 size)
+{
+    return allocNetPacket(size);
+}
+
+void IoUringTransport::freePacket(NetPacket *pkt)
+{
+    if (pkt) {
+        returnPacketBuffer(pkt);
+        freeNetPacket(pkt);
+    }
+}
+
+/**
+ * @brief Takes the next received datagram. Only enters the kernel
+ *        when no completion is waiting. The packet is lent the
+ *        receive buffer, any buffer it held before is returned.
+ * @return 1 if pkt holds a datagram, 0 if none, -1 if error
+ */
+int IoUringTransport::recv(NetPacket *pkt)
+{
+    io_uring_cqe cqe;
+    bool polled = false;
+
+    returnPacketBuffer(pkt);
+
+    if (!mUring) {
+        int received = mSocket.recv(pkt);
+
+        if (received < 0) {
+            mErrno = mSocket.mErrno;
+        }
+        return received;
+    }
+
+    for (;;) {
+        if (!mRecvArmed && !armRecv()) {
+            return -1;
+        }
+
+        if (!nextRecvCompletion(&cqe)) {
+            if (polled) {
+                return 0;
+            }
+
+            // submits queued sends too, and lets the kernel post
+            // completions it has ready
+            if (submit(0) < 0) {
+                return -1;
+            }
+            polled = true;
+            continue;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            mRecvArmed = false;
+        }
+
+        if (cqe.res < 0) {
+            if (cqe.res == -ENOBUFS) {
+                // every buffer was lent out, rearm and carry on
+                continue;
+            } else if ((cqe.res == -EINVAL) || (cqe.res == -EOPNOTSUPP)) {
+                // no multishot recvmsg on this kernel, the ring stays
+                // mapped until close since packets may hold buffers
+                mUring = false;
+                return recv(pkt);
+            }
+
+            mErrno = -cqe.res;
+            return -1;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        U16 bufferId = (U16)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        U8 *buffer = &mBuffers[(U32)bufferId * IOURING_BUFFER_SIZE];
+        io_uring_recvmsg_out *out = (io_uring_recvmsg_out*)buffer;
+        struct sockaddr_in *from = (struct sockaddr_in*)(out + 1);
+        U32 headroom = sizeof(io_uring_recvmsg_out) +
+                       mRecvMsg.msg_namelen +
+                       mRecvMsg.msg_controllen;
+
+        if ((out->flags & MSG_TRUNC) || (out->namelen < sizeof(*from))) {
+            // too big for a buffer, or not IPv4
+            recycleBuffer(bufferId);
+            continue;
+        }
+
+        pkt->rxTimestampNs = 0;
+        if (out->controllen > 0) {
+            struct msghdr control;
+
+            memset(&control, 0, sizeof(control));
+            control.msg_control = (U8*)(out + 1) + mRecvMsg.msg_namelen;
+            control.msg_controllen = out->controllen;
+            mSocket.readControl(&control, pkt);
+        }
+        if (pkt->rxTimestampNs == 0) {
+            pkt->rxTimestampNs = timeWallNs();
+        }
+
+        pkt->channel = -1;
+        pkt->data = &buffer[headroom];
+        pkt->len = out->payloadlen;
+        pkt->maxlen = IOURING_BUFFER_SIZE - headroom;
+        pkt->status = 0;
+        pkt->bufferId = bufferId;
+
+        // Host and Port are in network order
+        pkt->address.host = from->sin_addr.s_addr;
+        pkt->address.port = from->sin_port;
+
+        return 1;
+    }
+}
+
+/**
+ * @brief Copies the packet into a send slot and queues it. Nothing
+ *        reaches the kernel until flush(), the next empty recv(),
+ *        or the submission queue filling up.
+ * @return true if queued or sent, otherwise error. A queued send
+ *         that later fails only shows up in getError().
+ */
+bool IoUringTransport::send(NetPacket *pkt)
+{
+    io_uring_sqe *sqe;
+    IoUringSendSlot *slot;
+    U16 slotIndex;
+
+    if (!mUring || (pkt->len > IOURING_BUFFER_SIZE)) {
+        return sendAfterQueued(pkt);
+    }
+
+    if ((mFreeSlotCount == 0) && !waitForSendSlots(1)) {
+        // the ring can't take it, and a plain send would pass
+        // what is queued
+        return false;
+    }
+
+    sqe = getSqe();
+    if (sqe == NULL) {
+        return sendAfterQueued(pkt);
+    }
+
+    slotIndex = mFreeSlots[--mFreeSlotCount];
+    slot = &mSendSlots[slotIndex];
+
+    memcpy(slot->data, pkt->data, pkt->len);
+    slot->iov.iov_len = pkt->len;
+    slot->to.sin_addr.s_addr = pkt->address.host;
+    slot->to.sin_port = pkt->address.port;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = mSocket.getFd();
+    sqe->addr = (U64)(size_t)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = IOURING_TAG_SEND | slotIndex;
+
+    return true;
+}
+
+/**
+ * @brief Sends on the socket itself once every send queued in the
+ *        ring has completed, so a recipient's frames keep their seq
+ *        order. Gives up rather than send out of order.
+ * @return true if sent, otherwise error
+ */
+bool IoUringTransport::sendAfterQueued(NetPacket *pkt)
+{
+    if (mUring && !waitForSendSlots(IOURING_SEND_SLOTS)) {
+        return false;
+    }
+
+    if (!mSocket.send(pkt)) {
+        mErrno = mSocket.mErrno;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Submits every queued send with one syscall
+ */
+void IoUringTransport::flush()
+{
+    if (mUring && (mSqPending > 0)) {
+        submit(0);
+    }
+}
+
+bool IoUringTransport::resolveHost(IPaddress *address, const char *host, U32 port)
+{
+    return mSocket.resolveHost(address, host, port);
+}
+
+const char* IoUringTransport::getError()
+{
+    return strerror(mErrno);
+}
+
+/**
+ * @brief The socket itself, plain sends on it bypass the ring and
+ *        anything still queued in it
+ */
+int IoUringTransport::getFd()
+{
+    return mSocket.getFd();
+}
+
+bool IoUringTransport::isUring()
+{
+    return mUring;
+}
+
+PosixUdpTransport* IoUringTransport::getSocket()
+{
+    return &mSocket;
+}
+
+
+/**
+ * @brief Creates the ring, maps its queues, and registers the
+ *        provided buffer ring
+ * @return true if success, otherwise io_uring is not usable
+ */
+bool IoUringTransport::setupRing()
+{
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    U32 entries = IOURING_SEND_SLOTS + 8;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE |
+                   IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+
+    mRingFd = syscall(__NR_io_uring_setup, entries, &params);
+    if ((mRingFd < 0) && (errno == EINVAL)) {
+        // older kernel, try without the task running hints
+        params.flags = IORING_SETUP_CQSIZE;
+        mRingFd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (mRingFd < 0) {
+        mErrno = errno;
+        return false;
+    }
+
+    mSqEntries = params.sq_entries;
+    mCqEntries = params.cq_entries;
+    mSqRingSize = params.sq_off.array + mSqEntries * sizeof(U32);
+    mCqRingSize = params.cq_off.cqes + mCqEntries * sizeof(io_uring_cqe);
+    mSqesSize = mSqEntries * sizeof(io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (mCqRingSize > mSqRingSize) {
+            mSqRingSize = mCqRingSize;
+        }
+        mCqRingSize = mSqRingSize;
+    }
+
+    mSqRing = mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED) {
+        mErrno = errno;
+        mSqRing = NULL;
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        mCqRing = mSqRing;
+    } else {
+        mCqRing = mmap(NULL, mCqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED) {
+            mErrno = errno;
+            mCqRing = NULL;
+            return false;
+        }
+    }
+
+    mSqes = (io_uring_sqe*)mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+    if (mSqes == MAP_FAILED) {
+        mErrno = errno;
+        mSqes = NULL;
+        return false;
+    }
+
+    mSqHead = (U32*)((U8*)mSqRing + params.sq_off.head);
+    mSqTail = (U32*)((U8*)mSqRing + params.sq_off.tail);
+    mSqArray = (U32*)((U8*)mSqRing + params.sq_off.array);
+    mSqMask = *(U32*)((U8*)mSqRing + params.sq_off.ring_mask);
+    mSqLocalTail = *mSqTail;
+    mSqPending = 0;
+
+    mCqHead = (U32*)((U8*)mCqRing + params.cq_off.head);
+    mCqTail = (U32*)((U8*)mCqRing + params.cq_off.tail);
+    mCqMask = *(U32*)((U8*)mCqRing + params.cq_off.ring_mask);
+    mCqes = (io_uring_cqe*)((U8*)mCqRing + params.cq_off.cqes);
+
+    // sqe slots map one to one onto the submission ring
+    for (U32 i=0; i<mSqEntries; ++i) {
+        mSqArray[i] = i;
+    }
+
+    mStash = new io_uring_cqe[mCqEntries];
+    mStashHead = 0;
+    mStashCount = 0;
+
+    // provided receive buffers
+    mBufRing = (io_uring_buf_ring*)mmap(NULL,
+                                        IOURING_RECV_BUFFERS * sizeof(io_uring_buf),
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mBufRing == MAP_FAILED) {
+        mErrno = errno;
+        mBufRing = NULL;
+        return false;
+    }
+
+    mBuffers = (U8*)mmap(NULL, IOURING_RECV_BUFFERS * IOURING_BUFFER_SIZE,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mBuffers == MAP_FAILED) {
+        mErrno = errno;
+        mBuffers = NULL;
+        return false;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (U64)(size_t)mBufRing;
+    reg.ring_entries = IOURING_RECV_BUFFERS;
+    reg.bgid = IOURING_BUFFER_GROUP;
+
+    if (syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        mErrno = errno;
+        return false;
+    }
+
+    mBufTail = 0;
+    for (U32 i=0; i<IOURING_RECV_BUFFERS; ++i) {
+        recycleBuffer((U16)i);
+    }
+
+    memset(&mRecvMsg, 0, sizeof(mRecvMsg));
+    mRecvMsg.msg_namelen = sizeof(struct sockaddr_in);
+    // the SO_RXQ_OVFL count and the receive stamp land between the
+    // name and the payload
+    if (mSocket.mDropCounter) {
+        mRecvMsg.msg_controllen += CMSG_SPACE(sizeof(U32));
+    }
+    if (mSocket.mRxTimestamps) {
+        mRecvMsg.msg_controllen += CMSG_SPACE(sizeof(struct timespec));
+    }
+    mRecvArmed = false;
+
+    // send slots
+    mSendSlots = new IoUringSendSlot[IOURING_SEND_SLOTS];
+    mSendData = new U8[IOURING_SEND_SLOTS * IOURING_BUFFER_SIZE];
+    mFreeSlots = new U16[IOURING_SEND_SLOTS];
+
+    for (U32 i=0; i<IOURING_SEND_SLOTS; ++i) {
+        IoUringSendSlot *slot = &mSendSlots[i];
+
+        memset(slot, 0, sizeof(*slot));
+        slot->data = &mSendData[i * IOURING_BUFFER_SIZE];
+        slot->iov.iov_base = slot->data;
+        slot->to.sin_family = AF_INET;
+        slot->msg.msg_name = &slot->to;
+        slot->msg.msg_namelen = sizeof(slot->to);
+        slot->msg.msg_iov = &slot->iov;
+        slot->msg.msg_iovlen = 1;
+
+        mFreeSlots[i] = (U16)(IOURING_SEND_SLOTS - 1 - i);
+    }
+    mFreeSlotCount = IOURING_SEND_SLOTS;
+
+    return armRecv();
+}
+
+void IoUringTransport::teardownRing()
+{
+    // closing the ring cancels the receive and any send in flight
+    if (mRingFd >= 0) {
+        ::close(mRingFd);
+        mRingFd = -1;
+    }
+
+    if (mSqes) {
+        munmap(mSqes, mSqesSize);
+        mSqes = NULL;
+    }
+
+    if (mCqRing && (mCqRing != mSqRing)) {
+        munmap(mCqRing, mCqRingSize);
+    }
+    mCqRing = NULL;
+
+    if (mSqRing) {
+        munmap(mSqRing, mSqRingSize);
+        mSqRing = NULL;
+    }
+
+    if (mBufRing) {
+        munmap(mBufRing, IOURING_RECV_BUFFERS * sizeof(io_uring_buf));
+        mBufRing = NULL;
+    }
+
+    if (mBuffers) {
+        munmap(mBuffers, IOURING_RECV_BUFFERS * IOURING_BUFFER_SIZE);
+        mBuffers = NULL;
+    }
+
+    delete [] mStash;
+    delete [] mSendSlots;
+    delete [] mSendData;
+    delete [] mFreeSlots;
+    mStash = NULL;
+    mSendSlots = NULL;
+    mSendData = NULL;
+    mFreeSlots = NULL;
+}
+
+/**
+ * @brief Reserves the next submission queue entry, submitting what
+ *        is queued if the ring is full
+ * @return NULL if the ring is still full, otherwise a zeroed sqe
+ */
+io_uring_sqe* IoUringTransport::getSqe()
+{
+    io_uring_sqe *sqe;
+
+    if ((mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE)) >= mSqEntries) {
+        submit(0);
+        if ((mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE)) >= mSqEntries) {
+            return NULL;
+        }
+    }
+
+    sqe = &mSqes[mSqLocalTail & mSqMask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ++mSqLocalTail;
+    ++mSqPending;
+
+    return sqe;
+}
+
+/**
+ * @brief Publishes queued sqes and enters the kernel once
+ * @param waitNr completions to wait for
+ * @return sqes submitted, or -1 if error
+ */
+int IoUringTransport::submit(U32 waitNr)
+{
+    int submitted;
+
+    __atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+
+    submitted = syscall(__NR_io_uring_enter, mRingFd, mSqPending, waitNr,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+    if (submitted < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+            return 0;
+        }
+        mErrno = errno;
+        return -1;
+    }
+
+    mSqPending -= (U32)submitted;
+
+    return submitted;
+}
+
+/**
+ * @brief Queues the multishot recvmsg, it keeps completing into
+ *        provided buffers until it runs out of them
+ */
+bool IoUringTransport::armRecv()
+{
+    io_uring_sqe *sqe = getSqe();
+
+    if (sqe == NULL) {
+        mErrno = EBUSY;
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = mSocket.getFd();
+    sqe->addr = (U64)(size_t)&mRecvMsg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IOURING_BUFFER_GROUP;
+    sqe->user_data = IOURING_TAG_RECV;
+
+    mRecvArmed = true;
+
+    return true;
+}
+
+/**
+ * @brief Pops the next receive completion, retiring any send
+ *        completions ahead of it
+ * @return true if cqe was filled in
+ */
+bool IoUringTransport::nextRecvCompletion(io_uring_cqe *cqe)
+{
+    U32 head;
+    U32 tail;
+
+    if (mStashCount > 0) {
+        *cqe = mStash[mStashHead];
+        mStashHead = (mStashHead + 1) % mCqEntries;
+        --mStashCount;
+        return true;
+    }
+
+    head = *mCqHead;
+    tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        io_uring_cqe *next = &mCqes[head & mCqMask];
+
+        ++head;
+        if (next->user_data == IOURING_TAG_RECV) {
+            *cqe = *next;
+            __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        completeSend(next);
+    }
+
+    __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+
+    return false;
+}
+
+/**
+ * @brief Submits and waits until send slots complete. Receive
+ *        completions drained on the way are stashed for recv().
+ * @param wanted free slots to wait for, IOURING_SEND_SLOTS waits
+ *        for every queued send
+ * @return true if that many slots are free
+ */
+bool IoUringTransport::waitForSendSlots(U32 wanted)
+{
+    while (mFreeSlotCount < wanted) {
+        U32 head;
+        U32 tail;
+
+        if (submit(1) < 0) {
+            return false;
+        }
+
+        head = *mCqHead;
+        tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            io_uring_cqe *next = &mCqes[head & mCqMask];
+
+            if (next->user_data == IOURING_TAG_RECV) {
+                if (mStashCount >= mCqEntries) {
+                    break;
+                }
+                mStash[(mStashHead + mStashCount) % mCqEntries] = *next;
+                ++mStashCount;
+            } else {
+                completeSend(next);
+            }
+            ++head;
+        }
+
+        __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+
+        if ((mFreeSlotCount < wanted) && (head != tail)) {
+            // stash is full, give up rather than drop receives
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void IoUringTransport::completeSend(io_uring_cqe *cqe)
+{
+    if (cqe->res < 0) {
+        mErrno = -cqe->res;
+        if ((cqe->res == -EAGAIN) || (cqe->res == -ENOBUFS)) {
+            ++mSocket.mTxBusy;
+        }
+    }
+
+    mFreeSlots[mFreeSlotCount++] = (U16)(cqe->user_data & 0xFFFF);
+}
+
+/**
+ * @brief Hands a receive buffer back to the kernel
+ */
+void IoUringTransport::recycleBuffer(U16 bufferId)
+{
+    // index by hand, C++ builds of the uapi header pad bufs[] past
+    // the start of the ring
+    io_uring_buf *buf = &((io_uring_buf*)mBufRing)[mBufTail & (IOURING_RECV_BUFFERS - 1)];
+
+    buf->addr = (U64)(size_t)&mBuffers[(U32)bufferId * IOURING_BUFFER_SIZE];
+    buf->len = IOURING_BUFFER_SIZE;
+    buf->bid = bufferId;
+
+    ++mBufTail;
+    __atomic_store_n(&mBufRing->tail, mBufTail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Takes back the buffer lent to a packet, if any, and points
+ *        the packet at its own data again
+ */
+void IoUringTransport::returnPacketBuffer(NetPacket *pkt)
+{
+    if (pkt->bufferId >= 0) {
+        if (mBufRing) {
+            recycleBuffer((U16)pkt->bufferId);
+        }
+
+        pkt->bufferId = -1;
+        pkt->data = pkt->ownData;
+        pkt->maxlen = pkt->ownMaxlen;
+    }
+}
@@ -0,0 +1,126 @@
+/**
+ * @brief io_uring UDP transport for Linux. Receives with one
+ *        multishot recvmsg into a ring of provided buffers, which
+ *        are lent to packets rather than copied. Sends are queued
+ *        and handed to the kernel in batches by flush(), so neither
+ *        direction costs a syscall per packet under load.
+ *
+ *        Falls back to PosixUdpTransport when the kernel has no
+ *        usable io_uring (needs 6.0+ for multishot recvmsg).
+ */
+
+#ifndef _IOURINGTRANSPORT_H
+#define _IOURINGTRANSPORT_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+#include "posixtransport.h"
+
+// Provided receive buffers, count must be a power of 2
+#ifndef IOURING_RECV_BUFFERS
+#define IOURING_RECV_BUFFERS 512
+#endif
+// Bytes per receive buffer and send slot, including the recvmsg header
+#ifndef IOURING_BUFFER_SIZE
+#define IOURING_BUFFER_SIZE 2048
+#endif
+// Sends in flight before send() has to wait for completions
+#ifndef IOURING_SEND_SLOTS
+#define IOURING_SEND_SLOTS 256
+#endif
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+struct IoUringSendSlot
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in to;
+    U8 *data;
+};
+
+struct IoUringTransport
+{
+    PosixUdpTransport mSocket;  // owns the fd, and the fallback path
+    bool mUring;                // false when running on the fallback
+    int mErrno;
+
+    int mRingFd;
+
+    // submission queue
+    void *mSqRing;
+    U32 mSqRingSize;
+    U32 *mSqHead;
+    U32 *mSqTail;
+    U32 *mSqArray;
+    U32 mSqMask;
+    U32 mSqEntries;
+    U32 mSqLocalTail;           // tail including sqes not yet published
+    U32 mSqPending;             // sqes queued but not yet submitted
+    io_uring_sqe *mSqes;
+    U32 mSqesSize;
+
+    // completion queue
+    void *mCqRing;
+    U32 mCqRingSize;
+    U32 *mCqHead;
+    U32 *mCqTail;
+    U32 mCqMask;
+    U32 mCqEntries;
+    io_uring_cqe *mCqes;
+
+    // receive completions set aside while waiting for a send slot
+    io_uring_cqe *mStash;
+    U32 mStashHead;
+    U32 mStashCount;
+
+    // provided receive buffers
+    io_uring_buf_ring *mBufRing;
+    U8 *mBuffers;
+    U16 mBufTail;
+    struct msghdr mRecvMsg;
+    bool mRecvArmed;
+
+    // send slots
+    IoUringSendSlot *mSendSlots;
+    U8 *mSendData;
+    U16 *mFreeSlots;
+    U32 mFreeSlotCount;
+
+    void clear();
+    bool open(U32 port);
+    void close();
+
+    NetPacket* allocPacket(U32 size);
+    void freePacket(NetPacket *pkt);
+
+    int recv(NetPacket *pkt);
+    bool send(NetPacket *pkt);
+    void flush();
+
+    bool resolveHost(IPaddress *address, const char *host, U32 port);
+    const char* getError();
+    int getFd();
+
+    bool isUring();
+    PosixUdpTransport* getSocket();
+
+    bool setupRing();
+    void teardownRing();
+    io_uring_sqe* getSqe();
+    int submit(U32 waitNr);
+    bool armRecv();
+    bool nextRecvCompletion(io_uring_cqe *cqe);
+    bool waitForSendSlots(U32 wanted);
+    bool sendAfterQueued(NetPacket *pkt);
+    void completeSend(io_uring_cqe *cqe);
+    void recycleBuffer(U16 bufferId);
+    void returnPacketBuffer(NetPacket *pkt);
+};
+
+#endif
@@ -0,0 +1,334 @@
+/**
+ * @brief In-process loopback transport
+ */
+
+#include <string.h>
+#include "looptransport.h"
+#include "util.h"
+
+// 127.0.0.1, every loop endpoint appears to live on the local host
+#define LOOP_HOST 0x7F000001
+
+LoopHub gLoopHub;
+
+
+/**
+ * @brief Resets the simulated network
+ * @param latencyNs one way delivery time
+ * @param queueLimit datagrams queued per endpoint before dropping
+ * @return true if success, otherwise error
+ */
+bool LoopHub::init(U64 latencyNs, U32 queueLimit)
+{
+    memset(mPorts, 0, sizeof(mPorts));
+    mFree = NULL;
+    mChunks = NULL;
+    mNextEphemeral = LOOP_EPHEMERAL_BASE;
+
+    mLatencyNs = latencyNs;
+    mQueueLimit = queueLimit;
+
+    mSent = 0;
+    mDelivered = 0;
+    mDropped = 0;
+
+    return true;
+}
+
+void LoopHub::shutdown()
+{
+    for (U32 port=0; port<LOOP_PORT_COUNT; ++port) {
+        if (mPorts[port]) {
+            unbind(port);
+        }
+    }
+
+    while (mChunks) {
+        LoopChunk *next = mChunks->next;
+
+        delete mChunks;
+        mChunks = next;
+    }
+    mFree = NULL;
+}
+
+/**
+ * @brief Claims a port
+ * @param port in/out, 0 picks the next free ephemeral port
+ * @return NULL if the port is taken, otherwise the endpoint
+ */
+LoopEndpoint* LoopHub::bind(U32 *port)
+{
+    LoopEndpoint *endpoint;
+
+    if (*port == 0) {
+        for (U32 i=LOOP_EPHEMERAL_BASE; i<LOOP_PORT_COUNT; ++i) {
+            U32 candidate = mNextEphemeral++;
+
+            if (mNextEphemeral >= LOOP_PORT_COUNT) {
+                mNextEphemeral = LOOP_EPHEMERAL_BASE;
+            }
+
+            if (mPorts[candidate] == NULL) {
+                *port = candidate;
+                break;
+            }
+        }
+
+        if (*port == 0) {
+            return NULL;
+        }
+    }
+
+    if ((*port >= LOOP_PORT_COUNT) || mPorts[*port]) {
+        return NULL;
+    }
+
+    endpoint = new LoopEndpoint;
+    endpoint->head = NULL;
+    endpoint->tail = NULL;
+    endpoint->queued = 0;
+
+    mPorts[*port] = endpoint;
+
+    return endpoint;
+}
+
+/**
+ * @brief Releases a port, dropping anything still queued to it
+ */
+void LoopHub::unbind(U32 port)
+{
+    LoopEndpoint *endpoint;
+
+    if ((port >= LOOP_PORT_COUNT) || (mPorts[port] == NULL)) {
+        return;
+    }
+
+    endpoint = mPorts[port];
+    while (endpoint->head) {
+        LoopDatagram *next = endpoint->head->next;
+
+        freeDatagram(endpoint->head);
+        endpoint->head = next;
+    }
+
+    delete endpoint;
+    mPorts[port] = NULL;
+}
+
+/**
+ * @brief Copies the packet into the network, addressed to
+ *        pkt->address
+ * @return true if queued, otherwise dropped
+ */
+bool LoopHub::post(U32 fromPort, NetPacket *pkt)
+{
+    LoopEndpoint *endpoint;
+    LoopDatagram *datagram;
+    U32 toPort = SDLNet_Read16(&pkt->address.port);
+
+    ++mSent;
+
+    endpoint = mPorts[toPort];
+    if ((endpoint == NULL) || (endpoint->queued >= mQueueLimit) ||
+        (pkt->len < 0) || (pkt->len > LOOP_MAX_DATAGRAM)) {
+        ++mDropped;
+        return false;
+    }
+
+    datagram = allocDatagram();
+    if (datagram == NULL) {
+        ++mDropped;
+        return false;
+    }
+
+    datagram->next = NULL;
+    datagram->deliverNs = timeNowNs() + mLatencyNs;
+    SDLNet_Write32(LOOP_HOST, &datagram->from.host);
+    SDLNet_Write16((U16)fromPort, &datagram->from.port);
+    datagram->len = pkt->len;
+    memcpy(datagram->data, pkt->data, pkt->len);
+
+    // latency is the same for everyone, so the queue stays in time order
+    if (endpoint->tail) {
+        endpoint->tail->next = datagram;
+    } else {
+        endpoint->head = datagram;
+    }
+    endpoint->tail = datagram;
+    ++endpoint->queued;
+
+    return true;
+}
+
+/**
+ * @brief Pops the oldest datagram that has arrived by now
+ * @return 1 if pkt holds a datagram, 0 if none
+ */
+int LoopHub::take(LoopEndpoint *endpoint, NetPacket *pkt)
+{
+    LoopDatagram *datagram = endpoint->head;
+
+    if ((datagram == NULL) || (datagram->deliverNs > timeNowNs())) {
+        return 0;
+    }
+
+    endpoint->head = datagram->next;
+    if (endpoint->head == NULL) {
+        endpoint->tail = NULL;
+    }
+    --endpoint->queued;
+
+    // truncate like a real socket would
+    pkt->len = (datagram->len < (U32)pkt->maxlen) ? datagram->len : pkt->maxlen;
+    memcpy(pkt->data, datagram->data, pkt->len);
+    pkt->channel = -1;
+    pkt->status = 0;
+    pkt->address = datagram->from;
+    // when it was due, as the kernel would have stamped it
+    pkt->rxTimestampNs = timeWallNs() - (timeNowNs() - datagram->deliverNs);
+
+    freeDatagram(datagram);
+    ++mDelivered;
+
+    return 1;
+}
+
+U64 LoopHub::inFlight()
+{
+    return mSent - mDelivered - mDropped;
+}
+
+LoopDatagram* LoopHub::allocDatagram()
+{
+    LoopDatagram *datagram;
+
+    if (mFree == NULL) {
+        LoopChunk *chunk = new LoopChunk;
+
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->next = mChunks;
+        mChunks = chunk;
+
+        for (U32 i=0; i<LOOP_CHUNK_DATAGRAMS; ++i) {
+            freeDatagram(&chunk->datagrams[i]);
+        }
+    }
+
+    datagram = mFree;
+    mFree = datagram->next;
+
+    return datagram;
+}
+
+void LoopHub::freeDatagram(LoopDatagram *datagram)
+{
+    datagram->next = mFree;
+    mFree = datagram;
+}
+
+
+void LoopTransport::clear()
+{
+    mHub = &gLoopHub;
+    mEndpoint = NULL;
+    mPort = 0;
+    mError = "";
+}
+
+/**
+ * @brief Binds a loop endpoint
+ * @param port local port, 0 to let the hub pick
+ * @return true if success, otherwise error
+ */
+bool LoopTransport::open(U32 port)
+{
+    mPort = port;
+    mEndpoint = mHub->bind(&mPort);
+    if (mEndpoint == NULL) {
+        mError = "loop port in use";
+        return false;
+    }
+
+    return true;
+}
+
+void LoopTransport::close()
+{
+    if (mEndpoint) {
+        mHub->unbind(mPort);
+        mEndpoint = NULL;
+    }
+}
+
+NetPacket* LoopTransport::allocPacket(U32 size)
+{
+    return allocNetPacket(size);
+}
+
+void LoopTransport::freePacket(NetPacket *pkt)
+{
+    freeNetPacket(pkt);
+}
+
+/**
+ * @return 1 if pkt holds a datagram, 0 if none
+ */
+int LoopTransport::recv(NetPacket *pkt)
+{
+    return mHub->take(mEndpoint, pkt);
+}
+
+/**
+ * @brief Sends the packet to pkt->address. Like UDP, a datagram
+ *        dropped on the way still counts as sent.
+ */
+bool LoopTransport::send(NetPacket *pkt)
+{
+    mHub->post(mPort, pkt);
+
+    return true;
+}
+
+// sends are never queued in the transport itself
+void LoopTransport::flush()
+{
+}
+
+/**
+ * @brief Any host name resolves to the local host
+ */
+bool LoopTransport::resolveHost(IPaddress *address, const char *host, U32 port)
+{
+    SDLNet_Write32(host ? LOOP_HOST : 0, &address->host);
+    SDLNet_Write16((U16)port, &address->port);
+
+    return true;
+}
+
+// the hub only delivers to one endpoint per port
+bool LoopTransport::openGroup(IPaddress *group, U32 interfaceHost)
+{
+    mError = "multicast is not supported";
+    return false;
+}
+
+const char* LoopTransport::getError()
+{
+    return mError;
+}
+
+// there is no socket
+int LoopTransport::getFd()
+{
+    return -1;
+}
+
+U32 LoopTransport::getPort()
+{
+    return mPort;
+}
@@ -0,0 +1,113 @@
+/**
+ * @brief In-process loopback transport. Datagrams move between
+ *        transports in the same process through a LoopHub, with no
+ *        kernel involved. Delivery time comes from timeNowNs(), so
+ *        with USE_VIRTUAL_CLOCK a run is fully deterministic.
+ *
+ *        Endpoints are addressed by port only, the host part of an
+ *        address is ignored.
+ */
+
+#ifndef _LOOPTRANSPORT_H
+#define _LOOPTRANSPORT_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+
+#ifndef LOOP_MAX_DATAGRAM
+#define LOOP_MAX_DATAGRAM 2048
+#endif
+// Datagrams queued at one endpoint before further ones are dropped,
+// the loop equivalent of SO_RCVBUF
+#ifndef LOOP_QUEUE_LIMIT
+#define LOOP_QUEUE_LIMIT 4096
+#endif
+#define LOOP_PORT_COUNT 65536
+#define LOOP_EPHEMERAL_BASE 32768
+#define LOOP_CHUNK_DATAGRAMS 256
+
+struct LoopDatagram
+{
+    LoopDatagram *next;
+    U64 deliverNs;
+    IPaddress from;
+    U32 len;
+    U8 data[LOOP_MAX_DATAGRAM];
+};
+
+struct LoopEndpoint
+{
+    LoopDatagram *head;
+    LoopDatagram *tail;
+    U32 queued;
+};
+
+struct LoopChunk
+{
+    LoopChunk *next;
+    LoopDatagram datagrams[LOOP_CHUNK_DATAGRAMS];
+};
+
+/**
+ * @brief The simulated network. Every datagram takes mLatencyNs to
+ *        arrive and endpoints deliver in send order.
+ */
+struct LoopHub
+{
+    LoopEndpoint *mPorts[LOOP_PORT_COUNT];
+    LoopDatagram *mFree;
+    LoopChunk *mChunks;
+    U32 mNextEphemeral;
+
+    U64 mLatencyNs;
+    U32 mQueueLimit;
+
+    U64 mSent;
+    U64 mDelivered;
+    U64 mDropped;           // queue full, or nobody bound to the port
+
+    bool init(U64 latencyNs, U32 queueLimit);
+    void shutdown();
+
+    LoopEndpoint* bind(U32 *port);
+    void unbind(U32 port);
+
+    bool post(U32 fromPort, NetPacket *pkt);
+    int take(LoopEndpoint *endpoint, NetPacket *pkt);
+
+    U64 inFlight();
+
+    LoopDatagram* allocDatagram();
+    void freeDatagram(LoopDatagram *datagram);
+};
+
+extern LoopHub gLoopHub;
+
+struct LoopTransport
+{
+    LoopHub *mHub;
+    LoopEndpoint *mEndpoint;
+    U32 mPort;
+    const char *mError;
+
+    void clear();
+    bool open(U32 port);
+    bool openGroup(IPaddress *group, U32 interfaceHost);
+    void close();
+
+    NetPacket* allocPacket(U32 size);
+    void freePacket(NetPacket *pkt);
+
+    int recv(NetPacket *pkt);
+    bool send(NetPacket *pkt);
+    void flush();
+
+    bool resolveHost(IPaddress *address, const char *host, U32 port);
+    const char* getError();
+    int getFd();
+
+    U32 getPort();
+};
+
+#endif
@@ -0,0 +1,342 @@
+/**
+ * @brief Messenger wire format, shared by the client and the
+ *        server. Generated by tools/msggen/msggen.py from
+ *        common/messenger.schema, do not edit.
+ *
+ *        For each message TYPE_X with a body MsgrX:
+ *          MSGR_X_FRAME_SIZE   header plus body
+ *          EncodeX()           writes the header, returns the body
+ *                              to fill in place
+ *          IsValidX()          type and length are right and the
+ *                              frame fits in what is left
+ *          DecodeX()           the body in place, NULL unless valid
+ */
+
+#ifndef _MESSENGER_H
+#define _MESSENGER_H
+
+#include <stddef.h>
+#include "types.h"
+
+enum {
+    TC_MAX_NAME_SIZE = 8,
+    TC_MAX_TEXT_SIZE = 128,
+    TC_COOKIE_SIZE = 12
+};
+
+// Clients are addressed by handle as TO_ADDRESS_HANDLE_BASE + handle
+enum {
+    TO_ADDRESS_SERVER = 0,
+    TO_ADDRESS_BROADCAST = 1,
+    TO_ADDRESS_HANDLE_BASE = 2
+};
+
+struct MsgrHdr
+{
+    U32 to;
+    U32 from;
+    U32 seq;
+    U32 type;
+    U32 length;
+};
+
+enum {
+    // No ACKs right now
+    TYPE_ACK = 1,
+    TYPE_JOIN = 2,
+    TYPE_LEAVE = 3,
+    TYPE_TEXT = 4,
+    TYPE_DIRECT = 5,
+    TYPE_COOKIE = 6,
+    TYPE_GROUP = 7,
+    TYPE_BUSY = 8
+};
+
+// A JOIN is only accepted with a cookie the server issued to the
+// sender's address, send zeros to be given one
+struct MsgrJoin
+{
+    char name[TC_MAX_NAME_SIZE];
+    U8 cookie[TC_COOKIE_SIZE];
+};
+
+struct MsgrLeave
+{
+    char name[TC_MAX_NAME_SIZE];
+};
+
+// sentSec/sentNsec is when the author sent it, wall clock, and is
+// passed on unchanged by the server. Zero if the sender didn't say.
+struct MsgrText
+{
+    char name[TC_MAX_NAME_SIZE];
+    char data[TC_MAX_TEXT_SIZE];
+    U32 sentSec;
+    U32 sentNsec;
+};
+
+// Text sent to a single client looked up by name. The server passes
+// it on as a DIRECT to that client, name is then the sender's.
+struct MsgrDirect
+{
+    char name[TC_MAX_NAME_SIZE];
+    char to[TC_MAX_NAME_SIZE];
+    char data[TC_MAX_TEXT_SIZE];
+};
+
+// Server to an address that has to prove it's real, echo cookie
+// back in a JOIN, it is opaque to the client
+struct MsgrCookie
+{
+    U8 cookie[TC_COOKIE_SIZE];
+};
+
+// Server to a joined client: the multicast group its broadcasts can
+// come from, host and port in network order. The client joins the
+// group and sends a GROUP back. The server answers with a GROUP to
+// that client's handle sent to the group. When that one is echoed as
+// well, the server sends broadcasts to the client through the group
+// and confirms with a last GROUP. Group frames are numbered on their
+// own from seq + 1 in the confirming GROUP.
+struct MsgrGroup
+{
+    U32 host;
+    U16 port;
+    U16 reserved;
+    U32 seq;
+};
+
+// Server to an address whose JOIN it turned away while overloaded,
+// send the JOIN again after retryMs
+struct MsgrBusy
+{
+    U32 retryMs;
+};
+
+// A datagram from the server may carry several frames back to back,
+// each one a MsgrHdr followed by hdr.length bytes.
+struct MessengerPacket
+{
+    MsgrHdr hdr;
+    union {
+        MsgrJoin join;
+        MsgrLeave leave;
+        MsgrText text;
+        MsgrDirect direct;
+        MsgrCookie cookie;
+        MsgrGroup group;
+        MsgrBusy busy;
+    };
+};
+
+// TYPE_ACK
+enum {
+    MSGR_ACK_FRAME_SIZE = sizeof(MsgrHdr)
+};
+
+inline void EncodeAck(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_ACK;
+    mpkt->hdr.length = 0;
+}
+
+inline bool IsValidAck(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_ACK) &&
+           (hdr->length == 0) &&
+           (available >= MSGR_ACK_FRAME_SIZE);
+}
+
+// TYPE_JOIN
+enum {
+    MSGR_JOIN_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrJoin)
+};
+
+inline MsgrJoin* EncodeJoin(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_JOIN;
+    mpkt->hdr.length = sizeof(MsgrJoin);
+    return &mpkt->join;
+}
+
+inline bool IsValidJoin(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_JOIN) &&
+           (hdr->length == sizeof(MsgrJoin)) &&
+           (available >= MSGR_JOIN_FRAME_SIZE);
+}
+
+inline MsgrJoin* DecodeJoin(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidJoin(&mpkt->hdr, available) ? &mpkt->join : NULL;
+}
+
+// TYPE_LEAVE
+enum {
+    MSGR_LEAVE_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrLeave)
+};
+
+inline MsgrLeave* EncodeLeave(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_LEAVE;
+    mpkt->hdr.length = sizeof(MsgrLeave);
+    return &mpkt->leave;
+}
+
+inline bool IsValidLeave(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_LEAVE) &&
+           (hdr->length == sizeof(MsgrLeave)) &&
+           (available >= MSGR_LEAVE_FRAME_SIZE);
+}
+
+inline MsgrLeave* DecodeLeave(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidLeave(&mpkt->hdr, available) ? &mpkt->leave : NULL;
+}
+
+// TYPE_TEXT
+enum {
+    MSGR_TEXT_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrText)
+};
+
+inline MsgrText* EncodeText(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_TEXT;
+    mpkt->hdr.length = sizeof(MsgrText);
+    return &mpkt->text;
+}
+
+inline bool IsValidText(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_TEXT) &&
+           (hdr->length == sizeof(MsgrText)) &&
+           (available >= MSGR_TEXT_FRAME_SIZE);
+}
+
+inline MsgrText* DecodeText(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidText(&mpkt->hdr, available) ? &mpkt->text : NULL;
+}
+
+// TYPE_DIRECT
+enum {
+    MSGR_DIRECT_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrDirect)
+};
+
+inline MsgrDirect* EncodeDirect(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_DIRECT;
+    mpkt->hdr.length = sizeof(MsgrDirect);
+    return &mpkt->direct;
+}
+
+inline bool IsValidDirect(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_DIRECT) &&
+           (hdr->length == sizeof(MsgrDirect)) &&
+           (available >= MSGR_DIRECT_FRAME_SIZE);
+}
+
+inline MsgrDirect* DecodeDirect(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidDirect(&mpkt->hdr, available) ? &mpkt->direct : NULL;
+}
+
+// TYPE_COOKIE
+enum {
+    MSGR_COOKIE_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrCookie)
+};
+
+inline MsgrCookie* EncodeCookie(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_COOKIE;
+    mpkt->hdr.length = sizeof(MsgrCookie);
+    return &mpkt->cookie;
+}
+
+inline bool IsValidCookie(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_COOKIE) &&
+           (hdr->length == sizeof(MsgrCookie)) &&
+           (available >= MSGR_COOKIE_FRAME_SIZE);
+}
+
+inline MsgrCookie* DecodeCookie(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidCookie(&mpkt->hdr, available) ? &mpkt->cookie : NULL;
+}
+
+// TYPE_GROUP
+enum {
+    MSGR_GROUP_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrGroup)
+};
+
+inline MsgrGroup* EncodeGroup(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_GROUP;
+    mpkt->hdr.length = sizeof(MsgrGroup);
+    return &mpkt->group;
+}
+
+inline bool IsValidGroup(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_GROUP) &&
+           (hdr->length == sizeof(MsgrGroup)) &&
+           (available >= MSGR_GROUP_FRAME_SIZE);
+}
+
+inline MsgrGroup* DecodeGroup(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidGroup(&mpkt->hdr, available) ? &mpkt->group : NULL;
+}
+
+// TYPE_BUSY
+enum {
+    MSGR_BUSY_FRAME_SIZE = sizeof(MsgrHdr) + sizeof(MsgrBusy)
+};
+
+inline MsgrBusy* EncodeBusy(MessengerPacket *mpkt, U32 to, U32 from, U32 seq)
+{
+    mpkt->hdr.to = to;
+    mpkt->hdr.from = from;
+    mpkt->hdr.seq = seq;
+    mpkt->hdr.type = TYPE_BUSY;
+    mpkt->hdr.length = sizeof(MsgrBusy);
+    return &mpkt->busy;
+}
+
+inline bool IsValidBusy(const MsgrHdr *hdr, U32 available)
+{
+    return (hdr->type == TYPE_BUSY) &&
+           (hdr->length == sizeof(MsgrBusy)) &&
+           (available >= MSGR_BUSY_FRAME_SIZE);
+}
+
+inline MsgrBusy* DecodeBusy(MessengerPacket *mpkt, U32 available)
+{
+    return IsValidBusy(&mpkt->hdr, available) ? &mpkt->busy : NULL;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * @brief Datagram buffer shared by every socket transport
+ */
+
+#ifndef _NETPACKET_H
+#define _NETPACKET_H
+
+#include <stddef.h>
+#include "types.h"
+#include "SDL_net.h"
+
+/**
+ * @brief Same leading fields as SDL_net's UDPpacket, so code written
+ *        against UDPpacket works unchanged. The data buffer is
+ *        allocated in the same block as the packet.
+ *
+ *        A transport may point data at one of its own receive
+ *        buffers instead of copying into ownData. The buffer is
+ *        lent until the next recv or freePacket with this packet.
+ */
+struct NetPacket
+{
+    int channel;
+    U8 *data;
+    int len;
+    int maxlen;
+    int status;
+    IPaddress address;  // Host and Port are in network order
+    U64 rxTimestampNs;  // wall clock when it arrived, from the kernel
+                        // where the transport can get it, 0 if unknown
+
+    int bufferId;       // lent transport buffer, -1 if data is ownData
+    U8 *ownData;
+    int ownMaxlen;
+};
+
+/**
+ * @brief Allocates a packet and its data in one block
+ * @param size max bytes the packet can hold
+ * @return NULL if error, otherwise pointer to valid packet
+ */
+inline NetPacket* allocNetPacket(U32 size)
+{
+    U8 *block = new U8[sizeof(NetPacket) + size];
+    NetPacket *pkt = (NetPacket*)block;
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    pkt->channel = -1;
+    pkt->data = &block[sizeof(NetPacket)];
+    pkt->len = 0;
+    pkt->maxlen = size;
+    pkt->status = 0;
+    pkt->address.host = 0;
+    pkt->address.port = 0;
+    pkt->rxTimestampNs = 0;
+    pkt->bufferId = -1;
+    pkt->ownData = pkt->data;
+    pkt->ownMaxlen = size;
+
+    return pkt;
+}
+
+inline void freeNetPacket(NetPacket *pkt)
+{
+    if (pkt) {
+        delete [] (U8*)pkt;
+    }
+}
+
+#endif
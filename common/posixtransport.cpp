@@ -0,0 +1,394 @@
+/**
+ * @brief Native BSD socket UDP transport
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "posixtransport.h"
+#include "util.h"
+
+// room for the SO_RXQ_OVFL count and the SO_TIMESTAMPNS stamp
+#define POSIX_CONTROL_SIZE 64
+
+void PosixUdpTransport::clear()
+{
+    mFd = -1;
+    mErrno = 0;
+    mDropCounter = false;
+    mRxDrops = 0;
+    mTxBusy = 0;
+    mRxTimestamps = false;
+}
+
+/**
+ * @brief Opens a non-blocking UDP socket bound to all interfaces
+ * @param port local port, 0 to let the system pick
+ * @return true if success, otherwise error
+ */
+bool PosixUdpTransport::open(U32 port)
+{
+    return openAt(htonl(INADDR_ANY), port, false);
+}
+
+/**
+ * @brief Opens a non-blocking socket that receives a multicast group.
+ *        It is bound to the group's port with the address shared, so
+ *        every receiver on the host gets each datagram.
+ * @param group group address and port, network order
+ * @param interfaceHost address of the interface to join on, network
+ *        order, INADDR_ANY lets the system pick
+ * @return true if success, otherwise error
+ */
+bool PosixUdpTransport::openGroup(IPaddress *group, U32 interfaceHost)
+{
+    struct ip_mreq membership;
+
+    if (!openAt(group->host, ntohs(group->port), true)) {
+        return false;
+    }
+
+    memset(&membership, 0, sizeof(membership));
+    membership.imr_multiaddr.s_addr = group->host;
+    membership.imr_interface.s_addr = interfaceHost;
+
+    if (setsockopt(mFd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                   &membership, sizeof(membership)) < 0) {
+        mErrno = errno;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sends multicast datagrams out of one interface
+ * @param interfaceHost address of the interface, network order
+ * @param ttl hops, 1 keeps them on the local segment
+ * @return true if success, otherwise error
+ */
+bool PosixUdpTransport::setMulticastInterface(U32 interfaceHost, U32 ttl)
+{
+    struct in_addr local;
+
+    local.s_addr = interfaceHost;
+    if (setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local)) < 0) {
+        mErrno = errno;
+        return false;
+    }
+
+    return setOption(IPPROTO_IP, IP_MULTICAST_TTL, (int)ttl);
+}
+
+/**
+ * @param host local address, network order
+ * @param port local port in host order
+ * @param shared let other sockets bind the same address and port
+ */
+bool PosixUdpTransport::openAt(U32 host, U32 port, bool shared)
+{
+    struct sockaddr_in local;
+    int flags;
+    int on = 1;
+
+    mErrno = 0;
+
+    mFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (mFd < 0) {
+        mErrno = errno;
+        return false;
+    }
+
+    flags = fcntl(mFd, F_GETFL, 0);
+    if ((flags < 0) || (fcntl(mFd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+        mErrno = errno;
+        close();
+        return false;
+    }
+
+    fcntl(mFd, F_SETFD, FD_CLOEXEC);
+
+    if (shared &&
+        (setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)) {
+        mErrno = errno;
+        close();
+        return false;
+    }
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = host;
+    local.sin_port = htons((U16)port);
+
+    if (bind(mFd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        mErrno = errno;
+        close();
+        return false;
+    }
+
+    mRxDrops = 0;
+    mTxBusy = 0;
+#ifdef SO_RXQ_OVFL
+    // without it drops just aren't counted
+    mDropCounter = (setsockopt(mFd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0);
+#else
+    mDropCounter = false;
+#endif
+#ifdef SO_TIMESTAMPNS
+    mRxTimestamps = (setsockopt(mFd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0);
+#else
+    mRxTimestamps = false;
+#endif
+
+    return true;
+}
+
+void PosixUdpTransport::close()
+{
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+NetPacket* PosixUdpTransport::allocPacket(U32 size)
+{
+    return allocNetPacket(size);
+}
+
+void PosixUdpTransport::freePacket(NetPacket *pkt)
+{
+    freeNetPacket(pkt);
+}
+
+/**
+ * @brief Receives one datagram if one is waiting
+ * @return 1 if pkt holds a datagram, 0 if none, -1 if error
+ */
+int PosixUdpTransport::recv(NetPacket *pkt)
+{
+    struct sockaddr_in from;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        U8 data[POSIX_CONTROL_SIZE];
+    } control;
+    ssize_t len;
+
+    iov.iov_base = pkt->data;
+    iov.iov_len = pkt->maxlen;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (mDropCounter || mRxTimestamps) {
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+    }
+
+    len = recvmsg(mFd, &msg, 0);
+    if (len < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+            return 0;
+        }
+        mErrno = errno;
+        return -1;
+    }
+
+    pkt->rxTimestampNs = 0;
+    if (msg.msg_controllen > 0) {
+        readControl(&msg, pkt);
+    }
+    if (pkt->rxTimestampNs == 0) {
+        pkt->rxTimestampNs = timeWallNs();
+    }
+
+    pkt->channel = -1;
+    pkt->len = (int)len;
+    pkt->status = 0;
+
+    // Host and Port are in network order
+    pkt->address.host = from.sin_addr.s_addr;
+    pkt->address.port = from.sin_port;
+
+    return 1;
+}
+
+/**
+ * @brief Takes the socket's drop count and the kernel receive stamp
+ *        from a received datagram's control messages. The kernel only
+ *        adds the drop count once there are drops to report.
+ */
+void PosixUdpTransport::readControl(struct msghdr *msg, NetPacket *pkt)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+#ifdef SO_RXQ_OVFL
+        if ((cmsg->cmsg_type == SO_RXQ_OVFL) &&
+            (cmsg->cmsg_len >= CMSG_LEN(sizeof(U32)))) {
+            memcpy(&mRxDrops, CMSG_DATA(cmsg), sizeof(U32));
+        }
+#endif
+#ifdef SCM_TIMESTAMPNS
+        if ((cmsg->cmsg_type == SCM_TIMESTAMPNS) &&
+            (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timespec)))) {
+            struct timespec ts;
+
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            pkt->rxTimestampNs = ((U64)ts.tv_sec * 1000000000ULL) + (U64)ts.tv_nsec;
+        }
+#endif
+    }
+}
+
+/**
+ * @return datagrams the kernel dropped for a full receive buffer,
+ *         as of the last one received
+ */
+U32 PosixUdpTransport::getRxDrops()
+{
+    return mRxDrops;
+}
+
+U64 PosixUdpTransport::getTxBusy()
+{
+    return mTxBusy;
+}
+
+/**
+ * @brief Sends the packet to pkt->address
+ * @return true if success, otherwise error
+ */
+bool PosixUdpTransport::send(NetPacket *pkt)
+{
+    struct sockaddr_in to;
+    ssize_t len;
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = pkt->address.host;
+    to.sin_port = pkt->address.port;
+
+    len = sendto(mFd, pkt->data, pkt->len, 0,
+                 (struct sockaddr*)&to, sizeof(to));
+    if (len < 0) {
+        mErrno = errno;
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) {
+            ++mTxBusy;
+        }
+        return false;
+    }
+
+    return len == pkt->len;
+}
+
+// sends are never queued
+void PosixUdpTransport::flush()
+{
+}
+
+/**
+ * @brief Resolves a host name or dotted quad, like SDLNet_ResolveHost
+ * @param host NULL for INADDR_ANY
+ * @param port in host order
+ * @return true if success, otherwise error
+ */
+bool PosixUdpTransport::resolveHost(IPaddress *address, const char *host, U32 port)
+{
+    address->port = htons((U16)port);
+
+    if (host == NULL) {
+        address->host = htonl(INADDR_ANY);
+        return true;
+    }
+
+    struct in_addr addr;
+    if (inet_pton(AF_INET, host, &addr) == 1) {
+        address->host = addr.s_addr;
+        return true;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if ((getaddrinfo(host, NULL, &hints, &result) != 0) || (result == NULL)) {
+        mErrno = EHOSTUNREACH;
+        address->host = INADDR_NONE;
+        return false;
+    }
+
+    address->host = ((struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(result);
+
+    return true;
+}
+
+const char* PosixUdpTransport::getError()
+{
+    return strerror(mErrno);
+}
+
+int PosixUdpTransport::getFd()
+{
+    return mFd;
+}
+
+bool PosixUdpTransport::setOption(int level, int name, int value)
+{
+    if (setsockopt(mFd, level, name, &value, sizeof(value)) < 0) {
+        mErrno = errno;
+        return false;
+    }
+
+    return true;
+}
+
+bool PosixUdpTransport::setRecvBufferSize(U32 bytes)
+{
+    return setOption(SOL_SOCKET, SO_RCVBUF, (int)bytes);
+}
+
+bool PosixUdpTransport::setSendBufferSize(U32 bytes)
+{
+    return setOption(SOL_SOCKET, SO_SNDBUF, (int)bytes);
+}
+
+// Linux reports twice the requested size, the kernel keeps half
+// for bookkeeping
+U32 PosixUdpTransport::getRecvBufferSize()
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+
+    getsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &value, &len);
+
+    return (U32)value;
+}
+
+U32 PosixUdpTransport::getSendBufferSize()
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+
+    getsockopt(mFd, SOL_SOCKET, SO_SNDBUF, &value, &len);
+
+    return (U32)value;
+}
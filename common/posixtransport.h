@@ -0,0 +1,61 @@
+/**
+ * @brief Native BSD socket UDP transport for Linux and other POSIX
+ *        systems. Skips the SDL_net layer on the packet path and
+ *        exposes the descriptor so socket options can be tuned.
+ */
+
+#ifndef _POSIXTRANSPORT_H
+#define _POSIXTRANSPORT_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+
+struct msghdr;
+
+struct PosixUdpTransport
+{
+    int mFd;
+    int mErrno;         // errno of the last failed call
+
+    // Where the kernel supports SO_RXQ_OVFL each datagram carries the
+    // number the socket has dropped so far for a full receive buffer
+    bool mDropCounter;
+    U32 mRxDrops;
+    U64 mTxBusy;        // sends refused for a full send buffer
+
+    // SO_TIMESTAMPNS, the kernel stamps each datagram as it arrives.
+    // Without it recv() stamps it when it is picked up.
+    bool mRxTimestamps;
+
+    void clear();
+    bool open(U32 port);
+    bool openGroup(IPaddress *group, U32 interfaceHost);
+    void close();
+
+    NetPacket* allocPacket(U32 size);
+    void freePacket(NetPacket *pkt);
+
+    int recv(NetPacket *pkt);
+    bool send(NetPacket *pkt);
+    void flush();
+
+    bool resolveHost(IPaddress *address, const char *host, U32 port);
+    const char* getError();
+
+    int getFd();
+    bool setOption(int level, int name, int value);
+    bool setRecvBufferSize(U32 bytes);
+    bool setSendBufferSize(U32 bytes);
+    U32 getRecvBufferSize();
+    U32 getSendBufferSize();
+    bool setMulticastInterface(U32 interfaceHost, U32 ttl);
+
+    U32 getRxDrops();
+    U64 getTxBusy();
+    void readControl(struct msghdr *msg, NetPacket *pkt);
+
+    bool openAt(U32 host, U32 port, bool shared);
+};
+
+#endif
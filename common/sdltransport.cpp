@@ -0,0 +1,111 @@
+/**
+ * @brief SDL_net UDP transport
+ */
+
+#include "sdltransport.h"
+#include "util.h"
+
+void SdlNetTransport::clear()
+{
+    mSocket = 0;
+}
+
+/**
+ * @brief Opens the UDP socket
+ * @param port local port, 0 to let the system pick
+ * @return true if success, otherwise error
+ */
+bool SdlNetTransport::open(U32 port)
+{
+    mSocket = SDLNet_UDP_Open(port);
+
+    return mSocket != 0;
+}
+
+void SdlNetTransport::close()
+{
+    if (mSocket) {
+        SDLNet_UDP_Close(mSocket);
+        mSocket = 0;
+    }
+}
+
+NetPacket* SdlNetTransport::allocPacket(U32 size)
+{
+    return allocNetPacket(size);
+}
+
+void SdlNetTransport::freePacket(NetPacket *pkt)
+{
+    freeNetPacket(pkt);
+}
+
+/**
+ * @brief Receives one datagram if one is waiting
+ * @return 1 if pkt holds a datagram, 0 if none, -1 if error
+ */
+int SdlNetTransport::recv(NetPacket *pkt)
+{
+    int numPkts;
+
+    mShell.channel = -1;
+    mShell.data = pkt->data;
+    mShell.len = 0;
+    mShell.maxlen = pkt->maxlen;
+
+    numPkts = SDLNet_UDP_Recv(mSocket, &mShell);
+    if (numPkts > 0) {
+        pkt->channel = mShell.channel;
+        pkt->len = mShell.len;
+        pkt->status = mShell.status;
+        pkt->address = mShell.address;
+        // SDL_net has no kernel stamp, this is when it was picked up
+        pkt->rxTimestampNs = timeWallNs();
+        return 1;
+    }
+
+    return (numPkts < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Sends the packet to pkt->address
+ * @return true if success, otherwise error
+ */
+bool SdlNetTransport::send(NetPacket *pkt)
+{
+    mShell.channel = -1;
+    mShell.data = pkt->data;
+    mShell.len = pkt->len;
+    mShell.maxlen = pkt->maxlen;
+    mShell.address = pkt->address;
+
+    return SDLNet_UDP_Send(mSocket, -1, &mShell) != 0;
+}
+
+// sends are never queued
+void SdlNetTransport::flush()
+{
+}
+
+bool SdlNetTransport::resolveHost(IPaddress *address, const char *host, U32 port)
+{
+    return SDLNet_ResolveHost(address, host, port) != -1;
+}
+
+// SDL_net has no multicast
+bool SdlNetTransport::openGroup(IPaddress *group, U32 interfaceHost)
+{
+    SDLNet_SetError("multicast is not supported");
+    return false;
+}
+
+const char* SdlNetTransport::getError()
+{
+    return SDLNet_GetError();
+}
+
+// SDL_net keeps its descriptor to itself
+int SdlNetTransport::getFd()
+{
+    return -1;
+}
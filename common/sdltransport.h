@@ -0,0 +1,36 @@
+/**
+ * @brief SDL_net UDP transport
+ */
+
+#ifndef _SDLTRANSPORT_H
+#define _SDLTRANSPORT_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "netpacket.h"
+
+struct SdlNetTransport
+{
+    UDPsocket mSocket;
+
+    // describes a NetPacket to SDL_net, data is never copied
+    UDPpacket mShell;
+
+    void clear();
+    bool open(U32 port);
+    bool openGroup(IPaddress *group, U32 interfaceHost);
+    void close();
+
+    NetPacket* allocPacket(U32 size);
+    void freePacket(NetPacket *pkt);
+
+    int recv(NetPacket *pkt);
+    bool send(NetPacket *pkt);
+    void flush();
+
+    bool resolveHost(IPaddress *address, const char *host, U32 port);
+    const char* getError();
+    int getFd();
+};
+
+#endif
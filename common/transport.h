@@ -0,0 +1,50 @@
+/**
+ * @brief Socket transports. A transport is any type providing
+ *
+ *          void clear();                // mark closed, before first open
+ *          bool open(U32 port);         // port in host order, 0 for any
+ *          void close();
+ *          NetPacket* allocPacket(U32 size);
+ *          void freePacket(NetPacket *pkt);
+ *          int recv(NetPacket *pkt);    // 1 received, 0 none, -1 error
+ *          bool send(NetPacket *pkt);   // to pkt->address, may be queued
+ *          void flush();                // hand queued sends to the kernel
+ *          bool resolveHost(IPaddress *address, const char *host, U32 port);
+ *          const char* getError();
+ *          int getFd();                 // socket other threads may send
+ *                                       // on directly, -1 if none
+ *
+ *        Client transports also provide
+ *
+ *          bool openGroup(IPaddress *group, U32 interfaceHost);
+ *                                       // open() on the group's port,
+ *                                       // receiving the multicast group
+ *
+ *        The client and server sockets take the transport as a
+ *        template argument, so calls on the hot path are direct
+ *        and can be inlined rather than going through a vtable.
+ *        ImpairedTransport wraps any of them to simulate a bad
+ *        network.
+ */
+
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+// Values for SERVER_TRANSPORT and CLIENT_TRANSPORT
+#define TRANSPORT_SDLNET 1
+#define TRANSPORT_POSIX  2
+#define TRANSPORT_IOURING 3
+#define TRANSPORT_LOOP   4
+
+#include "netpacket.h"
+#include "sdltransport.h"
+#include "looptransport.h"
+#ifndef _WIN32
+#include "posixtransport.h"
+#endif
+#ifdef __linux__
+#include "iouringtransport.h"
+#endif
+#include "impairedtransport.h"
+
+#endif
@@ -0,0 +1,349 @@
+/**
+ * @brief Server to server link for a federated cluster
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cluster.h"
+#include "metrics.h"
+#include "consoleutil.h"
+#include "util.h"
+
+#define CLUSTER_PAD(n) (((n) + 3) & ~3U)
+// longest "host:port" entry in SERVER_CLUSTER_NODES
+#define CLUSTER_MAX_ENTRY 64
+
+
+/**
+ * @brief Opens the link on this node's port and allocates the batch
+ * @param node index of this node in nodes
+ * @param nodes "host:port" of every node, comma separated
+ * @return true if success, otherwise error
+ */
+bool ClusterLink::init(U32 node, const char *nodes)
+{
+    ClusterHdr *hdr;
+
+    memset(this, 0, sizeof(*this));
+    mTransport.clear();
+
+    if (!parseNodes(nodes)) {
+        return false;
+    }
+
+    if (node >= mNodeCount) {
+        ConsolePrintf("ERROR: Node %d is not in the cluster of %d\n",
+                      node,
+                      mNodeCount);
+        return false;
+    }
+    mNode = node;
+
+    // a restarted node starts its seqs over, peers see the new epoch
+    // and forget what they saw from it before
+#ifdef USE_VIRTUAL_CLOCK
+    mEpoch = node + 1;
+#else
+    mEpoch = ((U32)time(NULL) ^ (U32)timeNowNs()) | 1;
+#endif
+
+    // Port is in network order
+    if (!mTransport.open(SDLNet_Read16(&mPeers[node].address.port))) {
+        ConsolePrintf("ERROR: open(%d): %s\n",
+                      SDLNet_Read16(&mPeers[node].address.port),
+                      mTransport.getError());
+        return false;
+    }
+    mOpen = true;
+
+    mBatch = mTransport.allocPacket(SERVER_CLUSTER_DATAGRAM_SIZE);
+    mRx = mTransport.allocPacket(SERVER_CLUSTER_DATAGRAM_SIZE);
+    if ((mBatch == NULL) || (mRx == NULL)) {
+        ConsolePrintf("ERROR: allocPacket(%d): %s\n",
+                      SERVER_CLUSTER_DATAGRAM_SIZE,
+                      mTransport.getError());
+        shutdown();
+        return false;
+    }
+
+    hdr = (ClusterHdr*)mBatch->data;
+    hdr->magic = CLUSTER_MAGIC;
+    hdr->node = mNode;
+    hdr->epoch = mEpoch;
+    hdr->count = 0;
+    mBatch->len = sizeof(ClusterHdr);
+
+    return true;
+}
+
+/**
+ * @brief Sends what is batched and closes the link
+ */
+void ClusterLink::shutdown()
+{
+    if (mBatch) {
+        sendBatch();
+        mTransport.freePacket(mBatch);
+        mBatch = NULL;
+    }
+
+    if (mRx) {
+        mTransport.freePacket(mRx);
+        mRx = NULL;
+    }
+
+    if (mOpen) {
+        mTransport.close();
+        mOpen = false;
+    }
+}
+
+/**
+ * @brief Fills mPeers from the node list
+ * @return true if success, otherwise error
+ */
+bool ClusterLink::parseNodes(const char *nodes)
+{
+    const char *entry = nodes;
+
+    mNodeCount = 0;
+
+    while (*entry) {
+        char host[CLUSTER_MAX_ENTRY];
+        const char *end = strchr(entry, ',');
+        U32 length = end ? (U32)(end - entry) : (U32)strlen(entry);
+        char *colon;
+
+        if ((length == 0) || (length >= sizeof(host)) ||
+            (mNodeCount >= SERVER_CLUSTER_MAX_NODES)) {
+            ConsolePrintf("ERROR: Bad cluster node list %s\n", nodes);
+            return false;
+        }
+
+        memcpy(host, entry, length);
+        host[length] = '\0';
+
+        colon = strrchr(host, ':');
+        if (colon == NULL) {
+            ConsolePrintf("ERROR: Cluster node %s has no port\n", host);
+            return false;
+        }
+        *colon = '\0';
+
+        if (!mTransport.resolveHost(&mPeers[mNodeCount].address,
+                                    host,
+                                    atoi(colon + 1))) {
+            ConsolePrintf("ERROR: resolveHost(%s): %s\n",
+                          host,
+                          mTransport.getError());
+            return false;
+        }
+        ++mNodeCount;
+
+        entry += length;
+        if (*entry == ',') {
+            ++entry;
+        }
+    }
+
+    return mNodeCount > 0;
+}
+
+/**
+ * @brief Adds a frame to the batch for every other node, sending the
+ *        batch first if the frame doesn't fit
+ * @param frame client frame, header and body
+ * @param flags CLUSTER_RECORD_ bits, passed on with the frame
+ * @return true if success, otherwise the frame can never fit a
+ *         datagram
+ */
+bool ClusterLink::relay(const U8 *frame, U32 length, U32 flags)
+{
+    ClusterRecord *record;
+    U32 size = sizeof(ClusterRecord) + CLUSTER_PAD(length);
+
+    if ((sizeof(ClusterHdr) + size) > (U32)mBatch->maxlen) {
+        return false;
+    }
+
+    if ((mBatch->len + size) > (U32)mBatch->maxlen) {
+        sendBatch();
+    }
+
+    if (mBatchCount == 0) {
+        mBatchSinceNs = timeNowNs();
+    }
+
+    record = (ClusterRecord*)&mBatch->data[mBatch->len];
+    record->seq = ++mTxSeq;
+    record->length = length;
+    record->flags = flags;
+
+    memcpy(&record[1], frame, length);
+    memset((U8*)&record[1] + length, 0, CLUSTER_PAD(length) - length);
+
+    mBatch->len += size;
+    ++mBatchCount;
+    gMetrics.countCluster(CLUSTER_TX_FRAMES, 1);
+
+    return true;
+}
+
+/**
+ * @brief Sends the batch once its oldest frame has waited long enough
+ * @param lingerNs how long is long enough, normally CLUSTER_LINGER_NS
+ * @param force send whatever is batched now
+ * @return true if the batch was sent
+ */
+bool ClusterLink::flush(U64 nowNs, U64 lingerNs, bool force)
+{
+    if ((mBatchCount > 0) &&
+        (force || ((nowNs - mBatchSinceNs) >= lingerNs))) {
+        sendBatch();
+        return true;
+    }
+
+    return false;
+}
+
+void ClusterLink::sendBatch()
+{
+    if (mBatchCount == 0) {
+        return;
+    }
+
+    ((ClusterHdr*)mBatch->data)->count = mBatchCount;
+
+    for (U32 i=0; i<mNodeCount; ++i) {
+        if (i == mNode) {
+            continue;
+        }
+
+        mBatch->address = mPeers[i].address;
+        if (mTransport.send(mBatch)) {
+            gMetrics.countCluster(CLUSTER_TX_DATAGRAMS, 1);
+        } else {
+            gMetrics.countCluster(CLUSTER_TX_ERRORS, 1);
+        }
+    }
+
+    mBatch->len = sizeof(ClusterHdr);
+    mBatchCount = 0;
+}
+
+/**
+ * @brief Next frame relayed by another node, each delivered once
+ * @param length set to the frame length
+ * @param flags set to the CLUSTER_RECORD_ bits it was relayed with
+ * @return NULL if none, otherwise the frame, valid until the next
+ *         call
+ */
+const U8* ClusterLink::next(U32 *length, U32 *flags)
+{
+    for (;;) {
+        ClusterHdr *hdr;
+
+        while (mRxLeft > 0) {
+            ClusterRecord *record = (ClusterRecord*)&mRx->data[mRxOffset];
+            const U8 *frame = (const U8*)&record[1];
+
+            --mRxLeft;
+
+            if (((mRxOffset + sizeof(ClusterRecord)) > (U32)mRx->len) ||
+                ((mRxOffset + sizeof(ClusterRecord) + record->length) > (U32)mRx->len)) {
+                // count is more than the datagram holds
+                gMetrics.countCluster(CLUSTER_RX_REJECTED, 1);
+                mRxLeft = 0;
+                break;
+            }
+            mRxOffset += sizeof(ClusterRecord) + CLUSTER_PAD(record->length);
+
+            if (isDuplicate(mRxPeer, mRxEpoch, record->seq)) {
+                gMetrics.countCluster(CLUSTER_RX_DUPLICATES, 1);
+                continue;
+            }
+
+            gMetrics.countCluster(CLUSTER_RX_FRAMES, 1);
+            *length = record->length;
+            *flags = record->flags;
+            return frame;
+        }
+
+        if (mTransport.recv(mRx) <= 0) {
+            return NULL;
+        }
+
+        hdr = (ClusterHdr*)mRx->data;
+        if ((mRx->len < (int)sizeof(ClusterHdr)) ||
+            (hdr->magic != CLUSTER_MAGIC)) {
+            gMetrics.countCluster(CLUSTER_RX_REJECTED, 1);
+            continue;
+        }
+
+        // only from the listed nodes, each from its own address
+        mRxPeer = findPeer(&mRx->address, hdr->node);
+        if (mRxPeer == NULL) {
+            gMetrics.countCluster(CLUSTER_RX_REJECTED, 1);
+            continue;
+        }
+
+        mRxEpoch = hdr->epoch;
+        mRxOffset = sizeof(ClusterHdr);
+        mRxLeft = hdr->count;
+    }
+}
+
+/**
+ * @return the peer listed as node, if address is its, otherwise NULL
+ */
+ClusterPeer* ClusterLink::findPeer(IPaddress *address, U32 node)
+{
+    ClusterPeer *peer;
+
+    if ((node >= mNodeCount) || (node == mNode)) {
+        return NULL;
+    }
+
+    peer = &mPeers[node];
+    if ((peer->address.host != address->host) ||
+        (peer->address.port != address->port)) {
+        return NULL;
+    }
+
+    return peer;
+}
+
+/**
+ * @brief Records seq as seen from peer
+ * @return true if it was seen before, or is too old to tell
+ */
+bool ClusterLink::isDuplicate(ClusterPeer *peer, U32 epoch, U32 seq)
+{
+    U32 behind;
+
+    if (peer->epoch != epoch) {
+        // first frame from this run of the peer
+        peer->epoch = epoch;
+        peer->highest = seq;
+        peer->seen = 1;
+        return false;
+    }
+
+    if ((S32)(seq - peer->highest) > 0) {
+        U32 ahead = seq - peer->highest;
+
+        peer->seen = (ahead < 64) ? ((peer->seen << ahead) | 1) : 1;
+        peer->highest = seq;
+        return false;
+    }
+
+    behind = peer->highest - seq;
+    if ((behind >= 64) || (peer->seen & (1ULL << behind))) {
+        return true;
+    }
+
+    peer->seen |= 1ULL << behind;
+    return false;
+}
@@ -0,0 +1,101 @@
+/**
+ * @brief Server to server link for a federated cluster. Every node
+ *        keeps its own clients and relays its broadcasts to every
+ *        other node over UDP, the nodes are a static list in
+ *        SERVER_CLUSTER_NODES. Relayed frames are batched, several
+ *        to a datagram, and sent once the oldest has waited
+ *        SERVER_CLUSTER_LINGER_US or the datagram is full.
+ *
+ *        Each node numbers the frames it relays. A receiver keeps,
+ *        per origin, the highest seq seen and a bitmap of the 64 below
+ *        it, so a datagram that arrives twice is delivered once.
+ *        Nothing is resent, a lost datagram is lost.
+ *
+ *        Datagram layout, all fields in host order like the client
+ *        frames:
+ *          ClusterHdr
+ *          ClusterRecord, then length bytes of frame, padded to 4
+ *          ...count records in all
+ */
+
+#ifndef _CLUSTER_H
+#define _CLUSTER_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "servercfg.h"
+#include "transport.h"
+
+#define CLUSTER_MAGIC 0x434C5352     // "CLSR"
+#define CLUSTER_LINGER_NS ((U64)SERVER_CLUSTER_LINGER_US * 1000ULL)
+
+// ClusterRecord::flags
+#define CLUSTER_RECORD_HISTORY 0x0001   // chat, kept for late joiners
+
+struct ClusterHdr
+{
+    U32 magic;
+    U32 node;       // index of the sender in SERVER_CLUSTER_NODES
+    U32 epoch;      // changes when the sender restarts
+    U32 count;      // records that follow
+};
+
+struct ClusterRecord
+{
+    U32 seq;        // numbered by the origin node, from 1
+    U16 length;     // frame bytes that follow
+    U16 flags;
+};
+
+struct ClusterPeer
+{
+    IPaddress address;
+
+    // duplicate filter for frames this peer relays
+    U32 epoch;
+    U32 highest;
+    U64 seen;       // bit n set: highest - n arrived
+};
+
+struct ClusterLink
+{
+    U32 mNode;
+    U32 mNodeCount;
+    U32 mEpoch;
+    ClusterPeer mPeers[SERVER_CLUSTER_MAX_NODES];
+
+    // The link is a plain socket next to the client one
+#if SERVER_TRANSPORT == TRANSPORT_SDLNET
+    SdlNetTransport mTransport;
+#else
+    PosixUdpTransport mTransport;
+#endif
+    bool mOpen;
+
+    // outgoing batch, the same datagram goes to every peer
+    NetPacket *mBatch;
+    U32 mBatchCount;
+    U64 mBatchSinceNs;
+    U32 mTxSeq;
+
+    // datagram being walked by next()
+    NetPacket *mRx;
+    U32 mRxOffset;
+    U32 mRxLeft;
+    U32 mRxEpoch;
+    ClusterPeer *mRxPeer;
+
+    bool init(U32 node, const char *nodes);
+    void shutdown();
+
+    bool relay(const U8 *frame, U32 length, U32 flags);
+    bool flush(U64 nowNs, U64 lingerNs, bool force);
+    const U8* next(U32 *length, U32 *flags);
+
+    bool parseNodes(const char *nodes);
+    ClusterPeer* findPeer(IPaddress *address, U32 node);
+    bool isDuplicate(ClusterPeer *peer, U32 epoch, U32 seq);
+    void sendBatch();
+};
+
+#endif
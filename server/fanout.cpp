@@ -0,0 +1,304 @@
+/**
+ * @brief Parallel broadcast fan-out
+ */
+
+#include "fanout.h"
+
+#if SERVER_FANOUT_THREADS > 0
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "consoleutil.h"
+#include "trace.h"
+
+
+/**
+ * @brief Starts the sender threads
+ * @param fd socket to send on, stays owned by the caller
+ * @param threads most threads besides the caller, which also sends,
+ *        fewer if there aren't the CPUs to run them
+ * @param maxTargets most recipients in one send
+ * @return true if success, otherwise error
+ */
+bool FanoutPool::init(int fd, U32 threads, U32 maxTargets)
+{
+    threads = threadsFor(threads);
+
+    mFd = fd;
+    mThreadCount = threads;
+    mMaxTargets = maxTargets;
+    mGeneration = 0;
+    mRunning = 0;
+    mQuit = false;
+    mFrame = NULL;
+    mLength = 0;
+    mCount = 0;
+    mNextChunk = 0;
+
+    mTargets = new FanoutTarget[maxTargets];
+    mWorkers = new FanoutWorker[threads + 1];
+    if (!mTargets || !mWorkers) {
+        delete [] mTargets;
+        delete [] mWorkers;
+        mTargets = NULL;
+        mWorkers = NULL;
+        return false;
+    }
+
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mStart, NULL);
+    pthread_cond_init(&mDone, NULL);
+
+    for (U32 i=0; i<=threads; ++i) {
+        FanoutWorker *worker = &mWorkers[i];
+
+        memset(worker, 0, sizeof(*worker));
+        worker->pool = this;
+
+        for (U32 n=0; n<FANOUT_BATCH; ++n) {
+            worker->iov[n][0].iov_base = &worker->headers[n];
+            worker->iov[n][0].iov_len = sizeof(MsgrHdr);
+
+            worker->msgs[n].msg_hdr.msg_name = &worker->addresses[n];
+            worker->msgs[n].msg_hdr.msg_namelen = sizeof(worker->addresses[n]);
+            worker->msgs[n].msg_hdr.msg_iov = worker->iov[n];
+            worker->msgs[n].msg_hdr.msg_iovlen = 2;
+
+            worker->addresses[n].sin_family = AF_INET;
+        }
+    }
+
+    for (U32 i=0; i<threads; ++i) {
+        if (pthread_create(&mWorkers[i].thread, NULL, threadMain, &mWorkers[i]) != 0) {
+            ConsolePrintf("ERROR: Unable to start fan-out thread %d\n", i);
+            shutdown();
+            return false;
+        }
+        mWorkers[i].started = true;
+    }
+
+    return true;
+}
+
+/**
+ * @param threads threads wanted besides the caller
+ * @return threads there are CPUs to run next to the caller's, 0 means
+ *         the pool would only add the handoff to every send
+ */
+U32 FanoutPool::threadsFor(U32 threads)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((cpus > 0) && (threads > (U32)(cpus - 1))) {
+        threads = (U32)(cpus - 1);
+    }
+
+    return threads;
+}
+
+void FanoutPool::shutdown()
+{
+    if (mWorkers == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    mQuit = true;
+    pthread_cond_broadcast(&mStart);
+    pthread_mutex_unlock(&mLock);
+
+    for (U32 i=0; i<mThreadCount; ++i) {
+        if (mWorkers[i].started) {
+            pthread_join(mWorkers[i].thread, NULL);
+        }
+    }
+
+    pthread_cond_destroy(&mDone);
+    pthread_cond_destroy(&mStart);
+    pthread_mutex_destroy(&mLock);
+
+    delete [] mWorkers;
+    delete [] mTargets;
+    mWorkers = NULL;
+    mTargets = NULL;
+}
+
+/**
+ * @brief Where the caller lists the recipients of the next send,
+ *        room for maxTargets
+ */
+FanoutTarget* FanoutPool::getTargets()
+{
+    return mTargets;
+}
+
+/**
+ * @brief Sends frame to the first count targets, each with its own
+ *        to and seq patched in to the header. Returns once all of
+ *        them have been handed to the kernel.
+ * @param frame one frame, starting with its MsgrHdr
+ * @param length bytes in frame
+ * @param count targets filled in by the caller
+ * @param stats totals over every thread
+ */
+void FanoutPool::send(const U8 *frame, U32 length, U32 count, FanoutStats *stats)
+{
+    mFrame = frame;
+    mLength = length;
+    mCount = (count < mMaxTargets) ? count : mMaxTargets;
+    __atomic_store_n(&mNextChunk, 0, __ATOMIC_RELAXED);
+
+    for (U32 i=0; i<=mThreadCount; ++i) {
+        memset(&mWorkers[i].stats, 0, sizeof(FanoutStats));
+    }
+
+    // don't wake the threads for less than a chunk each
+    if (mCount > FANOUT_CHUNK) {
+        pthread_mutex_lock(&mLock);
+        mRunning = mThreadCount;
+        ++mGeneration;
+        pthread_cond_broadcast(&mStart);
+        pthread_mutex_unlock(&mLock);
+    }
+
+    work(&mWorkers[mThreadCount]);
+
+    if (mCount > FANOUT_CHUNK) {
+        pthread_mutex_lock(&mLock);
+        while (mRunning > 0) {
+            pthread_cond_wait(&mDone, &mLock);
+        }
+        pthread_mutex_unlock(&mLock);
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (U32 i=0; i<=mThreadCount; ++i) {
+        stats->sent += mWorkers[i].stats.sent;
+        stats->bytes += mWorkers[i].stats.bytes;
+        stats->errors += mWorkers[i].stats.errors;
+        stats->busy += mWorkers[i].stats.busy;
+    }
+}
+
+/**
+ * @brief Takes chunks until none are left
+ */
+void FanoutPool::work(FanoutWorker *worker)
+{
+    U32 chunks = (mCount + FANOUT_CHUNK - 1) / FANOUT_CHUNK;
+
+    for (;;) {
+        U32 chunk = __atomic_fetch_add(&mNextChunk, 1, __ATOMIC_RELAXED);
+        U32 begin = chunk * FANOUT_CHUNK;
+
+        if (chunk >= chunks) {
+            break;
+        }
+
+        sendChunk(worker, begin, (begin + FANOUT_CHUNK < mCount) ? (begin + FANOUT_CHUNK) : mCount);
+    }
+}
+
+void FanoutPool::sendChunk(FanoutWorker *worker, U32 begin, U32 end)
+{
+    const MsgrHdr *hdr = (const MsgrHdr*)mFrame;
+    U32 batched = 0;
+    U64 traceNs = TraceStart();
+
+    for (U32 i=begin; i<end; ++i) {
+        FanoutTarget *target = &mTargets[i];
+
+        worker->headers[batched] = *hdr;
+        worker->headers[batched].to = target->to;
+        worker->headers[batched].seq = target->seq;
+
+        // Host and Port are in network order
+        worker->addresses[batched].sin_addr.s_addr = target->address.host;
+        worker->addresses[batched].sin_port = target->address.port;
+
+        // the body is the same for everyone
+        worker->iov[batched][1].iov_base = (void*)(mFrame + sizeof(MsgrHdr));
+        worker->iov[batched][1].iov_len = mLength - sizeof(MsgrHdr);
+
+        if (++batched == FANOUT_BATCH) {
+            flushBatch(worker, batched);
+            batched = 0;
+        }
+    }
+
+    if (batched > 0) {
+        flushBatch(worker, batched);
+    }
+
+    TraceStop(TRACE_FANOUT, traceNs, end - begin);
+}
+
+/**
+ * @brief Hands a batch to the kernel, waiting a little for buffer
+ *        space if the socket is full
+ */
+void FanoutPool::flushBatch(FanoutWorker *worker, U32 count)
+{
+    U32 done = 0;
+
+    while (done < count) {
+        int sent = sendmmsg(mFd, &worker->msgs[done], count - done, 0);
+
+        if (sent > 0) {
+            worker->stats.sent += sent;
+            worker->stats.bytes += (U64)sent * mLength;
+            done += sent;
+        } else if ((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            struct pollfd pfd;
+
+            ++worker->stats.busy;
+            pfd.fd = mFd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, FANOUT_WAIT_MS) <= 0) {
+                worker->stats.errors += count - done;
+                return;
+            }
+        } else if ((sent < 0) && (errno == EINTR)) {
+            continue;
+        } else {
+            // this datagram failed, carry on with the rest
+            ++worker->stats.errors;
+            ++done;
+        }
+    }
+}
+
+void* FanoutPool::threadMain(void *arg)
+{
+    FanoutWorker *worker = (FanoutWorker*)arg;
+    FanoutPool *pool = worker->pool;
+    U32 seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mLock);
+        while (!pool->mQuit && (pool->mGeneration == seen)) {
+            pthread_cond_wait(&pool->mStart, &pool->mLock);
+        }
+        seen = pool->mGeneration;
+        pthread_mutex_unlock(&pool->mLock);
+
+        if (pool->mQuit) {
+            break;
+        }
+
+        pool->work(worker);
+
+        pthread_mutex_lock(&pool->mLock);
+        if (--pool->mRunning == 0) {
+            pthread_cond_signal(&pool->mDone);
+        }
+        pthread_mutex_unlock(&pool->mLock);
+    }
+
+    return NULL;
+}
+
+#endif
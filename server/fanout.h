@@ -0,0 +1,103 @@
+/**
+ * @brief Parallel broadcast fan-out. Splits a broadcast's recipients
+ *        in to chunks and sends them from a pool of threads, all
+ *        writing to the server socket with sendmmsg. The frame body
+ *        is shared, only the per recipient header (to, seq) is built
+ *        for each send.
+ *
+ *        The caller assigns every sequence number before the send
+ *        starts and send() returns only once every chunk is done,
+ *        so each client still sees its frames in seq order.
+ */
+
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "servercfg.h"
+#include "tcprotocol.h"
+
+// One recipient of a broadcast
+struct FanoutTarget
+{
+    IPaddress address;
+    U32 to;
+    U32 seq;
+};
+
+#if SERVER_FANOUT_THREADS > 0
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Recipients a thread takes at a time
+#define FANOUT_CHUNK 256
+// Datagrams per sendmmsg
+#define FANOUT_BATCH 64
+// How long to wait for room in the socket buffer before giving up
+#define FANOUT_WAIT_MS 20
+
+struct FanoutStats
+{
+    U64 sent;
+    U64 bytes;
+    U64 errors;
+    U64 busy;       // waits for room in the socket buffer
+};
+
+struct FanoutPool;
+
+struct FanoutWorker
+{
+    FanoutPool *pool;
+    pthread_t thread;
+    bool started;
+    FanoutStats stats;
+
+    MsgrHdr headers[FANOUT_BATCH];
+    struct sockaddr_in addresses[FANOUT_BATCH];
+    struct iovec iov[FANOUT_BATCH][2];
+    struct mmsghdr msgs[FANOUT_BATCH];
+};
+
+struct FanoutPool
+{
+    int mFd;
+    U32 mThreadCount;
+    FanoutWorker *mWorkers;     // mThreadCount threads, then the caller
+
+    FanoutTarget *mTargets;
+    U32 mMaxTargets;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mStart;
+    pthread_cond_t mDone;
+    U32 mGeneration;            // bumped for every send
+    U32 mRunning;               // threads still working on it
+    bool mQuit;
+
+    // the send in progress
+    const U8 *mFrame;
+    U32 mLength;
+    U32 mCount;
+    U32 mNextChunk;
+
+    bool init(int fd, U32 threads, U32 maxTargets);
+    void shutdown();
+
+    FanoutTarget* getTargets();
+    void send(const U8 *frame, U32 length, U32 count, FanoutStats *stats);
+
+    void work(FanoutWorker *worker);
+    void sendChunk(FanoutWorker *worker, U32 begin, U32 end);
+    void flushBatch(FanoutWorker *worker, U32 count);
+
+    static U32 threadsFor(U32 threads);
+    static void* threadMain(void *arg);
+};
+
+#endif
+
+#endif
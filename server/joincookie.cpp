@@ -0,0 +1,149 @@
+/**
+ * @brief Stateless join cookies
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "joincookie.h"
+#include "servercfg.h"
+#include "consoleutil.h"
+#include "util.h"
+
+// Cookie layout, only the server reads it:
+//   U32 issued     seconds of timeNowNs()
+//   U64 mac        SipHash of host, port and issued
+#define COOKIE_ISSUED_OFFSET 0
+#define COOKIE_MAC_OFFSET 4
+
+JoinCookies gJoinCookies;
+
+
+/**
+ * @brief Picks the secret. Cookies from an earlier run no longer
+ *        verify, those clients just get a fresh one.
+ */
+void JoinCookies::init()
+{
+#ifdef USE_VIRTUAL_CLOCK
+    // a simulated run has to be repeatable
+    mKey[0] = 0x736F6D6570736575ULL;
+    mKey[1] = 0x646F72616E646F6DULL;
+#else
+    FILE *random = fopen("/dev/urandom", "rb");
+    bool seeded = false;
+
+    if (random) {
+        seeded = (fread(mKey, sizeof(mKey), 1, random) == 1);
+        fclose(random);
+    }
+
+    if (!seeded) {
+        // guessable, but still differs from run to run
+        U64 stack = (U64)(size_t)&seeded;
+
+        ConsolePrintf("ERROR: No random source, join cookies are weak\n");
+        mKey[0] = timeNowNs() ^ ((U64)time(NULL) << 32);
+        mKey[1] = sipHash(mKey, (const U8*)&stack, sizeof(stack));
+    }
+#endif
+}
+
+/**
+ * @brief Writes a cookie for address in to cookie, TC_COOKIE_SIZE bytes
+ */
+void JoinCookies::issue(IPaddress *address, U64 nowNs, U8 *cookie)
+{
+    U32 issued = (U32)(nowNs / 1000000000ULL);
+    U64 tag = mac(address, issued);
+
+    memcpy(&cookie[COOKIE_ISSUED_OFFSET], &issued, sizeof(issued));
+    memcpy(&cookie[COOKIE_MAC_OFFSET], &tag, sizeof(tag));
+}
+
+/**
+ * @return true if cookie was issued to address no more than
+ *         SERVER_COOKIE_LIFETIME_S ago
+ */
+bool JoinCookies::verify(IPaddress *address, U64 nowNs, const U8 *cookie)
+{
+    U32 now = (U32)(nowNs / 1000000000ULL);
+    U32 issued;
+    U64 tag;
+
+    memcpy(&issued, &cookie[COOKIE_ISSUED_OFFSET], sizeof(issued));
+    memcpy(&tag, &cookie[COOKIE_MAC_OFFSET], sizeof(tag));
+
+    if ((issued > now) || ((now - issued) > SERVER_COOKIE_LIFETIME_S)) {
+        return false;
+    }
+
+    return tag == mac(address, issued);
+}
+
+U64 JoinCookies::mac(IPaddress *address, U32 issued)
+{
+    U8 data[10];
+
+    // Host and Port are in network order, hashed as is
+    memcpy(&data[0], &address->host, 4);
+    memcpy(&data[4], &address->port, 2);
+    memcpy(&data[6], &issued, 4);
+
+    return sipHash(mKey, data, sizeof(data));
+}
+
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3)                                   \
+    do {                                                            \
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                  \
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                  \
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+    } while (0)
+
+/**
+ * @brief SipHash-2-4, a keyed hash made for short inputs
+ */
+U64 JoinCookies::sipHash(const U64 key[2], const U8 *data, U32 length)
+{
+    U64 v0 = 0x736F6D6570736575ULL ^ key[0];
+    U64 v1 = 0x646F72616E646F6DULL ^ key[1];
+    U64 v2 = 0x6C7967656E657261ULL ^ key[0];
+    U64 v3 = 0x7465646279746573ULL ^ key[1];
+    U64 m;
+    U32 i;
+
+    for (i=0; (i + 8)<=length; i+=8) {
+        m = 0;
+        for (U32 b=0; b<8; ++b) {
+            m |= (U64)data[i + b] << (8 * b);
+        }
+
+        v3 ^= m;
+        SIP_ROUND(v0, v1, v2, v3);
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    // last block, the leftover bytes and the length
+    m = (U64)length << 56;
+    for (U32 b=0; (i + b)<length; ++b) {
+        m |= (U64)data[i + b] << (8 * b);
+    }
+
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+
+    v2 ^= 0xFF;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
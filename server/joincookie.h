@@ -0,0 +1,34 @@
+/**
+ * @brief Stateless join cookies. A JOIN without a valid cookie only
+ *        gets a COOKIE back, the client has to echo it in a second
+ *        JOIN before a slot is taken. Nothing is kept per sender:
+ *        the cookie is the time it was issued and a SipHash-2-4 MAC,
+ *        under a secret chosen at startup, of that time and the
+ *        source address, so only someone who can receive at the
+ *        address can join from it.
+ */
+
+#ifndef _JOINCOOKIE_H
+#define _JOINCOOKIE_H
+
+#include "types.h"
+#include "SDL_net.h"
+#include "tcprotocol.h"
+
+struct JoinCookies
+{
+    U64 mKey[2];
+
+    void init();
+
+    void issue(IPaddress *address, U64 nowNs, U8 *cookie);
+    bool verify(IPaddress *address, U64 nowNs, const U8 *cookie);
+
+    U64 mac(IPaddress *address, U32 issued);
+
+    static U64 sipHash(const U64 key[2], const U8 *data, U32 length);
+};
+
+extern JoinCookies gJoinCookies;
+
+#endif
@@ -9,13 +9,29 @@
 #include "tcprotocol.h"
 #include "servercfg.h"
 #include "consoleutil.h"
+#include "metrics.h"
+#include "socketmonitor.h"
+#include "trace.h"
+#include "rxscheduler.h"
+#include "overload.h"
 
 
 int main(int argc, char **argv)
 {
     ServerSocket server;
+    RxScheduler scheduler;
     bool quit;
     bool obtainingInput = false;
+    U32 portOffset = 0;
+#if (SERVER_TRANSPORT == TRANSPORT_POSIX) || (SERVER_TRANSPORT == TRANSPORT_IOURING)
+    SocketMonitor monitor;
+#endif
+#ifdef SERVER_CLUSTER_NODES
+    U32 node = 0;
+#endif
+#ifdef SERVER_MULTICAST_GROUP
+    bool multicast = false;
+#endif
 
     // Initialize the console
     if (!ConsoleInit(CLEAR_LINE_ON_ENTER)) {
@@ -31,12 +47,84 @@ int main(int argc, char **argv)
     }
     ConsolePrintf("SDLNet initialized\n");
 
+#ifdef SERVER_IMPAIRMENT
+    gImpairmentDefaults.clear();
+    if (!gImpairmentDefaults.parse(SERVER_IMPAIRMENT)) {
+        ConsolePrintf("ERROR: Bad SERVER_IMPAIRMENT: %s\n", SERVER_IMPAIRMENT);
+        exit(EXIT_FAILURE);
+    }
+    ConsolePrintf("Impairing outgoing datagrams: %s\n", SERVER_IMPAIRMENT);
+#endif
+
+#ifdef SERVER_CLUSTER_NODES
+    // Check for parameters, each node of a cluster gets its own ports
+    if (argc > 1) {
+        node = atoi(argv[1]);
+    }
+    portOffset = node * SERVER_NODE_PORT_STEP;
+#endif
+
     // Initialize server
-    if (!server.init(UDP_SOCKET_PORT, UDP_MAX_PACKET_SIZE, MAX_CLIENTS)) {
+    if (!server.init(UDP_SOCKET_PORT + portOffset, UDP_MAX_PACKET_SIZE, MAX_CLIENTS)) {
         ConsolePrintf("ERROR: Unable to init server\n");
         exit(EXIT_FAILURE);
     }
 
+    // control traffic is handled ahead of chat
+    if (!scheduler.init(&server)) {
+        ConsolePrintf("ERROR: Unable to init receive scheduler\n");
+        exit(EXIT_FAILURE);
+    }
+
+#if (SERVER_TRANSPORT == TRANSPORT_POSIX) || (SERVER_TRANSPORT == TRANSPORT_IOURING)
+    {
+#ifdef SERVER_IMPAIRMENT
+        ServerBaseTransport *transport = server.getTransport()->getInner();
+#else
+        ServerBaseTransport *transport = server.getTransport();
+#endif
+#if SERVER_TRANSPORT == TRANSPORT_IOURING
+        PosixUdpTransport *sock = transport->getSocket();
+
+        ConsolePrintf("io_uring %s\n", transport->isUring() ?
+                      "enabled" : "unavailable, using plain sockets");
+#else
+        PosixUdpTransport *sock = transport;
+#endif
+
+        // Bigger kernel buffers ride out bursts between loop iterations
+        if (SERVER_SOCKET_RCVBUF > 0) {
+            sock->setRecvBufferSize(SERVER_SOCKET_RCVBUF);
+        }
+        if (SERVER_SOCKET_SNDBUF > 0) {
+            sock->setSendBufferSize(SERVER_SOCKET_SNDBUF);
+        }
+        ConsolePrintf("Socket buffers: rcv %u snd %u\n",
+                      sock->getRecvBufferSize(),
+                      sock->getSendBufferSize());
+
+        // drops below the protocol show up in the stats
+#ifdef SERVER_IMPAIRMENT
+        monitor.init(sock, server.getTransport()->getImpairment());
+#else
+        monitor.init(sock, NULL);
+#endif
+
+#ifdef SERVER_MULTICAST_GROUP
+        // Broadcasts to the group leave through this interface
+        IPaddress local;
+        if (sock->resolveHost(&local, SERVER_MULTICAST_INTERFACE, 0) &&
+            sock->setMulticastInterface(local.host, SERVER_MULTICAST_TTL)) {
+            multicast = true;
+        } else {
+            ConsolePrintf("ERROR: Unable to send multicast on %s: %s\n",
+                          SERVER_MULTICAST_INTERFACE,
+                          sock->getError());
+        }
+#endif
+    }
+#endif
+
     // Host and Port are in network order
     IPaddress *srvadd = server.getLocalServerIP();
     ConsolePrintf("Server Started: %d.%d.%d.%d:%d\n",
@@ -53,9 +141,39 @@ int main(int argc, char **argv)
     }
     ConsolePrintf("Ready to receive packets\n");
 
+#ifdef SERVER_MULTICAST_GROUP
+    // Without it every broadcast goes to each client in turn
+    if (multicast && EnableMulticastBroadcast(&server,
+                                              SERVER_MULTICAST_GROUP,
+                                              SERVER_MULTICAST_PORT + portOffset)) {
+        ConsolePrintf("Broadcasting through multicast group %s:%d\n",
+                      SERVER_MULTICAST_GROUP,
+                      SERVER_MULTICAST_PORT + portOffset);
+    }
+#endif
+
+#ifdef SERVER_CLUSTER_NODES
+    if (!JoinCluster(&server, node, SERVER_CLUSTER_NODES)) {
+        ConsolePrintf("ERROR: Unable to join cluster %s as node %d\n",
+                      SERVER_CLUSTER_NODES,
+                      node);
+        exit(EXIT_FAILURE);
+    }
+    ConsolePrintf("Node %d of cluster %s\n", node, SERVER_CLUSTER_NODES);
+#endif
+
+    // Stats are for diagnostics, keep going without them
+    gMetrics.clear();
+    gOverload.init(timeNowNs());
+    if (InitStatsEndpoint(STATS_PORT + portOffset)) {
+        ConsolePrintf("Stats on local UDP port %d\n", STATS_PORT + portOffset);
+    }
+
 	// Main loop
 	quit = false;
 	while (!quit) {
+        U64 loopStartNs = timeNowNs();
+
         // get input
         if (ConsoleHandleInput()) {
             // user is typing something
@@ -75,25 +193,74 @@ int main(int argc, char **argv)
         // get network input
         if (!quit) {
             ServerPacket *pkt;
+            U32 handled = 0;
+
+            // read ahead, then handle a burst by priority
+            scheduler.fill();
 
-            pkt = server.allocPacket();
-            if (pkt) {
-                if (server.receiveData(pkt)) {
-                    // handle data
-                    if (!HandleClientData(&server, pkt)) {
-                        quit = true;
+            while (!quit && (handled < SERVER_RX_BURST) &&
+                   ((pkt = scheduler.next()) != NULL)) {
+                U64 rxNs = timeNowNs();
+                U64 wallNs = timeWallNs();
+                U64 queuedNs = 0;
+
+                // how long it waited, in the socket and queued here
+                if ((pkt->rxTimestampNs != 0) && (wallNs >= pkt->rxTimestampNs)) {
+                    queuedNs = wallNs - pkt->rxTimestampNs;
+                    gMetrics.rxQueueNs.record(queuedNs);
+                    if (RxScheduler::classify(pkt) == RX_CLASS_CONTROL) {
+                        gMetrics.controlQueueNs.record(queuedNs);
                     }
                 }
 
-                // finish with the packet, free it
-                server.freePacket(pkt);
+                if (TraceMessage()) {
+                    TraceRecord(TRACE_RECEIVE, rxNs - queuedNs, rxNs, pkt->len);
+                }
+
+                // handle data
+                if (!HandleClientData(&server, pkt)) {
+                    quit = true;
+                }
+
+                gMetrics.rxToSendNs.record(timeNowNs() - rxNs);
+                TraceDone();
+
+                // finish with the packet, back to the pool
+                scheduler.release(pkt);
+                ++handled;
             }
+
+            // what is left waits for the next iteration
+            gOverload.sample(0, scheduler.depth());
         } // end network
+
+        // periodic protocol work
+        if (!quit) {
+            ServiceMessengerProtocol(&server);
+#if (SERVER_TRANSPORT == TRANSPORT_POSIX) || (SERVER_TRANSPORT == TRANSPORT_IOURING)
+            monitor.service(loopStartNs);
+#endif
+            ServiceStatsEndpoint();
+        }
+
+        // send everything queued this iteration in one go
+        server.flush();
+
+        {
+            U64 loopEndNs = timeNowNs();
+
+            gMetrics.loopNs.record(loopEndNs - loopStartNs);
+            gOverload.sample(loopEndNs - loopStartNs, 0);
+            gOverload.service(loopEndNs);
+        }
 	}
 
     // Clean up and exit
+    ShutdownStatsEndpoint();
     ShutdownMessengerProtocol(&server);
+    scheduler.shutdown();
     server.shutdown();
+    TraceShutdown();
     SDLNet_Quit();
 
     return EXIT_SUCCESS;
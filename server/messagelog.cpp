@@ -0,0 +1,981 @@
+/**
+ * @brief Persistent append-only message log
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "messagelog.h"
+#include "consoleutil.h"
+
+static U32 alignRecord(U32 size);
+static U32 segmentIndexCapacity(U32 segmentSize);
+static U32 segmentDataOffset(U32 segmentSize);
+static U32 recordChecksum(const U8 *data, U32 length);
+static void segmentPath(char *path, const char *dir, U64 baseSeq);
+static void sparePath(char *path, const char *dir);
+static U32 listSegments(const char *dir, U64 **segments);
+static const LogRecordHdr* validRecord(const U8 *base, U32 size, U32 offset, U64 seq);
+static int compareSeq(const void *a, const void *b);
+
+
+/**
+ * @brief Opens the log, continuing after the last valid record of
+ *        the newest segment if one exists, and starts the thread
+ *        that flushes it.
+ * @param dir directory holding the segment files, created if missing
+ * @param segmentSize size of each segment file in bytes
+ * @param syncIntervalMs max time written records stay unflushed
+ * @param keepSegments segments kept, older ones are deleted
+ * @return true if success, otherwise error
+ */
+bool MessageLog::init(const char *dir, U32 segmentSize, U32 syncIntervalMs, U32 keepSegments)
+{
+    U64 *segments = NULL;
+    U32 count;
+    bool retval;
+
+    strncpy(mDir, dir, MSGLOG_MAX_PATH);
+    mDir[MSGLOG_MAX_PATH - 1] = '\0';
+    mSegmentSize = segmentSize;
+    mSyncIntervalMs = syncIntervalMs;
+    mKeepSegments = keepSegments;
+
+    mFd = -1;
+    mBase = NULL;
+    mActiveSize = 0;
+    mIndex = NULL;
+    mNextSeq = 1;
+    mLastSyncMs = 0;
+
+    mThreadStarted = false;
+    mQuit = false;
+    mSyncFd = -1;
+    mSyncWanted = false;
+    mRetiredFd = -1;
+    mRetiredBase = NULL;
+    mRetiredSize = 0;
+    mSpareFd = -1;
+    mSpareBase = NULL;
+    mSpareWanted = true;
+    mPruneWanted = true;
+
+    if ((mkdir(mDir, 0755) < 0) && (errno != EEXIST)) {
+        ConsolePrintf("ERROR: mkdir(%s): %s\n", mDir, strerror(errno));
+        return false;
+    }
+
+    count = listSegments(mDir, &segments);
+    if (count > 0) {
+        retval = recoverSegment(segments[count - 1]);
+    } else {
+        retval = createSegment(1);
+    }
+
+    if (segments) {
+        delete [] segments;
+    }
+
+    if (!retval) {
+        return false;
+    }
+
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mWake, NULL);
+    pthread_cond_init(&mDone, NULL);
+    mSyncFd = mFd;
+
+    if (pthread_create(&mThread, NULL, threadMain, this) != 0) {
+        ConsolePrintf("ERROR: Unable to start message log thread\n");
+        shutdown();
+        return false;
+    }
+    mThreadStarted = true;
+
+    return true;
+}
+
+/**
+ * @brief Flushes everything written, waits for the thread to finish
+ *        and closes the active segment
+ */
+void MessageLog::shutdown()
+{
+    char path[MSGLOG_MAX_PATH + 32];
+
+    sync();
+
+    if (mThreadStarted) {
+        pthread_mutex_lock(&mLock);
+        mQuit = true;
+        pthread_cond_signal(&mWake);
+        pthread_mutex_unlock(&mLock);
+
+        pthread_join(mThread, NULL);
+        mThreadStarted = false;
+    }
+
+    if (mFd >= 0) {
+        fdatasync(mFd);
+    }
+    closeSegment();
+
+    if (mSpareFd >= 0) {
+        munmap(mSpareBase, mSegmentSize);
+        ::close(mSpareFd);
+        mSpareFd = -1;
+        mSpareBase = NULL;
+
+        sparePath(path, mDir);
+        unlink(path);
+    }
+
+    pthread_cond_destroy(&mDone);
+    pthread_cond_destroy(&mWake);
+    pthread_mutex_destroy(&mLock);
+}
+
+/**
+ * @brief Appends a record, rotating to a new segment when full.
+ *        The record is durable after the next sync.
+ * @param data record payload
+ * @param length payload length
+ * @return sequence number of the record, 0 if error
+ */
+U64 MessageLog::append(const U8 *data, U32 length)
+{
+    U32 recordSize = alignRecord(sizeof(LogRecordHdr) + length);
+    LogRecordHdr *rec;
+    U64 relative;
+
+    if (mBase == NULL) {
+        return 0;
+    }
+
+    if (recordSize > (mSegmentSize - segmentDataOffset(mSegmentSize))) {
+        // would never fit
+        return 0;
+    }
+
+    if ((mWriteOffset + recordSize) > mActiveSize) {
+        if (!rotate()) {
+            return 0;
+        }
+    }
+
+    rec = (LogRecordHdr*)&mBase[mWriteOffset];
+    memcpy(&rec[1], data, length);
+    rec->length = length;
+    rec->seq = mNextSeq;
+    rec->checksum = recordChecksum(data, length);
+    rec->reserved = 0;
+    // magic last so a reader never sees a partial record
+    __atomic_store_n(&rec->magic, (U32)LOG_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+    relative = mNextSeq - mSegmentBaseSeq;
+    if ((relative % LOG_INDEX_STRIDE) == 0) {
+        mIndex[relative / LOG_INDEX_STRIDE] = mWriteOffset;
+        mIndexDirty = true;
+    }
+
+    mWriteOffset += recordSize;
+
+    return mNextSeq++;
+}
+
+/**
+ * @brief Syncs written records once the sync interval has passed
+ * @param nowMs current time in milliseconds
+ */
+void MessageLog::service(U64 nowMs)
+{
+    if (mWriteOffset == mSyncedOffset) {
+        // nothing to flush
+        mLastSyncMs = nowMs;
+        return;
+    }
+
+    if ((nowMs - mLastSyncMs) >= mSyncIntervalMs) {
+        sync();
+        mLastSyncMs = nowMs;
+    }
+}
+
+/**
+ * @brief Starts writeback of all records written since the last sync
+ *        and has the thread wait for it, so the caller never blocks
+ *        on the disk.
+ */
+void MessageLog::sync()
+{
+    U32 pageMask = (U32)sysconf(_SC_PAGESIZE) - 1;
+    U32 start;
+
+    if ((mBase == NULL) || (mWriteOffset == mSyncedOffset)) {
+        return;
+    }
+
+    start = mSyncedOffset & ~pageMask;
+    if (msync(&mBase[start], mWriteOffset - start, MS_ASYNC) < 0) {
+        ConsolePrintf("ERROR: msync(%s): %s\n", mDir, strerror(errno));
+    }
+
+    if (mIndexDirty) {
+        LogSegmentHdr *segHdr = (LogSegmentHdr*)mBase;
+
+        msync(mBase, segHdr->dataOffset, MS_ASYNC);
+        mIndexDirty = false;
+    }
+
+    mSyncedOffset = mWriteOffset;
+
+    if (mThreadStarted) {
+        pthread_mutex_lock(&mLock);
+        mSyncWanted = true;
+        pthread_cond_signal(&mWake);
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+/**
+ * @brief Hands the full segment to the thread and continues in the
+ *        spare it prepared, or in a new one if the spare isn't ready
+ * @return true if success, otherwise error
+ */
+bool MessageLog::rotate()
+{
+    int spareFd = -1;
+    U8 *spareBase = NULL;
+    bool retval;
+
+    sync();
+
+    pthread_mutex_lock(&mLock);
+    // only waits if the disk is a whole segment behind
+    while (mRetiredFd >= 0) {
+        pthread_cond_wait(&mDone, &mLock);
+    }
+    mRetiredFd = mFd;
+    mRetiredBase = mBase;
+    mRetiredSize = mActiveSize;
+    mSyncFd = -1;
+
+    if (mSpareFd >= 0) {
+        spareFd = mSpareFd;
+        spareBase = mSpareBase;
+        mSpareFd = -1;
+        mSpareBase = NULL;
+    }
+    pthread_cond_signal(&mWake);
+    pthread_mutex_unlock(&mLock);
+
+    mFd = -1;
+    mBase = NULL;
+    mIndex = NULL;
+
+    if (spareFd >= 0) {
+        retval = adoptSpare(mNextSeq, spareFd, spareBase);
+    } else {
+        retval = createSegment(mNextSeq);
+    }
+
+    pthread_mutex_lock(&mLock);
+    mSyncFd = mFd;
+    mSyncWanted = true;
+    mSpareWanted = true;
+    mPruneWanted = true;
+    pthread_cond_signal(&mWake);
+    pthread_mutex_unlock(&mLock);
+
+    return retval;
+}
+
+/**
+ * @brief Creates, sizes and maps a new empty segment
+ * @param baseSeq sequence number of the first record in the segment
+ * @return true if success, otherwise error
+ */
+bool MessageLog::createSegment(U64 baseSeq)
+{
+    char path[MSGLOG_MAX_PATH + 32];
+
+    segmentPath(path, mDir, baseSeq);
+
+    mFd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFd < 0) {
+        ConsolePrintf("ERROR: open(%s): %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // sized once up front, so syncing data never changes metadata
+    if (ftruncate(mFd, mSegmentSize) < 0) {
+        ConsolePrintf("ERROR: ftruncate(%s): %s\n", path, strerror(errno));
+        closeSegment();
+        return false;
+    }
+
+    mBase = (U8*)mmap(NULL, mSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (mBase == MAP_FAILED) {
+        ConsolePrintf("ERROR: mmap(%s): %s\n", path, strerror(errno));
+        mBase = NULL;
+        closeSegment();
+        return false;
+    }
+    mActiveSize = mSegmentSize;
+
+    startSegment(baseSeq);
+
+    return true;
+}
+
+/**
+ * @brief Makes the spare the active segment. The header is written
+ *        before the rename so a reader never finds it without one.
+ * @param baseSeq sequence number of the first record in the segment
+ * @param fd spare file, owned by the log from here on
+ * @param base spare mapping, mSegmentSize bytes
+ * @return true if success, otherwise error
+ */
+bool MessageLog::adoptSpare(U64 baseSeq, int fd, U8 *base)
+{
+    char path[MSGLOG_MAX_PATH + 32];
+    char spare[MSGLOG_MAX_PATH + 32];
+
+    mFd = fd;
+    mBase = base;
+    mActiveSize = mSegmentSize;
+
+    startSegment(baseSeq);
+
+    segmentPath(path, mDir, baseSeq);
+    sparePath(spare, mDir);
+    if (rename(spare, path) < 0) {
+        ConsolePrintf("ERROR: rename(%s): %s\n", spare, strerror(errno));
+        closeSegment();
+        return createSegment(baseSeq);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes the header of the freshly mapped segment and starts
+ *        appending after its index
+ * @param baseSeq sequence number of the first record in the segment
+ */
+void MessageLog::startSegment(U64 baseSeq)
+{
+    LogSegmentHdr *segHdr = (LogSegmentHdr*)mBase;
+
+    segHdr->magic = LOG_SEGMENT_MAGIC;
+    segHdr->indexStride = LOG_INDEX_STRIDE;
+    segHdr->indexCapacity = segmentIndexCapacity(mSegmentSize);
+    segHdr->dataOffset = segmentDataOffset(mSegmentSize);
+    segHdr->baseSeq = baseSeq;
+
+    mIndex = (U32*)&segHdr[1];
+    mSegmentBaseSeq = baseSeq;
+    mWriteOffset = segHdr->dataOffset;
+    mSyncedOffset = mWriteOffset;
+    // header goes out with the first sync
+    mIndexDirty = true;
+    mNextSeq = baseSeq;
+}
+
+/**
+ * @brief Maps an existing segment and finds the end of its valid
+ *        records. Anything after a torn or corrupt record is discarded.
+ * @param baseSeq sequence number of the first record in the segment
+ * @return true if success, otherwise error
+ */
+bool MessageLog::recoverSegment(U64 baseSeq)
+{
+    char path[MSGLOG_MAX_PATH + 32];
+    LogSegmentHdr *segHdr;
+    const LogRecordHdr *rec;
+    struct stat st;
+    U64 seq;
+
+    segmentPath(path, mDir, baseSeq);
+
+    mFd = ::open(path, O_RDWR);
+    if (mFd < 0) {
+        ConsolePrintf("ERROR: open(%s): %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // the segment keeps the size it was created with even if the
+    // configured size has changed since
+    if ((fstat(mFd, &st) < 0) || ((U32)st.st_size < sizeof(LogSegmentHdr))) {
+        ConsolePrintf("ERROR: Message log segment %s is corrupt\n", path);
+        closeSegment();
+        return false;
+    }
+    mActiveSize = (U32)st.st_size;
+
+    mBase = (U8*)mmap(NULL, mActiveSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (mBase == MAP_FAILED) {
+        ConsolePrintf("ERROR: mmap(%s): %s\n", path, strerror(errno));
+        mBase = NULL;
+        closeSegment();
+        return false;
+    }
+
+    segHdr = (LogSegmentHdr*)mBase;
+    if ((segHdr->magic == LOG_SEGMENT_MAGIC) && (segHdr->baseSeq == 0)) {
+        // a spare renamed just before a crash, its name is the base
+        segHdr->baseSeq = baseSeq;
+    }
+    if ((segHdr->magic != LOG_SEGMENT_MAGIC) || (segHdr->baseSeq != baseSeq)) {
+        ConsolePrintf("ERROR: Message log segment %s is corrupt\n", path);
+        closeSegment();
+        return false;
+    }
+
+    mIndex = (U32*)&segHdr[1];
+    mSegmentBaseSeq = baseSeq;
+    mWriteOffset = segHdr->dataOffset;
+
+    // walk the records to find where writing left off
+    seq = baseSeq;
+    while ((rec = validRecord(mBase, mActiveSize, mWriteOffset, seq)) != NULL) {
+        mWriteOffset += alignRecord(sizeof(LogRecordHdr) + rec->length);
+        ++seq;
+    }
+
+    // drop index entries that point past the recovered end
+    for (U32 k=((seq - baseSeq) + LOG_INDEX_STRIDE - 1) / LOG_INDEX_STRIDE; k<segHdr->indexCapacity; ++k) {
+        mIndex[k] = 0;
+    }
+
+    // clear the start of any torn record so readers stop here
+    if ((mWriteOffset + sizeof(LogRecordHdr)) <= mActiveSize) {
+        memset(&mBase[mWriteOffset], 0, sizeof(LogRecordHdr));
+    }
+
+    mSyncedOffset = mWriteOffset;
+    mIndexDirty = true;
+    mNextSeq = seq;
+
+    return true;
+}
+
+/**
+ * @brief Unmaps and closes the active segment
+ */
+void MessageLog::closeSegment()
+{
+    if (mBase) {
+        munmap(mBase, mActiveSize);
+        mBase = NULL;
+        mIndex = NULL;
+    }
+
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+
+/**
+ * @brief Creates the next segment ahead of time, allocated to its
+ *        full size and with everything but baseSeq in its header,
+ *        so rotating costs the main loop only a rename
+ * @param fd set to the spare file
+ * @param base set to its mapping
+ * @return true if success, otherwise error
+ */
+bool MessageLog::prepareSpare(int *fd, U8 **base)
+{
+    char path[MSGLOG_MAX_PATH + 32];
+    LogSegmentHdr *segHdr;
+    void *mapped;
+    int err;
+
+    sparePath(path, mDir);
+
+    *fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (*fd < 0) {
+        ConsolePrintf("ERROR: open(%s): %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // allocate the blocks now rather than on first write, falling
+    // back to a sparse file where the filesystem can't
+    err = posix_fallocate(*fd, 0, mSegmentSize);
+    if ((err != 0) && (ftruncate(*fd, mSegmentSize) < 0)) {
+        ConsolePrintf("ERROR: ftruncate(%s): %s\n", path, strerror(errno));
+        ::close(*fd);
+        return false;
+    }
+
+    mapped = mmap(NULL, mSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (mapped == MAP_FAILED) {
+        ConsolePrintf("ERROR: mmap(%s): %s\n", path, strerror(errno));
+        ::close(*fd);
+        return false;
+    }
+
+    segHdr = (LogSegmentHdr*)mapped;
+    segHdr->magic = LOG_SEGMENT_MAGIC;
+    segHdr->indexStride = LOG_INDEX_STRIDE;
+    segHdr->indexCapacity = segmentIndexCapacity(mSegmentSize);
+    segHdr->dataOffset = segmentDataOffset(mSegmentSize);
+    segHdr->baseSeq = 0;
+
+    msync(mapped, segHdr->dataOffset, MS_SYNC);
+    fdatasync(*fd);
+
+    *base = (U8*)mapped;
+    return true;
+}
+
+/**
+ * @brief Deletes the oldest segments beyond mKeepSegments
+ */
+void MessageLog::pruneSegments()
+{
+    char path[MSGLOG_MAX_PATH + 32];
+    U64 *segments = NULL;
+    U32 count;
+
+    count = listSegments(mDir, &segments);
+
+    for (U32 i=0; (count - i) > mKeepSegments; ++i) {
+        segmentPath(path, mDir, segments[i]);
+        if (unlink(path) < 0) {
+            ConsolePrintf("ERROR: unlink(%s): %s\n", path, strerror(errno));
+        }
+    }
+
+    if (segments) {
+        delete [] segments;
+    }
+}
+
+/**
+ * @brief Does the work the main loop hands over, everything that
+ *        can wait on the disk. Runs until shutdown and finishes
+ *        whatever is pending before it returns.
+ */
+void* MessageLog::threadMain(void *arg)
+{
+    MessageLog *log = (MessageLog*)arg;
+
+    pthread_mutex_lock(&log->mLock);
+
+    for (;;) {
+        if (log->mRetiredFd >= 0) {
+            int fd = log->mRetiredFd;
+            U8 *base = log->mRetiredBase;
+            U32 size = log->mRetiredSize;
+
+            pthread_mutex_unlock(&log->mLock);
+            fdatasync(fd);
+            munmap(base, size);
+            ::close(fd);
+            pthread_mutex_lock(&log->mLock);
+
+            log->mRetiredFd = -1;
+            pthread_cond_signal(&log->mDone);
+            continue;
+        }
+
+        if (log->mSyncWanted) {
+            int fd = log->mSyncFd;
+
+            log->mSyncWanted = false;
+            if (fd >= 0) {
+                // the fd stays open, rotate() retires it to this thread
+                pthread_mutex_unlock(&log->mLock);
+                fdatasync(fd);
+                pthread_mutex_lock(&log->mLock);
+            }
+            continue;
+        }
+
+        if (log->mSpareWanted && !log->mQuit) {
+            int fd = -1;
+            U8 *base = NULL;
+
+            log->mSpareWanted = false;
+            if (log->mSpareFd < 0) {
+                pthread_mutex_unlock(&log->mLock);
+                if (!log->prepareSpare(&fd, &base)) {
+                    fd = -1;
+                }
+                pthread_mutex_lock(&log->mLock);
+
+                log->mSpareFd = fd;
+                log->mSpareBase = base;
+            }
+            continue;
+        }
+
+        if (log->mPruneWanted) {
+            log->mPruneWanted = false;
+            pthread_mutex_unlock(&log->mLock);
+            log->pruneSegments();
+            pthread_mutex_lock(&log->mLock);
+            continue;
+        }
+
+        if (log->mQuit) {
+            break;
+        }
+
+        pthread_cond_wait(&log->mWake, &log->mLock);
+    }
+
+    pthread_mutex_unlock(&log->mLock);
+
+    return NULL;
+}
+
+
+/**
+ * @brief Finds the segments of the log
+ * @param dir directory holding the segment files
+ * @return true if at least one segment exists
+ */
+bool MessageLogReader::open(const char *dir)
+{
+    strncpy(mDir, dir, MSGLOG_MAX_PATH);
+    mDir[MSGLOG_MAX_PATH - 1] = '\0';
+
+    mFd = -1;
+    mBase = NULL;
+    mSize = 0;
+    mOffset = 0;
+    mCurrent = 0;
+    mExpectedSeq = 0;
+
+    mSegmentCount = listSegments(mDir, &mSegments);
+
+    return mSegmentCount > 0;
+}
+
+void MessageLogReader::close()
+{
+    unmapSegment();
+
+    if (mSegments) {
+        delete [] mSegments;
+        mSegments = NULL;
+    }
+    mSegmentCount = 0;
+}
+
+/**
+ * @brief Positions the reader at the first record with a sequence
+ *        number at or after seq, using the segment index to skip
+ *        most of the records before it.
+ * @param seq sequence number to start at
+ * @return true if success, otherwise error
+ */
+bool MessageLogReader::seek(U64 seq)
+{
+    const LogSegmentHdr *segHdr;
+    const LogRecordHdr *rec;
+    const U32 *index;
+    U32 segment = 0;
+    U64 relative;
+
+    if (mSegmentCount == 0) {
+        return false;
+    }
+
+    // last segment starting at or before seq
+    for (U32 i=0; i<mSegmentCount; ++i) {
+        if (mSegments[i] <= seq) {
+            segment = i;
+        }
+    }
+
+    if (!mapSegment(segment)) {
+        return false;
+    }
+
+    segHdr = (const LogSegmentHdr*)mBase;
+    if (seq < segHdr->baseSeq) {
+        // older records are gone, start at the oldest
+        seq = segHdr->baseSeq;
+    }
+
+    // jump to the nearest indexed record, then scan forward
+    index = (const U32*)&segHdr[1];
+    relative = (seq - segHdr->baseSeq) / segHdr->indexStride;
+    while ((relative > 0) &&
+           ((relative >= segHdr->indexCapacity) || (index[relative] == 0))) {
+        --relative;
+    }
+
+    if (relative > 0) {
+        mOffset = index[relative];
+        mExpectedSeq = segHdr->baseSeq + (relative * segHdr->indexStride);
+    }
+
+    while ((mExpectedSeq < seq) &&
+           ((rec = validRecord(mBase, mSize, mOffset, mExpectedSeq)) != NULL)) {
+        mOffset += alignRecord(sizeof(LogRecordHdr) + rec->length);
+        ++mExpectedSeq;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns the next record. The data points in to the mapped
+ *        segment and is valid until the reader moves to another segment.
+ * @param data set to the record payload
+ * @param length set to the payload length
+ * @param seq set to the record sequence number
+ * @return true if a record was returned, false at the end of the log
+ */
+bool MessageLogReader::next(const U8 **data, U32 *length, U64 *seq)
+{
+    const LogRecordHdr *rec;
+
+    if (mBase == NULL) {
+        return false;
+    }
+
+    rec = validRecord(mBase, mSize, mOffset, mExpectedSeq);
+    while (rec == NULL) {
+        // end of this segment, continue in the next one if it follows on
+        if (((mCurrent + 1) >= mSegmentCount) ||
+            (mSegments[mCurrent + 1] != mExpectedSeq)) {
+            return false;
+        }
+
+        if (!mapSegment(mCurrent + 1)) {
+            return false;
+        }
+
+        rec = validRecord(mBase, mSize, mOffset, mExpectedSeq);
+    }
+
+    *data = (const U8*)&rec[1];
+    *length = rec->length;
+    *seq = rec->seq;
+
+    mOffset += alignRecord(sizeof(LogRecordHdr) + rec->length);
+    ++mExpectedSeq;
+
+    return true;
+}
+
+/**
+ * @brief Maps a segment read only and positions at its first record
+ * @param segment index in to mSegments
+ * @return true if success, otherwise error
+ */
+bool MessageLogReader::mapSegment(U32 segment)
+{
+    char path[MSGLOG_MAX_PATH + 32];
+    const LogSegmentHdr *segHdr;
+    struct stat st;
+    void *base;
+
+    unmapSegment();
+
+    segmentPath(path, mDir, mSegments[segment]);
+
+    mFd = ::open(path, O_RDONLY);
+    if (mFd < 0) {
+        ConsolePrintf("ERROR: open(%s): %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if ((fstat(mFd, &st) < 0) || ((U32)st.st_size < sizeof(LogSegmentHdr))) {
+        unmapSegment();
+        return false;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ConsolePrintf("ERROR: mmap(%s): %s\n", path, strerror(errno));
+        unmapSegment();
+        return false;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    mBase = (const U8*)base;
+    mSize = (U32)st.st_size;
+    mCurrent = segment;
+
+    segHdr = (const LogSegmentHdr*)mBase;
+    if ((segHdr->magic != LOG_SEGMENT_MAGIC) || (segHdr->dataOffset >= mSize)) {
+        ConsolePrintf("ERROR: Message log segment %s is corrupt\n", path);
+        unmapSegment();
+        return false;
+    }
+
+    mOffset = segHdr->dataOffset;
+    mExpectedSeq = segHdr->baseSeq;
+
+    return true;
+}
+
+void MessageLogReader::unmapSegment()
+{
+    if (mBase) {
+        munmap((void*)mBase, mSize);
+        mBase = NULL;
+        mSize = 0;
+    }
+
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+
+U32 alignRecord(U32 size)
+{
+    return (size + (LOG_RECORD_ALIGN - 1)) & ~(LOG_RECORD_ALIGN - 1);
+}
+
+/**
+ * @brief Index entries needed if a segment is filled with empty records
+ */
+U32 segmentIndexCapacity(U32 segmentSize)
+{
+    U32 maxRecords = segmentSize / alignRecord(sizeof(LogRecordHdr));
+
+    return (maxRecords / LOG_INDEX_STRIDE) + 1;
+}
+
+U32 segmentDataOffset(U32 segmentSize)
+{
+    return alignRecord(sizeof(LogSegmentHdr) +
+                       (segmentIndexCapacity(segmentSize) * sizeof(U32)));
+}
+
+/**
+ * @brief FNV-1a of the payload, catches records torn by a crash
+ */
+U32 recordChecksum(const U8 *data, U32 length)
+{
+    U32 hash = 2166136261u;
+
+    for (U32 i=0; i<length; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+void segmentPath(char *path, const char *dir, U64 baseSeq)
+{
+    sprintf(path, "%s/msglog-%016llx.seg", dir, baseSeq);
+}
+
+/**
+ * @brief Where the next segment is prepared, listSegments skips it
+ */
+void sparePath(char *path, const char *dir)
+{
+    sprintf(path, "%s/msglog.spare", dir);
+}
+
+/**
+ * @brief Checks for a complete record with the expected sequence
+ *        number at offset
+ * @return the record if valid, otherwise NULL
+ */
+const LogRecordHdr* validRecord(const U8 *base, U32 size, U32 offset, U64 seq)
+{
+    const LogRecordHdr *rec;
+
+    if ((offset + sizeof(LogRecordHdr)) > size) {
+        return NULL;
+    }
+
+    rec = (const LogRecordHdr*)&base[offset];
+    if (__atomic_load_n(&rec->magic, __ATOMIC_ACQUIRE) != LOG_RECORD_MAGIC) {
+        return NULL;
+    }
+
+    if ((rec->seq != seq) ||
+        (rec->length > (size - offset - sizeof(LogRecordHdr))) ||
+        (rec->checksum != recordChecksum((const U8*)&rec[1], rec->length))) {
+        return NULL;
+    }
+
+    return rec;
+}
+
+/**
+ * @brief Lists segment base sequence numbers in ascending order
+ * @param dir directory holding the segment files
+ * @param segments set to an array the caller deletes, NULL if none
+ * @return number of segments
+ */
+U32 listSegments(const char *dir, U64 **segments)
+{
+    DIR *d;
+    struct dirent *entry;
+    U32 count = 0;
+    U32 capacity = 0;
+    U64 *list = NULL;
+
+    *segments = NULL;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        unsigned long long baseSeq;
+        char suffix[8];
+
+        if (sscanf(entry->d_name, "msglog-%16llx.%3s", &baseSeq, suffix) != 2) {
+            continue;
+        }
+        if (strcmp(suffix, "seg")) {
+            continue;
+        }
+
+        if (count == capacity) {
+            U64 *grown;
+
+            capacity = capacity ? (capacity * 2) : 16;
+            grown = new U64[capacity];
+            if (list) {
+                memcpy(grown, list, count * sizeof(U64));
+                delete [] list;
+            }
+            list = grown;
+        }
+
+        list[count++] = baseSeq;
+    }
+
+    closedir(d);
+
+    if (count > 0) {
+        qsort(list, count, sizeof(U64), compareSeq);
+    }
+
+    *segments = list;
+    return count;
+}
+
+int compareSeq(const void *a, const void *b)
+{
+    U64 x = *(const U64*)a;
+    U64 y = *(const U64*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
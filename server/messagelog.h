@@ -0,0 +1,141 @@
+/**
+ * @brief Persistent append-only message log. Records are written
+ *        in to fixed size memory mapped segment files which are
+ *        flushed to disk in batches rather than once per message.
+ *        The main loop only writes to memory, a background thread
+ *        does the fdatasync, pre-sizes the next segment before the
+ *        current one fills and deletes the oldest segments.
+ */
+
+#ifndef _MESSAGELOG_H
+#define _MESSAGELOG_H
+
+#include <pthread.h>
+#include "types.h"
+
+#define MSGLOG_MAX_PATH 256
+
+enum {
+    LOG_SEGMENT_MAGIC = 0x5347534D, // "MSGS"
+    LOG_RECORD_MAGIC = 0x5247534D,  // "MSGR"
+    LOG_RECORD_ALIGN = 8,
+    LOG_INDEX_STRIDE = 64
+};
+
+/**
+ * @brief Start of every segment file. It is followed by the index,
+ *        U32 index[indexCapacity], where entry k is the offset of
+ *        record baseSeq + k*LOG_INDEX_STRIDE (0 if not written yet),
+ *        and then the records starting at dataOffset.
+ */
+struct LogSegmentHdr
+{
+    U32 magic;
+    U32 indexStride;
+    U32 indexCapacity;
+    U32 dataOffset;
+    U64 baseSeq;
+};
+
+/**
+ * @brief Precedes every record, the payload follows and the
+ *        record is padded to LOG_RECORD_ALIGN. A zero magic
+ *        marks the end of the data in a segment.
+ */
+struct LogRecordHdr
+{
+    U32 magic;
+    U32 length;
+    U64 seq;
+    U32 checksum;
+    U32 reserved;
+};
+
+/**
+ * @brief Writer side of the log, owns the active segment
+ */
+struct MessageLog
+{
+    char mDir[MSGLOG_MAX_PATH];
+    U32 mSegmentSize;
+    U32 mSyncIntervalMs;
+    U32 mKeepSegments;
+
+    // active segment
+    int mFd;
+    U8 *mBase;
+    U32 mActiveSize;
+    U32 *mIndex;
+    U64 mSegmentBaseSeq;
+    U32 mWriteOffset;
+    U32 mSyncedOffset;
+    bool mIndexDirty;
+
+    U64 mNextSeq;
+    U64 mLastSyncMs;
+
+    // background thread, everything below is under mLock
+    pthread_t mThread;
+    bool mThreadStarted;
+    pthread_mutex_t mLock;
+    pthread_cond_t mWake;
+    pthread_cond_t mDone;
+    bool mQuit;
+    int mSyncFd;            // active segment, -1 while rotating
+    bool mSyncWanted;
+    int mRetiredFd;         // full segment to flush, unmap and close
+    U8 *mRetiredBase;
+    U32 mRetiredSize;
+    int mSpareFd;           // next segment, -1 until it is ready
+    U8 *mSpareBase;
+    bool mSpareWanted;
+    bool mPruneWanted;
+
+    bool init(const char *dir, U32 segmentSize, U32 syncIntervalMs, U32 keepSegments);
+    void shutdown();
+
+    U64 append(const U8 *data, U32 length);
+    void service(U64 nowMs);
+    void sync();
+
+    bool rotate();
+    bool createSegment(U64 baseSeq);
+    bool adoptSpare(U64 baseSeq, int fd, U8 *base);
+    void startSegment(U64 baseSeq);
+    bool recoverSegment(U64 baseSeq);
+    void closeSegment();
+
+    bool prepareSpare(int *fd, U8 **base);
+    void pruneSegments();
+    static void* threadMain(void *arg);
+};
+
+/**
+ * @brief Read side of the log. Segments are mapped read only so
+ *        history can be scanned at memory speed by the server or
+ *        by an offline tool, even while the server is appending.
+ */
+struct MessageLogReader
+{
+    char mDir[MSGLOG_MAX_PATH];
+    U64 *mSegments;
+    U32 mSegmentCount;
+    U32 mCurrent;
+
+    int mFd;
+    const U8 *mBase;
+    U32 mSize;
+    U32 mOffset;
+    U64 mExpectedSeq;
+
+    bool open(const char *dir);
+    void close();
+
+    bool seek(U64 seq);
+    bool next(const U8 **data, U32 *length, U64 *seq);
+
+    bool mapSegment(U32 segment);
+    void unmapSegment();
+};
+
+#endif
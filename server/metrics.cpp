@@ -0,0 +1,354 @@
+/**
+ * @brief Server metrics registry and stats endpoint
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "SDL_net.h"
+#include "metrics.h"
+#include "serversocket.h"
+#include "consoleutil.h"
+
+#define STATS_MAX_REPORT_SIZE 16384
+
+ServerMetrics gMetrics;
+
+static const char *gTypeNames[] = {
+    "unknown",
+    "ack",
+    "join",
+    "leave",
+    "text",
+    "direct",
+    "cookie",
+    "group",
+    "busy"
+};
+
+static const char *gMalformedNames[MALFORMED_COUNT] = {
+    "short_header",
+    "bad_length",
+    "unknown_type",
+    "not_joined",
+    "already_joined",
+    "name_in_use",
+    "unknown_recipient",
+    "server_full",
+    "bad_name"
+};
+
+static const char *gDropNames[DROP_COUNT] = {
+    "kernel_rx",
+    "rate_limit",
+    "impaired"
+};
+
+static const char *gOverloadLevelNames[OVERLOAD_LEVEL_COUNT] = {
+    "none",
+    "mild",
+    "moderate",
+    "severe"
+};
+
+static const char *gShedNames[SHED_COUNT] = {
+    "coalesce",
+    "replay",
+    "broadcast",
+    "join"
+};
+
+static const char *gRxClassNames[RX_CLASS_COUNT] = {
+    "control",
+    "chat"
+};
+
+static const char *gClusterNames[CLUSTER_COUNT] = {
+    "tx_frames",
+    "tx_datagrams",
+    "tx_errors",
+    "rx_frames",
+    "rx_duplicates",
+    "rx_rejected"
+};
+
+// The report is bigger than an io_uring receive buffer, and the
+// endpoint is far from hot, so it stays on a plain socket
+#if SERVER_TRANSPORT == TRANSPORT_SDLNET
+static SdlNetTransport gStatsTransport;
+#else
+static PosixUdpTransport gStatsTransport;
+#endif
+static NetPacket *gStatsPacket = NULL;
+static bool gStatsOpen = false;
+
+static U32 formatHistogram(char *buffer, U32 size, const char *name, Histogram *hist);
+
+
+void Histogram::clear()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+/**
+ * @brief Adds a value to the histogram
+ * @param value value to record
+ */
+void Histogram::record(U64 value)
+{
+    U64 prevMax = __atomic_load_n(&max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&counts[bucketOf(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sum, value, __ATOMIC_RELAXED);
+
+    while ((value > prevMax) &&
+           !__atomic_compare_exchange_n(&max, &prevMax, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // prevMax reloaded, try again
+    }
+}
+
+/**
+ * @brief Finds the value at a percentile
+ * @param p percentile, 0.0 to 100.0
+ * @return lowest value of the bucket the percentile falls in
+ */
+U64 Histogram::percentile(double p)
+{
+    U64 count = __atomic_load_n(&total, __ATOMIC_RELAXED);
+    U64 target;
+    U64 seen = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    target = (U64)((p / 100.0) * (double)count);
+    if (target >= count) {
+        target = count - 1;
+    }
+
+    for (U32 i=0; i<HIST_BUCKETS; ++i) {
+        seen += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+        if (seen > target) {
+            return bucketLowest(i);
+        }
+    }
+
+    return max;
+}
+
+U32 Histogram::bucketOf(U64 value)
+{
+    U32 msb;
+    U32 shift;
+
+    if (value < (2 << HIST_SUB_BUCKET_BITS)) {
+        return (U32)value;
+    }
+
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - HIST_SUB_BUCKET_BITS;
+
+    return (shift << HIST_SUB_BUCKET_BITS) + (U32)(value >> shift);
+}
+
+U64 Histogram::bucketLowest(U32 bucket)
+{
+    U32 shift;
+
+    if (bucket < (2 << HIST_SUB_BUCKET_BITS)) {
+        return bucket;
+    }
+
+    shift = (bucket >> HIST_SUB_BUCKET_BITS) - 1;
+
+    return (U64)(bucket - (shift << HIST_SUB_BUCKET_BITS)) << shift;
+}
+
+
+void ServerMetrics::clear()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+/**
+ * @brief Writes all metrics as "name value" lines
+ * @param buffer location to store the report
+ * @param size size of buffer
+ * @return length of the report
+ */
+U32 ServerMetrics::format(char *buffer, U32 size)
+{
+    U32 len = 0;
+    U32 numTypes = sizeof(gTypeNames) / sizeof(gTypeNames[0]);
+    U64 protocolDrops = 0;
+
+#define APPEND(...) \
+    if (len < size) { \
+        int n = snprintf(&buffer[len], size - len, __VA_ARGS__); \
+        len += (n > 0) ? n : 0; \
+    }
+
+    for (U32 i=0; i<numTypes; ++i) {
+        APPEND("rx_packets{type=\"%s\"} %llu\n", gTypeNames[i],
+               __atomic_load_n(&rxPackets[i], __ATOMIC_RELAXED));
+        APPEND("rx_bytes{type=\"%s\"} %llu\n", gTypeNames[i],
+               __atomic_load_n(&rxBytes[i], __ATOMIC_RELAXED));
+        APPEND("tx_packets{type=\"%s\"} %llu\n", gTypeNames[i],
+               __atomic_load_n(&txPackets[i], __ATOMIC_RELAXED));
+        APPEND("tx_bytes{type=\"%s\"} %llu\n", gTypeNames[i],
+               __atomic_load_n(&txBytes[i], __ATOMIC_RELAXED));
+    }
+    APPEND("tx_errors %llu\n", __atomic_load_n(&txErrors, __ATOMIC_RELAXED));
+    APPEND("tx_busy %llu\n", __atomic_load_n(&txBusy, __ATOMIC_RELAXED));
+
+    for (U32 i=0; i<MALFORMED_COUNT; ++i) {
+        U64 count = __atomic_load_n(&malformed[i], __ATOMIC_RELAXED);
+
+        APPEND("malformed{reason=\"%s\"} %llu\n", gMalformedNames[i], count);
+        protocolDrops += count;
+    }
+
+    // every place a datagram can go missing, side by side
+    for (U32 i=0; i<DROP_COUNT; ++i) {
+        APPEND("drops{where=\"%s\"} %llu\n", gDropNames[i],
+               __atomic_load_n(&drops[i], __ATOMIC_RELAXED));
+    }
+    APPEND("drops{where=\"protocol\"} %llu\n", protocolDrops);
+
+    APPEND("socket_rcvbuf %llu\n", __atomic_load_n(&socketRcvbuf, __ATOMIC_RELAXED));
+    APPEND("socket_sndbuf %llu\n", __atomic_load_n(&socketSndbuf, __ATOMIC_RELAXED));
+    APPEND("socket_buffer_grows %llu\n", __atomic_load_n(&socketGrows, __ATOMIC_RELAXED));
+
+    for (U32 i=0; i<RX_CLASS_COUNT; ++i) {
+        APPEND("rx_scheduled{class=\"%s\"} %llu\n", gRxClassNames[i],
+               __atomic_load_n(&rxScheduled[i], __ATOMIC_RELAXED));
+    }
+    APPEND("rx_chat_promoted %llu\n", __atomic_load_n(&rxChatPromoted, __ATOMIC_RELAXED));
+
+    APPEND("overload_level %llu\n", __atomic_load_n(&overloadLevel, __ATOMIC_RELAXED));
+    for (U32 i=OVERLOAD_MILD; i<OVERLOAD_LEVEL_COUNT; ++i) {
+        APPEND("overload_raised{level=\"%s\"} %llu\n", gOverloadLevelNames[i],
+               __atomic_load_n(&overloadRaised[i], __ATOMIC_RELAXED));
+    }
+    for (U32 i=0; i<SHED_COUNT; ++i) {
+        APPEND("shed{action=\"%s\"} %llu\n", gShedNames[i],
+               __atomic_load_n(&shed[i], __ATOMIC_RELAXED));
+    }
+
+    for (U32 i=0; i<CLUSTER_COUNT; ++i) {
+        APPEND("cluster{event=\"%s\"} %llu\n", gClusterNames[i],
+               __atomic_load_n(&cluster[i], __ATOMIC_RELAXED));
+    }
+
+#undef APPEND
+
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "fanout", &fanout);
+    }
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "rx_to_send_ns", &rxToSendNs);
+    }
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "rx_queue_ns", &rxQueueNs);
+    }
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "control_queue_ns", &controlQueueNs);
+    }
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "client_to_server_ns", &clientToServerNs);
+    }
+    if (len < size) {
+        len += formatHistogram(&buffer[len], size - len, "loop_ns", &loopNs);
+    }
+
+    return (len < size) ? len : (size - 1);
+}
+
+U32 formatHistogram(char *buffer, U32 size, const char *name, Histogram *hist)
+{
+    U64 count = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    U64 sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+    int n;
+
+    n = snprintf(buffer, size,
+                 "%s_count %llu\n"
+                 "%s_mean %llu\n"
+                 "%s{p=\"50\"} %llu\n"
+                 "%s{p=\"99\"} %llu\n"
+                 "%s{p=\"99.9\"} %llu\n"
+                 "%s_max %llu\n",
+                 name, count,
+                 name, count ? (sum / count) : 0,
+                 name, hist->percentile(50.0),
+                 name, hist->percentile(99.0),
+                 name, hist->percentile(99.9),
+                 name, __atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+
+    return (n > 0) ? (U32)n : 0;
+}
+
+
+/**
+ * @brief Opens the UDP stats endpoint. Any datagram sent to it from
+ *        the local host is answered with the metrics report.
+ * @param port UDP port to listen on
+ * @return true if success, otherwise error
+ */
+bool InitStatsEndpoint(U32 port)
+{
+    gStatsTransport.clear();
+    if (!gStatsTransport.open(port)) {
+        ConsolePrintf("ERROR: open(%d): %s\n",
+                      port,
+                      gStatsTransport.getError());
+        return false;
+    }
+    gStatsOpen = true;
+
+    gStatsPacket = gStatsTransport.allocPacket(STATS_MAX_REPORT_SIZE);
+    if (gStatsPacket == NULL) {
+        ConsolePrintf("ERROR: allocPacket(%d): %s\n",
+                      STATS_MAX_REPORT_SIZE,
+                      gStatsTransport.getError());
+        ShutdownStatsEndpoint();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Answers pending stats requests
+ */
+void ServiceStatsEndpoint()
+{
+    if (!gStatsOpen) {
+        return;
+    }
+
+    while (gStatsTransport.recv(gStatsPacket) > 0) {
+        // Host is in network order, only answer 127.x.x.x
+        if ((gStatsPacket->address.host & 0xFF) != 127) {
+            continue;
+        }
+
+        gStatsPacket->len = gMetrics.format((char*)gStatsPacket->data,
+                                            gStatsPacket->maxlen);
+        gStatsTransport.send(gStatsPacket);
+    }
+}
+
+void ShutdownStatsEndpoint()
+{
+    if (gStatsPacket) {
+        gStatsTransport.freePacket(gStatsPacket);
+        gStatsPacket = NULL;
+    }
+
+    if (gStatsOpen) {
+        gStatsTransport.close();
+        gStatsOpen = false;
+    }
+}
@@ -0,0 +1,228 @@
+/**
+ * @brief Server metrics registry. Counters and histograms are
+ *        updated with relaxed atomic adds so any thread can record
+ *        and readers never take a lock.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include "types.h"
+
+enum {
+    METRICS_MAX_TYPES = 16,
+
+    // log-linear buckets, 16 per power of two (within ~6%)
+    HIST_SUB_BUCKET_BITS = 4,
+    HIST_BUCKETS = (64 - HIST_SUB_BUCKET_BITS + 1) * (1 << HIST_SUB_BUCKET_BITS)
+};
+
+// Reasons a client packet was dropped by the protocol
+enum {
+    MALFORMED_SHORT_HEADER = 0,
+    MALFORMED_BAD_LENGTH,
+    MALFORMED_UNKNOWN_TYPE,
+    MALFORMED_NOT_JOINED,
+    MALFORMED_ALREADY_JOINED,
+    MALFORMED_NAME_IN_USE,
+    MALFORMED_UNKNOWN_RECIPIENT,
+    MALFORMED_SERVER_FULL,
+    MALFORMED_BAD_NAME,
+    MALFORMED_COUNT
+};
+
+// Datagrams lost outside the protocol, see SocketMonitor
+enum {
+    DROP_KERNEL_RX = 0,     // receive buffer full
+    DROP_RATE_LIMIT,        // rate limiter queue full, SERVER_IMPAIRMENT
+    DROP_IMPAIRED,          // simulated loss, SERVER_IMPAIRMENT
+    DROP_COUNT
+};
+
+// Overload levels, see overload.h
+enum {
+    OVERLOAD_NONE = 0,
+    OVERLOAD_MILD,
+    OVERLOAD_MODERATE,
+    OVERLOAD_SEVERE,
+    OVERLOAD_LEVEL_COUNT
+};
+
+// Load shed while overloaded, see overload.h
+enum {
+    SHED_COALESCE = 0,      // cluster batch sent after the longer linger
+    SHED_REPLAY,            // history replay turn skipped
+    SHED_BROADCAST,         // broadcast TEXT dropped
+    SHED_JOIN,              // JOIN answered with BUSY
+    SHED_COUNT
+};
+
+// Receive priority classes, see rxscheduler.h
+enum {
+    RX_CLASS_CONTROL = 0,
+    RX_CLASS_CHAT,
+    RX_CLASS_COUNT
+};
+
+// Server to server relay events, see cluster.h
+enum {
+    CLUSTER_TX_FRAMES = 0,
+    CLUSTER_TX_DATAGRAMS,
+    CLUSTER_TX_ERRORS,
+    CLUSTER_RX_FRAMES,
+    CLUSTER_RX_DUPLICATES,
+    CLUSTER_RX_REJECTED,
+    CLUSTER_COUNT
+};
+
+/**
+ * @brief HDR style histogram, values below 2^(HIST_SUB_BUCKET_BITS+1)
+ *        are exact, above that each power of two is split in to
+ *        2^HIST_SUB_BUCKET_BITS buckets.
+ */
+struct Histogram
+{
+    U64 counts[HIST_BUCKETS];
+    U64 total;
+    U64 sum;
+    U64 max;
+
+    void clear();
+    void record(U64 value);
+    U64 percentile(double p);
+
+    static U32 bucketOf(U64 value);
+    static U64 bucketLowest(U32 bucket);
+};
+
+struct ServerMetrics
+{
+    // per message type, index 0 counts unknown types
+    U64 rxPackets[METRICS_MAX_TYPES];
+    U64 rxBytes[METRICS_MAX_TYPES];
+    U64 txPackets[METRICS_MAX_TYPES];
+    U64 txBytes[METRICS_MAX_TYPES];
+    U64 txErrors;
+    U64 txBusy;             // sends refused or delayed for a full
+                            // socket buffer
+
+    U64 malformed[MALFORMED_COUNT];
+    U64 cluster[CLUSTER_COUNT];
+
+    U64 rxScheduled[RX_CLASS_COUNT];
+    U64 rxChatPromoted;     // chat handled ahead of waiting control
+
+    U64 overloadLevel;
+    U64 overloadRaised[OVERLOAD_LEVEL_COUNT];  // times each was entered
+    U64 shed[SHED_COUNT];
+
+    // sampled from the socket, see SocketMonitor
+    U64 drops[DROP_COUNT];
+    U64 socketRcvbuf;
+    U64 socketSndbuf;
+    U64 socketGrows;
+
+    Histogram fanout;       // datagrams per broadcast, one for the
+                            // whole multicast group
+    Histogram rxToSendNs;   // packet received to handling done
+    Histogram rxQueueNs;    // kernel receive stamp to handled
+    Histogram controlQueueNs;   // the same, session control only
+    Histogram clientToServerNs; // author's send stamp to kernel receive
+                                // stamp, only as good as the clocks agree
+    Histogram loopNs;       // main loop iteration time
+
+    void clear();
+
+    void countRx(U32 type, U32 bytes)
+    {
+        type = (type < METRICS_MAX_TYPES) ? type : 0;
+        __atomic_fetch_add(&rxPackets[type], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&rxBytes[type], bytes, __ATOMIC_RELAXED);
+    }
+
+    void countTx(U32 type, U32 bytes)
+    {
+        type = (type < METRICS_MAX_TYPES) ? type : 0;
+        __atomic_fetch_add(&txPackets[type], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&txBytes[type], bytes, __ATOMIC_RELAXED);
+    }
+
+    void countTxBatch(U32 type, U64 packets, U64 bytes, U64 errors)
+    {
+        type = (type < METRICS_MAX_TYPES) ? type : 0;
+        __atomic_fetch_add(&txPackets[type], packets, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&txBytes[type], bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&txErrors, errors, __ATOMIC_RELAXED);
+    }
+
+    void countTxError()
+    {
+        __atomic_fetch_add(&txErrors, 1, __ATOMIC_RELAXED);
+    }
+
+    void countMalformed(U32 reason)
+    {
+        __atomic_fetch_add(&malformed[reason], 1, __ATOMIC_RELAXED);
+    }
+
+    void countTxBusy(U64 count)
+    {
+        __atomic_fetch_add(&txBusy, count, __ATOMIC_RELAXED);
+    }
+
+    void setDrops(U32 where, U64 total)
+    {
+        __atomic_store_n(&drops[where], total, __ATOMIC_RELAXED);
+    }
+
+    void countScheduled(U32 cls)
+    {
+        __atomic_fetch_add(&rxScheduled[cls], 1, __ATOMIC_RELAXED);
+    }
+
+    void countChatPromoted()
+    {
+        __atomic_fetch_add(&rxChatPromoted, 1, __ATOMIC_RELAXED);
+    }
+
+    void setOverloadLevel(U32 level)
+    {
+        __atomic_store_n(&overloadLevel, level, __ATOMIC_RELAXED);
+    }
+
+    void countOverload(U32 level)
+    {
+        __atomic_fetch_add(&overloadRaised[level], 1, __ATOMIC_RELAXED);
+    }
+
+    void countShed(U32 action, U64 count)
+    {
+        __atomic_fetch_add(&shed[action], count, __ATOMIC_RELAXED);
+    }
+
+    void setSocketBuffers(U64 rcvbuf, U64 sndbuf)
+    {
+        __atomic_store_n(&socketRcvbuf, rcvbuf, __ATOMIC_RELAXED);
+        __atomic_store_n(&socketSndbuf, sndbuf, __ATOMIC_RELAXED);
+    }
+
+    void countSocketGrow()
+    {
+        __atomic_fetch_add(&socketGrows, 1, __ATOMIC_RELAXED);
+    }
+
+    void countCluster(U32 event, U64 count)
+    {
+        __atomic_fetch_add(&cluster[event], count, __ATOMIC_RELAXED);
+    }
+
+    U32 format(char *buffer, U32 size);
+};
+
+extern ServerMetrics gMetrics;
+
+bool InitStatsEndpoint(U32 port);
+void ServiceStatsEndpoint();
+void ShutdownStatsEndpoint();
+
+#endif
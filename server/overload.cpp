@@ -0,0 +1,112 @@
+/**
+ * @brief Overload detection
+ */
+
+#include <string.h>
+#include "overload.h"
+#include "consoleutil.h"
+
+#define OVERLOAD_SAMPLE_NS ((U64)SERVER_OVERLOAD_SAMPLE_MS * 1000000ULL)
+
+OverloadMonitor gOverload;
+
+static const char *gOverloadNames[OVERLOAD_LEVEL_COUNT] = {
+    "none",
+    "mild",
+    "moderate",
+    "severe"
+};
+
+
+void OverloadMonitor::init(U64 nowNs)
+{
+    memset(this, 0, sizeof(*this));
+    mNextNs = nowNs + OVERLOAD_SAMPLE_NS;
+    mLastKernelDrops = __atomic_load_n(&gMetrics.drops[DROP_KERNEL_RX], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Grades what was sampled once a sample period is over and
+ *        moves the level, call it every main loop iteration
+ */
+void OverloadMonitor::service(U64 nowNs)
+{
+    U64 drops;
+    U64 newDrops;
+    U64 loopUs;
+    U32 queue;
+    U32 level;
+    U32 signal;
+    U32 sustained;
+    U32 last = mLevel;
+
+    if (nowNs < mNextNs) {
+        return;
+    }
+    mNextNs = nowNs + OVERLOAD_SAMPLE_NS;
+
+    drops = __atomic_load_n(&gMetrics.drops[DROP_KERNEL_RX], __ATOMIC_RELAXED);
+    newDrops = (drops >= mLastKernelDrops) ? (drops - mLastKernelDrops) : drops;
+    mLastKernelDrops = drops;
+
+    loopUs = mWorstLoopNs / 1000;
+    queue = mDeepestQueue;
+    mWorstLoopNs = 0;
+    mDeepestQueue = 0;
+
+    level = grade(loopUs,
+                  SERVER_OVERLOAD_LAG_MILD_US,
+                  SERVER_OVERLOAD_LAG_MODERATE_US,
+                  SERVER_OVERLOAD_LAG_SEVERE_US);
+
+    signal = grade(queue,
+                   SERVER_OVERLOAD_QUEUE_MILD,
+                   SERVER_OVERLOAD_QUEUE_MODERATE,
+                   SERVER_OVERLOAD_QUEUE_SEVERE);
+    level = (signal > level) ? signal : level;
+
+    // one slow sample is noise, raise only to what the last two agree on
+    sustained = (level < mLastGrade) ? level : mLastGrade;
+    mLastGrade = level;
+
+    // a kernel drop is lost chat already, it counts at once
+    signal = grade(newDrops,
+                   SERVER_OVERLOAD_DROPS_MILD,
+                   SERVER_OVERLOAD_DROPS_MODERATE,
+                   SERVER_OVERLOAD_DROPS_SEVERE);
+    sustained = (signal > sustained) ? signal : sustained;
+    level = (signal > level) ? signal : level;
+
+    if (sustained > mLevel) {
+        mLevel = sustained;
+        gMetrics.countOverload(mLevel);
+    } else if (level < mLevel) {
+        // recover a step at a time
+        --mLevel;
+    }
+    gMetrics.setOverloadLevel(mLevel);
+
+    if (mLevel != last) {
+        ConsolePrintf("Overload %s: loop %llu us, queue %u, kernel drops %llu\n",
+                      gOverloadNames[mLevel],
+                      (unsigned long long)loopUs,
+                      queue,
+                      (unsigned long long)newDrops);
+    }
+}
+
+/**
+ * @return OVERLOAD_ level value has reached
+ */
+U32 OverloadMonitor::grade(U64 value, U64 mild, U64 moderate, U64 severe)
+{
+    if (value >= severe) {
+        return OVERLOAD_SEVERE;
+    } else if (value >= moderate) {
+        return OVERLOAD_MODERATE;
+    } else if (value >= mild) {
+        return OVERLOAD_MILD;
+    }
+
+    return OVERLOAD_NONE;
+}
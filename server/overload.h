@@ -0,0 +1,65 @@
+/**
+ * @brief Overload detection. Every SERVER_OVERLOAD_SAMPLE_MS three
+ *        signals are graded against their thresholds in servercfg.h:
+ *        the slowest main loop iteration, the deepest receive queue
+ *        left after reading (see rxscheduler.h) and the datagrams the
+ *        kernel dropped for a full receive buffer. The worst grade
+ *        becomes the level once two samples in a row reach it, at once
+ *        for kernel drops, and the level falls a step per sample, so
+ *        the server doesn't flap at the edge.
+ *
+ *        The protocol sheds load by level, each one adding to the
+ *        last:
+ *          mild      cluster batches linger longer so more frames
+ *                    share a datagram, history replay slows down
+ *          moderate  broadcast TEXT is dropped, the whole room is the
+ *                    biggest fan-out there is. Unicast and DIRECT
+ *                    still get through.
+ *          severe    JOINs are answered with a BUSY, no new sessions
+ *                    until the load drops
+ *
+ *        Every shed is counted in gMetrics.
+ */
+
+#ifndef _OVERLOAD_H
+#define _OVERLOAD_H
+
+#include "types.h"
+#include "servercfg.h"
+#include "metrics.h"
+
+struct OverloadMonitor
+{
+    U32 mLevel;             // OVERLOAD_
+    U32 mLastGrade;         // OVERLOAD_ of the previous sample
+    U64 mNextNs;
+
+    // worst seen since the last sample
+    U64 mWorstLoopNs;
+    U32 mDeepestQueue;
+    U64 mLastKernelDrops;
+
+    void init(U64 nowNs);
+    void service(U64 nowNs);
+
+    void sample(U64 loopNs, U32 queueDepth)
+    {
+        if (loopNs > mWorstLoopNs) {
+            mWorstLoopNs = loopNs;
+        }
+        if (queueDepth > mDeepestQueue) {
+            mDeepestQueue = queueDepth;
+        }
+    }
+
+    U32 level()
+    {
+        return mLevel;
+    }
+
+    static U32 grade(U64 value, U64 mild, U64 moderate, U64 severe);
+};
+
+extern OverloadMonitor gOverload;
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ * @brief Receive side priority scheduling
+ */
+
+#include <string.h>
+#include "rxscheduler.h"
+#include "messenger.h"
+
+
+/**
+ * @brief Allocates the packet pool
+ * @return true if success, otherwise error
+ */
+bool RxScheduler::init(ServerSocket *server)
+{
+    memset(this, 0, sizeof(*this));
+    mServer = server;
+    mSenders = server->mSessions.mMaxSessions + SERVER_RX_QUEUE;
+
+    for (U32 c=0; c<RX_CLASS_COUNT; ++c) {
+        mSenderCount[c] = new U16[mSenders];
+        if (mSenderCount[c] == NULL) {
+            shutdown();
+            return false;
+        }
+        memset(mSenderCount[c], 0, sizeof(U16) * mSenders);
+    }
+
+    for (U32 i=0; i<SERVER_RX_QUEUE; ++i) {
+        mPackets[i] = server->allocPacket();
+        if (mPackets[i] == NULL) {
+            shutdown();
+            return false;
+        }
+        mFree[mFreeCount++] = mPackets[i];
+    }
+
+    return true;
+}
+
+/**
+ * @brief Frees every packet, queued ones are dropped unhandled
+ */
+void RxScheduler::shutdown()
+{
+    for (U32 i=0; i<SERVER_RX_QUEUE; ++i) {
+        if (mPackets[i]) {
+            mServer->freePacket(mPackets[i]);
+            mPackets[i] = NULL;
+        }
+    }
+
+    mFreeCount = 0;
+    for (U32 c=0; c<RX_CLASS_COUNT; ++c) {
+        delete [] mSenderCount[c];
+        mSenderCount[c] = NULL;
+        mHead[c] = 0;
+        mCount[c] = 0;
+    }
+    mSenders = 0;
+}
+
+/**
+ * @return the sender index for address without a session, one of
+ *         SERVER_RX_QUEUE past the session slots
+ */
+U32 RxScheduler::bucket(IPaddress *address)
+{
+    return mServer->mSessions.mMaxSessions +
+           ((address->host * 2654435761u) ^ address->port) % SERVER_RX_QUEUE;
+}
+
+/**
+ * @brief Reads what is waiting on the socket in to free packets and
+ *        queues it by class, until chat is at SERVER_RX_CHAT_LIMIT.
+ *        Control from a sender with chat queued waits behind it.
+ * @return datagrams read
+ */
+U32 RxScheduler::fill()
+{
+    U32 read = 0;
+
+    while ((mFreeCount > 0) && (mCount[RX_CLASS_CHAT] < SERVER_RX_CHAT_LIMIT)) {
+        ServerPacket *pkt = mFree[mFreeCount - 1];
+        int handle;
+        U32 from;
+        U32 cls;
+        U32 tail;
+
+        if (!mServer->receiveData(pkt)) {
+            break;
+        }
+        ++read;
+
+        handle = mServer->peerIPaddressToHandle(&pkt->address);
+        from = (handle >= 0) ? (U32)handle : bucket(&pkt->address);
+        cls = classify(pkt);
+        if ((cls == RX_CLASS_CONTROL) &&
+            (queued(RX_CLASS_CHAT, from) ||
+             ((handle >= 0) && queued(RX_CLASS_CHAT, bucket(&pkt->address))))) {
+            // keep the sender's frames in order, a LEAVE must not
+            // overtake its TEXT
+            cls = RX_CLASS_CHAT;
+        }
+        --mFreeCount;
+        tail = (mHead[cls] + mCount[cls]) % SERVER_RX_QUEUE;
+        mQueue[cls][tail] = pkt;
+        mSender[cls][tail] = from;
+        ++mCount[cls];
+        ++mSenderCount[cls][from];
+    }
+
+    return read;
+}
+
+/**
+ * @brief Takes the next packet to handle, give it back with release()
+ * @return NULL if nothing is queued
+ */
+ServerPacket* RxScheduler::next()
+{
+    ServerPacket *pkt;
+    U32 cls;
+
+    if ((mCount[RX_CLASS_CONTROL] > 0) &&
+        ((mCount[RX_CLASS_CHAT] == 0) || (mControlRun < SERVER_RX_CONTROL_RUN) ||
+         queued(RX_CLASS_CONTROL, mSender[RX_CLASS_CHAT][mHead[RX_CLASS_CHAT]]))) {
+        // the chat frame waits while its sender has control queued,
+        // which arrived first
+        cls = RX_CLASS_CONTROL;
+        ++mControlRun;
+    } else if (mCount[RX_CLASS_CHAT] > 0) {
+        if (mCount[RX_CLASS_CONTROL] > 0) {
+            // control has had its run, let one chat frame through
+            gMetrics.countChatPromoted();
+        }
+        cls = RX_CLASS_CHAT;
+        mControlRun = 0;
+    } else {
+        return NULL;
+    }
+
+    pkt = mQueue[cls][mHead[cls]];
+    --mSenderCount[cls][mSender[cls][mHead[cls]]];
+    mHead[cls] = (mHead[cls] + 1) % SERVER_RX_QUEUE;
+    --mCount[cls];
+
+    gMetrics.countScheduled(cls);
+
+    return pkt;
+}
+
+void RxScheduler::release(ServerPacket *pkt)
+{
+    mFree[mFreeCount++] = pkt;
+}
+
+/**
+ * @return RX_CLASS_CONTROL for JOIN, LEAVE, ACK and GROUP, otherwise
+ *         RX_CLASS_CHAT. Malformed datagrams are chat, they don't get
+ *         ahead of anything.
+ */
+U32 RxScheduler::classify(ServerPacket *pkt)
+{
+    MsgrHdr *hdr = (MsgrHdr*)pkt->data;
+
+    if (((U32)pkt->len < sizeof(MsgrHdr)) ||
+        (hdr->type == TYPE_TEXT) || (hdr->type == TYPE_DIRECT)) {
+        return RX_CLASS_CHAT;
+    }
+
+    return RX_CLASS_CONTROL;
+}
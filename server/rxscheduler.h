@@ -0,0 +1,82 @@
+/**
+ * @brief Receive side priority scheduling. Datagrams are read ahead
+ *        of the protocol in to a pool of SERVER_RX_QUEUE packets and
+ *        queued by class: session control (JOIN, LEAVE, ACK, GROUP)
+ *        or chat (TEXT, DIRECT and anything malformed). next() hands
+ *        out control first, so a JOIN never waits behind a burst of
+ *        chat that arrived before it.
+ *
+ *        One sender's frames are still handled in the order they
+ *        arrived. Control from a sender with chat queued is queued as
+ *        chat, and chat doesn't go ahead of its sender's control.
+ *        Queued frames are counted per sender and class, so checking
+ *        costs the same however deep the queues are. A sender is its
+ *        session slot, or for addresses without a session one of
+ *        SERVER_RX_QUEUE buckets past the last slot. Two senders
+ *        sharing a bucket only keep each other in order. Control from
+ *        a session also checks its address's bucket, for chat read
+ *        before its JOIN was handled.
+ *
+ *        Chat is not starved: after SERVER_RX_CONTROL_RUN control
+ *        frames in a row, a waiting chat frame goes next. Reading
+ *        stops while chat holds SERVER_RX_CHAT_LIMIT packets, so the
+ *        rest of the pool is always there for control and nothing is
+ *        dropped here. What isn't read waits in the socket buffer.
+ *
+ *        Replies are sent while their frame is handled, so they go
+ *        out in the same order. io_uring holds them until flush() but
+ *        doesn't reorder them.
+ */
+
+#ifndef _RXSCHEDULER_H
+#define _RXSCHEDULER_H
+
+#include "types.h"
+#include "servercfg.h"
+#include "serversocket.h"
+#include "metrics.h"
+
+struct RxScheduler
+{
+    ServerSocket *mServer;
+
+    // every packet, free or queued
+    ServerPacket *mPackets[SERVER_RX_QUEUE];
+    ServerPacket *mFree[SERVER_RX_QUEUE];
+    U32 mFreeCount;
+
+    // a ring per RX_CLASS_, in arrival order
+    ServerPacket *mQueue[RX_CLASS_COUNT][SERVER_RX_QUEUE];
+    U32 mSender[RX_CLASS_COUNT][SERVER_RX_QUEUE];
+    U32 mHead[RX_CLASS_COUNT];
+    U32 mCount[RX_CLASS_COUNT];
+
+    // frames queued per sender, for each RX_CLASS_
+    U32 mSenders;
+    U16 *mSenderCount[RX_CLASS_COUNT];
+
+    U32 mControlRun;        // control handed out since the last chat
+
+    bool init(ServerSocket *server);
+    void shutdown();
+
+    U32 fill();
+    ServerPacket* next();
+    void release(ServerPacket *pkt);
+
+    U32 depth()
+    {
+        return mCount[RX_CLASS_CONTROL] + mCount[RX_CLASS_CHAT];
+    }
+
+    bool queued(U32 cls, U32 sender)
+    {
+        return mSenderCount[cls][sender] > 0;
+    }
+
+    U32 bucket(IPaddress *address);
+
+    static U32 classify(ServerPacket *pkt);
+};
+
+#endif
@@ -5,5 +5,132 @@
 #define UDP_MAX_PACKET_SIZE 512
 #define MAX_CLIENTS 10
 
+// Socket backend, TRANSPORT_SDLNET, TRANSPORT_POSIX or, on Linux,
+// TRANSPORT_IOURING (see transport.h). TRANSPORT_LOOP is for
+// in-process simulation only.
+#ifndef SERVER_TRANSPORT
+#ifdef _WIN32
+#define SERVER_TRANSPORT TRANSPORT_SDLNET
+#else
+#define SERVER_TRANSPORT TRANSPORT_POSIX
+#endif
+#endif
+
+// Impair outgoing datagrams to test on a bad network, see
+// ImpairmentConfig::parse() for the settings
+//#define SERVER_IMPAIRMENT "loss=0.01,delay=20000,jitter=5000"
+
+// Kernel socket buffer sizes requested by the POSIX and io_uring transports,
+// 0 keeps the system default
+#define SERVER_SOCKET_RCVBUF (1024*1024)
+#define SERVER_SOCKET_SNDBUF (1024*1024)
+
+// Every SERVER_SOCKET_SAMPLE_MS the server reads the socket's drop
+// counters in to its stats. A buffer that overflowed since the last
+// sample doubles, up to these limits (POSIX and io_uring transports).
+// Without CAP_NET_ADMIN net.core.rmem_max and wmem_max cap them lower.
+#define SERVER_SOCKET_SAMPLE_MS 100
+#define SERVER_SOCKET_RCVBUF_MAX (16*1024*1024)
+#define SERVER_SOCKET_SNDBUF_MAX (16*1024*1024)
+
+// Broadcasts to SERVER_FANOUT_MIN_RECIPIENTS or more clients are sent by
+// SERVER_FANOUT_THREADS threads plus the main loop, straight to the
+// socket with sendmmsg (Linux, POSIX or io_uring transport). 0 keeps
+// every send on the main loop. Off until the fanout/* benchmarks show a
+// gain on the target host, on one CPU fanout/threads is the slower one.
+// A host with no CPU to spare keeps broadcasts on the main loop anyway.
+#ifndef SERVER_FANOUT_THREADS
+#define SERVER_FANOUT_THREADS 0
+#endif
+#define SERVER_FANOUT_MIN_RECIPIENTS 1024
+
+// Broadcast TEXT is sent once to this IPv4 multicast group for every
+// client that can receive it, the rest still get it unicast (POSIX or
+// io_uring transport). The group goes out of the interface with address
+// SERVER_MULTICAST_INTERFACE, 127.0.0.1 keeps it on this host.
+//#define SERVER_MULTICAST_GROUP "239.255.42.99"
+#define SERVER_MULTICAST_PORT 2002
+#define SERVER_MULTICAST_INTERFACE "127.0.0.1"
+#define SERVER_MULTICAST_TTL 1
+
+// Federation, see cluster.h. The server to server link address of
+// every node in the cluster, in node order. Start node n as "server n",
+// it takes clients on UDP_SOCKET_PORT + n * SERVER_NODE_PORT_STEP (and
+// moves its stats and multicast ports by as much), so a whole cluster
+// can run on one host. Relayed frames wait up to
+// SERVER_CLUSTER_LINGER_US for others to share their datagram.
+//#define SERVER_CLUSTER_NODES "127.0.0.1:2100,127.0.0.1:2101,127.0.0.1:2102"
+#define SERVER_CLUSTER_MAX_NODES 16
+#define SERVER_NODE_PORT_STEP 10
+#define SERVER_CLUSTER_DATAGRAM_SIZE 1400
+#define SERVER_CLUSTER_LINGER_US 1000
+
+// How long a join cookie stays good, a client that takes longer
+// between the two JOINs is sent a new one
+#define SERVER_COOKIE_LIFETIME_S 30
+
+// Local UDP port answering with the metrics report
+#define STATS_PORT 2001
+
+// Received datagrams are read ahead in to SERVER_RX_QUEUE packets and
+// up to SERVER_RX_BURST are handled per main loop iteration, session
+// control before chat. A waiting chat frame goes after every
+// SERVER_RX_CONTROL_RUN control frames in a row. Reading pauses while
+// chat fills SERVER_RX_CHAT_LIMIT packets. See rxscheduler.h.
+#define SERVER_RX_QUEUE 256
+#define SERVER_RX_CHAT_LIMIT 192
+#define SERVER_RX_BURST 32
+#define SERVER_RX_CONTROL_RUN 8
+
+// Overload detection, see overload.h. Every SERVER_OVERLOAD_SAMPLE_MS
+// the slowest main loop iteration, the deepest receive queue and the
+// kernel receive drops since the last sample are graded against these,
+// and the worst grade is the level. Mild stretches the cluster linger
+// by SERVER_OVERLOAD_LINGER_SCALE and cuts replay to
+// SERVER_OVERLOAD_REPLAY_BURST, moderate drops broadcast TEXT, severe
+// tells JOINs to come back in SERVER_OVERLOAD_BUSY_RETRY_MS.
+#define SERVER_OVERLOAD_SAMPLE_MS 100
+#define SERVER_OVERLOAD_LAG_MILD_US 2000
+#define SERVER_OVERLOAD_LAG_MODERATE_US 20000
+#define SERVER_OVERLOAD_LAG_SEVERE_US 100000
+#define SERVER_OVERLOAD_QUEUE_MILD SERVER_RX_BURST
+#define SERVER_OVERLOAD_QUEUE_MODERATE (SERVER_RX_QUEUE / 2)
+#define SERVER_OVERLOAD_QUEUE_SEVERE SERVER_RX_CHAT_LIMIT
+#define SERVER_OVERLOAD_DROPS_MILD 1
+#define SERVER_OVERLOAD_DROPS_MODERATE 64
+#define SERVER_OVERLOAD_DROPS_SEVERE 1024
+#define SERVER_OVERLOAD_LINGER_SCALE 4
+#define SERVER_OVERLOAD_REPLAY_BURST 1
+#define SERVER_OVERLOAD_BUSY_RETRY_MS 2000
+
+// Span tracing of one in SERVER_TRACE_SAMPLE received messages, 0 turns
+// it off. Each thread keeps its last SERVER_TRACE_RING_SIZE spans, the
+// "/trace [ms]" command writes the last SERVER_TRACE_WINDOW_MS (or ms)
+// of them to SERVER_TRACE_FILE, see trace.h.
+#ifndef SERVER_TRACE_SAMPLE
+#define SERVER_TRACE_SAMPLE 1000
+#endif
+#define SERVER_TRACE_RING_SIZE 4096
+#define SERVER_TRACE_WINDOW_MS 1000
+#define SERVER_TRACE_FILE "trace.json"
+
+// Chat history kept in memory and replayed to joining clients
+#define HISTORY_MAX_MESSAGES 64
+#define HISTORY_REPLAY_MESSAGES 20
+// Max replay datagrams sent per main loop iteration
+#define HISTORY_REPLAY_BURST 8
+
+// Persistent chat log, comment out MSGLOG_ENABLE (or build with
+// MSGLOG_DISABLE) to turn it off
+#ifndef MSGLOG_DISABLE
+#define MSGLOG_ENABLE
+#endif
+#define MSGLOG_DIR "msglog"
+#define MSGLOG_SEGMENT_SIZE (4*1024*1024)
+#define MSGLOG_SYNC_INTERVAL_MS 200
+// Segments kept on disk, the oldest are deleted beyond this. Keep at
+// least 2 so the last HISTORY_MAX_MESSAGES survive a rotation.
+#define MSGLOG_KEEP_SEGMENTS 16
+
 #endif
 
@@ -14,7 +14,8 @@
 //#define DEBUG_SHOW_RAW_TX_PACKET
 
 
-bool ServerSocket::init(U32 port, U32 bufferSize, U32 maxClients)
+template <class Transport>
+bool BasicServerSocket<Transport>::init(U32 port, U32 bufferSize, U32 maxClients)
 {
     bool retval = true; // default success
 
@@ -22,146 +23,100 @@ bool ServerSocket::init(U32 port, U32 bufferSize, U32 maxClients)
     mBufferSize = bufferSize;
     mMaxClients = maxClients;
 
-    mClientCount = 0;
-    mServerSocket = 0;
+    mTransport.clear();
 
-    mClientList = new ClientConn[mMaxClients];
-    if (mClientList == NULL) {
+    if (!mSessions.init(mMaxClients)) {
         retval = false;
         ConsolePrintf("ERROR: Unable to allocate client list %d\n",
                       mMaxClients);
-    } else {
-        // init client list
-        for (U32 i=0; i<mMaxClients; ++i) {
-            mClientList[i].clear();
-        }
     }
 
     // Get the server's IP address
     if (retval) {
-        int hostResolved = SDLNet_ResolveHost(&mServerIP, NULL, mPort);
-
-        if (hostResolved == -1) {
+        if (!mTransport.resolveHost(&mServerIP, NULL, mPort)) {
             retval = false;
-            ConsolePrintf("ERROR: SDLNet_ResolveHost(%d): %s\n",
+            ConsolePrintf("ERROR: resolveHost(%d): %s\n",
                           mPort,
-                          SDLNet_GetError());
+                          mTransport.getError());
         }
     }
 
     if (retval) {
-        mServerSocket = SDLNet_UDP_Open(mPort);
-        if (mServerSocket == 0) {
+        if (!mTransport.open(mPort)) {
             retval = false;
-            ConsolePrintf("ERROR: SDLNet_UDP_Open(%d): %s\n",
+            ConsolePrintf("ERROR: open(%d): %s\n",
                           mPort,
-                          SDLNet_GetError());
+                          mTransport.getError());
         }
     }
 
     return retval;
 }
 
-void ServerSocket::shutdown()
+template <class Transport>
+void BasicServerSocket<Transport>::shutdown()
 {
-    if (mClientList) {
-        delete [] mClientList;
-    }
+    mSessions.shutdown();
 
-    if (mServerSocket) {
-        SDLNet_UDP_Close(mServerSocket);
-    }
+    mTransport.close();
 }
 
-ServerPacket* ServerSocket::allocPacket()
+template <class Transport>
+ServerPacket* BasicServerSocket<Transport>::allocPacket()
 {
     ServerPacket *pkt;
 
-    pkt = SDLNet_AllocPacket(mBufferSize);
+    pkt = mTransport.allocPacket(mBufferSize);
     if (pkt == NULL) {
-        ConsolePrintf("ERROR: SDLNet_AllocPacket(%d): %s\n",
+        ConsolePrintf("ERROR: allocPacket(%d): %s\n",
                       mBufferSize,
-                      SDLNet_GetError());
+                      mTransport.getError());
     }
 
     return pkt;
 }
 
-void ServerSocket::freePacket(ServerPacket *pkt)
+template <class Transport>
+void BasicServerSocket<Transport>::freePacket(ServerPacket *pkt)
 {
     if (pkt) {
-        SDLNet_FreePacket(pkt);
+        mTransport.freePacket(pkt);
     }
 }
 
-int ServerSocket::allocClient(IPaddress *address)
+template <class Transport>
+int BasicServerSocket<Transport>::allocClient(IPaddress *address)
 {
-    U32 clientIndex = 0;
-
-    if (address == NULL) {
-        return -1;
-    }
-
-    // find empty slot
-    for (clientIndex=0; clientIndex<mMaxClients; ++clientIndex) {
-        if (!mClientList[clientIndex].used) {
-            // found empty slot
-            break;
-        }
-    }
-
-    if (clientIndex >= mMaxClients) {
-        // too many clients
-        return -1;
-    }
-
-    ++mClientCount;
-    mClientList[clientIndex].used = true;
-    mClientList[clientIndex].address = *address;
-
-    return clientIndex;
+    return mSessions.alloc(address);
 }
 
-void ServerSocket::freeClient(U32 handle)
+template <class Transport>
+void BasicServerSocket<Transport>::freeClient(U32 handle)
 {
-    if (handle >= mMaxClients) {
-        // invalid handle
-        return;
-    }
-
-    if (mClientList[handle].used) {
-        mClientList[handle].clear();
-        --mClientCount;
-    }
+    mSessions.free(handle);
 }
 
-void ServerSocket::setPrivateData(U32 handle, void *ptr)
+template <class Transport>
+void BasicServerSocket<Transport>::setPrivateData(U32 handle, void *ptr)
 {
-    if (handle >= mMaxClients) {
-        // invalid handle
-        return;
-    } else if (mClientList[handle].used) {
-        mClientList[handle].appData = ptr;
-    } else {
-        // invalid handle
-        return;
+    if (mSessions.isUsed(handle)) {
+        mSessions.mAppData[handle] = ptr;
     }
 }
 
-void* ServerSocket::getPrivateData(U32 handle)
+template <class Transport>
+void* BasicServerSocket<Transport>::getPrivateData(U32 handle)
 {
-    if (handle >= mMaxClients) {
-        // invalid handle
-        return NULL;
-    } else if (mClientList[handle].used) {
-        return mClientList[handle].appData;
+    if (mSessions.isUsed(handle)) {
+        return mSessions.mAppData[handle];
     } else {
         // invalid handle
         return NULL;
     }
 }
 
-bool ServerSocket::receiveData(ServerPacket *pkt)
+template <class Transport>
+bool BasicServerSocket<Transport>::receiveData(ServerPacket *pkt)
 {
     int numPkts;
 
@@ -169,7 +124,7 @@ bool ServerSocket::receiveData(ServerPacket *pkt)
         return false;
     }
 
-    numPkts = SDLNet_UDP_Recv(mServerSocket, pkt);
+    numPkts = mTransport.recv(pkt);
     if (numPkts > 0) {
 #ifdef DEBUG_SHOW_RAW_RX_PACKET
         ConsolePrintf("<---- UDP Packet Received\n");
@@ -189,8 +144,8 @@ bool ServerSocket::receiveData(ServerPacket *pkt)
 #endif
         return true;
     } else if (numPkts < 0) {
-        ConsolePrintf("ERROR: SDLNet_UDP_Recv(): %s\n",
-                      SDLNet_GetError());
+        ConsolePrintf("ERROR: recv(): %s\n",
+                      mTransport.getError());
         return false;
     } else {
         // no data
@@ -198,9 +153,9 @@ bool ServerSocket::receiveData(ServerPacket *pkt)
     }
 }
 
-bool ServerSocket::transmitData(int toHandle, ServerPacket *pkt)
+template <class Transport>
+bool BasicServerSocket<Transport>::transmitData(int toHandle, ServerPacket *pkt)
 {
-    int numRecepients;
     IPaddress *toAddress;
 
     if (pkt == NULL) {
@@ -209,67 +164,78 @@ bool ServerSocket::transmitData(int toHandle, ServerPacket *pkt)
 
     toAddress = handleToPeerIPaddress(toHandle);
     if (toAddress) {
-        pkt->address = *toAddress;
-
-#ifdef DEBUG_SHOW_RAW_TX_PACKET
-        ConsolePrintf("----> UDP Packet Transmitted\n");
-        ConsolePrintf("\tChannel: %d\n", pkt->channel);
-        ConsolePrintf("\tLength:  %d\n", pkt->len);
-        ConsolePrintf("\tMaxlen:  %d\n", pkt->maxlen);
-        ConsolePrintf("\tStatus:  %d\n", pkt->status);
-
-        // Host and Port are in network order
-        ConsolePrintf("\tAddress: %d.%d.%d.%d:%d\n",
-                      (pkt->address.host >>  0) & 0xFF,
-                      (pkt->address.host >>  8) & 0xFF,
-                      (pkt->address.host >> 16) & 0xFF,
-                      (pkt->address.host >> 24) & 0xFF,
-                      pkt->address.port);
-        debugDumpMemoryContents(pkt->data, pkt->len);
-#endif
-
-        numRecepients = SDLNet_UDP_Send(mServerSocket, -1, pkt);
-        if (numRecepients == 0) {
-            // unable to send
-            return false;
-        } else {
-            // success
-            return true;
-        }
+        return transmitDataToAddress(toAddress, pkt);
     } else {
         // invalid handle
         return false;
     }
 }
 
-IPaddress* ServerSocket::handleToPeerIPaddress(U32 handle)
+template <class Transport>
+bool BasicServerSocket<Transport>::transmitDataToAddress(IPaddress *toAddress, ServerPacket *pkt)
+{
+    if ((pkt == NULL) || (toAddress == NULL)) {
+        return false;
+    }
+
+    pkt->address = *toAddress;
+
+#ifdef DEBUG_SHOW_RAW_TX_PACKET
+    ConsolePrintf("----> UDP Packet Transmitted\n");
+    ConsolePrintf("\tChannel: %d\n", pkt->channel);
+    ConsolePrintf("\tLength:  %d\n", pkt->len);
+    ConsolePrintf("\tMaxlen:  %d\n", pkt->maxlen);
+    ConsolePrintf("\tStatus:  %d\n", pkt->status);
+
+    // Host and Port are in network order
+    ConsolePrintf("\tAddress: %d.%d.%d.%d:%d\n",
+                  (pkt->address.host >>  0) & 0xFF,
+                  (pkt->address.host >>  8) & 0xFF,
+                  (pkt->address.host >> 16) & 0xFF,
+                  (pkt->address.host >> 24) & 0xFF,
+                  pkt->address.port);
+    debugDumpMemoryContents(pkt->data, pkt->len);
+#endif
+
+    return mTransport.send(pkt);
+}
+
+/**
+ * @brief Hands any sends the transport has queued to the kernel
+ */
+template <class Transport>
+void BasicServerSocket<Transport>::flush()
+{
+    mTransport.flush();
+}
+
+template <class Transport>
+IPaddress* BasicServerSocket<Transport>::handleToPeerIPaddress(U32 handle)
 {
     if (handle >= mMaxClients) {
         // invalid handle
         return NULL;
     }
 
-    return &mClientList[handle].address;
+    return &mSessions.mAddress[handle];
 }
 
-int ServerSocket::peerIPaddressToHandle(IPaddress *address)
+template <class Transport>
+int BasicServerSocket<Transport>::peerIPaddressToHandle(IPaddress *address)
 {
-    int handle = -1;
-
-    for (U32 clientIndex=0; clientIndex<mMaxClients; ++clientIndex) {
-        if (mClientList[clientIndex].address.host == address->host) {
-            if (mClientList[clientIndex].address.port == address->port) {
-                // found match
-                handle = clientIndex;
-                break;
-            }
-        }
-    }
-
-    return handle;
+    return mSessions.find(address);
 }
 
-IPaddress* ServerSocket::getLocalServerIP()
+template <class Transport>
+IPaddress* BasicServerSocket<Transport>::getLocalServerIP()
 {
     return &mServerIP;
 }
+
+template <class Transport>
+Transport* BasicServerSocket<Transport>::getTransport()
+{
+    return &mTransport;
+}
+
+template struct BasicServerSocket<ServerTransport>;
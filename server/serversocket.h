@@ -8,40 +8,36 @@
 
 #include "types.h"
 #include "SDL_net.h"
+#include "servercfg.h"
+#include "transport.h"
+#include "sessiontable.h"
 
-typedef UDPpacket ServerPacket;
+typedef NetPacket ServerPacket;
 
-struct ClientConn
-{
-    bool used;
-    IPaddress address;
-    void *appData;
-
-    void clear() {
-        used = false;
-        address.host = 0;
-        address.port = 0;
-        appData = NULL;
-    }
-};
-
-struct ServerSocket
+/**
+ * @brief Server socket over a transport, see transport.h. Use the
+ *        ServerSocket typedef, the transport is chosen by
+ *        SERVER_TRANSPORT in servercfg.h.
+ */
+template <class Transport>
+struct BasicServerSocket
 {
     U32 mPort;
     U32 mBufferSize;
     U32 mMaxClients;
 
     IPaddress mServerIP;
-    UDPsocket mServerSocket;
+    Transport mTransport;
 
-    ClientConn *mClientList;
-    U32 mClientCount;
+    SessionTable mSessions;
 
     bool init(U32 port, U32 bufferSize, U32 maxClients);
     void shutdown();
 
     bool receiveData(ServerPacket *pkt);
     bool transmitData(int toHandle, ServerPacket *pkt);
+    bool transmitDataToAddress(IPaddress *toAddress, ServerPacket *pkt);
+    void flush();
 
     IPaddress* handleToPeerIPaddress(U32 handle);
     int peerIPaddressToHandle(IPaddress *address);
@@ -56,6 +52,25 @@ struct ServerSocket
     void* getPrivateData(U32 handle);
 
     IPaddress* getLocalServerIP();
+    Transport* getTransport();
 };
 
+#if SERVER_TRANSPORT == TRANSPORT_IOURING
+typedef IoUringTransport ServerBaseTransport;
+#elif SERVER_TRANSPORT == TRANSPORT_LOOP
+typedef LoopTransport ServerBaseTransport;
+#elif SERVER_TRANSPORT == TRANSPORT_POSIX
+typedef PosixUdpTransport ServerBaseTransport;
+#else
+typedef SdlNetTransport ServerBaseTransport;
+#endif
+
+#ifdef SERVER_IMPAIRMENT
+typedef ImpairedTransport<ServerBaseTransport> ServerTransport;
+#else
+typedef ServerBaseTransport ServerTransport;
+#endif
+
+typedef BasicServerSocket<ServerTransport> ServerSocket;
+
 #endif
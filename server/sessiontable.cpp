@@ -0,0 +1,124 @@
+/**
+ * @brief Session table
+ */
+
+#include <string.h>
+#include "sessiontable.h"
+
+/**
+ * @brief Allocates every array for maxSessions slots, all free
+ * @return true if success, otherwise error
+ */
+bool SessionTable::init(U32 maxSessions)
+{
+    mMaxSessions = maxSessions;
+    mCount = 0;
+
+    mAddress = new IPaddress[maxSessions];
+    mFlags = new U8[maxSessions];
+    mTxSeq = new U32[maxSessions];
+    mRxSeq = new U32[maxSessions];
+    mAppData = new void*[maxSessions];
+
+    if ((mAddress == NULL) || (mFlags == NULL) || (mTxSeq == NULL) ||
+        (mRxSeq == NULL) || (mAppData == NULL)) {
+        shutdown();
+        return false;
+    }
+
+    memset(mAddress, 0, sizeof(IPaddress) * maxSessions);
+    memset(mFlags, 0, sizeof(U8) * maxSessions);
+    memset(mTxSeq, 0, sizeof(U32) * maxSessions);
+    memset(mRxSeq, 0, sizeof(U32) * maxSessions);
+    memset(mAppData, 0, sizeof(void*) * maxSessions);
+
+    return true;
+}
+
+void SessionTable::shutdown()
+{
+    delete [] mAddress;
+    delete [] mFlags;
+    delete [] mTxSeq;
+    delete [] mRxSeq;
+    delete [] mAppData;
+
+    mAddress = NULL;
+    mFlags = NULL;
+    mTxSeq = NULL;
+    mRxSeq = NULL;
+    mAppData = NULL;
+
+    mMaxSessions = 0;
+    mCount = 0;
+}
+
+/**
+ * @brief Takes the lowest free slot for address
+ * @return handle if success, otherwise -1
+ */
+int SessionTable::alloc(IPaddress *address)
+{
+    U32 handle;
+
+    if (address == NULL) {
+        return -1;
+    }
+
+    for (handle=0; handle<mMaxSessions; ++handle) {
+        if (!(mFlags[handle] & SESSION_USED)) {
+            // found empty slot
+            break;
+        }
+    }
+
+    if (handle >= mMaxSessions) {
+        // too many sessions
+        return -1;
+    }
+
+    ++mCount;
+    mFlags[handle] = SESSION_USED;
+    mAddress[handle] = *address;
+    mTxSeq[handle] = 0;
+    mRxSeq[handle] = 0;
+    mAppData[handle] = NULL;
+
+    return handle;
+}
+
+void SessionTable::free(U32 handle)
+{
+    if (!isUsed(handle)) {
+        // invalid handle
+        return;
+    }
+
+    --mCount;
+    mFlags[handle] = 0;
+    mAddress[handle].host = 0;
+    mAddress[handle].port = 0;
+    mAppData[handle] = NULL;
+}
+
+/**
+ * @brief Finds the session of a peer address
+ * @return handle if found, otherwise -1
+ */
+int SessionTable::find(IPaddress *address)
+{
+    U32 host = address->host;
+    U16 port = address->port;
+
+    // a free slot's address is 0.0.0.0:0, so a datagram claiming that
+    // address must not match one
+    for (U32 handle=0; handle<mMaxSessions; ++handle) {
+        if ((mAddress[handle].host == host) && (mAddress[handle].port == port) &&
+            (mFlags[handle] & SESSION_USED)) {
+            // found match
+            return handle;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,52 @@
+/**
+ * @brief Per client session state, one slot per handle, laid out as
+ *        parallel arrays. The fields read for every packet and walked
+ *        by every broadcast (address, flags, sequence numbers) each
+ *        sit in their own dense array, so a scan over all sessions
+ *        only touches the bytes it compares. Anything else belongs to
+ *        the application, reached through mAppData.
+ */
+
+#ifndef _SESSIONTABLE_H
+#define _SESSIONTABLE_H
+
+#include "types.h"
+#include "SDL_net.h"
+
+// mFlags bits, the others are the application's and alloc() clears
+// them
+#define SESSION_USED 0x01
+
+struct SessionTable
+{
+    U32 mMaxSessions;
+    U32 mCount;
+
+    // hot
+    IPaddress *mAddress;
+    U8 *mFlags;
+    U32 *mTxSeq;
+    U32 *mRxSeq;
+
+    // cold
+    void **mAppData;
+
+    bool init(U32 maxSessions);
+    void shutdown();
+
+    int alloc(IPaddress *address);
+    void free(U32 handle);
+    int find(IPaddress *address);
+
+    bool isUsed(U32 handle)
+    {
+        return (handle < mMaxSessions) && (mFlags[handle] & SESSION_USED);
+    }
+
+    U32 nextTxSeq(U32 handle)
+    {
+        return ++mTxSeq[handle];
+    }
+};
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @brief Socket drop accounting and buffer autotuning
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "socketmonitor.h"
+#include "metrics.h"
+#include "consoleutil.h"
+
+#ifndef _WIN32
+
+#define SOCKET_SAMPLE_NS ((U64)SERVER_SOCKET_SAMPLE_MS * 1000000ULL)
+
+
+/**
+ * @param socket open socket to watch and tune
+ * @param impairment impairment wrapped around it, NULL if none
+ */
+void SocketMonitor::init(PosixUdpTransport *socket, NetImpairment *impairment)
+{
+    mSocket = socket;
+    mImpairment = impairment;
+
+    // Linux reports twice what was asked for
+    mRecvBytes = socket->getRecvBufferSize() / 2;
+    mSendBytes = socket->getSendBufferSize() / 2;
+
+    mLastDrops = socket->getRxDrops();
+    mLastBusy = 0;
+    mSocketBusy = socket->getTxBusy();
+    mNextNs = 0;
+}
+
+/**
+ * @brief Samples the counters once SERVER_SOCKET_SAMPLE_MS has passed,
+ *        growing a buffer that overflowed since the last sample
+ * @param nowNs current time
+ */
+void SocketMonitor::service(U64 nowNs)
+{
+    U32 drops;
+    U64 busy;
+
+    if (nowNs < mNextNs) {
+        return;
+    }
+    mNextNs = nowNs + SOCKET_SAMPLE_NS;
+
+    drops = mSocket->getRxDrops();
+    gMetrics.setDrops(DROP_KERNEL_RX, drops);
+
+    // the fan-out threads count their own waits in to txBusy
+    busy = mSocket->getTxBusy();
+    gMetrics.countTxBusy(busy - mSocketBusy);
+    mSocketBusy = busy;
+    busy = __atomic_load_n(&gMetrics.txBusy, __ATOMIC_RELAXED);
+
+    if (drops != mLastDrops) {
+        grow(true);
+    }
+    if (busy != mLastBusy) {
+        grow(false);
+    }
+    mLastDrops = drops;
+    mLastBusy = busy;
+
+    if (mImpairment) {
+        gMetrics.setDrops(DROP_RATE_LIMIT, mImpairment->mStats.queueDropped);
+        gMetrics.setDrops(DROP_IMPAIRED,
+                          mImpairment->mStats.lost + mImpairment->mStats.burstLost);
+    }
+
+    gMetrics.setSocketBuffers(mSocket->getRecvBufferSize(),
+                              mSocket->getSendBufferSize());
+}
+
+/**
+ * @brief Doubles the receive or send buffer, within its limit
+ * @return true if the buffer grew
+ */
+bool SocketMonitor::grow(bool receive)
+{
+    U32 *requested = receive ? &mRecvBytes : &mSendBytes;
+    U32 limit = receive ? SERVER_SOCKET_RCVBUF_MAX : SERVER_SOCKET_SNDBUF_MAX;
+    U32 before;
+    U32 after;
+    U32 want;
+
+    if (*requested >= limit) {
+        // as big as it gets
+        return false;
+    }
+
+    want = (*requested < (limit / 2)) ? (*requested * 2) : limit;
+    before = receive ? mSocket->getRecvBufferSize() : mSocket->getSendBufferSize();
+
+#ifdef SO_RCVBUFFORCE
+    // past net.core.rmem_max or wmem_max only with CAP_NET_ADMIN
+    if (!mSocket->setOption(SOL_SOCKET, receive ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, (int)want))
+#endif
+    {
+        if (receive) {
+            mSocket->setRecvBufferSize(want);
+        } else {
+            mSocket->setSendBufferSize(want);
+        }
+    }
+
+    after = receive ? mSocket->getRecvBufferSize() : mSocket->getSendBufferSize();
+    if (after <= before) {
+        // held down by the system limit, stop asking
+        ConsolePrintf("Socket %s buffer stays at %u, the system limit\n",
+                      receive ? "receive" : "send",
+                      after);
+        *requested = limit;
+        return false;
+    }
+
+    *requested = want;
+    gMetrics.countSocketGrow();
+    ConsolePrintf("Socket %s buffer grown to %u\n",
+                  receive ? "receive" : "send",
+                  after);
+
+    return true;
+}
+
+#endif
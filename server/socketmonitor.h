@@ -0,0 +1,40 @@
+/**
+ * @brief Watches the server socket for datagrams lost below the
+ *        protocol. Every SERVER_SOCKET_SAMPLE_MS it copies the
+ *        kernel's receive drop count, refused sends and, with
+ *        SERVER_IMPAIRMENT, the impairment's drops in to gMetrics, so
+ *        the stats tell them apart from the protocol's own. A buffer
+ *        that overflowed since the last sample is doubled, up to
+ *        SERVER_SOCKET_RCVBUF_MAX or SERVER_SOCKET_SNDBUF_MAX.
+ */
+
+#ifndef _SOCKETMONITOR_H
+#define _SOCKETMONITOR_H
+
+#include "types.h"
+#include "servercfg.h"
+#include "transport.h"
+
+#ifndef _WIN32
+
+struct SocketMonitor
+{
+    PosixUdpTransport *mSocket;
+    NetImpairment *mImpairment;     // NULL if not impaired
+
+    U32 mRecvBytes;                 // last size asked for
+    U32 mSendBytes;
+    U32 mLastDrops;
+    U64 mLastBusy;
+    U64 mSocketBusy;                // socket's tx busy already counted
+    U64 mNextNs;
+
+    void init(PosixUdpTransport *socket, NetImpairment *impairment);
+    void service(U64 nowNs);
+
+    bool grow(bool receive);
+};
+
+#endif
+
+#endif
@@ -4,6 +4,14 @@
 #include "consoleutil.h"
 #include "tcprotocol.h"
 #include "servercfg.h"
+#include "messagelog.h"
+#include "metrics.h"
+#include "fanout.h"
+#include "joincookie.h"
+#include "textfilter.h"
+#include "cluster.h"
+#include "trace.h"
+#include "overload.h"
 
 // By commenting out these defines it turns off
 // debugs. Likewise, uncommenting them out will
@@ -12,17 +20,30 @@
 
 #define SERVER_NAME "SERVER"
 
+#define NAME_INDEX_EMPTY (-1)
+
+// server->mSessions flags kept by the protocol, next to SESSION_USED
+#define SESSION_GROUP_PROBED 0x02   // sent a probe through the group
+#define SESSION_GROUP_MEMBER 0x04   // broadcasts go through the group
+
 struct ConsoleCommand
 {
     char cmd[8];
 };
 
+/**
+ * @brief What a joined client has beyond its session. Sequence
+ *        numbers and the address are in server->mSessions, by handle,
+ *        so broadcasts never come here.
+ */
 struct MessengerClient
 {
     U32 handle;
     U32 msgAddr;
-    U32 txSeq;
-    U32 rxSeq;
+
+    // history positions still to be replayed, [replayNext, replayEnd)
+    U32 replayNext;
+    U32 replayEnd;
 
     char name[TC_MAX_NAME_SIZE];
 
@@ -30,14 +51,107 @@ struct MessengerClient
     {
         handle = 0;
         msgAddr = 0;
-        txSeq = 0;
-        rxSeq = 0;
+        replayNext = 0;
+        replayEnd = 0;
         name[0] = '\0';
     }
+};
+
+// Who may send a message type
+enum {
+    JOINED_ANY = 0,
+    JOINED_REQUIRED,        // only a client that has joined
+    JOINED_FORBIDDEN        // only an address that hasn't joined yet
+};
+
+// Any length that fits in the datagram
+#define MESSAGE_ANY_LENGTH 0xFFFFFFFF
+
+typedef bool (*MessageHandlerFn)(ServerSocket *server,
+                                 ServerPacket *pkt,
+                                 MessengerPacket *mpkt,
+                                 MessengerClient *client);
+
+/**
+ * @brief How HandleClientData() checks and dispatches one message
+ *        type. The handler is only called once hdr.length is within
+ *        [minLength, maxLength] and the sender is allowed, with client
+ *        NULL unless the sender has joined. It returns false on a
+ *        fatal error.
+ */
+struct MessageHandler
+{
+    MessageHandlerFn handler;
+    U32 minLength;
+    U32 maxLength;
+    U32 joined;
+    const char *name;       // for errors
+};
+
+struct NameSlot
+{
+    S32 handle;
+    U32 hash;
+};
+
+/**
+ * @brief Open addressed (linear probing) index from client
+ *        name to handle. Names themselves are not copied, they
+ *        are compared against the MessengerClient of the handle.
+ */
+struct NameIndex
+{
+    NameSlot *slots;
+    U32 mask;
+
+    bool init(U32 maxEntries);
+    void shutdown();
+
+    int find(ServerSocket *server, const char *name);
+    bool insert(ServerSocket *server, const char *name, U32 handle);
+    void remove(ServerSocket *server, const char *name);
+
+    static U32 hashName(const char *name);
+};
+
+struct HistoryEntry
+{
+    U32 length;
+    U8 frame[sizeof(MsgrHdr) + sizeof(MsgrText)];
+};
+
+/**
+ * @brief Fixed size ring of the most recent chat frames, stored
+ *        exactly as they went out on the wire. Positions are absolute
+ *        message counts, position p is kept in entries[p % HISTORY_MAX_MESSAGES].
+ */
+struct MessageHistory
+{
+    HistoryEntry entries[HISTORY_MAX_MESSAGES];
+    U32 total;
+
+    void clear()
+    {
+        total = 0;
+    }
+
+    void add(const U8 *frame, U32 length)
+    {
+        HistoryEntry *entry = &entries[total % HISTORY_MAX_MESSAGES];
+
+        entry->length = length;
+        memcpy(entry->frame, frame, length);
+        ++total;
+    }
+
+    U32 oldest()
+    {
+        return (total > HISTORY_MAX_MESSAGES) ? (total - HISTORY_MAX_MESSAGES) : 0;
+    }
 
-    U32 getNextTxSeq()
+    HistoryEntry* get(U32 position)
     {
-        return ++txSeq;
+        return &entries[position % HISTORY_MAX_MESSAGES];
     }
 };
 
@@ -45,19 +159,180 @@ static void sendTextMsg(ServerSocket *server,
                         MessengerClient *client,
                         const char *from,
                         const char *fmt, ...);
+static void sendText(ServerSocket *server,
+                     MessengerClient *client,
+                     U32 fromAddr,
+                     const char *from,
+                     const char *text,
+                     U64 sentNs);
+static void sendDirect(ServerSocket *server,
+                       MessengerClient *client,
+                       U32 fromAddr,
+                       const char *from,
+                       const char *text);
+static void broadcastText(ServerSocket *server,
+                          U32 fromAddr,
+                          const char *from,
+                          const char *text,
+                          U64 sentNs);
+static void sendTextToAddress(ServerSocket *server,
+                              IPaddress *address,
+                              const char *from,
+                              const char *text);
+static void sendCookie(ServerSocket *server, IPaddress *address);
+static void sendBusy(ServerSocket *server, IPaddress *address);
+static void sendGroup(ServerSocket *server, U32 handle, bool probe);
+static bool handleAck(ServerSocket *server,
+                      ServerPacket *pkt,
+                      MessengerPacket *mpkt,
+                      MessengerClient *client);
+static bool handleJoin(ServerSocket *server,
+                       ServerPacket *pkt,
+                       MessengerPacket *mpkt,
+                       MessengerClient *client);
+static bool handleLeave(ServerSocket *server,
+                        ServerPacket *pkt,
+                        MessengerPacket *mpkt,
+                        MessengerClient *client);
+static bool handleText(ServerSocket *server,
+                       ServerPacket *pkt,
+                       MessengerPacket *mpkt,
+                       MessengerClient *client);
+static bool handleDirect(ServerSocket *server,
+                         ServerPacket *pkt,
+                         MessengerPacket *mpkt,
+                         MessengerClient *client);
+static bool handleGroup(ServerSocket *server,
+                        ServerPacket *pkt,
+                        MessengerPacket *mpkt,
+                        MessengerClient *client);
+static bool transmitFrame(ServerSocket *server, U32 handle, ServerPacket *pkt);
+static void deliverBroadcast(ServerSocket *server, ServerPacket *pkt, bool keep);
+static void serviceCluster(ServerSocket *server);
+#if SERVER_FANOUT_THREADS > 0
+static U32 fanoutBroadcast(ServerSocket *server, ServerPacket *pkt);
+#endif
 static bool processLeave(ServerSocket *server, U32 handle);
+#ifdef MSGLOG_ENABLE
+static void loadHistoryFromLog();
+#endif
+static void startReplay(MessengerClient *client);
+static void sendReplay(ServerSocket *server, MessengerClient *client);
+static MessengerClient* findClient(ServerSocket *server, const char *nameOrHandle);
+static U64 textSentNs(const MsgrText *text);
 
 
 static ConsoleCommand gCommandList[] = {
     {"help"},
     {"list"},
     {"kick"},
+    {"msg"},
+    {"stats"},
+    {"trace"},
     {"quit"},
     {""}
 };
 
+// Indexed by hdr.type. A new message type goes in
+// common/messenger.schema, then regenerate common/messenger.h with
+// tools/msggen and add its entry here. A NULL handler is an unknown type.
+static const MessageHandler gHandlers[] = {
+    {NULL,          0,                  0,                  JOINED_ANY,         NULL},
+    {handleAck,     0,                  MESSAGE_ANY_LENGTH, JOINED_ANY,         "ack"},     // TYPE_ACK
+    {handleJoin,    sizeof(MsgrJoin),   sizeof(MsgrJoin),   JOINED_FORBIDDEN,   "join"},    // TYPE_JOIN
+    {handleLeave,   sizeof(MsgrLeave),  sizeof(MsgrLeave),  JOINED_REQUIRED,    "leave"},   // TYPE_LEAVE
+    {handleText,    sizeof(MsgrText),   sizeof(MsgrText),   JOINED_REQUIRED,    "text"},    // TYPE_TEXT
+    {handleDirect,  sizeof(MsgrDirect), sizeof(MsgrDirect), JOINED_REQUIRED,    "direct"},  // TYPE_DIRECT
+    {NULL,          0,                  0,                  JOINED_ANY,         NULL},      // TYPE_COOKIE, server to client only
+    {handleGroup,   sizeof(MsgrGroup),  sizeof(MsgrGroup),  JOINED_REQUIRED,    "group"},   // TYPE_GROUP
+    {NULL,          0,                  0,                  JOINED_ANY,         NULL}       // TYPE_BUSY, server to client only
+};
+
+#define MESSAGE_HANDLER_COUNT (sizeof(gHandlers) / sizeof(gHandlers[0]))
+
+// one MessengerClient per handle, taken while the handle is in use
+static MessengerClient *gClientSlab = NULL;
+static NameIndex gNameIndex;
+static MessageHistory gHistory;
+#ifdef MSGLOG_ENABLE
+static MessageLog gMessageLog;
+static bool gMessageLogOpen = false;
+#endif
+
+#if SERVER_FANOUT_THREADS > 0
+static FanoutPool gFanout;
+static bool gFanoutOpen = false;
+#endif
+
+// Multicast group broadcasts go to, see EnableMulticastBroadcast()
+static IPaddress gGroup;
+static bool gGroupOpen = false;
+// seq of the last frame sent to the group
+static U32 gGroupSeq = 0;
+// sessions with SESSION_GROUP_MEMBER
+static U32 gGroupMembers = 0;
+
+// Other nodes of a federated cluster, see JoinCluster()
+static ClusterLink gCluster;
+static bool gClusterOpen = false;
+
+// number of clients with history left to replay
+static U32 gReplayPending = 0;
+// client the next replay pass starts at, so each gets a turn
+static U32 gReplayCursor = 0;
+
 bool InitMessengerProtocol(ServerSocket *server)
 {
+    gClientSlab = new MessengerClient[server->mMaxClients];
+    if (gClientSlab == NULL) {
+        ConsolePrintf("ERROR: Unable to allocate clients %d\n",
+                      server->mMaxClients);
+        return false;
+    }
+
+    if (!gNameIndex.init(server->mMaxClients)) {
+        ConsolePrintf("ERROR: Unable to allocate name index %d\n",
+                      server->mMaxClients);
+        return false;
+    }
+
+    gJoinCookies.init();
+    InitTextFilter();
+    gHistory.clear();
+    gReplayPending = 0;
+    gReplayCursor = 0;
+    gGroupOpen = false;
+    gGroupSeq = 0;
+    gGroupMembers = 0;
+
+#ifdef MSGLOG_ENABLE
+    // the log is not required to chat, keep going without it
+    gMessageLogOpen = gMessageLog.init(MSGLOG_DIR,
+                                       MSGLOG_SEGMENT_SIZE,
+                                       MSGLOG_SYNC_INTERVAL_MS,
+                                       MSGLOG_KEEP_SEGMENTS);
+    if (gMessageLogOpen) {
+        loadHistoryFromLog();
+    } else {
+        ConsolePrintf("ERROR: Unable to open message log %s\n", MSGLOG_DIR);
+    }
+#endif
+
+#if SERVER_FANOUT_THREADS > 0
+    // only a transport with a plain socket can share it with the
+    // threads, and only with a CPU to spare for them, otherwise every
+    // broadcast stays on the main loop
+    if ((server->getTransport()->getFd() >= 0) &&
+        (FanoutPool::threadsFor(SERVER_FANOUT_THREADS) > 0)) {
+        gFanoutOpen = gFanout.init(server->getTransport()->getFd(),
+                                   SERVER_FANOUT_THREADS,
+                                   server->mMaxClients);
+        if (!gFanoutOpen) {
+            ConsolePrintf("ERROR: Unable to start broadcast fan-out\n");
+        }
+    }
+#endif
+
     ConsolePrintf("Commands begin with \"/\". List commands with \"/help\"\n");
     return true;
 }
@@ -70,16 +345,42 @@ void ShutdownMessengerProtocol(ServerSocket *server)
     }
 
     // Iterate through all clients
-    for (int i=0; i<MAX_CLIENTS; ++i) {
+    for (U32 i=0; i<server->mMaxClients; ++i) {
         MessengerClient *mc = (MessengerClient*)server->getPrivateData(i);
         if (mc) {
             server->setPrivateData(i, NULL);
             server->freeClient(i);
 
             mc->clear();
-            delete mc;
         }
     }
+
+    delete [] gClientSlab;
+    gClientSlab = NULL;
+
+    gGroupOpen = false;
+    gGroupMembers = 0;
+
+    if (gClusterOpen) {
+        gCluster.shutdown();
+        gClusterOpen = false;
+    }
+
+    gNameIndex.shutdown();
+
+#if SERVER_FANOUT_THREADS > 0
+    if (gFanoutOpen) {
+        gFanout.shutdown();
+        gFanoutOpen = false;
+    }
+#endif
+
+#ifdef MSGLOG_ENABLE
+    if (gMessageLogOpen) {
+        gMessageLog.shutdown();
+        gMessageLogOpen = false;
+    }
+#endif
 }
 
 /**
@@ -112,7 +413,7 @@ bool HandleUserInput(ServerSocket *server)
             ConsolePrintf("Client List\n");
 
             // print list
-            for (int i=0; i<MAX_CLIENTS; ++i) {
+            for (U32 i=0; i<server->mMaxClients; ++i) {
                 MessengerClient *client;
 
                 client = (MessengerClient*)server->getPrivateData(i);
@@ -122,8 +423,8 @@ bool HandleUserInput(ServerSocket *server)
                     ConsolePrintf("\t%02d:\t%s\t%6d%6d\n",
                                   i,
                                   client->name,
-                                  client->txSeq,
-                                  client->rxSeq);
+                                  server->mSessions.mTxSeq[i],
+                                  server->mSessions.mRxSeq[i]);
                 }
             }
 
@@ -133,10 +434,12 @@ bool HandleUserInput(ServerSocket *server)
         } else if (!strncmp(buffer, "/kick", strlen("/kick"))) {
             if (length > (int)strlen("/kick")) {
                 MessengerClient *mc;
-                int handle = atoi(&buffer[strlen("/kick") + 1]);
 
-                mc = (MessengerClient*)server->getPrivateData(handle);
+                // handle or name
+                mc = findClient(server, &buffer[strlen("/kick") + 1]);
                 if (mc) {
+                    U32 handle = mc->handle;
+
                     sendTextMsg(server,
                                 mc,
                                 SERVER_NAME,
@@ -150,12 +453,51 @@ bool HandleUserInput(ServerSocket *server)
                                        handle);
                     }
                 } else {
-                    ConsolePrintf("ERROR: Unknown Client %d\n",
-                                  handle);
+                    ConsolePrintf("ERROR: Unknown Client %s\n",
+                                  &buffer[strlen("/kick") + 1]);
                 }
             } else {
                 ConsolePrintf("Missing Client handle\n");
             }
+        } else if (!strncmp(buffer, "/msg ", strlen("/msg "))) {
+            // "/msg" format: name text
+            char *to = &buffer[strlen("/msg ")];
+            char *text = strchr(to, ' ');
+
+            if (text) {
+                MessengerClient *mc;
+
+                *text++ = '\0';
+                mc = findClient(server, to);
+                if (mc) {
+                    // copied out of buffer, sendText() reads a whole
+                    // TC_MAX_TEXT_SIZE
+                    sendTextMsg(server, mc, SERVER_NAME, "%s", text);
+                } else {
+                    ConsolePrintf("ERROR: Unknown Client %s\n", to);
+                }
+            } else {
+                ConsolePrintf("Missing message text\n");
+            }
+        } else if (!strcmp(buffer, "/stats")) {
+            static char report[8192];
+
+            gMetrics.format(report, sizeof(report));
+            ConsolePrintf("%s", report);
+        } else if (!strncmp(buffer, "/trace", strlen("/trace"))) {
+            // "/trace" format: [milliseconds]
+            U32 windowMs = SERVER_TRACE_WINDOW_MS;
+            U32 spans;
+
+            if (length > (int)strlen("/trace")) {
+                windowMs = atoi(&buffer[strlen("/trace") + 1]);
+            }
+
+            spans = TraceDump(SERVER_TRACE_FILE, (U64)windowMs * 1000000ULL);
+            ConsolePrintf("%d spans from the last %d ms in %s\n",
+                          spans,
+                          windowMs,
+                          SERVER_TRACE_FILE);
         } else if (!strcmp(buffer, "/quit")) {
             // user wants to quit
             keepGoing = false;
@@ -167,204 +509,1177 @@ bool HandleUserInput(ServerSocket *server)
 
 
 /**
- * @brief This function handles data from the clients
+ * @brief This function handles data from the clients. Everything a
+ *        message type needs checked is in its gHandlers entry and is
+ *        checked here, once, before its handler runs.
  * @param client pointer to client socket
  * @param pkt pointer to packet received from client
  * @return true to keep going, otherwise, quit the program
  */
 bool HandleClientData(ServerSocket *server, ServerPacket *pkt)
 {
-    bool fatalError = false;
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+    const MessageHandler *entry;
+    MessengerClient *client = NULL;
+    int handle;
 
-    // Determine what client sent
-    if ((U32)pkt->len >= sizeof(MsgrHdr)) {
-        // valid packet
-        MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
-        int handle = server->peerIPaddressToHandle(&pkt->address);
-        switch (mpkt->hdr.type) {
-        case TYPE_ACK:
-            // TODO:
-            // This will not be done for the first part of this.
-            break;
-        case TYPE_JOIN:
-            // Verify message size
-            if (mpkt->hdr.length == sizeof(MsgrJoin)) {
-                if (handle >= 0) {
-                    // client already joined
-                    ConsolePrintf("ERROR: Client[%d] attempting to join again\n",
-                                  handle);
-                    break;
-                }
+    if ((U32)pkt->len < sizeof(MsgrHdr)) {
+        gMetrics.countRx(0, pkt->len);
+        gMetrics.countMalformed(MALFORMED_SHORT_HEADER);
+        ConsolePrintf("ERROR: client sent message with invalid header, %d\n",
+                      pkt->len);
+        return true;
+    }
 
-                handle = server->allocClient(&pkt->address);
-                if (handle >= 0) {
-                    MessengerClient *client = new MessengerClient;
-                    client->clear();
+    gMetrics.countRx(mpkt->hdr.type, pkt->len);
 
-                    client->handle = handle;
-                    client->msgAddr = mpkt->hdr.from;
-                    client->rxSeq = mpkt->hdr.seq;
-                    strncpy(client->name, mpkt->join.name, TC_MAX_NAME_SIZE);
-                    client->name[TC_MAX_NAME_SIZE-1] = '\0';
+    if ((mpkt->hdr.type >= MESSAGE_HANDLER_COUNT) ||
+        (gHandlers[mpkt->hdr.type].handler == NULL)) {
+        gMetrics.countMalformed(MALFORMED_UNKNOWN_TYPE);
+        return true;
+    }
+    entry = &gHandlers[mpkt->hdr.type];
 
-                    server->setPrivateData(handle, client);
+    // Verify message size, against the header and the datagram
+    if ((mpkt->hdr.length < entry->minLength) ||
+        (mpkt->hdr.length > entry->maxLength) ||
+        (mpkt->hdr.length > ((U32)pkt->len - sizeof(MsgrHdr)))) {
+        gMetrics.countMalformed(MALFORMED_BAD_LENGTH);
+        ConsolePrintf("ERROR: client sent %s message of invalid length %d\n",
+                      entry->name,
+                      mpkt->hdr.length);
+        return true;
+    }
 
-                    sendTextMsg(server,
-                                NULL, // broadcast
-                                SERVER_NAME,
-                                "%s has joined",
-                                client->name);
-                } else {
-                    ConsolePrintf("ERROR: Unable to allocate client\n");
-                    fatalError = true;
-                    break;
-                }
-            } else {
-                ConsolePrintf("ERROR: client sent join message of invalid length %d != %d\n",
-                              mpkt->hdr.length,
-                              sizeof(MsgrJoin));
-            }
-            break;
-        case TYPE_LEAVE:
-            // Verify message size
-            if (mpkt->hdr.length == sizeof(MsgrLeave)) {
-                if (handle >= 0) {
-                    if (!processLeave(server, handle)) {
-                        fatalError = true;
-                    }
-                } else {
-                    ConsolePrintf("ERROR: client leaving when they haven't joined yet\n");
-                }
-            } else {
-                ConsolePrintf("ERROR: client sent leave message of invalid length %d != %d\n",
-                              mpkt->hdr.length,
-                              sizeof(MsgrLeave));
-            }
-            break;
-        case TYPE_TEXT:
-            // Verify message size
-            if (mpkt->hdr.length == sizeof(MsgrText)) {
-                if (handle >= 0) {
-                    MessengerClient *client;
-
-                    client = (MessengerClient*)server->getPrivateData(handle);
-                    if (client) {
-                        client->rxSeq = mpkt->hdr.seq;
-                        sendTextMsg(server,
-                                    NULL, // broadcast
-                                    mpkt->text.name,
-                                    mpkt->text.data);
-                    } else {
-                        ConsolePrintf("ERROR: Unable to find client %d data\n",
-                                      handle);
-                        fatalError = true;
-                    }
-                } else {
-                    ConsolePrintf("ERROR: client texting when they haven't joined yet\n");
-                }
-            } else {
-                ConsolePrintf("ERROR: client sent text message of invalid length %d != %d\n",
-                              mpkt->hdr.length,
-                              sizeof(MsgrText));
-            }
-            break;
+    handle = server->peerIPaddressToHandle(&pkt->address);
+
+    if ((entry->joined == JOINED_REQUIRED) && (handle < 0)) {
+        gMetrics.countMalformed(MALFORMED_NOT_JOINED);
+        ConsolePrintf("ERROR: client sent %s when they haven't joined yet\n",
+                      entry->name);
+        return true;
+    }
+
+    if ((entry->joined == JOINED_FORBIDDEN) && (handle >= 0)) {
+        gMetrics.countMalformed(MALFORMED_ALREADY_JOINED);
+        ConsolePrintf("ERROR: Client[%d] sent %s but has already joined\n",
+                      handle,
+                      entry->name);
+        return true;
+    }
+
+    if (handle >= 0) {
+        server->mSessions.mRxSeq[handle] = mpkt->hdr.seq;
+
+        client = (MessengerClient*)server->getPrivateData(handle);
+        if (client == NULL) {
+            ConsolePrintf("ERROR: Unable to find client %d data\n",
+                          handle);
+            return false;
         }
-    } else {
-        ConsolePrintf("ERROR: client sent message with invalid header, %d\n",
-                      pkt->len);
     }
 
-    if (fatalError) {
-        // error
-        return false;
+    if (gTraceId) {
+        U64 beginNs = timeNowNs();
+        bool keepGoing = entry->handler(server, pkt, mpkt, client);
+
+        TraceStop(TRACE_HANDLE, beginNs, mpkt->hdr.type);
+        return keepGoing;
     }
 
-    return true;
+    return entry->handler(server, pkt, mpkt, client);
 }
 
 
-void sendTextMsg(ServerSocket *server,
-                 MessengerClient *client,
-                 const char *from,
-                 const char *fmt, ...)
+bool handleAck(ServerSocket *server,
+               ServerPacket *pkt,
+               MessengerPacket *mpkt,
+               MessengerClient *client)
 {
-    char text[TC_MAX_TEXT_SIZE*2];
-    va_list args;
+    // TODO:
+    // This will not be done for the first part of this.
+    return true;
+}
 
-    va_start(args, fmt);
-    vsprintf(text, fmt, args);
+/**
+ * @brief First JOIN gets a cookie, the second, echoing it, joins
+ */
+bool handleJoin(ServerSocket *server,
+                ServerPacket *pkt,
+                MessengerPacket *mpkt,
+                MessengerClient *client)
+{
+    char name[TC_MAX_NAME_SIZE];
+    int handle;
 
-    if (client == NULL) {
-        // Iterate through all clients
-        for (int i=0; i<MAX_CLIENTS; ++i) {
-            MessengerClient *mc = (MessengerClient*)server->getPrivateData(i);
-            if (mc) {
-                sendTextMsg(server, mc, from, text);
-            }
-        }
+    if (gOverload.level() >= OVERLOAD_SEVERE) {
+        // no new sessions until the load drops, and like the
+        // cookie this keeps nothing about the sender
+        gMetrics.countShed(SHED_JOIN, 1);
+        sendBusy(server, &pkt->address);
+        return true;
+    }
 
-        ConsolePrintf("%s: %s\n", from, text);
-    } else {
-        ServerPacket *pkt = server->allocPacket();
-        if (pkt) {
-            MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+    if (!gJoinCookies.verify(&pkt->address, timeNowNs(), mpkt->join.cookie)) {
+        // first of the two JOINs, or the cookie is stale.
+        // Nothing is kept about the sender until it
+        // echoes the cookie, so a spoofed flood only
+        // costs a hash and a reply no bigger than the JOIN
+        sendCookie(server, &pkt->address);
+        return true;
+    }
+
+    // the name goes out with everything the client sends
+    SanitizeText(name, mpkt->join.name, TC_MAX_NAME_SIZE);
+
+    if (name[0] == '#') {
+        // "#12" is how a handle is written, see findClient()
+        gMetrics.countMalformed(MALFORMED_BAD_NAME);
+        sendTextToAddress(server,
+                          &pkt->address,
+                          SERVER_NAME,
+                          "Names can't start with #");
+        return true;
+    }
 
-            // Header
-            mpkt->hdr.to = client->handle;
-            mpkt->hdr.from = 0; // Server
-            mpkt->hdr.length = sizeof(MsgrText);
-            mpkt->hdr.seq = client->getNextTxSeq();
-            mpkt->hdr.type = TYPE_TEXT;
+    if (gNameIndex.find(server, name) >= 0) {
+        // name already taken, tell the sender since
+        // they don't have a handle yet
+        gMetrics.countMalformed(MALFORMED_NAME_IN_USE);
+        ConsolePrintf("ERROR: Client name %s already in use\n",
+                      name);
+        sendTextToAddress(server,
+                          &pkt->address,
+                          SERVER_NAME,
+                          "Name is already in use");
+        return true;
+    }
 
-            // Text NAME
-            strncpy(mpkt->text.name, client->name, TC_MAX_NAME_SIZE);
-            mpkt->text.name[TC_MAX_NAME_SIZE - 1] = '\0';
+    handle = server->allocClient(&pkt->address);
+    if (handle < 0) {
+        // every handle is taken, anyone with a cookie can get here
+        // so it must not stop the server. Come back later.
+        gMetrics.countMalformed(MALFORMED_SERVER_FULL);
+        sendBusy(server, &pkt->address);
+        return true;
+    }
 
-            // Text DATA
-            strncpy(mpkt->text.data, text, TC_MAX_TEXT_SIZE);
-            mpkt->text.data[TC_MAX_TEXT_SIZE - 1] = '\0';
+    client = &gClientSlab[handle];
+    client->clear();
 
-            // Pkt Hdr
-            pkt->len = sizeof(MsgrHdr) + mpkt->hdr.length;
+    client->handle = handle;
+    client->msgAddr = mpkt->hdr.from;
+    server->mSessions.mRxSeq[handle] = mpkt->hdr.seq;
+    strncpy(client->name, name, TC_MAX_NAME_SIZE);
 
-            if (!server->transmitData(client->handle, pkt)) {
-                ConsolePrintf("ERROR: Unable to send to client %d\n",
-                              client->handle);
-            }
+    server->setPrivateData(handle, client);
+    gNameIndex.insert(server, client->name, handle);
 
-            server->freePacket(pkt);
+    sendTextMsg(server,
+                NULL, // broadcast
+                SERVER_NAME,
+                "%s has joined",
+                client->name);
+
+    startReplay(client);
+
+    if (gGroupOpen) {
+        // the client may take broadcasts from the group instead
+        sendGroup(server, handle, false);
+    }
+
+    return true;
+}
+
+bool handleLeave(ServerSocket *server,
+                 ServerPacket *pkt,
+                 MessengerPacket *mpkt,
+                 MessengerClient *client)
+{
+    return processLeave(server, client->handle);
+}
+
+bool handleText(ServerSocket *server,
+                ServerPacket *pkt,
+                MessengerPacket *mpkt,
+                MessengerClient *client)
+{
+    U64 sentNs = textSentNs(&mpkt->text);
+
+    // the author's clock against ours, skipped when they disagree
+    if ((sentNs != 0) && (pkt->rxTimestampNs >= sentNs)) {
+        gMetrics.clientToServerNs.record(pkt->rxTimestampNs - sentNs);
+    }
+
+    if (mpkt->hdr.to >= TO_ADDRESS_HANDLE_BASE) {
+        // unicast to a single client by handle
+        MessengerClient *to;
+
+        to = (MessengerClient*)server->getPrivateData(
+                mpkt->hdr.to - TO_ADDRESS_HANDLE_BASE);
+        if (to) {
+            sendText(server,
+                     to,
+                     TO_ADDRESS_HANDLE_BASE + client->handle,
+                     client->name,
+                     mpkt->text.data,
+                     sentNs);
+        } else {
+            gMetrics.countMalformed(MALFORMED_UNKNOWN_RECIPIENT);
+            ConsolePrintf("ERROR: client %d texting unknown address %d\n",
+                          client->handle,
+                          mpkt->hdr.to);
         }
+    } else if (gOverload.level() >= OVERLOAD_MODERATE) {
+        // the whole room is the biggest fan-out there is, it goes
+        // first
+        gMetrics.countShed(SHED_BROADCAST, 1);
+    } else {
+        broadcastText(server,
+                      TO_ADDRESS_HANDLE_BASE + client->handle,
+                      client->name,
+                      mpkt->text.data,
+                      sentNs);
     }
-    va_end(args);
+
+    return true;
 }
 
-bool processLeave(ServerSocket *server, U32 handle)
+bool handleDirect(ServerSocket *server,
+                  ServerPacket *pkt,
+                  MessengerPacket *mpkt,
+                  MessengerClient *client)
 {
-    bool fatalError = false;
-    MessengerClient *client;
+    char toName[TC_MAX_NAME_SIZE];
+    int toHandle;
 
-    client = (MessengerClient*)server->getPrivateData(handle);
-    if (client) {
-        server->setPrivateData(handle, NULL);
-        server->freeClient(handle);
+    strncpy(toName, mpkt->direct.to, TC_MAX_NAME_SIZE);
+    toName[TC_MAX_NAME_SIZE-1] = '\0';
 
+    toHandle = gNameIndex.find(server, toName);
+    if (toHandle >= 0) {
+        sendDirect(server,
+                   (MessengerClient*)server->getPrivateData(toHandle),
+                   TO_ADDRESS_HANDLE_BASE + client->handle,
+                   client->name,
+                   mpkt->direct.data);
+    } else {
+        gMetrics.countMalformed(MALFORMED_UNKNOWN_RECIPIENT);
         sendTextMsg(server,
-                    NULL, // broadcast
+                    client,
                     SERVER_NAME,
-                    "%s has left",
-                    client->name);
+                    "Unknown client %s",
+                    toName);
+    }
 
-        client->clear();
-        delete client;
-    } else {
-        ConsolePrintf("ERROR: Unable to find client %d data\n",
-                      handle);
-        fatalError = true;
+    return true;
+}
+
+/**
+ * @brief A client in the multicast group. The first GROUP from it is
+ *        answered with a probe through the group, the second means
+ *        the probe arrived, so its broadcasts move to the group.
+ */
+bool handleGroup(ServerSocket *server,
+                 ServerPacket *pkt,
+                 MessengerPacket *mpkt,
+                 MessengerClient *client)
+{
+    U8 *flags = &server->mSessions.mFlags[client->handle];
+
+    if (!gGroupOpen || (*flags & SESSION_GROUP_MEMBER)) {
+        // nothing to do
+        return true;
     }
 
-    if (fatalError) {
-        return false;
+    if (!(*flags & SESSION_GROUP_PROBED)) {
+        *flags |= SESSION_GROUP_PROBED;
+        sendGroup(server, client->handle, true);
     } else {
-        return true;
+        *flags |= SESSION_GROUP_MEMBER;
+        ++gGroupMembers;
+
+        // broadcasts after gGroupSeq come through the group
+        sendGroup(server, client->handle, false);
     }
+
+    return true;
+}
+
+
+/**
+ * @return when the author sent the text, wall clock, 0 if unknown
+ */
+static U64 textSentNs(const MsgrText *text)
+{
+    return ((U64)text->sentSec * 1000000000ULL) + text->sentNsec;
+}
+
+/**
+ * @brief Serializes a TEXT message in to the packet, the text is
+ *        cleaned on the way (see textfilter.h)
+ * @param pkt packet to fill in
+ * @param to destination message address
+ * @param fromAddr source message address
+ * @param seq sequence number for the destination
+ * @param from name of the sender
+ * @param text null terminated text, in a buffer of at least
+ *        TC_MAX_TEXT_SIZE bytes
+ * @param sentNs when the author sent it, wall clock, 0 if unknown
+ */
+static void buildTextFrame(ServerPacket *pkt,
+                           U32 to,
+                           U32 fromAddr,
+                           U32 seq,
+                           const char *from,
+                           const char *text,
+                           U64 sentNs)
+{
+    MsgrText *body = EncodeText((MessengerPacket*)pkt->data, to, fromAddr, seq);
+
+    body->sentSec = (U32)(sentNs / 1000000000ULL);
+    body->sentNsec = (U32)(sentNs % 1000000000ULL);
+
+    // Text NAME
+    strncpy(body->name, from, TC_MAX_NAME_SIZE);
+    body->name[TC_MAX_NAME_SIZE - 1] = '\0';
+
+    // Text DATA
+    SanitizeText(body->data, text, TC_MAX_TEXT_SIZE);
+
+    // Pkt Hdr
+    pkt->len = MSGR_TEXT_FRAME_SIZE;
+}
+
+/**
+ * @brief Sends text to a single client, exactly one transmit. Like
+ *        every text sender it reads a whole TC_MAX_TEXT_SIZE buffer.
+ */
+void sendText(ServerSocket *server,
+              MessengerClient *client,
+              U32 fromAddr,
+              const char *from,
+              const char *text,
+              U64 sentNs)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        buildTextFrame(pkt,
+                       TO_ADDRESS_HANDLE_BASE + client->handle,
+                       fromAddr,
+                       server->mSessions.nextTxSeq(client->handle),
+                       from,
+                       text,
+                       sentNs);
+
+        if (!transmitFrame(server, client->handle, pkt)) {
+            ConsolePrintf("ERROR: Unable to send to client %d\n",
+                          client->handle);
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+/**
+ * @brief Passes a DIRECT on to its recipient, exactly one transmit.
+ *        It stays a DIRECT so the client can tell it was private.
+ */
+void sendDirect(ServerSocket *server,
+                MessengerClient *client,
+                U32 fromAddr,
+                const char *from,
+                const char *text)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        MsgrDirect *body = EncodeDirect((MessengerPacket*)pkt->data,
+                                        TO_ADDRESS_HANDLE_BASE + client->handle,
+                                        fromAddr,
+                                        server->mSessions.nextTxSeq(client->handle));
+
+        strncpy(body->name, from, TC_MAX_NAME_SIZE);
+        body->name[TC_MAX_NAME_SIZE - 1] = '\0';
+        strncpy(body->to, client->name, TC_MAX_NAME_SIZE);
+        body->to[TC_MAX_NAME_SIZE - 1] = '\0';
+        SanitizeText(body->data, text, TC_MAX_TEXT_SIZE);
+        pkt->len = MSGR_DIRECT_FRAME_SIZE;
+
+        if (!transmitFrame(server, client->handle, pkt)) {
+            ConsolePrintf("ERROR: Unable to send to client %d\n",
+                          client->handle);
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+/**
+ * @brief Sends text to every joined client, and to the other nodes
+ *        of the cluster for theirs
+ */
+void broadcastText(ServerSocket *server,
+                   U32 fromAddr,
+                   const char *from,
+                   const char *text,
+                   U64 sentNs)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        // keep chat from clients, not server notices, for late joiners
+        bool keep = (fromAddr >= TO_ADDRESS_HANDLE_BASE);
+
+        // serialize once, only the destination fields differ per client
+        buildTextFrame(pkt, TO_ADDRESS_BROADCAST, fromAddr, 0, from, text, sentNs);
+
+        if (gClusterOpen &&
+            !gCluster.relay(pkt->data, pkt->len,
+                            keep ? CLUSTER_RECORD_HISTORY : 0)) {
+            ConsolePrintf("ERROR: Unable to relay to the cluster\n");
+        }
+
+        deliverBroadcast(server, pkt, keep);
+        server->freePacket(pkt);
+    }
+
+    ConsolePrintf("%s: %s\n", from, text);
+}
+
+/**
+ * @brief Sends a serialized broadcast frame to every joined client
+ * @param keep add it to the history and message log
+ */
+void deliverBroadcast(ServerSocket *server, ServerPacket *pkt, bool keep)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+    SessionTable *sessions = &server->mSessions;
+    U32 recipients = 0;
+    bool sent = false;
+
+    if (keep) {
+        gHistory.add(pkt->data, pkt->len);
+#ifdef MSGLOG_ENABLE
+        if (gMessageLogOpen) {
+            gMessageLog.append(pkt->data, pkt->len);
+        }
+#endif
+    }
+
+    // once for every client in the multicast group
+    if (gGroupMembers > 0) {
+        mpkt->hdr.to = TO_ADDRESS_BROADCAST;
+        mpkt->hdr.seq = ++gGroupSeq;
+
+        if (server->transmitDataToAddress(&gGroup, pkt)) {
+            gMetrics.countTx(TYPE_TEXT, pkt->len);
+        } else {
+            gMetrics.countTxError();
+            ConsolePrintf("ERROR: Unable to send to multicast group\n");
+        }
+        ++recipients;
+    }
+
+#if SERVER_FANOUT_THREADS > 0
+    if (gFanoutOpen &&
+        ((sessions->mCount - gGroupMembers) >= SERVER_FANOUT_MIN_RECIPIENTS)) {
+        recipients += fanoutBroadcast(server, pkt);
+        sent = true;
+    }
+#endif
+
+    // Iterate through the clients outside the group, every
+    // session in use has joined
+    for (U32 i=0; !sent && (i<sessions->mMaxSessions); ++i) {
+        if ((sessions->mFlags[i] & (SESSION_USED | SESSION_GROUP_MEMBER)) == SESSION_USED) {
+            mpkt->hdr.to = TO_ADDRESS_HANDLE_BASE + i;
+            mpkt->hdr.seq = sessions->nextTxSeq(i);
+
+            if (!transmitFrame(server, i, pkt)) {
+                ConsolePrintf("ERROR: Unable to send to client %d\n",
+                              i);
+            }
+            ++recipients;
+        }
+    }
+
+    gMetrics.fanout.record(recipients);
+}
+
+#if SERVER_FANOUT_THREADS > 0
+/**
+ * @brief Sends a broadcast frame through the fan-out threads. Every
+ *        seq is taken here, up front, and anything still queued in
+ *        the transport goes out first, so each client sees its
+ *        frames in order.
+ * @return number of recipients
+ */
+U32 fanoutBroadcast(ServerSocket *server, ServerPacket *pkt)
+{
+    FanoutTarget *targets = gFanout.getTargets();
+    SessionTable *sessions = &server->mSessions;
+    FanoutStats stats;
+    U32 count = 0;
+
+    server->flush();
+
+    for (U32 i=0; i<sessions->mMaxSessions; ++i) {
+        if ((sessions->mFlags[i] & (SESSION_USED | SESSION_GROUP_MEMBER)) == SESSION_USED) {
+            targets[count].address = sessions->mAddress[i];
+            targets[count].to = TO_ADDRESS_HANDLE_BASE + i;
+            targets[count].seq = sessions->nextTxSeq(i);
+            ++count;
+        }
+    }
+
+    gFanout.send(pkt->data, pkt->len, count, &stats);
+    gMetrics.countTxBatch(TYPE_TEXT, stats.sent, stats.bytes, stats.errors);
+    gMetrics.countTxBusy(stats.busy);
+
+    if (stats.errors > 0) {
+        ConsolePrintf("ERROR: Broadcast failed to %llu of %d clients\n",
+                      stats.errors,
+                      count);
+    }
+
+    return count;
+}
+#endif
+
+/**
+ * @brief Sends text to an address that has no client handle,
+ *        the frame is not sequenced.
+ */
+void sendTextToAddress(ServerSocket *server,
+                       IPaddress *address,
+                       const char *from,
+                       const char *text)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        char buffer[TC_MAX_TEXT_SIZE];
+
+        // text may be shorter than buildTextFrame() reads
+        strncpy(buffer, text, TC_MAX_TEXT_SIZE - 1);
+        buffer[TC_MAX_TEXT_SIZE - 1] = '\0';
+        buildTextFrame(pkt, TO_ADDRESS_SERVER, TO_ADDRESS_SERVER, 0, from, buffer, 0);
+
+        if (server->transmitDataToAddress(address, pkt)) {
+            gMetrics.countTx(TYPE_TEXT, pkt->len);
+        } else {
+            gMetrics.countTxError();
+            ConsolePrintf("ERROR: Unable to send to unjoined client\n");
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+/**
+ * @brief Sends a join cookie to an address that has no client
+ *        handle, the frame is not sequenced.
+ */
+void sendCookie(ServerSocket *server, IPaddress *address)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        MsgrCookie *body = EncodeCookie((MessengerPacket*)pkt->data,
+                                        TO_ADDRESS_SERVER,
+                                        TO_ADDRESS_SERVER,
+                                        0);
+
+        gJoinCookies.issue(address, timeNowNs(), body->cookie);
+        pkt->len = MSGR_COOKIE_FRAME_SIZE;
+
+        if (server->transmitDataToAddress(address, pkt)) {
+            gMetrics.countTx(TYPE_COOKIE, pkt->len);
+        } else {
+            gMetrics.countTxError();
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+/**
+ * @brief Tells an address its JOIN was turned away, for overload or a
+ *        full client table, and when to try again
+ */
+void sendBusy(ServerSocket *server, IPaddress *address)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        MsgrBusy *body = EncodeBusy((MessengerPacket*)pkt->data,
+                                    TO_ADDRESS_SERVER,
+                                    TO_ADDRESS_SERVER,
+                                    0);
+
+        body->retryMs = SERVER_OVERLOAD_BUSY_RETRY_MS;
+        pkt->len = MSGR_BUSY_FRAME_SIZE;
+
+        if (server->transmitDataToAddress(address, pkt)) {
+            gMetrics.countTx(TYPE_BUSY, pkt->len);
+        } else {
+            gMetrics.countTxError();
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+/**
+ * @brief Sends a GROUP naming the multicast group and its last seq,
+ *        sequenced to the client, or as a probe for the client
+ *        through the group itself, unsequenced
+ */
+void sendGroup(ServerSocket *server, U32 handle, bool probe)
+{
+    ServerPacket *pkt = server->allocPacket();
+    if (pkt) {
+        MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+        MsgrGroup *body;
+        bool sent;
+
+        body = EncodeGroup(mpkt,
+                           TO_ADDRESS_HANDLE_BASE + handle,
+                           TO_ADDRESS_SERVER,
+                           probe ? 0 : server->mSessions.nextTxSeq(handle));
+
+        // Host and Port are in network order
+        body->host = gGroup.host;
+        body->port = gGroup.port;
+        body->reserved = 0;
+        body->seq = gGroupSeq;
+        pkt->len = MSGR_GROUP_FRAME_SIZE;
+
+        if (probe) {
+            sent = server->transmitDataToAddress(&gGroup, pkt);
+            if (sent) {
+                gMetrics.countTx(TYPE_GROUP, pkt->len);
+            } else {
+                gMetrics.countTxError();
+            }
+        } else {
+            sent = transmitFrame(server, handle, pkt);
+        }
+
+        if (!sent) {
+            ConsolePrintf("ERROR: Unable to send group to client %d\n",
+                          handle);
+        }
+
+        server->freePacket(pkt);
+    }
+}
+
+void sendTextMsg(ServerSocket *server,
+                 MessengerClient *client,
+                 const char *from,
+                 const char *fmt, ...)
+{
+    char text[TC_MAX_TEXT_SIZE*2];
+    va_list args;
+    U64 traceNs = TraceStart();
+
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    TraceStop(TRACE_FORMAT, traceNs, 0);
+
+    if (client == NULL) {
+        broadcastText(server, TO_ADDRESS_SERVER, from, text, 0);
+    } else {
+        sendText(server, client, TO_ADDRESS_SERVER, from, text, 0);
+    }
+}
+
+/**
+ * @brief Transmits a packet to a client and counts it by the
+ *        type of its first frame
+ * @return true if success, otherwise error
+ */
+bool transmitFrame(ServerSocket *server, U32 handle, ServerPacket *pkt)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+    U64 traceNs = TraceStart();
+    bool sent = server->transmitData(handle, pkt);
+
+    TraceStop(TRACE_TRANSMIT, traceNs, handle);
+
+    if (sent) {
+        gMetrics.countTx(mpkt->hdr.type, pkt->len);
+        return true;
+    } else {
+        gMetrics.countTxError();
+        return false;
+    }
+}
+
+bool processLeave(ServerSocket *server, U32 handle)
+{
+    bool fatalError = false;
+    MessengerClient *client;
+
+    client = (MessengerClient*)server->getPrivateData(handle);
+    if (client) {
+        gNameIndex.remove(server, client->name);
+
+        if (server->mSessions.mFlags[handle] & SESSION_GROUP_MEMBER) {
+            --gGroupMembers;
+        }
+
+        if (client->replayNext < client->replayEnd) {
+            // leaving before replay finished
+            --gReplayPending;
+        }
+
+        server->setPrivateData(handle, NULL);
+        server->freeClient(handle);
+
+        sendTextMsg(server,
+                    NULL, // broadcast
+                    SERVER_NAME,
+                    "%s has left",
+                    client->name);
+
+        // back to the slab
+        client->clear();
+    } else {
+        ConsolePrintf("ERROR: Unable to find client %d data\n",
+                      handle);
+        fatalError = true;
+    }
+
+    if (fatalError) {
+        return false;
+    } else {
+        return true;
+    }
+}
+
+/**
+ * @brief Performs periodic work, flushing the message log, trading
+ *        broadcasts with the rest of the cluster and pacing history
+ *        replay so a join doesn't stall the main loop.
+ */
+void ServiceMessengerProtocol(ServerSocket *server)
+{
+    U32 budget = HISTORY_REPLAY_BURST;
+
+    if (gOverload.level() >= OVERLOAD_MILD) {
+        budget = SERVER_OVERLOAD_REPLAY_BURST;
+    }
+
+#ifdef MSGLOG_ENABLE
+    if (gMessageLogOpen) {
+        gMessageLog.service(timeNowNs() / 1000000);
+    }
+#endif
+
+    if (gClusterOpen) {
+        serviceCluster(server);
+    }
+
+    if (gReplayPending == 0) {
+        // nothing to do
+        return;
+    }
+
+    if (budget < HISTORY_REPLAY_BURST) {
+        // overloaded, the rest of the turn waits
+        gMetrics.countShed(SHED_REPLAY, 1);
+    }
+
+    // round robin over clients, one datagram per client per turn
+    for (U32 n=0; (n<server->mMaxClients) && (budget > 0) && (gReplayPending > 0); ++n) {
+        MessengerClient *mc;
+
+        gReplayCursor = (gReplayCursor + 1) % server->mMaxClients;
+        mc = (MessengerClient*)server->getPrivateData(gReplayCursor);
+        if (mc && (mc->replayNext < mc->replayEnd)) {
+            sendReplay(server, mc);
+            --budget;
+        }
+    }
+}
+
+/**
+ * @brief Delivers broadcasts relayed by the other nodes to our
+ *        clients, and sends our own once they have waited long enough
+ */
+void serviceCluster(ServerSocket *server)
+{
+    const U8 *frame;
+    U32 length;
+    U32 flags;
+
+    while ((frame = gCluster.next(&length, &flags)) != NULL) {
+        MessengerPacket *relayed = (MessengerPacket*)frame;
+        ServerPacket *pkt;
+
+        if (!IsValidText(&relayed->hdr, length)) {
+            gMetrics.countCluster(CLUSTER_RX_REJECTED, 1);
+            continue;
+        }
+
+        if (gOverload.level() >= OVERLOAD_MODERATE) {
+            // shed like our own broadcasts
+            gMetrics.countShed(SHED_BROADCAST, 1);
+            continue;
+        }
+
+        pkt = server->allocPacket();
+        if (pkt) {
+            MsgrText *text = &((MessengerPacket*)pkt->data)->text;
+
+            // the sender's handle is only good on its own node
+            buildTextFrame(pkt,
+                           TO_ADDRESS_BROADCAST,
+                           TO_ADDRESS_SERVER,
+                           0,
+                           relayed->text.name,
+                           relayed->text.data,
+                           textSentNs(&relayed->text));
+            deliverBroadcast(server, pkt, (flags & CLUSTER_RECORD_HISTORY) != 0);
+
+            ConsolePrintf("%s: %s\n", text->name, text->data);
+            server->freePacket(pkt);
+        }
+    }
+
+    if (gOverload.level() >= OVERLOAD_MILD) {
+        // more frames to a datagram
+        if (gCluster.flush(timeNowNs(), CLUSTER_LINGER_NS * SERVER_OVERLOAD_LINGER_SCALE, false)) {
+            gMetrics.countShed(SHED_COALESCE, 1);
+        }
+    } else {
+        gCluster.flush(timeNowNs(), CLUSTER_LINGER_NS, false);
+    }
+}
+
+/**
+ * @brief Joins a federated cluster: broadcasts from here on are
+ *        relayed to every other node, and theirs delivered to our
+ *        clients, so a room spans the whole cluster
+ * @param node index of this node in nodes
+ * @param nodes server to server address of every node, see
+ *        SERVER_CLUSTER_NODES
+ * @return true if success, otherwise error
+ */
+bool JoinCluster(ServerSocket *server, U32 node, const char *nodes)
+{
+    if (gClusterOpen) {
+        gCluster.shutdown();
+        gClusterOpen = false;
+    }
+
+    gClusterOpen = gCluster.init(node, nodes);
+
+    return gClusterOpen;
+}
+
+/**
+ * @brief Offers clients that join from now on a multicast group to
+ *        take broadcasts from. The socket has to be set up to send
+ *        multicast already, see main().
+ * @param group IPv4 multicast address
+ * @param port group port in host order
+ * @return true if success, otherwise error
+ */
+bool EnableMulticastBroadcast(ServerSocket *server, const char *group, U32 port)
+{
+    IPaddress address;
+    U32 first;
+
+    if (!server->getTransport()->resolveHost(&address, group, port)) {
+        ConsolePrintf("ERROR: resolveHost(%s): %s\n",
+                      group,
+                      server->getTransport()->getError());
+        return false;
+    }
+
+    // Host is in network order, 224.0.0.0/4 is multicast
+    first = address.host & 0xFF;
+    if ((first < 224) || (first > 239)) {
+        ConsolePrintf("ERROR: %s is not a multicast address\n", group);
+        return false;
+    }
+
+    gGroup = address;
+    gGroupSeq = 0;
+    gGroupMembers = 0;
+    gGroupOpen = true;
+
+    return true;
+}
+
+#ifdef MSGLOG_ENABLE
+/**
+ * @brief Fills the history ring with the newest frames from the
+ *        message log, so history survives a server restart.
+ */
+void loadHistoryFromLog()
+{
+    MessageLogReader reader;
+    const U8 *data;
+    U32 length;
+    U64 seq;
+    U64 first = 1;
+
+    if (gMessageLog.mNextSeq > HISTORY_MAX_MESSAGES) {
+        first = gMessageLog.mNextSeq - HISTORY_MAX_MESSAGES;
+    }
+
+    if (reader.open(MSGLOG_DIR) && reader.seek(first)) {
+        while (reader.next(&data, &length, &seq)) {
+            if (length <= sizeof(gHistory.entries[0].frame)) {
+                gHistory.add(data, length);
+            }
+        }
+    }
+
+    reader.close();
+}
+#endif
+
+/**
+ * @brief Marks the most recent history for replay to a new client
+ */
+void startReplay(MessengerClient *client)
+{
+    U32 oldest = gHistory.oldest();
+
+    client->replayEnd = gHistory.total;
+    if (client->replayEnd > HISTORY_REPLAY_MESSAGES) {
+        client->replayNext = client->replayEnd - HISTORY_REPLAY_MESSAGES;
+    } else {
+        client->replayNext = 0;
+    }
+
+    if (client->replayNext < oldest) {
+        client->replayNext = oldest;
+    }
+
+    if (client->replayNext < client->replayEnd) {
+        ++gReplayPending;
+    }
+}
+
+/**
+ * @brief Sends the client one datagram with as many history frames
+ *        as fit. Stored frames are copied as is, only the destination
+ *        and sequence number are patched.
+ */
+void sendReplay(ServerSocket *server, MessengerClient *client)
+{
+    ServerPacket *pkt = server->allocPacket();
+    U32 offset = 0;
+
+    if (pkt == NULL) {
+        return;
+    }
+
+    // skip anything overwritten since the client joined
+    if (client->replayNext < gHistory.oldest()) {
+        client->replayNext = gHistory.oldest();
+    }
+
+    while (client->replayNext < client->replayEnd) {
+        HistoryEntry *entry = gHistory.get(client->replayNext);
+        MessengerPacket *mpkt;
+
+        if ((offset + entry->length) > server->mBufferSize) {
+            // datagram full
+            break;
+        }
+
+        memcpy(&pkt->data[offset], entry->frame, entry->length);
+
+        mpkt = (MessengerPacket*)&pkt->data[offset];
+        mpkt->hdr.to = TO_ADDRESS_HANDLE_BASE + client->handle;
+        mpkt->hdr.seq = server->mSessions.nextTxSeq(client->handle);
+
+        offset += entry->length;
+        ++client->replayNext;
+    }
+
+    if (client->replayNext >= client->replayEnd) {
+        // replay complete
+        --gReplayPending;
+    }
+
+    if (offset > 0) {
+        pkt->len = offset;
+        if (!transmitFrame(server, client->handle, pkt)) {
+            ConsolePrintf("ERROR: Unable to send to client %d\n",
+                          client->handle);
+        }
+    }
+
+    server->freePacket(pkt);
+}
+
+/**
+ * @brief Looks up a client by name, or by handle written as "#12".
+ *        No name starts with '#', handleJoin() turns those away.
+ * @return NULL if not found, otherwise the client
+ */
+MessengerClient* findClient(ServerSocket *server, const char *nameOrHandle)
+{
+    char name[TC_MAX_NAME_SIZE];
+    int handle;
+
+    if (nameOrHandle[0] == '#') {
+        if ((nameOrHandle[1] < '0') || (nameOrHandle[1] > '9')) {
+            return NULL;
+        }
+        return (MessengerClient*)server->getPrivateData(atoi(&nameOrHandle[1]));
+    }
+
+    strncpy(name, nameOrHandle, TC_MAX_NAME_SIZE);
+    name[TC_MAX_NAME_SIZE-1] = '\0';
+
+    handle = gNameIndex.find(server, name);
+    if (handle < 0) {
+        return NULL;
+    }
+
+    return (MessengerClient*)server->getPrivateData(handle);
+}
+
+
+/**
+ * @brief Allocates the index, sized to keep the load factor at or below 1/2
+ * @param maxEntries maximum number of names that will be inserted
+ * @return true if success, otherwise error
+ */
+bool NameIndex::init(U32 maxEntries)
+{
+    U32 size = 2;
+
+    while (size < (maxEntries * 2)) {
+        size <<= 1;
+    }
+
+    slots = new NameSlot[size];
+    if (slots == NULL) {
+        return false;
+    }
+
+    mask = size - 1;
+    for (U32 i=0; i<size; ++i) {
+        slots[i].handle = NAME_INDEX_EMPTY;
+        slots[i].hash = 0;
+    }
+
+    return true;
+}
+
+void NameIndex::shutdown()
+{
+    if (slots) {
+        delete [] slots;
+        slots = NULL;
+    }
+}
+
+/**
+ * @brief FNV-1a hash of a name
+ */
+U32 NameIndex::hashName(const char *name)
+{
+    U32 hash = 2166136261u;
+
+    for (U32 i=0; (i<TC_MAX_NAME_SIZE) && name[i]; ++i) {
+        hash ^= (U8)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Finds the handle of the client using name
+ * @return handle if found, otherwise -1
+ */
+int NameIndex::find(ServerSocket *server, const char *name)
+{
+    U32 hash = hashName(name);
+
+    for (U32 i=hash & mask; slots[i].handle != NAME_INDEX_EMPTY; i=(i+1) & mask) {
+        if (slots[i].hash == hash) {
+            MessengerClient *mc;
+
+            mc = (MessengerClient*)server->getPrivateData(slots[i].handle);
+            if (mc && !strncmp(mc->name, name, TC_MAX_NAME_SIZE)) {
+                // found match
+                return slots[i].handle;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Adds name to the index, the caller must have
+ *        already verified the name isn't present.
+ * @return true if success, otherwise error
+ */
+bool NameIndex::insert(ServerSocket *server, const char *name, U32 handle)
+{
+    U32 hash = hashName(name);
+    U32 i = hash & mask;
+
+    // load factor is at most 1/2 so there is always an empty slot
+    while (slots[i].handle != NAME_INDEX_EMPTY) {
+        i = (i + 1) & mask;
+    }
+
+    slots[i].handle = handle;
+    slots[i].hash = hash;
+
+    return true;
+}
+
+/**
+ * @brief Removes name from the index. Entries after it in the
+ *        probe sequence are shifted back so no tombstones are needed.
+ */
+void NameIndex::remove(ServerSocket *server, const char *name)
+{
+    U32 hash = hashName(name);
+    U32 i;
+
+    for (i=hash & mask; slots[i].handle != NAME_INDEX_EMPTY; i=(i+1) & mask) {
+        if (slots[i].hash == hash) {
+            MessengerClient *mc;
+
+            mc = (MessengerClient*)server->getPrivateData(slots[i].handle);
+            if (mc && !strncmp(mc->name, name, TC_MAX_NAME_SIZE)) {
+                break;
+            }
+        }
+    }
+
+    if (slots[i].handle == NAME_INDEX_EMPTY) {
+        // not found
+        return;
+    }
+
+    // backward shift deletion
+    for (U32 j=(i+1) & mask; slots[j].handle != NAME_INDEX_EMPTY; j=(j+1) & mask) {
+        U32 home = slots[j].hash & mask;
+
+        // move j in to the hole at i unless its home lies in (i, j]
+        bool inRange = (i <= j) ? ((home > i) && (home <= j))
+                                : ((home > i) || (home <= j));
+        if (!inRange) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i].handle = NAME_INDEX_EMPTY;
+    slots[i].hash = 0;
 }
@@ -0,0 +1,768 @@
+/**
+ * @brief Text payload filter
+ */
+
+#include <string.h>
+#include "textfilter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXTFILTER_X86
+#include <immintrin.h>
+#endif
+
+static U32 filterSse2(char *dst, const char *src, U32 size);
+static U32 filterAvx2(char *dst, const char *src, U32 size);
+static U32 sanitizeSse2(char *dst, const char *src, U32 size);
+static U32 sanitizeAvx2(char *dst, const char *src, U32 size);
+
+TextFilterFn gTextFilter = SanitizeTextScalar;
+static const char *gTextFilterName = "scalar";
+
+
+/**
+ * @brief Picks the widest implementation the CPU runs
+ */
+void InitTextFilter()
+{
+#ifdef TEXTFILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        gTextFilter = filterAvx2;
+        gTextFilterName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        gTextFilter = filterSse2;
+        gTextFilterName = "sse2";
+    }
+#endif
+}
+
+const char* TextFilterName()
+{
+    return gTextFilterName;
+}
+
+
+/**
+ * @brief Copies the one character at src to dst, or drops it, never
+ *        reading available bytes or more
+ * @param copied set to the bytes written to dst
+ * @return bytes of src used
+ */
+static U32 sanitizeChar(char *dst, const U8 *src, U32 available, U32 *copied)
+{
+    U8 c = src[0];
+    U32 extra;
+    U32 cp;
+    U32 lowest;
+
+    if (c < 0x80) {
+        *copied = ((c >= 0x20) && (c != 0x7F)) ? 1 : 0;
+        dst[0] = c;
+        return 1;
+    }
+
+    *copied = 1;
+    dst[0] = '?';
+
+    if ((c & 0xE0) == 0xC0) {
+        extra = 1;
+        cp = c & 0x1F;
+        lowest = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        extra = 2;
+        cp = c & 0x0F;
+        lowest = 0x800;
+    } else if ((c & 0xF8) == 0xF0) {
+        extra = 3;
+        cp = c & 0x07;
+        lowest = 0x10000;
+    } else {
+        // stray continuation or invalid lead byte
+        return 1;
+    }
+
+    for (U32 i=1; i<=extra; ++i) {
+        // a cut off sequence also ends here, the terminator is
+        // not a continuation byte
+        if ((i >= available) || ((src[i] & 0xC0) != 0x80)) {
+            return 1;
+        }
+        cp = (cp << 6) | (src[i] & 0x3F);
+    }
+
+    if ((cp < lowest) || (cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF))) {
+        // overlong, out of range or a surrogate
+        return 1;
+    }
+
+    if ((cp >= 0x80) && (cp <= 0x9F)) {
+        *copied = 0;
+    } else {
+        memcpy(dst, src, extra + 1);
+        *copied = extra + 1;
+    }
+    return extra + 1;
+}
+
+/**
+ * @brief Character at a time from in, then zero fills dst
+ */
+static inline U32 sanitizeTail(char *dst, U32 out, const U8 *src, U32 in, U32 size)
+{
+    U32 limit = size - 1;
+    U32 copied;
+
+    while ((in < limit) && src[in]) {
+        U8 c = src[in];
+
+        if ((c >= 0x20) && (c < 0x7F)) {
+            dst[out++] = c;
+            ++in;
+            continue;
+        }
+        in += sanitizeChar(&dst[out], &src[in], limit - in, &copied);
+        out += copied;
+    }
+
+    memset(&dst[out], 0, size - out);
+
+    return out;
+}
+
+U32 SanitizeTextScalar(char *dst, const char *src, U32 size)
+{
+    if (size == 0) {
+        return 0;
+    }
+
+    return sanitizeTail(dst, 0, (const U8*)src, 0, size);
+}
+
+
+#ifdef TEXTFILTER_X86
+
+// Each vector pass below copies whole blocks of printable ASCII and
+// valid UTF-8. At the first byte that isn't, the block is still stored
+// but only the bytes before it count, then that one character goes
+// through sanitizeChar(). out never passes in, so a block store at out
+// stays inside dst.
+//
+// There a block with bytes from 0x80 up is classed into bit masks, one
+// bit per byte: continuation bytes, the leads of 2, 3 and 4 byte
+// sequences and the few leads that limit their second byte. textMask()
+// then keeps each sequence that is whole in the block and copies
+// unchanged. A sequence cut by the end of the block is left to
+// sanitizeChar(), which reads on past it.
+//
+// Blocks may cover src[size - 1], which is never part of the text.
+// Only a printable ASCII block copies it, one for one, so it's taken
+// back off the end. Any other block drops it before looking for
+// sequences, so none ends on it.
+//
+// Clean text, nearly all chat, first goes through a fast path when
+// size is a multiple of the block.
+// Blocks are checked and stored whole until one holds a byte that
+// doesn't count. For clean text that byte is the terminator. Its block
+// is stored with everything from the terminator on zeroed, and the
+// blocks after it are stored as zeros. So dst is written once, with no
+// per character work and no memset. Any other byte gives up, and the
+// slow path then writes dst again from the start. The fast path is
+// kept apart from the slow one so clean text doesn't pay for the slow
+// path's stack frame. A TEXT payload, four AVX2 blocks, is checked all
+// at once with a single branch, the loop costs a mispredict at its
+// last block. Its UTF-8 is checked with byte shuffles, which SSE2
+// doesn't have, so there only ASCII takes the fast path.
+//
+// Adding 1 moves printable ASCII, 0x20 to 0x7E, to the only bytes
+// above 0x20 as signed, so one compare finds them.
+
+// Loaded from [32 - n], keeps the first n bytes of a block
+static const U8 gTextKeep[64] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/**
+ * @brief One bit per byte of a block, for textMask()
+ */
+struct TextClasses
+{
+    U32 ascii;          // printable ASCII
+    U32 cont;           // 0x80 to 0xBF
+    U32 lead2;          // 0xC2 to 0xDF
+    U32 lead3;          // 0xE0 to 0xEF
+    U32 lead4;          // 0xF0 to 0xF4
+    U32 minA0;          // 0xE0 and 0xC2, the next byte is 0xA0 up
+    U32 min90;          // 0xF0, the next byte is 0x90 up
+    U32 maxA0;          // 0xED, the next byte is below 0xA0
+    U32 max90;          // 0xF4, the next byte is below 0x90
+    U32 belowA0;        // 0x80 to 0x9F
+    U32 below90;        // 0x80 to 0x8F
+};
+
+// Nothing after the block, a sequence doesn't continue past it
+static const TextClasses gTextNone = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+/**
+ * @brief Bits of the bytes of two blocks, lo then hi, that are
+ *        printable ASCII or in a sequence sanitizeChar() would copy
+ *        unchanged, whole in the two
+ */
+static inline U64 textMask(const TextClasses *lo, const TextClasses *hi)
+{
+    U64 ascii = lo->ascii | ((U64)hi->ascii << 32);
+    U64 cont = lo->cont | ((U64)hi->cont << 32);
+    U64 lead2 = lo->lead2 | ((U64)hi->lead2 << 32);
+    U64 lead3 = lo->lead3 | ((U64)hi->lead3 << 32);
+    U64 lead4 = lo->lead4 | ((U64)hi->lead4 << 32);
+    U64 belowA0 = lo->belowA0 | ((U64)hi->belowA0 << 32);
+    U64 below90 = lo->below90 | ((U64)hi->below90 << 32);
+    // second bytes that make the sequence overlong, a surrogate,
+    // above U+10FFFF or a C1 control
+    U64 bad = (((lo->minA0 | ((U64)hi->minA0 << 32)) << 1) & belowA0) |
+              (((lo->min90 | ((U64)hi->min90 << 32)) << 1) & below90) |
+              (((lo->maxA0 | ((U64)hi->maxA0 << 32)) << 1) & ~belowA0) |
+              (((lo->max90 | ((U64)hi->max90 << 32)) << 1) & ~below90);
+    U64 second = (cont & ~bad) >> 1;
+    U64 seq2 = lead2 & second;
+    U64 seq3 = lead3 & second & (cont >> 2);
+    U64 seq4 = lead4 & second & (cont >> 2) & (cont >> 3);
+
+    return ascii | seq2 | (seq2 << 1) |
+           seq3 | (seq3 << 1) | (seq3 << 2) |
+           seq4 | (seq4 << 1) | (seq4 << 2) | (seq4 << 3);
+}
+
+// As signed bytes continuation bytes are -128 to -65, and the leads
+// -62 to -33, -32 to -17 and -16 to -12. Only the first count bytes of
+// the block are classed.
+
+__attribute__((target("sse2")))
+static inline void classesSse2(TextClasses *c, __m128i block, U32 ascii, U32 count)
+{
+    U32 valid = (1U << count) - 1;
+
+    c->ascii = ascii & valid;
+    c->cont = (U32)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-64), block)) & valid;
+    c->lead2 = (U32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(-63)),
+                                                    _mm_cmpgt_epi8(_mm_set1_epi8(-32), block)));
+    c->lead3 = (U32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(-33)),
+                                                    _mm_cmpgt_epi8(_mm_set1_epi8(-16), block)));
+    c->lead4 = (U32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(-17)),
+                                                    _mm_cmpgt_epi8(_mm_set1_epi8(-11), block)));
+    c->minA0 = (U32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xE0)),
+                                                   _mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xC2))));
+    c->min90 = (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xF0)));
+    c->maxA0 = (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xED)));
+    c->max90 = (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8((char)0xF4)));
+    c->belowA0 = (U32)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-96), block));
+    c->below90 = (U32)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-112), block));
+}
+
+__attribute__((target("avx2")))
+static inline void classesAvx2(TextClasses *c, __m256i block, U32 ascii, U32 count)
+{
+    U32 valid = (count < 32) ? ((1U << count) - 1) : 0xFFFFFFFF;
+
+    c->ascii = ascii & valid;
+    c->cont = (U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), block)) & valid;
+    c->lead2 = (U32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8(-63)),
+                                                          _mm256_cmpgt_epi8(_mm256_set1_epi8(-32), block)));
+    c->lead3 = (U32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8(-33)),
+                                                          _mm256_cmpgt_epi8(_mm256_set1_epi8(-16), block)));
+    c->lead4 = (U32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8(-17)),
+                                                          _mm256_cmpgt_epi8(_mm256_set1_epi8(-11), block)));
+    c->minA0 = (U32)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xE0)),
+                                                         _mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xC2))));
+    c->min90 = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xF0)));
+    c->maxA0 = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xED)));
+    c->max90 = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)0xF4)));
+    c->belowA0 = (U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-96), block));
+    c->below90 = (U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-112), block));
+}
+
+__attribute__((target("sse2")))
+static inline bool cleanSse2(char *dst, const U8 *src, U32 size, U32 *length)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i block;
+    __m128i keep;
+    U32 other;
+    U32 end;
+    U32 in;
+
+    for (in=0; ; in+=16) {
+        block = _mm_loadu_si128((const __m128i*)&src[in]);
+        other = ~(U32)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_add_epi8(block, one), space)) & 0xFFFF;
+        if ((in + 16) == size) {
+            // src[size - 1] is never text, it counts as the terminator
+            other |= 1U << 15;
+        }
+        if (other != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*)&dst[in], block);
+    }
+
+    end = __builtin_ctz(other);
+    if (((in + end) < (size - 1)) && (src[in + end] != 0)) {
+        return false;
+    }
+    keep = _mm_loadu_si128((const __m128i*)&gTextKeep[32 - end]);
+    _mm_storeu_si128((__m128i*)&dst[in], _mm_and_si128(block, keep));
+    *length = in + end;
+
+    for (in+=16; in<size; in+=16) {
+        _mm_storeu_si128((__m128i*)&dst[in], zero);
+    }
+
+    return true;
+}
+
+__attribute__((target("avx2")))
+static inline bool cleanAvx2(char *dst, const U8 *src, U32 size, U32 *length)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i block;
+    __m256i keep;
+    U32 other;
+    U32 end;
+    U32 in;
+
+    for (in=0; ; in+=32) {
+        block = _mm256_loadu_si256((const __m256i*)&src[in]);
+        other = ~(U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_add_epi8(block, one), space));
+        if ((in + 32) == size) {
+            other |= 1U << 31;
+        }
+        if (other != 0) {
+            break;
+        }
+        _mm256_storeu_si256((__m256i*)&dst[in], block);
+    }
+
+    end = __builtin_ctz(other);
+    if (((in + end) < (size - 1)) && (src[in + end] != 0)) {
+        return false;
+    }
+    keep = _mm256_loadu_si256((const __m256i*)&gTextKeep[32 - end]);
+    _mm256_storeu_si256((__m256i*)&dst[in], _mm256_and_si256(block, keep));
+    *length = in + end;
+
+    for (in+=32; in<size; in+=32) {
+        _mm256_storeu_si256((__m256i*)&dst[in], zero);
+    }
+
+    return true;
+}
+
+__attribute__((target("sse2")))
+U32 filterSse2(char *dst, const char *src, U32 size)
+{
+    U32 length;
+
+    if (((size % 16) == 0) && (size > 0) && cleanSse2(dst, (const U8*)src, size, &length)) {
+        return length;
+    }
+
+    return sanitizeSse2(dst, src, size);
+}
+
+/**
+ * @brief Keeps the bytes of the block at `at` that come before end
+ */
+__attribute__((target("avx2")))
+static inline __m256i keepAvx2(__m256i block, U32 end, U32 at)
+{
+    U32 n = (end <= at) ? 0 : (((end - at) > 32) ? 32 : (end - at));
+
+    return _mm256_and_si256(block, _mm256_loadu_si256((const __m256i*)&gTextKeep[32 - n]));
+}
+
+// Error bits of utf8ErrorsAvx2(), from Keiser and Lemire's lookup
+// check. Each is set in all three tables for a pair of bytes that
+// can't follow one another, so the three looked up values of a byte
+// and the one before it only share a bit for a bad pair.
+enum
+{
+    UTF8_TOO_SHORT = 1 << 0,        // 11______ then 0_______ or 11______
+    UTF8_TOO_LONG = 1 << 1,         // 0_______ then 10______
+    UTF8_OVERLONG_3 = 1 << 2,       // 11100000 then 100_____
+    UTF8_TOO_LARGE = 1 << 3,        // 11110100 then 1001____ or 101_____, or higher leads
+    UTF8_SURROGATE = 1 << 4,        // 11101101 then 101_____
+    UTF8_OVERLONG_2 = 1 << 5,       // 1100000_ then 10______
+    UTF8_TOO_LARGE_1000 = 1 << 6,   // 11110101 and up then 1000____
+    UTF8_OVERLONG_4 = 1 << 6,       // 11110000 then 1000____
+    UTF8_TWO_CONTS = 1 << 7,        // 10______ then 10______
+    UTF8_CARRY = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS
+};
+
+/**
+ * @brief Flags each byte of block that isn't valid UTF-8 after the
+ *        bytes before it, the end of before, or is the second byte of
+ *        a C1 control. A third or fourth byte that isn't a
+ *        continuation is flagged too, so a sequence cut short is
+ *        flagged at the byte that cuts it.
+ */
+__attribute__((target("avx2")))
+static inline __m256i utf8ErrorsAvx2(__m256i block, __m256i before)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i firstHigh = _mm256_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        (char)(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        (char)(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4));
+    const __m256i firstLow = _mm256_setr_epi8(
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2),
+        (char)UTF8_CARRY,
+        (char)UTF8_CARRY,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        (char)(UTF8_CARRY | UTF8_OVERLONG_2),
+        (char)UTF8_CARRY,
+        (char)UTF8_CARRY,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000));
+    const __m256i secondHigh = _mm256_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    __m256i joined = _mm256_permute2x128_si256(before, block, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(block, joined, 15);
+    __m256i prev2 = _mm256_alignr_epi8(block, joined, 14);
+    __m256i prev3 = _mm256_alignr_epi8(block, joined, 13);
+    __m256i pairs;
+    __m256i must;
+    __m256i c1;
+
+    pairs = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(firstHigh, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                         _mm256_shuffle_epi8(firstLow, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(secondHigh, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble)));
+    // third bytes of 3 and 4 byte sequences and fourth bytes of 4 byte
+    // ones are continuations after continuations, which set TWO_CONTS
+    must = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                            _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)))),
+                            _mm256_set1_epi8((char)0x80));
+    // C2 80 to C2 9F
+    c1 = _mm256_and_si256(_mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xC2)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(-96), block));
+
+    return _mm256_or_si256(_mm256_xor_si256(pairs, must), c1);
+}
+
+/**
+ * @brief Bits of the bytes of block that are printable ASCII or valid
+ *        UTF-8, and of its zeros that end the text whole
+ */
+__attribute__((target("avx2")))
+static inline U32 utf8TextAvx2(__m256i block, __m256i before, U32 *ends)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i valid = _mm256_cmpeq_epi8(utf8ErrorsAvx2(block, before), zero);
+    __m256i text = _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_add_epi8(block, _mm256_set1_epi8(1)),
+                                                     _mm256_set1_epi8(0x20)),
+                                   _mm256_cmpgt_epi8(zero, block));
+
+    *ends = (U32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block, zero), valid));
+    return (U32)_mm256_movemask_epi8(_mm256_and_si256(text, valid));
+}
+
+/**
+ * @brief cleanAvx2x4() for text with bytes from 0x80 up, taking
+ *        valid UTF-8 as well. Out of line, its frame would slow the
+ *        ASCII path.
+ */
+__attribute__((target("avx2"), noinline))
+static bool cleanUtf8Avx2x4(char *dst, const U8 *src, U32 *length)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i*)&src[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)&src[32]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)&src[64]);
+    __m256i d = _mm256_loadu_si256((const __m256i*)&src[96]);
+    // src[127] becomes a zero, so a sequence can't take it and the
+    // text ends there at the latest
+    __m256i last = _mm256_and_si256(d, _mm256_loadu_si256((const __m256i*)&gTextKeep[1]));
+    U32 endA;
+    U32 endB;
+    U32 endC;
+    U32 endD;
+    U64 low;
+    U64 high;
+    U64 ends;
+    U32 end;
+
+    low = (U64)utf8TextAvx2(a, _mm256_setzero_si256(), &endA) |
+          ((U64)utf8TextAvx2(b, a, &endB) << 32);
+    high = (U64)utf8TextAvx2(c, b, &endC) |
+           ((U64)utf8TextAvx2(last, c, &endD) << 32);
+    low = ~low;
+    high = ~high;
+
+    // the first byte that isn't text must be a zero that ends a
+    // whole sequence
+    if (low != 0) {
+        end = __builtin_ctzll(low);
+        ends = endA | ((U64)endB << 32);
+    } else {
+        end = 64 + __builtin_ctzll(high);
+        ends = endC | ((U64)endD << 32);
+    }
+    if (((ends >> (end % 64)) & 1) == 0) {
+        return false;
+    }
+
+    _mm256_storeu_si256((__m256i*)&dst[0], keepAvx2(a, end, 0));
+    _mm256_storeu_si256((__m256i*)&dst[32], keepAvx2(b, end, 32));
+    _mm256_storeu_si256((__m256i*)&dst[64], keepAvx2(c, end, 64));
+    _mm256_storeu_si256((__m256i*)&dst[96], keepAvx2(d, end, 96));
+    *length = end;
+    return true;
+}
+
+/**
+ * @brief cleanAvx2() unrolled for exactly four blocks
+ */
+__attribute__((target("avx2")))
+static inline bool cleanAvx2x4(char *dst, const U8 *src, U32 *length)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i space = _mm256_set1_epi8(0x20);
+    __m256i a = _mm256_loadu_si256((const __m256i*)&src[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i*)&src[32]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)&src[64]);
+    __m256i d = _mm256_loadu_si256((const __m256i*)&src[96]);
+    U64 low;
+    U64 high;
+    U32 end;
+
+    if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d))) != 0) {
+        return cleanUtf8Avx2x4(dst, src, length);
+    }
+
+    low = (U64)(U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_add_epi8(a, one), space)) |
+          ((U64)(U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_add_epi8(b, one), space)) << 32);
+    high = (U64)(U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_add_epi8(c, one), space)) |
+           ((U64)(U32)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_add_epi8(d, one), space)) << 32);
+    low = ~low;
+    // src[127] is never text, it counts as the terminator
+    high = ~high | (1ULL << 63);
+
+    end = (low != 0) ? __builtin_ctzll(low) : (64 + __builtin_ctzll(high));
+    if ((end < 127) && (src[end] != 0)) {
+        return false;
+    }
+
+    _mm256_storeu_si256((__m256i*)&dst[0], keepAvx2(a, end, 0));
+    _mm256_storeu_si256((__m256i*)&dst[32], keepAvx2(b, end, 32));
+    _mm256_storeu_si256((__m256i*)&dst[64], keepAvx2(c, end, 64));
+    _mm256_storeu_si256((__m256i*)&dst[96], keepAvx2(d, end, 96));
+    *length = end;
+    return true;
+}
+
+__attribute__((target("avx2")))
+U32 filterAvx2(char *dst, const char *src, U32 size)
+{
+    U32 length;
+
+    if (size == 128) {
+        if (cleanAvx2x4(dst, (const U8*)src, &length)) {
+            return length;
+        }
+    } else if (((size % 32) == 0) && (size > 0) && cleanAvx2(dst, (const U8*)src, size, &length)) {
+        return length;
+    }
+
+    return sanitizeAvx2(dst, src, size);
+}
+
+__attribute__((target("sse2"), noinline))
+U32 sanitizeSse2(char *dst, const char *src, U32 size)
+{
+    const U8 *in8 = (const U8*)src;
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(0x7F);
+    U32 limit = size - 1;
+    U32 in = 0;
+    U32 out = 0;
+    U32 copied;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    while ((in + 16) <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i*)&in8[in]);
+        // signed compares, so bytes from 0x80 up fail the first
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(block, low),
+                                          _mm_cmplt_epi8(block, high));
+        U32 mask = (U32)_mm_movemask_epi8(printable);
+
+        if ((mask != 0xFFFF) && (_mm_movemask_epi8(block) != 0)) {
+            TextClasses classes;
+
+            classesSse2(&classes, block, mask, ((in + 16) > limit) ? (limit - in) : 16);
+            mask = (U32)textMask(&classes, &gTextNone);
+        }
+
+        _mm_storeu_si128((__m128i*)&dst[out], block);
+
+        if (mask == 0xFFFF) {
+            in += 16;
+            out += 16;
+            continue;
+        }
+
+        mask = __builtin_ctz(~mask);
+        in += mask;
+        out += mask;
+        if ((in >= limit) || (in8[in] == 0)) {
+            break;
+        }
+        in += sanitizeChar(&dst[out], &in8[in], limit - in, &copied);
+        out += copied;
+    }
+
+    if (in > limit) {
+        out -= in - limit;
+        in = limit;
+    }
+
+    return sanitizeTail(dst, out, in8, in, size);
+}
+
+__attribute__((target("avx2"), noinline))
+U32 sanitizeAvx2(char *dst, const char *src, U32 size)
+{
+    const U8 *in8 = (const U8*)src;
+    const __m256i low = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(0x7F);
+    U32 limit = size - 1;
+    U32 in = 0;
+    U32 out = 0;
+    U32 copied;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    while ((in + 32) <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)&in8[in]);
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(block, low),
+                                             _mm256_cmpgt_epi8(high, block));
+        U32 mask = (U32)_mm256_movemask_epi8(printable);
+
+        if ((mask != 0xFFFFFFFF) && (_mm256_movemask_epi8(block) != 0)) {
+            TextClasses classes;
+
+            classesAvx2(&classes, block, mask, ((in + 32) > limit) ? (limit - in) : 32);
+            mask = (U32)textMask(&classes, &gTextNone);
+        }
+
+        _mm256_storeu_si256((__m256i*)&dst[out], block);
+
+        if (mask == 0xFFFFFFFF) {
+            in += 32;
+            out += 32;
+            continue;
+        }
+
+        mask = __builtin_ctz(~mask);
+        in += mask;
+        out += mask;
+        if ((in >= limit) || (in8[in] == 0)) {
+            break;
+        }
+        in += sanitizeChar(&dst[out], &in8[in], limit - in, &copied);
+        out += copied;
+    }
+
+    if (in > limit) {
+        out -= in - limit;
+        in = limit;
+    }
+
+    // finish the last partial block 16 bytes at a time
+    if ((in < limit) && in8[in]) {
+        out += sanitizeSse2(&dst[out], &src[in], size - in);
+    }
+
+    memset(&dst[out], 0, size - out);
+
+    return out;
+}
+
+#else
+
+U32 filterSse2(char *dst, const char *src, U32 size)
+{
+    return SanitizeTextScalar(dst, src, size);
+}
+
+U32 filterAvx2(char *dst, const char *src, U32 size)
+{
+    return SanitizeTextScalar(dst, src, size);
+}
+
+U32 sanitizeSse2(char *dst, const char *src, U32 size)
+{
+    return SanitizeTextScalar(dst, src, size);
+}
+
+U32 sanitizeAvx2(char *dst, const char *src, U32 size)
+{
+    return SanitizeTextScalar(dst, src, size);
+}
+
+#endif
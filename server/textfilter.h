@@ -0,0 +1,41 @@
+/**
+ * @brief Cleans text from clients before it is sent on to others,
+ *        whose consoles print it as is. One pass copies the text up
+ *        to its terminator, drops control bytes (C0, DEL and C1) and
+ *        replaces each byte that doesn't start valid UTF-8 with '?'.
+ *        Runs of printable ASCII and valid UTF-8 are checked and
+ *        copied 16 (SSE2) or 32 (AVX2) bytes at a time, picked at
+ *        startup by InitTextFilter(), anything else a character at a
+ *        time. Clean ASCII, and with AVX2 any clean text, is copied
+ *        once without the character pass.
+ */
+
+#ifndef _TEXTFILTER_H
+#define _TEXTFILTER_H
+
+#include "types.h"
+
+typedef U32 (*TextFilterFn)(char *dst, const char *src, U32 size);
+
+extern TextFilterFn gTextFilter;
+
+void InitTextFilter();
+const char* TextFilterName();
+
+U32 SanitizeTextScalar(char *dst, const char *src, U32 size);
+
+/**
+ * @brief Copies the text in src to dst, cleaned. dst is always
+ *        terminated and zero filled to size, like strncpy.
+ * @param dst size bytes, must not overlap src
+ * @param src size readable bytes, the text ends at the first zero
+ *        or at size - 1 bytes
+ * @param size of both buffers
+ * @return length of the text in dst
+ */
+inline U32 SanitizeText(char *dst, const char *src, U32 size)
+{
+    return gTextFilter(dst, src, size);
+}
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * @brief Sampled span tracing
+ */
+
+#include <stdio.h>
+#include "trace.h"
+#include "consoleutil.h"
+
+U32 gTraceId = 0;
+
+static U32 gTraceCountdown = SERVER_TRACE_SAMPLE;
+static U32 gTraceNextId = 0;
+
+static TraceRing *gTraceRings[TRACE_MAX_THREADS];
+static U32 gTraceRingCount = 0;
+
+// this thread's ring, made on its first span
+static __thread TraceRing *tTraceRing = NULL;
+static __thread bool tTraceNoRing = false;
+
+static const char *gTraceStageNames[TRACE_STAGE_COUNT] = {
+    "receive",
+    "handle",
+    "format",
+    "transmit",
+    "fanout"
+};
+
+static TraceRing* attachRing();
+
+
+/**
+ * @brief Decides whether to trace the message just received, call it
+ *        once per message before handling it
+ * @return trace id now in gTraceId, 0 if not sampled
+ */
+U32 TraceMessage()
+{
+#if SERVER_TRACE_SAMPLE > 0
+    if (--gTraceCountdown == 0) {
+        gTraceCountdown = SERVER_TRACE_SAMPLE;
+
+        // 0 means untraced, skip it when the ids wrap
+        if (++gTraceNextId == 0) {
+            ++gTraceNextId;
+        }
+        gTraceId = gTraceNextId;
+        return gTraceId;
+    }
+#endif
+
+    gTraceId = 0;
+    return 0;
+}
+
+/**
+ * @brief Ends tracing of the current message
+ */
+void TraceDone()
+{
+    gTraceId = 0;
+}
+
+/**
+ * @brief Adds a span for the current message to this thread's ring,
+ *        overwriting the oldest once it is full
+ */
+void TraceRecord(U32 stage, U64 beginNs, U64 endNs, U32 arg)
+{
+    TraceRing *ring = tTraceRing;
+    TraceEvent *event;
+
+    if (ring == NULL) {
+        ring = attachRing();
+        if (ring == NULL) {
+            return;
+        }
+    }
+
+    event = &ring->events[ring->count % SERVER_TRACE_RING_SIZE];
+    event->beginNs = beginNs;
+    event->endNs = endNs;
+    event->traceId = gTraceId;
+    event->stage = (U16)stage;
+    event->unused = 0;
+    event->arg = arg;
+
+    ++ring->count;
+}
+
+/**
+ * @return this thread's new ring, NULL if there are too many threads
+ *         or no memory
+ */
+TraceRing* attachRing()
+{
+    TraceRing *ring;
+    U32 thread;
+
+    if (tTraceNoRing) {
+        return NULL;
+    }
+
+    thread = __atomic_fetch_add(&gTraceRingCount, 1, __ATOMIC_RELAXED);
+    if (thread >= TRACE_MAX_THREADS) {
+        tTraceNoRing = true;
+        return NULL;
+    }
+
+    ring = new TraceRing;
+    if (ring == NULL) {
+        tTraceNoRing = true;
+        return NULL;
+    }
+    ring->thread = thread;
+    ring->count = 0;
+
+    __atomic_store_n(&gTraceRings[thread], ring, __ATOMIC_RELEASE);
+    tTraceRing = ring;
+
+    return ring;
+}
+
+/**
+ * @brief Writes the spans that ended in the last windowNs as Chrome
+ *        trace event JSON. Call it from the main loop, never while a
+ *        fan-out is running.
+ * @param path file to write, replaced
+ * @return spans written, 0 if none or error
+ */
+U32 TraceDump(const char *path, U64 windowNs)
+{
+    U64 nowNs = timeNowNs();
+    U64 fromNs = (nowNs > windowNs) ? (nowNs - windowNs) : 0;
+    U32 rings = __atomic_load_n(&gTraceRingCount, __ATOMIC_RELAXED);
+    U32 written = 0;
+    FILE *out;
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        ConsolePrintf("ERROR: Unable to open %s\n", path);
+        return 0;
+    }
+
+    if (rings > TRACE_MAX_THREADS) {
+        rings = TRACE_MAX_THREADS;
+    }
+
+    fprintf(out, "{\"traceEvents\": [\n");
+
+    for (U32 r=0; r<rings; ++r) {
+        TraceRing *ring = __atomic_load_n(&gTraceRings[r], __ATOMIC_ACQUIRE);
+        U32 first;
+
+        if (ring == NULL) {
+            continue;
+        }
+
+        first = (ring->count > SERVER_TRACE_RING_SIZE) ?
+                (ring->count - SERVER_TRACE_RING_SIZE) : 0;
+
+        for (U32 i=first; i!=ring->count; ++i) {
+            TraceEvent *event = &ring->events[i % SERVER_TRACE_RING_SIZE];
+            U64 durationNs;
+
+            if ((event->endNs < fromNs) || (event->stage >= TRACE_STAGE_COUNT)) {
+                continue;
+            }
+            durationNs = event->endNs - event->beginNs;
+
+            // times are in microseconds
+            fprintf(out,
+                    "%s{\"name\": \"%s\", \"cat\": \"msg\", \"ph\": \"X\", "
+                    "\"ts\": %llu.%03llu, \"dur\": %llu.%03llu, \"pid\": 1, \"tid\": %u, "
+                    "\"args\": {\"trace\": %u, \"arg\": %u}}",
+                    (written > 0) ? ",\n" : "",
+                    gTraceStageNames[event->stage],
+                    (unsigned long long)(event->beginNs / 1000),
+                    (unsigned long long)(event->beginNs % 1000),
+                    (unsigned long long)(durationNs / 1000),
+                    (unsigned long long)(durationNs % 1000),
+                    ring->thread,
+                    event->traceId,
+                    event->arg);
+            ++written;
+        }
+    }
+
+    fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+    fclose(out);
+
+    return written;
+}
+
+/**
+ * @brief Frees every ring, call it once no other thread records
+ */
+void TraceShutdown()
+{
+    U32 rings = __atomic_load_n(&gTraceRingCount, __ATOMIC_RELAXED);
+
+    if (rings > TRACE_MAX_THREADS) {
+        rings = TRACE_MAX_THREADS;
+    }
+
+    for (U32 r=0; r<rings; ++r) {
+        delete gTraceRings[r];
+        gTraceRings[r] = NULL;
+    }
+    gTraceRingCount = 0;
+    gTraceId = 0;
+    tTraceRing = NULL;
+}
@@ -0,0 +1,81 @@
+/**
+ * @brief Sampled span tracing. One in SERVER_TRACE_SAMPLE received
+ *        messages is given a trace id, and while it is handled each
+ *        stage (receive, handle, format, every transmit, fan-out
+ *        chunks) records when it began and ended. Messages that are
+ *        not sampled cost a counter decrement, and a test of gTraceId
+ *        at each stage.
+ *
+ *        Spans go in to a ring per thread, so recording takes no
+ *        lock. The fan-out threads only run while the main loop waits
+ *        on them, so the main loop can read every ring in TraceDump()
+ *        without them changing underneath it.
+ *
+ *        TraceDump() writes the spans in Chrome's trace event JSON,
+ *        open it in chrome://tracing or Perfetto.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "types.h"
+#include "servercfg.h"
+#include "util.h"
+
+// Most threads that record spans, others are not traced
+#define TRACE_MAX_THREADS 16
+
+enum {
+    TRACE_RECEIVE = 0,      // kernel receive stamp to read by the loop
+    TRACE_HANDLE,           // HandleClientData(), arg is the type
+    TRACE_FORMAT,           // formatting server text
+    TRACE_TRANSMIT,         // one send, arg is the handle
+    TRACE_FANOUT,           // one fan-out chunk, arg is recipients
+    TRACE_STAGE_COUNT
+};
+
+struct TraceEvent
+{
+    U64 beginNs;
+    U64 endNs;
+    U32 traceId;
+    U16 stage;
+    U16 unused;
+    U32 arg;
+};
+
+struct TraceRing
+{
+    U32 thread;
+    U32 count;      // events ever recorded, the newest is count - 1
+    TraceEvent events[SERVER_TRACE_RING_SIZE];
+};
+
+// Message being traced, 0 if none
+extern U32 gTraceId;
+
+U32 TraceMessage();
+void TraceDone();
+void TraceRecord(U32 stage, U64 beginNs, U64 endNs, U32 arg);
+U32 TraceDump(const char *path, U64 windowNs);
+void TraceShutdown();
+
+/**
+ * @return start of a span, 0 if the message isn't traced
+ */
+inline U64 TraceStart()
+{
+    return gTraceId ? timeNowNs() : 0;
+}
+
+/**
+ * @brief Ends a span started by TraceStart()
+ */
+inline void TraceStop(U32 stage, U64 beginNs, U32 arg)
+{
+    if (beginNs != 0) {
+        TraceRecord(stage, beginNs, timeNowNs(), arg);
+    }
+}
+
+#endif
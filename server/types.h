@@ -6,10 +6,12 @@
 #ifndef _EWATC_TYPES_H
 #define _EWATC_TYPES_H
 
+typedef unsigned long long U64;
 typedef unsigned int U32;
 typedef unsigned short U16;
 typedef unsigned char U8;
 
+typedef signed long long S64;
 typedef signed int S32;
 typedef signed short S16;
 typedef signed char S8;
@@ -4,6 +4,7 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 #include "util.h"
 
 #define DEBUG_USE_CONSOLE_UTIL
@@ -25,18 +26,18 @@ void debugDumpMemoryContents(const U8* bufPtr, U32 length, U32 offset)
     U8* last = (U8*)&bufPtr[length];
 
     // Align memory for debug printing
-    first = (U8*)((U32)first & (~(alignment-1)));
-    last = (U8*)(((U32)last + (alignment-1)) & (~(alignment-1)));
+    first = (U8*)((size_t)first & (~(size_t)(alignment-1)));
+    last = (U8*)(((size_t)last + (alignment-1)) & (~(size_t)(alignment-1)));
 
     // Print memory dump header
-    printf("Memory (0x%08x-0x%08x)\n", (U32)first, (U32)last);
+    printf("Memory (0x%08x-0x%08x)\n", (U32)(size_t)first, (U32)(size_t)last);
     if (bufPtr == NULL) {
         printf("\tInvalid buffer pointer\n");
     }
 
     // Print memory dump
     for (U8 *addr=first; addr<last; addr+= alignment) {
-        printf("0x%08x", (U32)addr);
+        printf("0x%08x", (U32)(size_t)addr);
         for (int i=0; i<alignment; ++i) {
             if ((i&(alignment/2 - 1)) == 0) {
                 printf(" ");
@@ -72,3 +73,42 @@ void debugDumpMemoryContents(const U8* bufPtr, U32 length, U32 offset)
         printf("\n");
     }
 }
+
+#ifdef USE_VIRTUAL_CLOCK
+U64 gVirtualClockNs = 0;
+#endif
+
+/**
+ * @brief Monotonic time
+ * @return nanoseconds since an arbitrary fixed point
+ */
+U64 timeNowNs()
+{
+#ifdef USE_VIRTUAL_CLOCK
+    return gVirtualClockNs;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((U64)ts.tv_sec * 1000000000ULL) + (U64)ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Wall clock time, comparable between hosts as far as their
+ *        clocks agree, and with kernel receive timestamps
+ * @return nanoseconds since the epoch
+ */
+U64 timeWallNs()
+{
+#ifdef USE_VIRTUAL_CLOCK
+    return gVirtualClockNs;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ((U64)ts.tv_sec * 1000000000ULL) + (U64)ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,41 @@
+/**
+ * @brief Counts heap allocations made by the benchmarked code.
+ *        Defining malloc and friends here takes precedence over the
+ *        C library's, which is still called to do the work (glibc).
+ *        operator new goes through malloc so it is counted too.
+ */
+
+#include <stddef.h>
+#include "alloccount.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+U64 gAllocCount = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    __atomic_fetch_add(&gAllocCount, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&gAllocCount, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&gAllocCount, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+    __libc_free(ptr);
+}
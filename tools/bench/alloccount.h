@@ -0,0 +1,13 @@
+/**
+ * @brief Heap allocation counter for benchmarks
+ */
+
+#ifndef _ALLOCCOUNT_H
+#define _ALLOCCOUNT_H
+
+#include "../../server/types.h"
+
+// number of malloc/calloc/realloc calls since the program started
+extern U64 gAllocCount;
+
+#endif
@@ -0,0 +1,725 @@
+/**
+ * @brief Microbenchmarks for the server socket and protocol hot
+ *        paths. Each result is one line,
+ *
+ *          name/param  iterations  ns/op  allocs/op
+ *
+ *        so runs before and after a change can be diffed directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "SDL_net.h"
+#include "../../server/types.h"
+#include "../../server/util.h"
+#include "../../server/serversocket.h"
+#include "../../server/tcprotocol.h"
+#include "../../server/fanout.h"
+#include "../../server/joincookie.h"
+#include "../../server/textfilter.h"
+#include "transport.h"
+#include "alloccount.h"
+
+#define UDP_MAX_PACKET_SIZE 512
+
+// Each benchmark runs at least this long once calibrated
+#define BENCH_MIN_TIME_NS (200ULL * 1000000ULL)
+#define BENCH_MAX_ITERATIONS 1000000000ULL
+
+// Fake clients live at 127.0.0.1:BENCH_CLIENT_PORT_BASE+n, after
+// BENCH_CLIENT_PORTS the host moves on to 127.0.0.2 and so on
+#define BENCH_CLIENT_PORT_BASE 20000
+#define BENCH_CLIENT_PORTS 40000
+
+// Loopback benchmarks send to themselves on this port
+#define BENCH_LOOPBACK_PORT 19999
+#define BENCH_LOOPBACK_TIMEOUT_NS (1000ULL * 1000000ULL)
+
+struct Benchmark
+{
+    const char *name;
+    U32 param;                       // clients joined, or datagrams per batch
+    void (*run)(U64 iterations);
+    bool (*setup)(U32 param);        // NULL runs against a ServerSocket
+    void (*teardown)();
+};
+
+/**
+ * @brief Sends a batch of datagrams to itself over loopback and
+ *        receives them back, one iteration per batch. Compares the
+ *        transports on the real kernel path.
+ */
+template <class Transport>
+struct LoopbackBench
+{
+    static Transport sTransport;
+    static NetPacket *sTx;
+    static NetPacket *sRx;
+    static U32 sBatch;
+    static U64 sLost;
+
+    static bool setup(U32 batch);
+    static void teardown();
+    static void run(U64 iterations);
+};
+
+/**
+ * @brief One broadcast frame to param fake clients per iteration,
+ *        sent one datagram at a time like the main loop does, or
+ *        through a FanoutPool
+ */
+struct FanoutBench
+{
+    static PosixUdpTransport sTransport;
+    static NetPacket *sPkt;
+    static FanoutTarget *sTargets;
+    static U32 sCount;
+#if SERVER_FANOUT_THREADS > 0
+    static FanoutPool sPool;
+#endif
+
+    static bool setup(U32 count);
+    static void teardown();
+    static void runMainLoop(U64 iterations);
+    static void runThreads(U64 iterations);
+};
+
+/**
+ * @brief One TEXT payload per iteration, param bytes of text in a
+ *        TC_MAX_TEXT_SIZE buffer, copied the old way (strncpy plus
+ *        terminator), with a plain memcpy, or cleaned by the text
+ *        filter
+ */
+struct TextBench
+{
+    static char sSrc[TC_MAX_TEXT_SIZE];
+    static char sDst[TC_MAX_TEXT_SIZE];
+    static char * volatile sOut;     // keeps the copies in the loop
+
+    static bool setupAscii(U32 length);
+    static bool setupUtf8(U32 length);
+    static bool setupCjk(U32 length);
+    static void teardown();
+    static void runStrncpy(U64 iterations);
+    static void runMemcpy(U64 iterations);
+    static void runScalar(U64 iterations);
+    static void runFilter(U64 iterations);
+};
+
+static ServerSocket gServer;
+static ServerPacket *gPkt;
+static U32 gClients;
+
+static bool setupServer(U32 clients);
+static void teardownServer();
+static void runBenchmark(Benchmark *bench);
+
+char TextBench::sSrc[TC_MAX_TEXT_SIZE];
+char TextBench::sDst[TC_MAX_TEXT_SIZE];
+char * volatile TextBench::sOut = TextBench::sDst;
+
+bool TextBench::setupAscii(U32 length)
+{
+    static const char pangram[] = "The quick brown fox jumps over the lazy dog. ";
+    static bool announced = false;
+
+    memset(sSrc, 0, sizeof(sSrc));
+    for (U32 i=0; i<length; ++i) {
+        sSrc[i] = pangram[i % (sizeof(pangram) - 1)];
+    }
+
+    if (!announced) {
+        InitTextFilter();
+        printf("# text filter %s\n", TextFilterName());
+        announced = true;
+    }
+
+    return true;
+}
+
+// mostly ASCII, with a two byte character every 16 bytes
+bool TextBench::setupUtf8(U32 length)
+{
+    setupAscii(length);
+
+    for (U32 i=14; (i + 1)<length; i+=16) {
+        sSrc[i] = (char)0xC3;
+        sSrc[i + 1] = (char)0xA9;
+    }
+
+    return true;
+}
+
+// three byte characters only, padded out with spaces
+bool TextBench::setupCjk(U32 length)
+{
+    static const char cjk[] = "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E";
+    U32 i;
+
+    setupAscii(length);
+
+    for (i=0; (i + 3)<=length; i+=3) {
+        memcpy(&sSrc[i], &cjk[i % (sizeof(cjk) - 1)], 3);
+    }
+    for (; i<length; ++i) {
+        sSrc[i] = ' ';
+    }
+
+    return true;
+}
+
+void TextBench::teardown()
+{
+}
+
+void TextBench::runStrncpy(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        char *out = sOut;
+
+        strncpy(out, sSrc, TC_MAX_TEXT_SIZE);
+        out[TC_MAX_TEXT_SIZE - 1] = '\0';
+    }
+}
+
+void TextBench::runMemcpy(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        memcpy(sOut, sSrc, TC_MAX_TEXT_SIZE);
+    }
+}
+
+void TextBench::runScalar(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        SanitizeTextScalar(sOut, sSrc, TC_MAX_TEXT_SIZE);
+    }
+}
+
+void TextBench::runFilter(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        SanitizeText(sOut, sSrc, TC_MAX_TEXT_SIZE);
+    }
+}
+
+
+void clientAddress(IPaddress *address, U32 n);
+static void buildJoin(ServerPacket *pkt, U32 n);
+static void buildLeave(ServerPacket *pkt);
+static void buildText(ServerPacket *pkt);
+static void buildDirect(ServerPacket *pkt, U32 to);
+
+static void benchAllocPacket(U64 iterations);
+static void benchAllocClient(U64 iterations);
+static void benchPeerLookup(U64 iterations);
+static void benchHandleAck(U64 iterations);
+static void benchHandleShortHeader(U64 iterations);
+static void benchHandleJoinLeave(U64 iterations);
+static void benchHandleJoinFlood(U64 iterations);
+static void benchHandleText(U64 iterations);
+static void benchHandleDirect(U64 iterations);
+
+static Benchmark gBenchmarks[] = {
+    {"packet/alloc_free",       1,    benchAllocPacket},
+    {"client/alloc_free",       10,   benchAllocClient},
+    {"client/alloc_free",       1000, benchAllocClient},
+    {"peer_lookup",             10,   benchPeerLookup},
+    {"peer_lookup",             1000, benchPeerLookup},
+    {"handle/ack",              1,    benchHandleAck},
+    {"handle/short_header",     1,    benchHandleShortHeader},
+    {"handle/join_leave",       1,    benchHandleJoinLeave},
+    {"handle/join_leave",       100,  benchHandleJoinLeave},
+    {"handle/join_flood",       1000, benchHandleJoinFlood},
+    {"handle/direct",           10,   benchHandleDirect},
+    {"handle/direct",           1000, benchHandleDirect},
+    {"handle/text_broadcast",   1,    benchHandleText},
+    {"handle/text_broadcast",   10,   benchHandleText},
+    {"handle/text_broadcast",   100,  benchHandleText},
+    {"handle/text_broadcast",   1000, benchHandleText},
+    {"loopback/posix",          1,    LoopbackBench<PosixUdpTransport>::run,
+                                      LoopbackBench<PosixUdpTransport>::setup,
+                                      LoopbackBench<PosixUdpTransport>::teardown},
+    {"loopback/posix",          32,   LoopbackBench<PosixUdpTransport>::run,
+                                      LoopbackBench<PosixUdpTransport>::setup,
+                                      LoopbackBench<PosixUdpTransport>::teardown},
+    {"loopback/iouring",        1,    LoopbackBench<IoUringTransport>::run,
+                                      LoopbackBench<IoUringTransport>::setup,
+                                      LoopbackBench<IoUringTransport>::teardown},
+    {"loopback/iouring",        32,   LoopbackBench<IoUringTransport>::run,
+                                      LoopbackBench<IoUringTransport>::setup,
+                                      LoopbackBench<IoUringTransport>::teardown},
+    {"fanout/main_loop",        50000, FanoutBench::runMainLoop,
+                                      FanoutBench::setup,
+                                      FanoutBench::teardown},
+#if SERVER_FANOUT_THREADS > 0
+    {"fanout/threads",          50000, FanoutBench::runThreads,
+                                      FanoutBench::setup,
+                                      FanoutBench::teardown},
+#endif
+    {"text/strncpy",            40,   TextBench::runStrncpy,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/strncpy",            127,  TextBench::runStrncpy,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/memcpy",             127,  TextBench::runMemcpy,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/filter_scalar",      40,   TextBench::runScalar,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/filter_scalar",      127,  TextBench::runScalar,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/filter",             40,   TextBench::runFilter,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/filter",             127,  TextBench::runFilter,
+                                      TextBench::setupAscii,
+                                      TextBench::teardown},
+    {"text/filter_utf8",        127,  TextBench::runFilter,
+                                      TextBench::setupUtf8,
+                                      TextBench::teardown},
+    {"text/filter_cjk",         127,  TextBench::runFilter,
+                                      TextBench::setupCjk,
+                                      TextBench::teardown},
+    {NULL,                      0,    NULL}
+};
+
+
+/**
+ * @brief Protocol console output is discarded while benchmarking
+ */
+void ConsolePrintf(const char* format, ...)
+{
+}
+
+int ConsoleFlushQueueToBuffer(char *buffer, U32 maxlen)
+{
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *filter = (argc > 1) ? argv[1] : NULL;
+
+    if (SDLNet_Init() < 0) {
+        fprintf(stderr, "ERROR: SDLNet_Init: %s\n", SDLNet_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    for (Benchmark *bench = &gBenchmarks[0]; bench->name; ++bench) {
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+
+        bool (*setup)(U32) = bench->setup ? bench->setup : setupServer;
+        void (*teardown)() = bench->teardown ? bench->teardown : teardownServer;
+
+        if (!setup(bench->param)) {
+            fprintf(stderr, "ERROR: Unable to set up %s/%d\n",
+                    bench->name, bench->param);
+            exit(EXIT_FAILURE);
+        }
+
+        runBenchmark(bench);
+        teardown();
+    }
+
+    SDLNet_Quit();
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+ * @brief Grows the iteration count until the run takes at least
+ *        BENCH_MIN_TIME_NS, then reports the last run
+ */
+void runBenchmark(Benchmark *bench)
+{
+    U64 iterations = 1;
+    U64 elapsed;
+    U64 allocs;
+    char name[64];
+
+    for (;;) {
+        U64 start;
+        U64 next;
+
+        allocs = gAllocCount;
+        start = timeNowNs();
+        bench->run(iterations);
+        elapsed = timeNowNs() - start;
+        allocs = gAllocCount - allocs;
+
+        if ((elapsed >= BENCH_MIN_TIME_NS) || (iterations >= BENCH_MAX_ITERATIONS)) {
+            break;
+        }
+
+        // aim a little past the minimum, growing at most 100x per step
+        if (elapsed == 0) {
+            next = iterations * 100;
+        } else {
+            next = (iterations * BENCH_MIN_TIME_NS * 6) / (elapsed * 5);
+            if (next > (iterations * 100)) {
+                next = iterations * 100;
+            }
+        }
+        iterations = (next > iterations) ? next : (iterations + 1);
+    }
+
+    snprintf(name, sizeof(name), "%s/%u", bench->name, bench->param);
+    printf("%-32s %12llu %12.1f ns/op %8.2f allocs/op\n",
+           name,
+           iterations,
+           (double)elapsed / (double)iterations,
+           (double)allocs / (double)iterations);
+    fflush(stdout);
+}
+
+/**
+ * @brief Starts a server with room for one more client than will
+ *        be joined, then joins them
+ */
+bool setupServer(U32 clients)
+{
+    gClients = clients;
+
+    if (!gServer.init(0, UDP_MAX_PACKET_SIZE, clients + 1)) {
+        return false;
+    }
+
+    if (!InitMessengerProtocol(&gServer)) {
+        return false;
+    }
+
+    gPkt = gServer.allocPacket();
+    if (gPkt == NULL) {
+        return false;
+    }
+
+    for (U32 n=0; n<clients; ++n) {
+        buildJoin(gPkt, n);
+        HandleClientData(&gServer, gPkt);
+    }
+
+    return gServer.mSessions.mCount == clients;
+}
+
+void teardownServer()
+{
+    gServer.freePacket(gPkt);
+    ShutdownMessengerProtocol(&gServer);
+    gServer.shutdown();
+}
+
+
+void benchAllocPacket(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        ServerPacket *pkt = gServer.allocPacket();
+        gServer.freePacket(pkt);
+    }
+}
+
+// slot search runs past every joined client
+void benchAllocClient(U64 iterations)
+{
+    IPaddress address;
+
+    clientAddress(&address, gClients);
+    for (U64 i=0; i<iterations; ++i) {
+        int handle = gServer.allocClient(&address);
+        gServer.freeClient(handle);
+    }
+}
+
+// lookup of the last joined client
+void benchPeerLookup(U64 iterations)
+{
+    IPaddress address;
+    volatile int handle;
+
+    clientAddress(&address, gClients - 1);
+    for (U64 i=0; i<iterations; ++i) {
+        handle = gServer.peerIPaddressToHandle(&address);
+    }
+    (void)handle;
+}
+
+void benchHandleAck(U64 iterations)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)gPkt->data;
+
+    buildLeave(gPkt);
+    mpkt->hdr.type = TYPE_ACK;
+    mpkt->hdr.length = 0;
+    gPkt->len = sizeof(MsgrHdr);
+
+    for (U64 i=0; i<iterations; ++i) {
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+void benchHandleShortHeader(U64 iterations)
+{
+    clientAddress(&gPkt->address, 0);
+    gPkt->len = sizeof(MsgrHdr) - 1;
+
+    for (U64 i=0; i<iterations; ++i) {
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+// one join and one leave per iteration, each notifies every client
+void benchHandleJoinLeave(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        buildJoin(gPkt, gClients);
+        HandleClientData(&gServer, gPkt);
+        buildLeave(gPkt);
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+// JOINs without a cookie from ever changing addresses, each only
+// gets a COOKIE back
+void benchHandleJoinFlood(U64 iterations)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)gPkt->data;
+
+    for (U64 i=0; i<iterations; ++i) {
+        buildJoin(gPkt, gClients + (U32)(i % BENCH_CLIENT_PORTS));
+        memset(mpkt->join.cookie, 0, TC_COOKIE_SIZE);
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+void benchHandleText(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        buildText(gPkt);
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+// direct from the first client to the last one, by name
+void benchHandleDirect(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        buildDirect(gPkt, gClients - 1);
+        HandleClientData(&gServer, gPkt);
+    }
+}
+
+
+template <class Transport> Transport LoopbackBench<Transport>::sTransport;
+template <class Transport> NetPacket* LoopbackBench<Transport>::sTx;
+template <class Transport> NetPacket* LoopbackBench<Transport>::sRx;
+template <class Transport> U32 LoopbackBench<Transport>::sBatch;
+template <class Transport> U64 LoopbackBench<Transport>::sLost;
+
+template <class Transport>
+bool LoopbackBench<Transport>::setup(U32 batch)
+{
+    sBatch = batch;
+    sLost = 0;
+
+    sTransport.clear();
+    if (!sTransport.open(BENCH_LOOPBACK_PORT)) {
+        fprintf(stderr, "ERROR: open(%d): %s\n",
+                BENCH_LOOPBACK_PORT, sTransport.getError());
+        return false;
+    }
+
+    sTx = sTransport.allocPacket(UDP_MAX_PACKET_SIZE);
+    sRx = sTransport.allocPacket(UDP_MAX_PACKET_SIZE);
+    if ((sTx == NULL) || (sRx == NULL)) {
+        return false;
+    }
+
+    sTransport.resolveHost(&sTx->address, "127.0.0.1", BENCH_LOOPBACK_PORT);
+    memset(sTx->data, 'x', UDP_MAX_PACKET_SIZE);
+    sTx->len = sizeof(MsgrHdr) + sizeof(MsgrText);
+
+    return true;
+}
+
+template <class Transport>
+void LoopbackBench<Transport>::teardown()
+{
+    if (sLost > 0) {
+        fprintf(stderr, "WARNING: %llu datagrams lost on loopback\n", sLost);
+    }
+
+    sTransport.freePacket(sRx);
+    sTransport.freePacket(sTx);
+    sTransport.close();
+}
+
+template <class Transport>
+void LoopbackBench<Transport>::run(U64 iterations)
+{
+    for (U64 i=0; i<iterations; ++i) {
+        U32 received = 0;
+        U64 deadline = 0;
+
+        for (U32 n=0; n<sBatch; ++n) {
+            sTransport.send(sTx);
+        }
+        sTransport.flush();
+
+        while (received < sBatch) {
+            int status = sTransport.recv(sRx);
+
+            if (status > 0) {
+                ++received;
+            } else if (status < 0) {
+                break;
+            } else if (deadline == 0) {
+                deadline = timeNowNs() + BENCH_LOOPBACK_TIMEOUT_NS;
+            } else if (timeNowNs() > deadline) {
+                break;
+            }
+        }
+        sLost += sBatch - received;
+    }
+}
+
+
+PosixUdpTransport FanoutBench::sTransport;
+NetPacket* FanoutBench::sPkt;
+FanoutTarget* FanoutBench::sTargets;
+U32 FanoutBench::sCount;
+#if SERVER_FANOUT_THREADS > 0
+FanoutPool FanoutBench::sPool;
+#endif
+
+bool FanoutBench::setup(U32 count)
+{
+    sCount = count;
+
+    sTransport.clear();
+    if (!sTransport.open(0)) {
+        fprintf(stderr, "ERROR: open(): %s\n", sTransport.getError());
+        return false;
+    }
+    sTransport.setSendBufferSize(SERVER_SOCKET_SNDBUF);
+
+    sPkt = sTransport.allocPacket(UDP_MAX_PACKET_SIZE);
+    if (sPkt == NULL) {
+        return false;
+    }
+    buildText(sPkt);
+
+#if SERVER_FANOUT_THREADS > 0
+    if (!sPool.init(sTransport.getFd(), SERVER_FANOUT_THREADS, count)) {
+        return false;
+    }
+    sTargets = sPool.getTargets();
+#else
+    sTargets = new FanoutTarget[count];
+#endif
+
+    for (U32 n=0; n<count; ++n) {
+        clientAddress(&sTargets[n].address, n);
+        sTargets[n].to = TO_ADDRESS_HANDLE_BASE + n;
+        sTargets[n].seq = 1;
+    }
+
+    return true;
+}
+
+void FanoutBench::teardown()
+{
+#if SERVER_FANOUT_THREADS > 0
+    sPool.shutdown();
+#else
+    delete [] sTargets;
+#endif
+    sTransport.freePacket(sPkt);
+    sTransport.close();
+}
+
+void FanoutBench::runMainLoop(U64 iterations)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)sPkt->data;
+
+    for (U64 i=0; i<iterations; ++i) {
+        for (U32 n=0; n<sCount; ++n) {
+            mpkt->hdr.to = sTargets[n].to;
+            mpkt->hdr.seq = sTargets[n].seq;
+            sPkt->address = sTargets[n].address;
+            sTransport.send(sPkt);
+        }
+    }
+}
+
+void FanoutBench::runThreads(U64 iterations)
+{
+#if SERVER_FANOUT_THREADS > 0
+    FanoutStats stats;
+
+    for (U64 i=0; i<iterations; ++i) {
+        sPool.send(sPkt->data, sPkt->len, sCount, &stats);
+    }
+#endif
+}
+
+
+void clientAddress(IPaddress *address, U32 n)
+{
+    // Host and Port are in network order
+    SDLNet_Write32(0x7F000001 + (n / BENCH_CLIENT_PORTS), &address->host);
+    SDLNet_Write16((U16)(BENCH_CLIENT_PORT_BASE + (n % BENCH_CLIENT_PORTS)), &address->port);
+}
+
+void buildJoin(ServerPacket *pkt, U32 n)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    clientAddress(&pkt->address, n);
+    EncodeJoin(mpkt, TO_ADDRESS_SERVER, 0, 1);
+    snprintf(mpkt->join.name, TC_MAX_NAME_SIZE, "b%05u", n);
+    gJoinCookies.issue(&pkt->address, timeNowNs(), mpkt->join.cookie);
+    pkt->len = MSGR_JOIN_FRAME_SIZE;
+}
+
+// leave from the extra client joined by buildJoin(pkt, gClients)
+void buildLeave(ServerPacket *pkt)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    clientAddress(&pkt->address, gClients);
+    EncodeLeave(mpkt, TO_ADDRESS_SERVER, 0, 2);
+    snprintf(mpkt->leave.name, TC_MAX_NAME_SIZE, "b%05u", gClients);
+    pkt->len = MSGR_LEAVE_FRAME_SIZE;
+}
+
+void buildText(ServerPacket *pkt)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    clientAddress(&pkt->address, 0);
+    EncodeText(mpkt, TO_ADDRESS_BROADCAST, 0, 3);
+    strcpy(mpkt->text.name, "b00000");
+    strcpy(mpkt->text.data, "The quick brown fox jumps over the lazy dog");
+    pkt->len = MSGR_TEXT_FRAME_SIZE;
+}
+
+void buildDirect(ServerPacket *pkt, U32 to)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    clientAddress(&pkt->address, 0);
+    EncodeDirect(mpkt, TO_ADDRESS_SERVER, 0, 4);
+    strcpy(mpkt->direct.name, "b00000");
+    snprintf(mpkt->direct.to, TC_MAX_NAME_SIZE, "b%05u", to);
+    strcpy(mpkt->direct.data, "The quick brown fox jumps over the lazy dog");
+    pkt->len = MSGR_DIRECT_FRAME_SIZE;
+}
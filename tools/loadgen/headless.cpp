@@ -0,0 +1,37 @@
+/**
+ * @brief Console functions for tools that run without an interactive
+ *        console. Output goes straight to stderr so stdout stays
+ *        free for results.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "../../client/consoleutil.h"
+
+bool ConsoleInit(U32 flags)
+{
+    return true;
+}
+
+bool ConsoleHandleInput()
+{
+    return false;
+}
+
+int ConsoleFlushQueueToBuffer(char *buffer, U32 maxlen)
+{
+    if (buffer && maxlen) {
+        buffer[0] = '\0';
+    }
+
+    return 0;
+}
+
+void ConsolePrintf(const char* format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
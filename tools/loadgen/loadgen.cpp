@@ -0,0 +1,538 @@
+/**
+ * @brief Headless load generator. Runs many Messenger sessions from
+ *        one process, each on its own ClientSocket, and measures how
+ *        many broadcasts were delivered and how long they took.
+ *
+ *        Every TEXT carries its send time, so any session receiving
+ *        the broadcast can compute the latency without clock sync.
+ *        The wall clock stamp in the frame against the kernel receive
+ *        stamp gives the one way time, send to arrival, apart from
+ *        the time the datagram then waited for us to read it.
+ *        Sessions are MessengerSessions, so the send path doesn't
+ *        allocate or copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "SDL_net.h"
+#include "../../client/types.h"
+#include "../../client/util.h"
+#include "../../client/clientsocket.h"
+#include "../../client/consoleutil.h"
+#include "../../client/tcprotocol.h"
+#include "../../server/metrics.h"
+
+#define UDP_MAX_PACKET_SIZE 512
+#define USE_RANDOM_PORT 0
+
+// Marks load generator text, followed by send time and session
+#define LOADGEN_TAG "LG "
+
+// Datagrams read per session per pass, keeps the polling fair
+#define LOADGEN_RX_PER_PASS 16
+// Sessions started per pass during the join phase
+#define LOADGEN_JOINS_PER_PASS 64
+
+// "lg" and the session number in LOADGEN_NAME_DIGITS base 36 digits,
+// within the TC_MAX_NAME_SIZE - 1 characters setName() keeps, so up
+// to LOADGEN_MAX_SESSIONS sessions all get their own name.
+#define LOADGEN_NAME_DIGITS 5
+#define LOADGEN_NAME_SIZE (2 + LOADGEN_NAME_DIGITS + 1)
+#define LOADGEN_MAX_SESSIONS (36 * 36 * 36 * 36 * 36)
+
+#define LOADGEN_JOIN_TIMEOUT_NS  (10ULL * 1000000000ULL)
+#define LOADGEN_SETTLE_NS        (1ULL * 1000000000ULL)
+
+struct LoadConfig
+{
+    char *host;
+    int port;
+    U32 sessions;
+    U32 seconds;
+    double rate;     // TEXT per second per session
+    U32 textBytes;
+    char *output;
+    U32 nodes;       // cluster nodes the sessions are spread over
+    U32 portStep;    // node n takes clients on port + n * portStep
+};
+
+struct LoadSession
+{
+    ClientSocket socket;
+    MessengerSession msgr;
+    U64 nextSendNs;
+    U64 sent;
+    U64 received;
+};
+
+struct LoadResults
+{
+    U32 joined;
+    U64 sent;
+    U64 delivered;
+    U64 bytesIn;
+    U64 runNs;
+    Histogram latencyNs;        // sent to released in order
+    Histogram oneWayNs;         // sent to kernel receive stamp
+    Histogram clientQueueNs;    // kernel receive stamp to read
+    RxWindowStats rxWindow;
+    U32 multicast;              // sessions taking broadcasts from the group
+    RxWindowStats groupWindow;
+};
+
+static bool parseArgs(int argc, char **argv, LoadConfig *cfg);
+static void raiseFileLimit(U32 sessions);
+static void sessionName(char *name, U32 sessionIndex);
+static void sendText(LoadSession *session, U32 sessionIndex, U32 textBytes);
+static void pollSession(LoadSession *session, ClientPacket *pkt, LoadResults *results, bool measure);
+static void readDatagram(LoadSession *session, ClientPacket *pkt, LoadResults *results, bool measure, bool fromGroup);
+static void addWindowStats(RxWindowStats *total, RxWindowStats *stats);
+static void countFrame(LoadSession *session, MessengerPacket *mpkt, LoadResults *results, bool measure, U64 rxWallNs);
+static void writeResults(LoadConfig *cfg, LoadResults *results);
+static void writeHistogram(FILE *out, const char *name, Histogram *hist, bool last);
+
+static LoadResults gResults;
+
+
+int main(int argc, char **argv)
+{
+    LoadConfig cfg;
+    LoadSession *sessions;
+    ClientPacket *pkt;
+    IPaddress srvadd;
+    U64 startNs;
+    U64 intervalNs;
+    U32 started;
+
+    if (!parseArgs(argc, argv, &cfg)) {
+        ConsolePrintf("Usage: %s host port [-n sessions] [-t seconds] "
+                      "[-r msgs/s per session] [-b text bytes] [-o results.json] "
+                      "[-c cluster nodes] [-s node port step]\n",
+                      argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    raiseFileLimit(cfg.sessions);
+
+    if (SDLNet_Init() != 0) {
+        ConsolePrintf("ERROR: SDLNet_Init: %s\n", SDLNet_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    sessions = new LoadSession[cfg.sessions];
+
+    for (U32 i=0; i<cfg.sessions; ++i) {
+        LoadSession *session = &sessions[i];
+        char name[LOADGEN_NAME_SIZE];
+
+        // round robin over the nodes of a cluster
+        if (!session->socket.toIPaddress(&srvadd,
+                                         cfg.host,
+                                         cfg.port + (i % cfg.nodes) * cfg.portStep)) {
+            exit(EXIT_FAILURE);
+        }
+
+        if (!session->socket.init(USE_RANDOM_PORT, UDP_MAX_PACKET_SIZE, &srvadd) ||
+            !session->msgr.init(&session->socket)) {
+            ConsolePrintf("ERROR: Unable to open socket for session %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+
+        sessionName(name, i);
+        session->msgr.setName(name);
+        session->sent = 0;
+        session->received = 0;
+    }
+
+    pkt = sessions[0].socket.allocPacket();
+    if (pkt == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&gResults, 0, sizeof(gResults));
+
+    // Join phase, a few sessions per pass so the server isn't
+    // hit with every join at once
+    started = 0;
+    startNs = timeNowNs();
+    while ((timeNowNs() - startNs) < LOADGEN_JOIN_TIMEOUT_NS) {
+        U32 joined = 0;
+
+        for (U32 n=0; (n<LOADGEN_JOINS_PER_PASS) && (started<cfg.sessions); ++n) {
+            sessions[started++].msgr.sendJoin();
+        }
+
+        for (U32 i=0; i<started; ++i) {
+            pollSession(&sessions[i], pkt, &gResults, false);
+            if (sessions[i].msgr.isJoined()) {
+                ++joined;
+            }
+        }
+
+        if (joined == cfg.sessions) {
+            break;
+        }
+    }
+
+    for (U32 i=0; i<cfg.sessions; ++i) {
+        if (sessions[i].msgr.isJoined()) {
+            ++gResults.joined;
+        }
+    }
+    ConsolePrintf("%d of %d sessions joined\n", gResults.joined, cfg.sessions);
+
+    // Run phase, sends are staggered across the interval
+    intervalNs = (U64)(1000000000.0 / cfg.rate);
+    startNs = timeNowNs();
+    for (U32 i=0; i<cfg.sessions; ++i) {
+        sessions[i].nextSendNs = startNs + ((intervalNs * i) / cfg.sessions);
+    }
+
+    while ((timeNowNs() - startNs) < ((U64)cfg.seconds * 1000000000ULL)) {
+        for (U32 i=0; i<cfg.sessions; ++i) {
+            LoadSession *session = &sessions[i];
+            U64 now = timeNowNs();
+
+            if (session->msgr.isJoined() && (now >= session->nextSendNs)) {
+                sendText(session, i, cfg.textBytes);
+
+                // don't try to catch up more than one interval
+                session->nextSendNs += intervalNs;
+                if (session->nextSendNs + intervalNs < now) {
+                    session->nextSendNs = now;
+                }
+            }
+
+            pollSession(session, pkt, &gResults, true);
+        }
+    }
+    gResults.runNs = timeNowNs() - startNs;
+
+    // Let in flight broadcasts arrive
+    startNs = timeNowNs();
+    while ((timeNowNs() - startNs) < LOADGEN_SETTLE_NS) {
+        for (U32 i=0; i<cfg.sessions; ++i) {
+            pollSession(&sessions[i], pkt, &gResults, true);
+        }
+    }
+
+    for (U32 i=0; i<cfg.sessions; ++i) {
+        MessengerSession *msgr = &sessions[i].msgr;
+
+        if (msgr->mGroupState == GROUP_ACTIVE) {
+            ++gResults.multicast;
+        }
+        if (msgr->isJoined()) {
+            msgr->sendLeave();
+        }
+        gResults.sent += sessions[i].sent;
+
+        addWindowStats(&gResults.rxWindow, &msgr->mRxWindow.mStats);
+        addWindowStats(&gResults.groupWindow, &msgr->mGroupWindow.mStats);
+    }
+
+    writeResults(&cfg, &gResults);
+
+    sessions[0].socket.freePacket(pkt);
+    for (U32 i=0; i<cfg.sessions; ++i) {
+        sessions[i].msgr.shutdown();
+        sessions[i].socket.shutdown();
+    }
+    delete [] sessions;
+
+    SDLNet_Quit();
+
+    return EXIT_SUCCESS;
+}
+
+
+bool parseArgs(int argc, char **argv, LoadConfig *cfg)
+{
+    cfg->sessions = 100;
+    cfg->seconds = 10;
+    cfg->rate = 1.0;
+    cfg->textBytes = 32;
+    cfg->output = NULL;
+    cfg->nodes = 1;
+    cfg->portStep = 10;
+
+    if (argc < 3) {
+        return false;
+    }
+
+    cfg->host = argv[1];
+    cfg->port = atoi(argv[2]);
+
+    for (int i=3; i<argc; i+=2) {
+        if ((i + 1) >= argc) {
+            return false;
+        }
+
+        if (!strcmp(argv[i], "-n")) {
+            cfg->sessions = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-t")) {
+            cfg->seconds = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-r")) {
+            cfg->rate = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-b")) {
+            cfg->textBytes = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-o")) {
+            cfg->output = argv[i + 1];
+        } else if (!strcmp(argv[i], "-c")) {
+            cfg->nodes = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-s")) {
+            cfg->portStep = atoi(argv[i + 1]);
+        } else {
+            return false;
+        }
+    }
+
+    if ((cfg->sessions == 0) || (cfg->sessions > LOADGEN_MAX_SESSIONS) ||
+        (cfg->rate <= 0.0) || (cfg->nodes == 0)) {
+        return false;
+    }
+
+    if (cfg->textBytes >= TC_MAX_TEXT_SIZE) {
+        cfg->textBytes = TC_MAX_TEXT_SIZE - 1;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Every session is a socket, make sure there are enough fds
+ */
+void raiseFileLimit(U32 sessions)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        if (limit.rlim_cur < (sessions + 64)) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+}
+
+/**
+ * @brief Names a session "lg" and its number in base 36, so every
+ *        name fits in TC_MAX_NAME_SIZE
+ */
+void sessionName(char *name, U32 sessionIndex)
+{
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+    name[0] = 'l';
+    name[1] = 'g';
+    for (int i=LOADGEN_NAME_DIGITS - 1; i>=0; --i) {
+        name[2 + i] = digits[sessionIndex % 36];
+        sessionIndex /= 36;
+    }
+    name[2 + LOADGEN_NAME_DIGITS] = '\0';
+}
+
+/**
+ * @brief Sends a broadcast TEXT stamped with the current time,
+ *        padded out to textBytes
+ */
+void sendText(LoadSession *session, U32 sessionIndex, U32 textBytes)
+{
+    char *text = session->msgr.textBuffer();
+    int len;
+
+    len = snprintf(text, TC_MAX_TEXT_SIZE, LOADGEN_TAG "%llu %u ",
+                   timeNowNs(), sessionIndex);
+    if ((len > 0) && ((U32)len < textBytes)) {
+        memset(&text[len], 'x', textBytes - len);
+        len = textBytes;
+    }
+
+    if (session->msgr.sendText(TO_ADDRESS_BROADCAST, len)) {
+        ++session->sent;
+    }
+}
+
+/**
+ * @brief Reads what has arrived for a session. Datagrams may hold
+ *        several frames back to back, frames are counted in seq
+ *        order once the receive window releases them.
+ * @param measure true to count load generator broadcasts
+ */
+void pollSession(LoadSession *session, ClientPacket *pkt, LoadResults *results, bool measure)
+{
+    MessengerPacket *mpkt;
+
+    for (U32 n=0; n<LOADGEN_RX_PER_PASS; ++n) {
+        if (!session->socket.receiveData(pkt)) {
+            break;
+        }
+        readDatagram(session, pkt, results, measure, false);
+    }
+
+    for (U32 n=0; n<LOADGEN_RX_PER_PASS; ++n) {
+        if (!session->socket.receiveGroupData(pkt)) {
+            break;
+        }
+        readDatagram(session, pkt, results, measure, true);
+    }
+
+    // gaps that have waited long enough
+    while ((mpkt = session->msgr.nextFrame(timeNowNs())) != NULL) {
+        countFrame(session, mpkt, results, measure, 0);
+    }
+
+    // a JOIN the server was too busy for
+    session->msgr.serviceJoin(timeNowNs());
+}
+
+/**
+ * @brief Puts every frame of a datagram through the session
+ * @param fromGroup pkt came through the multicast group
+ */
+void readDatagram(LoadSession *session, ClientPacket *pkt, LoadResults *results, bool measure, bool fromGroup)
+{
+    MessengerPacket *mpkt;
+    U32 offset = 0;
+    U64 now = timeNowNs();
+    U64 wallNs = timeWallNs();
+    bool inOrder;
+
+    results->bytesIn += pkt->len;
+
+    if (measure && (pkt->rxTimestampNs != 0) && (wallNs >= pkt->rxTimestampNs)) {
+        results->clientQueueNs.record(wallNs - pkt->rxTimestampNs);
+    }
+
+    while ((mpkt = NextMessengerFrame(pkt, &offset)) != NULL) {
+        if (fromGroup) {
+            inOrder = session->msgr.handleGroupFrame(mpkt, now);
+        } else {
+            inOrder = session->msgr.handleFrame(mpkt, now);
+        }
+
+        if (inOrder) {
+            countFrame(session, mpkt, results, measure, pkt->rxTimestampNs);
+        }
+
+        // held frames arrived in an earlier datagram, stamp unknown
+        while ((mpkt = session->msgr.nextFrame(now)) != NULL) {
+            countFrame(session, mpkt, results, measure, 0);
+        }
+    }
+}
+
+/**
+ * @brief Counts a load generator broadcast, latency is to when it
+ *        is released in order
+ * @param rxWallNs kernel receive stamp of the datagram it came in,
+ *        0 if unknown
+ */
+void countFrame(LoadSession *session, MessengerPacket *mpkt, LoadResults *results, bool measure, U64 rxWallNs)
+{
+    if (measure &&
+        (mpkt->hdr.type == TYPE_TEXT) &&
+        (mpkt->hdr.length == sizeof(MsgrText)) &&
+        !strncmp(mpkt->text.data, LOADGEN_TAG, strlen(LOADGEN_TAG))) {
+        U64 sentNs = strtoull(&mpkt->text.data[strlen(LOADGEN_TAG)], NULL, 10);
+        U64 now = timeNowNs();
+
+        U64 sentWallNs = ((U64)mpkt->text.sentSec * 1000000000ULL) + mpkt->text.sentNsec;
+
+        if (now > sentNs) {
+            results->latencyNs.record(now - sentNs);
+        }
+        if ((rxWallNs != 0) && (sentWallNs != 0) && (rxWallNs >= sentWallNs)) {
+            results->oneWayNs.record(rxWallNs - sentWallNs);
+        }
+        ++results->delivered;
+        ++session->received;
+    }
+}
+
+/**
+ * @brief Writes the results as JSON to the output file or stdout
+ */
+void writeResults(LoadConfig *cfg, LoadResults *results)
+{
+    FILE *out = stdout;
+    double seconds = (double)results->runNs / 1e9;
+    U64 expected = results->sent * results->joined;
+
+    if (cfg->output) {
+        out = fopen(cfg->output, "w");
+        if (out == NULL) {
+            ConsolePrintf("ERROR: Unable to open %s\n", cfg->output);
+            out = stdout;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"sessions\": %u,\n", cfg->sessions);
+    fprintf(out, "  \"nodes\": %u,\n", cfg->nodes);
+    fprintf(out, "  \"joined\": %u,\n", results->joined);
+    fprintf(out, "  \"seconds\": %.3f,\n", seconds);
+    fprintf(out, "  \"rate_per_session\": %.3f,\n", cfg->rate);
+    fprintf(out, "  \"text_bytes\": %u,\n", cfg->textBytes);
+    fprintf(out, "  \"sent\": %llu,\n", results->sent);
+    fprintf(out, "  \"expected_deliveries\": %llu,\n", expected);
+    fprintf(out, "  \"delivered\": %llu,\n", results->delivered);
+    fprintf(out, "  \"delivery_ratio\": %.6f,\n",
+            expected ? ((double)results->delivered / (double)expected) : 0.0);
+    fprintf(out, "  \"delivered_per_sec\": %.1f,\n",
+            (seconds > 0.0) ? ((double)results->delivered / seconds) : 0.0);
+    fprintf(out, "  \"bytes_in\": %llu,\n", results->bytesIn);
+    fprintf(out, "  \"rx_window\": {\"received\": %llu, \"held\": %llu, \"reordered\": %llu, "
+                 "\"lost\": %llu, \"late\": %llu, \"stale\": %llu},\n",
+            results->rxWindow.received,
+            results->rxWindow.held,
+            results->rxWindow.reordered,
+            results->rxWindow.lost,
+            results->rxWindow.late,
+            results->rxWindow.stale);
+    fprintf(out, "  \"multicast_sessions\": %u,\n", results->multicast);
+    fprintf(out, "  \"group_window\": {\"received\": %llu, \"held\": %llu, \"reordered\": %llu, "
+                 "\"lost\": %llu, \"late\": %llu, \"stale\": %llu},\n",
+            results->groupWindow.received,
+            results->groupWindow.held,
+            results->groupWindow.reordered,
+            results->groupWindow.lost,
+            results->groupWindow.late,
+            results->groupWindow.stale);
+    writeHistogram(out, "latency_ns", &results->latencyNs, false);
+    writeHistogram(out, "one_way_ns", &results->oneWayNs, false);
+    writeHistogram(out, "client_queue_ns", &results->clientQueueNs, true);
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+}
+
+/**
+ * @brief Writes a histogram as a JSON member
+ * @param last no comma after it
+ */
+void writeHistogram(FILE *out, const char *name, Histogram *hist, bool last)
+{
+    fprintf(out, "  \"%s\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, "
+                 "\"max\": %llu, \"mean\": %llu}%s\n",
+            name,
+            hist->percentile(50.0),
+            hist->percentile(99.0),
+            hist->percentile(99.9),
+            hist->max,
+            hist->total ? (hist->sum / hist->total) : 0,
+            last ? "" : ",");
+}
+
+void addWindowStats(RxWindowStats *total, RxWindowStats *stats)
+{
+    total->received += stats->received;
+    total->held += stats->held;
+    total->reordered += stats->reordered;
+    total->lost += stats->lost;
+    total->late += stats->late;
+    total->stale += stats->stale;
+}
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+Generates the Messenger wire header from its schema.
+
+    msggen.py common/messenger.schema common/messenger.h
+
+The schema is line based, blocks are a keyword line followed by
+indented lines:
+
+    enum                                constants, NAME = value
+    header Struct                       the frame header, type name
+    message TYPE_X = n [Struct field]   a message, with its body struct
+                                        and union member if it has one
+    packet Struct                       header plus a union of bodies
+
+Lines starting with "#" are dropped, "//" lines are copied as comments
+on the block that follows. Everything generated is inline and works on
+the frame in place, so nothing is copied.
+"""
+
+import re
+import sys
+
+
+class Block:
+    def __init__(self, kind, args, comments):
+        self.kind = kind
+        self.args = args
+        self.comments = comments
+        self.lines = []
+
+
+def parse(path):
+    blocks = []
+    comments = []
+    block = None
+
+    with open(path) as schema:
+        for number, raw in enumerate(schema, 1):
+            line = raw.rstrip()
+            text = line.strip()
+
+            if not text or text.startswith('#'):
+                continue
+
+            if text.startswith('//'):
+                comments.append(text)
+                continue
+
+            if line[0].isspace():
+                if block is None:
+                    sys.exit('%s:%d: field outside a block' % (path, number))
+                block.lines.append(text)
+                continue
+
+            words = text.split()
+            if words[0] not in ('enum', 'header', 'message', 'packet'):
+                sys.exit('%s:%d: unknown block %s' % (path, number, words[0]))
+
+            block = Block(words[0], words[1:], comments)
+            blocks.append(block)
+            comments = []
+
+    return blocks
+
+
+def camel(type_name):
+    """TYPE_DIRECT -> Direct"""
+    return ''.join(word.capitalize() for word in type_name.split('_')[1:])
+
+
+def upper(type_name):
+    """TYPE_DIRECT -> DIRECT"""
+    return type_name.split('_', 1)[1]
+
+
+def field(text):
+    match = re.match(r'^(\w+)\s+(\w+)(\[\w+\])?$', text)
+    if match is None:
+        sys.exit('bad field: %s' % text)
+    return '    %s %s%s;' % (match.group(1), match.group(2), match.group(3) or '')
+
+
+def message_args(block):
+    # TYPE_X = n [Struct field]
+    if len(block.args) not in (3, 5) or block.args[1] != '=':
+        sys.exit('bad message: %s' % ' '.join(block.args))
+    body = tuple(block.args[3:5]) if len(block.args) == 5 else None
+    return block.args[0], block.args[2], body
+
+
+def generate(blocks, schema_path):
+    out = []
+    header = None
+    messages = [message_args(b) + (b,) for b in blocks if b.kind == 'message']
+
+    out.append('/**')
+    out.append(' * @brief Messenger wire format, shared by the client and the')
+    out.append(' *        server. Generated by tools/msggen/msggen.py from')
+    out.append(' *        %s, do not edit.' % schema_path)
+    out.append(' *')
+    out.append(' *        For each message TYPE_X with a body MsgrX:')
+    out.append(' *          MSGR_X_FRAME_SIZE   header plus body')
+    out.append(' *          EncodeX()           writes the header, returns the body')
+    out.append(' *                              to fill in place')
+    out.append(' *          IsValidX()          type and length are right and the')
+    out.append(' *                              frame fits in what is left')
+    out.append(' *          DecodeX()           the body in place, NULL unless valid')
+    out.append(' */')
+    out.append('')
+    out.append('#ifndef _MESSENGER_H')
+    out.append('#define _MESSENGER_H')
+    out.append('')
+    out.append('#include <stddef.h>')
+    out.append('#include "types.h"')
+    out.append('')
+
+    for block in blocks:
+        if block.kind == 'enum':
+            out.extend(block.comments)
+            out.append('enum {')
+            for i, line in enumerate(block.lines):
+                out.append('    %s%s' % (line, ',' if i + 1 < len(block.lines) else ''))
+            out.append('};')
+            out.append('')
+
+        elif block.kind == 'header':
+            header = block.args[0]
+            out.extend(block.comments)
+            out.append('struct %s' % header)
+            out.append('{')
+            out.extend(field(line) for line in block.lines)
+            out.append('};')
+            out.append('')
+
+    out.append('enum {')
+    for i, (type_name, value, body, block) in enumerate(messages):
+        if body is None:
+            out.extend('    ' + comment for comment in block.comments)
+        out.append('    %s = %s%s' % (type_name, value, ',' if i + 1 < len(messages) else ''))
+    out.append('};')
+    out.append('')
+
+    for type_name, value, body, block in messages:
+        if body is None:
+            continue
+        out.extend(block.comments)
+        out.append('struct %s' % body[0])
+        out.append('{')
+        out.extend(field(line) for line in block.lines)
+        out.append('};')
+        out.append('')
+
+    for block in blocks:
+        if block.kind == 'packet':
+            out.extend(block.comments)
+            out.append('struct %s' % block.args[0])
+            out.append('{')
+            out.append('    %s hdr;' % header)
+            out.append('    union {')
+            for type_name, value, body, _ in messages:
+                if body is not None:
+                    out.append('        %s %s;' % body)
+            out.append('    };')
+            out.append('};')
+            out.append('')
+            packet = block.args[0]
+
+    for type_name, value, body, block in messages:
+        name = camel(type_name)
+        size = 'MSGR_%s_FRAME_SIZE' % upper(type_name)
+        body_size = 'sizeof(%s)' % body[0] if body else '0'
+
+        out.append('// %s' % type_name)
+        out.append('enum {')
+        if body:
+            out.append('    %s = sizeof(%s) + %s' % (size, header, body_size))
+        else:
+            out.append('    %s = sizeof(%s)' % (size, header))
+        out.append('};')
+        out.append('')
+
+        out.append('inline %s Encode%s(%s *mpkt, U32 to, U32 from, U32 seq)' %
+                   ('%s*' % body[0] if body else 'void', name, packet))
+        out.append('{')
+        out.append('    mpkt->hdr.to = to;')
+        out.append('    mpkt->hdr.from = from;')
+        out.append('    mpkt->hdr.seq = seq;')
+        out.append('    mpkt->hdr.type = %s;' % type_name)
+        out.append('    mpkt->hdr.length = %s;' % body_size)
+        if body:
+            out.append('    return &mpkt->%s;' % body[1])
+        out.append('}')
+        out.append('')
+
+        out.append('inline bool IsValid%s(const %s *hdr, U32 available)' % (name, header))
+        out.append('{')
+        out.append('    return (hdr->type == %s) &&' % type_name)
+        out.append('           (hdr->length == %s) &&' % body_size)
+        out.append('           (available >= %s);' % size)
+        out.append('}')
+        out.append('')
+
+        if body:
+            out.append('inline %s* Decode%s(%s *mpkt, U32 available)' % (body[0], name, packet))
+            out.append('{')
+            out.append('    return IsValid%s(&mpkt->hdr, available) ? &mpkt->%s : NULL;' % (name, body[1]))
+            out.append('}')
+            out.append('')
+
+    out.append('#endif')
+
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('Usage: %s schema header' % sys.argv[0])
+
+    text = generate(parse(sys.argv[1]), sys.argv[1])
+
+    with open(sys.argv[2], 'w') as header:
+        header.write(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,557 @@
+/**
+ * @brief Deterministic in-process simulation. Runs the real server
+ *        protocol and thousands of simulated clients in one process
+ *        over the loop transport, on a virtual clock.
+ *
+ *        Nothing depends on wall time or the kernel, so the same
+ *        arguments always produce the same run. The digest in the
+ *        results covers every datagram delivered, in order, and
+ *        makes that easy to check.
+ *
+ *        Wall time is only measured around HandleClientData, to give
+ *        the protocol cost without any socket in the way.
+ *
+ *        With -d every TEXT is followed by a DIRECT to the next
+ *        client by name, and the results count the ones that came
+ *        back to that client as a DIRECT.
+ *
+ *        Built with -DSERVER_IMPAIRMENT=\"\" -DCLIENT_IMPAIRMENT=\"\"
+ *        every socket is wrapped in an ImpairedTransport and -i sets
+ *        the impairment, still deterministic for a given seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "SDL_net.h"
+#include "../../server/types.h"
+#include "../../server/util.h"
+#include "../../server/serversocket.h"
+#include "../../server/tcprotocol.h"
+#include "../../server/metrics.h"
+#include "../../client/clientsocket.h"
+
+#if !defined(USE_VIRTUAL_CLOCK) || (SERVER_TRANSPORT != TRANSPORT_LOOP) || (CLIENT_TRANSPORT != TRANSPORT_LOOP)
+#error "Build with -DUSE_VIRTUAL_CLOCK -DSERVER_TRANSPORT=TRANSPORT_LOOP -DCLIENT_TRANSPORT=TRANSPORT_LOOP"
+#endif
+
+#if defined(SERVER_IMPAIRMENT) && defined(CLIENT_IMPAIRMENT)
+#define SIM_IMPAIRMENT
+#endif
+
+#define UDP_MAX_PACKET_SIZE 512
+
+// Clients started per tick during the join phase
+#define SIM_JOINS_PER_TICK 10
+// Ticks to let the network drain before giving up
+#define SIM_MAX_SETTLE_TICKS 100000
+
+// Marks simulated text, followed by virtual send time and client
+#define SIM_TAG "SIM "
+
+// "s" and a client number, room for any U32. The wire keeps the first
+// TC_MAX_NAME_SIZE - 1 characters.
+#define SIM_NAME_SIZE 12
+
+struct SimConfig
+{
+    U32 clients;
+    U32 seconds;
+    double rate;        // TEXT per second per client
+    U64 latencyNs;      // one way
+    U64 tickNs;
+    const char *impairment;
+    bool direct;        // -d, DIRECT to the next client with every TEXT
+    bool verbose;
+};
+
+struct SimClient
+{
+    ClientSocket socket;
+    char name[SIM_NAME_SIZE];
+    int handle;         // -1 until the server addresses us
+    U8 cookie[TC_COOKIE_SIZE];
+    bool echoCookie;    // a COOKIE came, send the JOIN again
+    U32 txSeq;
+    U64 nextSendNs;
+    U64 sent;
+    U64 received;
+};
+
+struct SimResults
+{
+    U32 joined;
+    U64 sent;
+    U64 delivered;
+    U64 directSent;
+    U64 directDelivered;
+    U64 serverPackets;
+    U64 serverHandleNs;
+    U64 wallNs;
+    U64 digest;
+    Histogram latencyNs;
+};
+
+static bool parseArgs(int argc, char **argv, SimConfig *cfg);
+static U64 wallNowNs();
+static U64 inFlight();
+static void stepServer(ServerSocket *server, ServerPacket *pkt, SimResults *results);
+static void stepClient(SimClient *client, ClientPacket *pkt, SimResults *results);
+static void sendJoin(SimClient *client, ClientPacket *pkt);
+static void sendLeave(SimClient *client, ClientPacket *pkt);
+static void sendText(SimClient *client, ClientPacket *pkt, U32 clientIndex);
+static void sendDirect(SimClient *client, ClientPacket *pkt, SimClient *to, SimResults *results);
+static void writeResults(SimConfig *cfg, SimResults *results);
+
+static SimResults gResults;
+static bool gVerbose = false;
+
+
+/**
+ * @brief Server console output only shows with -v
+ */
+void ConsolePrintf(const char* format, ...)
+{
+    va_list args;
+
+    if (gVerbose) {
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+    }
+}
+
+int ConsoleFlushQueueToBuffer(char *buffer, U32 maxlen)
+{
+    if (buffer && maxlen) {
+        buffer[0] = '\0';
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    SimConfig cfg;
+    ServerSocket server;
+    SimClient *clients;
+    ClientPacket *clientPkt;
+    ServerPacket *serverPkt;
+    IPaddress srvadd;
+    U64 intervalNs;
+    U64 startNs;
+    U64 endNs;
+    U32 started;
+    U64 wallStartNs;
+
+    if (!parseArgs(argc, argv, &cfg)) {
+        fprintf(stderr, "Usage: %s [-n clients] [-t seconds] [-r msgs/s per client] "
+                        "[-l latency us] [-k tick us] [-i impairment] [-d] [-v]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    gVerbose = cfg.verbose;
+
+    wallStartNs = wallNowNs();
+    gVirtualClockNs = 0;
+    gMetrics.clear();
+    memset(&gResults, 0, sizeof(gResults));
+    gResults.digest = 0xCBF29CE484222325ULL;
+
+    gLoopHub.init(cfg.latencyNs, LOOP_QUEUE_LIMIT);
+
+#ifdef SIM_IMPAIRMENT
+    gImpairmentDefaults.clear();
+    memset(&gImpairmentTotals, 0, sizeof(gImpairmentTotals));
+    gImpairmentNextStream = 0;
+    if (cfg.impairment && !gImpairmentDefaults.parse(cfg.impairment)) {
+        fprintf(stderr, "ERROR  Bad impairment: %s\n", cfg.impairment);
+        exit(EXIT_FAILURE);
+    }
+#else
+    if (cfg.impairment) {
+        fprintf(stderr, "ERROR  -i needs a build with SERVER_IMPAIRMENT and CLIENT_IMPAIRMENT\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    if (!server.init(UDP_SOCKET_PORT, UDP_MAX_PACKET_SIZE, cfg.clients) ||
+        !InitMessengerProtocol(&server)) {
+        fprintf(stderr, "ERROR: Unable to start the server\n");
+        exit(EXIT_FAILURE);
+    }
+
+    serverPkt = server.allocPacket();
+    clients = new SimClient[cfg.clients];
+
+    for (U32 i=0; i<cfg.clients; ++i) {
+        SimClient *client = &clients[i];
+
+        client->socket.toIPaddress(&srvadd, (char*)"localhost", UDP_SOCKET_PORT);
+        if (!client->socket.init(0, UDP_MAX_PACKET_SIZE, &srvadd)) {
+            fprintf(stderr, "ERROR: Unable to open client %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+
+        snprintf(client->name, SIM_NAME_SIZE, "s%05u", i);
+        client->handle = -1;
+        memset(client->cookie, 0, TC_COOKIE_SIZE);
+        client->echoCookie = false;
+        client->txSeq = 0;
+        client->sent = 0;
+        client->received = 0;
+    }
+
+    clientPkt = clients[0].socket.allocPacket();
+    if ((serverPkt == NULL) || (clientPkt == NULL)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Sends start once every join has made both round trips, for the
+    // cookie and for the handle, so every broadcast should reach every
+    // client, and are staggered across the interval
+    intervalNs = (U64)(1000000000.0 / cfg.rate);
+    startNs = ((cfg.clients / SIM_JOINS_PER_TICK) + 4) * cfg.tickNs + (4 * cfg.latencyNs);
+    for (U32 i=0; i<cfg.clients; ++i) {
+        clients[i].nextSendNs = startNs + ((intervalNs * i) / cfg.clients);
+    }
+
+    started = 0;
+    endNs = (U64)cfg.seconds * 1000000000ULL;
+    while (gVirtualClockNs < endNs) {
+        for (U32 n=0; (n<SIM_JOINS_PER_TICK) && (started<cfg.clients); ++n) {
+            sendJoin(&clients[started++], clientPkt);
+        }
+
+        for (U32 i=0; i<started; ++i) {
+            SimClient *client = &clients[i];
+
+            if ((client->handle >= 0) && (gVirtualClockNs >= client->nextSendNs)) {
+                SimClient *next = &clients[(i + 1) % cfg.clients];
+
+                sendText(client, clientPkt, i);
+                if (cfg.direct && (next != client) && (next->handle >= 0)) {
+                    sendDirect(client, clientPkt, next, &gResults);
+                }
+                client->nextSendNs += intervalNs;
+            }
+        }
+
+        stepServer(&server, serverPkt, &gResults);
+        for (U32 i=0; i<started; ++i) {
+            stepClient(&clients[i], clientPkt, &gResults);
+        }
+
+        gVirtualClockNs += cfg.tickNs;
+    }
+
+    // Let everything in flight arrive
+    for (U32 tick=0; (tick<SIM_MAX_SETTLE_TICKS) && (inFlight() > 0); ++tick) {
+        stepServer(&server, serverPkt, &gResults);
+        for (U32 i=0; i<started; ++i) {
+            stepClient(&clients[i], clientPkt, &gResults);
+        }
+        gVirtualClockNs += cfg.tickNs;
+    }
+
+    for (U32 i=0; i<cfg.clients; ++i) {
+        if (clients[i].handle >= 0) {
+            ++gResults.joined;
+            sendLeave(&clients[i], clientPkt);
+        }
+        gResults.sent += clients[i].sent;
+    }
+    gVirtualClockNs += cfg.latencyNs;
+    stepServer(&server, serverPkt, &gResults);
+
+    gResults.wallNs = wallNowNs() - wallStartNs;
+    writeResults(&cfg, &gResults);
+
+    clients[0].socket.freePacket(clientPkt);
+    for (U32 i=0; i<cfg.clients; ++i) {
+        clients[i].socket.shutdown();
+    }
+    delete [] clients;
+
+    server.freePacket(serverPkt);
+    ShutdownMessengerProtocol(&server);
+    server.shutdown();
+    gLoopHub.shutdown();
+
+    return EXIT_SUCCESS;
+}
+
+
+bool parseArgs(int argc, char **argv, SimConfig *cfg)
+{
+    cfg->clients = 1000;
+    cfg->seconds = 5;
+    cfg->rate = 1.0;
+    cfg->latencyNs = 200000;
+    cfg->tickNs = 100000;
+    cfg->impairment = NULL;
+    cfg->direct = false;
+    cfg->verbose = false;
+
+    for (int i=1; i<argc; ++i) {
+        if (!strcmp(argv[i], "-v")) {
+            cfg->verbose = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-d")) {
+            cfg->direct = true;
+            continue;
+        }
+
+        if ((i + 1) >= argc) {
+            return false;
+        }
+
+        if (!strcmp(argv[i], "-n")) {
+            cfg->clients = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-t")) {
+            cfg->seconds = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-r")) {
+            cfg->rate = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-l")) {
+            cfg->latencyNs = strtoull(argv[i + 1], NULL, 10) * 1000ULL;
+        } else if (!strcmp(argv[i], "-k")) {
+            cfg->tickNs = strtoull(argv[i + 1], NULL, 10) * 1000ULL;
+        } else if (!strcmp(argv[i], "-i")) {
+            cfg->impairment = argv[i + 1];
+        } else {
+            return false;
+        }
+        ++i;
+    }
+
+    if ((cfg->clients == 0) || (cfg->clients > (LOOP_EPHEMERAL_BASE - 1)) ||
+        (cfg->rate <= 0.0) || (cfg->tickNs == 0)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Real time, timeNowNs() is the virtual clock in this build
+ */
+U64 wallNowNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((U64)ts.tv_sec * 1000000000ULL) + (U64)ts.tv_nsec;
+}
+
+/**
+ * @brief Datagrams on the loop network or held back by an impairment
+ */
+U64 inFlight()
+{
+    U64 count = gLoopHub.inFlight();
+
+#ifdef SIM_IMPAIRMENT
+    ImpairmentStats *totals = &gImpairmentTotals;
+
+    count += (totals->offered + totals->duplicated) -
+             (totals->lost + totals->burstLost + totals->queueDropped + totals->released);
+#endif
+
+    return count;
+}
+
+/**
+ * @brief Runs the server over everything that has arrived
+ */
+void stepServer(ServerSocket *server, ServerPacket *pkt, SimResults *results)
+{
+    while (server->receiveData(pkt)) {
+        U64 startNs = wallNowNs();
+
+        HandleClientData(server, pkt);
+
+        results->serverHandleNs += wallNowNs() - startNs;
+        ++results->serverPackets;
+    }
+
+    ServiceMessengerProtocol(server);
+    server->flush();
+}
+
+/**
+ * @brief Reads what has arrived for a client. Datagrams may hold
+ *        several frames back to back.
+ */
+void stepClient(SimClient *client, ClientPacket *pkt, SimResults *results)
+{
+    while (client->socket.receiveData(pkt)) {
+        U32 offset = 0;
+
+        // FNV-1a over everything delivered, in delivery order
+        for (int i=0; i<pkt->len; ++i) {
+            results->digest = (results->digest ^ pkt->data[i]) * 0x100000001B3ULL;
+        }
+
+        while ((offset + sizeof(MsgrHdr)) <= (U32)pkt->len) {
+            MessengerPacket *mpkt = (MessengerPacket*)&pkt->data[offset];
+
+            if ((offset + sizeof(MsgrHdr) + mpkt->hdr.length) > (U32)pkt->len) {
+                // truncated frame
+                break;
+            }
+
+            if ((client->handle < 0) && (mpkt->hdr.to >= TO_ADDRESS_HANDLE_BASE)) {
+                // first frame addressed to us, we have joined
+                client->handle = mpkt->hdr.to - TO_ADDRESS_HANDLE_BASE;
+            }
+
+            if (IsValidCookie(&mpkt->hdr, pkt->len - offset) &&
+                (client->handle < 0)) {
+                memcpy(client->cookie, mpkt->cookie.cookie, TC_COOKIE_SIZE);
+                client->echoCookie = true;
+            }
+
+            if (IsValidText(&mpkt->hdr, pkt->len - offset) &&
+                !strncmp(mpkt->text.data, SIM_TAG, strlen(SIM_TAG))) {
+                U64 sentNs = strtoull(&mpkt->text.data[strlen(SIM_TAG)], NULL, 10);
+
+                results->latencyNs.record(gVirtualClockNs - sentNs);
+                ++results->delivered;
+                ++client->received;
+            }
+
+            if (IsValidDirect(&mpkt->hdr, pkt->len - offset) &&
+                !strncmp(mpkt->direct.to, client->name, TC_MAX_NAME_SIZE) &&
+                !strncmp(mpkt->direct.data, SIM_TAG, strlen(SIM_TAG))) {
+                ++results->directDelivered;
+            }
+
+            offset += sizeof(MsgrHdr) + mpkt->hdr.length;
+        }
+    }
+
+    // pkt is free again
+    if (client->echoCookie) {
+        client->echoCookie = false;
+        sendJoin(client, pkt);
+    }
+}
+
+void sendJoin(SimClient *client, ClientPacket *pkt)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    EncodeJoin(mpkt, TO_ADDRESS_SERVER, 0, ++client->txSeq);
+    strncpy(mpkt->join.name, client->name, TC_MAX_NAME_SIZE-1);
+    mpkt->join.name[TC_MAX_NAME_SIZE-1] = '\0';
+    memcpy(mpkt->join.cookie, client->cookie, TC_COOKIE_SIZE);
+
+    pkt->len = MSGR_JOIN_FRAME_SIZE;
+    client->socket.transmitData(pkt);
+}
+
+void sendLeave(SimClient *client, ClientPacket *pkt)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    EncodeLeave(mpkt,
+                TO_ADDRESS_SERVER,
+                TO_ADDRESS_HANDLE_BASE + client->handle,
+                ++client->txSeq);
+    strncpy(mpkt->leave.name, client->name, TC_MAX_NAME_SIZE-1);
+    mpkt->leave.name[TC_MAX_NAME_SIZE-1] = '\0';
+
+    pkt->len = MSGR_LEAVE_FRAME_SIZE;
+    client->socket.transmitData(pkt);
+}
+
+/**
+ * @brief Sends a broadcast TEXT stamped with the virtual time
+ */
+void sendText(SimClient *client, ClientPacket *pkt, U32 clientIndex)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    EncodeText(mpkt,
+               TO_ADDRESS_BROADCAST,
+               TO_ADDRESS_HANDLE_BASE + client->handle,
+               ++client->txSeq);
+    strncpy(mpkt->text.name, client->name, TC_MAX_NAME_SIZE-1);
+    mpkt->text.name[TC_MAX_NAME_SIZE-1] = '\0';
+    snprintf(mpkt->text.data, TC_MAX_TEXT_SIZE, SIM_TAG "%llu %u",
+             gVirtualClockNs, clientIndex);
+
+    pkt->len = MSGR_TEXT_FRAME_SIZE;
+    if (client->socket.transmitData(pkt)) {
+        ++client->sent;
+    }
+}
+
+/**
+ * @brief Sends a DIRECT to another client by name
+ */
+void sendDirect(SimClient *client, ClientPacket *pkt, SimClient *to, SimResults *results)
+{
+    MessengerPacket *mpkt = (MessengerPacket*)pkt->data;
+
+    EncodeDirect(mpkt,
+                 TO_ADDRESS_SERVER,
+                 TO_ADDRESS_HANDLE_BASE + client->handle,
+                 ++client->txSeq);
+    strncpy(mpkt->direct.name, client->name, TC_MAX_NAME_SIZE-1);
+    mpkt->direct.name[TC_MAX_NAME_SIZE-1] = '\0';
+    strncpy(mpkt->direct.to, to->name, TC_MAX_NAME_SIZE-1);
+    mpkt->direct.to[TC_MAX_NAME_SIZE-1] = '\0';
+    snprintf(mpkt->direct.data, TC_MAX_TEXT_SIZE, SIM_TAG "%llu", gVirtualClockNs);
+
+    pkt->len = MSGR_DIRECT_FRAME_SIZE;
+    if (client->socket.transmitData(pkt)) {
+        ++results->directSent;
+    }
+}
+
+/**
+ * @brief Writes the results as JSON to stdout
+ */
+void writeResults(SimConfig *cfg, SimResults *results)
+{
+    U64 expected = results->sent * results->joined;
+    Histogram *lat = &results->latencyNs;
+
+    printf("{\n");
+    printf("  \"clients\": %u,\n", cfg->clients);
+    printf("  \"joined\": %u,\n", results->joined);
+    printf("  \"virtual_seconds\": %.3f,\n", (double)gVirtualClockNs / 1e9);
+    printf("  \"wall_seconds\": %.3f,\n", (double)results->wallNs / 1e9);
+    printf("  \"sent\": %llu,\n", results->sent);
+    printf("  \"expected_deliveries\": %llu,\n", expected);
+    printf("  \"delivered\": %llu,\n", results->delivered);
+    printf("  \"delivery_ratio\": %.6f,\n",
+           expected ? (double)results->delivered / (double)expected : 0.0);
+    printf("  \"goodput_msgs_per_s\": %.1f,\n",
+           gVirtualClockNs ? (double)results->delivered * 1e9 / (double)gVirtualClockNs : 0.0);
+    printf("  \"direct\": {\"sent\": %llu, \"delivered\": %llu},\n",
+           results->directSent, results->directDelivered);
+    printf("  \"datagrams\": {\"sent\": %llu, \"delivered\": %llu, \"dropped\": %llu},\n",
+           gLoopHub.mSent, gLoopHub.mDelivered, gLoopHub.mDropped);
+#ifdef SIM_IMPAIRMENT
+    printf("  \"impairment\": {\"offered\": %llu, \"lost\": %llu, \"burst_lost\": %llu, "
+           "\"queue_dropped\": %llu, \"duplicated\": %llu, \"reordered\": %llu},\n",
+           gImpairmentTotals.offered, gImpairmentTotals.lost, gImpairmentTotals.burstLost,
+           gImpairmentTotals.queueDropped, gImpairmentTotals.duplicated,
+           gImpairmentTotals.reordered);
+#endif
+    printf("  \"server_packets\": %llu,\n", results->serverPackets);
+    printf("  \"server_handle_ns_per_packet\": %.1f,\n",
+           results->serverPackets ?
+           (double)results->serverHandleNs / (double)results->serverPackets : 0.0);
+    printf("  \"virtual_latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu},\n",
+           lat->percentile(50.0), lat->percentile(99.0), lat->max);
+    printf("  \"digest\": \"%016llx\"\n", results->digest);
+    printf("}\n");
+}